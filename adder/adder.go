@@ -2,7 +2,7 @@
 // managed by the Cluster.
 package adder
 
-// #cgo LDFLAGS: -L../pdp -lpdp -lssl -lcrypto
+// #cgo LDFLAGS: -L../pdp -lpdp -lssl -lcrypto -lm
 // extern int pdp_tag_file(char *filepath, size_t filepath_len, char *tagfilepath, size_t tagfilepath_len,char* keypath,char* password);
 import "C"
 
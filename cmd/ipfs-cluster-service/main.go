@@ -1,7 +1,7 @@
 // The ipfs-cluster-service application.
 package main
 
-// #cgo LDFLAGS: -L../../pdp -lpdp -lssl -lcrypto
+// #cgo LDFLAGS: -L../../pdp -lpdp -lssl -lcrypto -lm
 // #include "../../pdp/pdp.h"
 // extern PDP_key *generate_pdp_key();
 // extern int write_pdp_keypair(PDP_key *key, char *password,char* keypath);
@@ -33,10 +33,14 @@
 
 #include "pdp.h"
 #include <stdio.h>
+#include <stdlib.h>
 #include <getopt.h>
+#include <pthread.h>
+#include <signal.h>
 #include <sys/param.h>
 #include <sys/time.h>
 #include <sys/stat.h>
+#include <time.h>
 
 
 /*struct PDP_parameters_struct{
@@ -61,6 +65,10 @@ static struct option longopts[] = {
 	{"rsa_e", no_argument, NULL, 'e'},
 	{"blocksize", no_argument, NULL, 'b'},
 	{"numchallenge", no_argument, NULL, 'c'},
+	{"prover", required_argument, NULL, 'd'},
+	{"tagger", required_argument, NULL, 'w'},
+	{"scrub", required_argument, NULL, 'S'},
+	{"audit", required_argument, NULL, 'a'},
 	{NULL, 0, NULL, 0}
 };
 
@@ -73,19 +81,75 @@ void usage(){
 	fprintf(stdout, "under certain conditions.\n\n");
 	fprintf(stdout, "usage: pdp [options] [file]\n\n");
 	fprintf(stdout, "Commands:\n\n");
-	fprintf(stdout, "-t, --tag [file]\t\t tag a file\n");
-	fprintf(stdout, "-v, --verify [file]\t\t verify data possession\n\n");
+	fprintf(stdout, "-t, --tag [file]\t\t tag a file with the key in ~/.pdp opened with $PDP_PASSWORD\n");
+	fprintf(stdout, "-v, --verify [file]\t\t verify data possession,\n");
+	fprintf(stdout, "\t\t\t\t with the key in ~/.pdp opened with $PDP_PASSWORD\n");
+	fprintf(stdout, "-S, --scrub [file]\t\t check every block of a file against its tags,\n");
+	fprintf(stdout, "\t\t\t\t with the key in ~/.pdp opened with $PDP_PASSWORD\n");
+	fprintf(stdout, "-a, --audit [list]\t\t audit the files listed as \"peer file [risk]\" lines,\n");
+	fprintf(stdout, "\t\t\t\t with the key in ~/.pdp opened with $PDP_PASSWORD\n\n");
 	fprintf(stdout, "-k, --keygen\t\t\t generate a new PDP key pair\n\n");
+	fprintf(stdout, "-d, --prover [socket]\t\t serve challenges on a Unix socket until SIGTERM or SIGINT,\n");
+	fprintf(stdout, "\t\t\t\t caching $PDP_TAG_CACHE_MB (default 64) megabytes of tags; SIGUSR1 prints stats\n");
+	fprintf(stdout, "-w, --tagger [socket]\t\t tag files for local clients on a Unix socket until killed,\n");
+	fprintf(stdout, "\t\t\t\t with the key in ~/.pdp opened with $PDP_PASSWORD\n\n");
 	
 }
 
+/* print_prover_stats: Prints the prover's counters and the hits and misses of its tag cache */
+static void print_prover_stats(PDP_prover *prover){
+
+	PDP_prover_stats stats;
+	PDP_tag_cache_stats cache;
+
+	pdp_prover_stats(prover, &stats);
+	pdp_tag_cache_stats(pdp_default_ctx()->tagcache, &cache);
+	fprintf(stdout, "Requests: %llu received, %llu completed, %llu rejected, %llu expired, %llu failed\n",
+		(unsigned long long)stats.requests, (unsigned long long)stats.completed, (unsigned long long)stats.rejected,
+		(unsigned long long)stats.expired, (unsigned long long)stats.failed);
+	fprintf(stdout, "Tag cache: %llu hits, %llu misses, %llu evictions, %zu of %zu bytes\n",
+		(unsigned long long)cache.hits, (unsigned long long)cache.misses, (unsigned long long)cache.evictions,
+		cache.bytes, cache.budget);
+	fflush(stdout);
+}
+
+/* stop_prover: Waits for the SIGTERM or SIGINT that main blocks and stops the prover, so it can
+*  finish its running requests and remove its socket.  A SIGUSR1 prints its stats meanwhile.
+*/
+static void *stop_prover(void *arg){
+
+	sigset_t signals;
+	int sig = 0;
+
+	sigemptyset(&signals);
+	sigaddset(&signals, SIGTERM);
+	sigaddset(&signals, SIGINT);
+	sigaddset(&signals, SIGUSR1);
+	while(sigwait(&signals, &sig) == 0){
+		if(sig != SIGUSR1) break;
+		print_prover_stats((PDP_prover *)arg);
+	}
+	pdp_prover_stop((PDP_prover *)arg);
+
+	return NULL;
+}
+
 int main(int argc, char **argv){
 
 	PDP_key *key = NULL;
 	PDP_challenge *challenge = NULL, *server_challenge = NULL;
 	PDP_proof *proof = NULL;
+	PDP_prover *prover = NULL;
+	PDP_tagger *tagger = NULL;
+	PDP_scrub_result *scrub = NULL;
+	PDP_locate_result *located = NULL;
+	PDP_scheduler *sched = NULL;
+	PDP_scheduler_stats sched_stats;
+	PDP_audit_record *record = NULL;
+	pthread_t signal_thread;
+	sigset_t signals;
 	int opt = -1;
-	unsigned int numfileblocks = 0;
+	uint64_t numfileblocks = 0, batch = 0, i = 0;
 	struct stat st;
 #ifdef USE_S3
 	char tagfilepath[MAXPATHLEN];
@@ -98,7 +162,7 @@ int main(int argc, char **argv){
 
 	OpenSSL_add_all_algorithms();
 
-	while((opt = getopt_long(argc, argv, "kt:v:s:", longopts, NULL)) != -1){
+	while((opt = getopt_long(argc, argv, "kt:v:s:d:w:S:a:", longopts, NULL)) != -1){
 		switch(opt){
 			case 'k':
 				key = pdp_create_new_keypair();
@@ -113,8 +177,12 @@ int main(int argc, char **argv){
 #ifdef DEBUG_MODE
 				//gettimeofday(&tv1, NULL);
 #endif
-				if(pdp_tag_file(optarg, strlen(optarg), NULL, 0))
-					//fprintf(stdout, "Done!\n");
+				if(!getenv("PDP_PASSWORD")){
+					fprintf(stderr, "ERROR: Set PDP_PASSWORD to the password of the key.\n");
+					break;
+				}
+				if(!pdp_tag_file(optarg, strlen(optarg), NULL, 0, NULL, getenv("PDP_PASSWORD")))
+					fprintf(stderr, "ERROR: Could not tag %s.\n", optarg);
 #ifdef DEBUG_MODE
 				//gettimeofday(&tv2, NULL);
 				//printf("%lf\n", (double)( (double)(double)(((double)tv2.tv_sec) + (double)((double)tv2.tv_usec/1000000)) - (double)((double)((double)tv1.tv_sec) + (double)((double)tv1.tv_usec/1000000)) ) );
@@ -126,6 +194,10 @@ int main(int argc, char **argv){
 					fprintf(stderr, "ERROR: File name is too long.\n");
 					break;
 				}
+				if(!getenv("PDP_PASSWORD")){
+					fprintf(stderr, "ERROR: Set PDP_PASSWORD to the password of the key.\n");
+					break;
+				}
 				fprintf(stdout, "Verifying %s...\n", optarg);
 
 				/* Calculate the number pdp blocks in the file */
@@ -134,22 +206,138 @@ int main(int argc, char **argv){
 				if(st.st_size%PDP_BLOCKSIZE)
 					numfileblocks++;
 				
-				challenge = pdp_challenge_file(numfileblocks);
-				if(!challenge) fprintf(stderr, "No challenge\n");
-				key = pdp_get_pubkey();
+				/* Both sides load the key from the context's key path through its key cache */
+				challenge = pdp_ctx_challenge_file(pdp_default_ctx(), numfileblocks, NULL, getenv("PDP_PASSWORD"));
+				if(!challenge){
+					fprintf(stderr, "No challenge\n");
+					break;
+				}
+				key = pdp_key_cache_get(pdp_default_ctx()->keycache, pdp_default_ctx()->keypath, getenv("PDP_PASSWORD"));
 				server_challenge = sanitize_pdp_challenge(challenge);
-				proof = pdp_prove_file(optarg, strlen(optarg), NULL, 0, server_challenge, key);
+				proof = key ? pdp_ctx_prove_file(pdp_default_ctx(), optarg, strlen(optarg), NULL, 0, server_challenge, key) : NULL;
 				if(!proof) fprintf(stderr, "No proof\n");
-				if(pdp_verify_file(challenge, proof))
+				if(proof && pdp_ctx_verify_file(pdp_default_ctx(), challenge, proof, NULL, getenv("PDP_PASSWORD")))
 					fprintf(stdout, "Verified!\n");
 				else
 					fprintf(stdout, "Cheating!\n");
 				
+				if(key) pdp_key_cache_put(pdp_default_ctx()->keycache, key);
+				key = NULL;
 				destroy_pdp_challenge(challenge);
 				destroy_pdp_challenge(server_challenge);
 				destroy_pdp_proof(proof);
 				break;
 
+			case 'd':
+				prover = pdp_prover_new(pdp_default_ctx(), optarg, 0, 0, 0);
+				if(!prover){
+					fprintf(stderr, "ERROR: Could not serve on %s.\n", optarg);
+					break;
+				}
+				/* The daemon proves the same hot files over and over, so it caches tags unless told otherwise */
+				if(!getenv(PDP_TAG_CACHE_ENV)) pdp_tag_cache_set_budget(pdp_default_ctx()->tagcache, PDP_PROVER_TAG_CACHE);
+				/* Taken by stop_prover alone; the workers inherit the mask */
+				sigemptyset(&signals);
+				sigaddset(&signals, SIGTERM);
+				sigaddset(&signals, SIGINT);
+				sigaddset(&signals, SIGUSR1);
+				pthread_sigmask(SIG_BLOCK, &signals, NULL);
+				if(pthread_create(&signal_thread, NULL, stop_prover, prover) != 0){
+					fprintf(stderr, "ERROR: Could not serve on %s.\n", optarg);
+				}else{
+					pdp_prover_run(prover);
+					pthread_cancel(signal_thread);
+					pthread_join(signal_thread, NULL);
+					print_prover_stats(prover);
+				}
+				pthread_sigmask(SIG_UNBLOCK, &signals, NULL);
+				pdp_prover_free(prover);
+				prover = NULL;
+				break;
+
+			case 'w':
+				if(!getenv("PDP_PASSWORD")){
+					fprintf(stderr, "ERROR: Set PDP_PASSWORD to the password of the key.\n");
+					break;
+				}
+				tagger = pdp_tagger_new(pdp_default_ctx(), optarg, NULL, getenv("PDP_PASSWORD"), 0);
+				if(!tagger){
+					fprintf(stderr, "ERROR: Could not serve on %s.\n", optarg);
+					break;
+				}
+				pdp_tagger_run(tagger);
+				pdp_tagger_free(tagger);
+				tagger = NULL;
+				break;
+
+			case 'S':
+				if(!getenv("PDP_PASSWORD")){
+					fprintf(stderr, "ERROR: Set PDP_PASSWORD to the password of the key.\n");
+					break;
+				}
+				scrub = pdp_ctx_scrub_file(pdp_default_ctx(), optarg, NULL, NULL, getenv("PDP_PASSWORD"), 0, 0);
+				if(!scrub){
+					fprintf(stderr, "ERROR: Could not scrub %s.\n", optarg);
+					break;
+				}
+				for(batch = 0; batch < scrub->numbatches; batch++){
+					if(scrub->status[batch] == PDP_SCRUB_OK) continue;
+					if(scrub->status[batch] == PDP_SCRUB_CORRUPT)
+						located = pdp_ctx_locate_corrupt(pdp_default_ctx(), optarg, NULL, NULL, getenv("PDP_PASSWORD"),
+							batch * scrub->batch_blocks, scrub->batch_blocks);
+					if(located){
+						for(i = 0; i < located->numbad; i++)
+							fprintf(stdout, "Corrupt block %llu\n", (unsigned long long)located->bad[i]);
+						pdp_locate_result_free(located);
+						located = NULL;
+					}else{
+						fprintf(stdout, "%s blocks %llu-%llu\n", (scrub->status[batch] == PDP_SCRUB_CORRUPT) ? "Corrupt" : "Unreadable",
+							(unsigned long long)(batch * scrub->batch_blocks),
+							(unsigned long long)(((batch + 1) * scrub->batch_blocks > scrub->numblocks) ? scrub->numblocks - 1 : (batch + 1) * scrub->batch_blocks - 1));
+					}
+				}
+				fprintf(stdout, "Scrubbed %llu blocks in %llu batches in %.2fs: %llu corrupt, %llu unreadable\n",
+					(unsigned long long)scrub->numblocks, (unsigned long long)scrub->numbatches, scrub->elapsed,
+					(unsigned long long)scrub->corrupt, (unsigned long long)scrub->errors);
+				pdp_scrub_result_free(scrub);
+				scrub = NULL;
+				break;
+
+			case 'a':
+				if(!getenv("PDP_PASSWORD")){
+					fprintf(stderr, "ERROR: Set PDP_PASSWORD to the password of the key.\n");
+					break;
+				}
+				sched = pdp_scheduler_new(pdp_default_ctx(), NULL, getenv("PDP_PASSWORD"), 0);
+				if(!sched || pdp_scheduler_load(sched, optarg) < 1){
+					fprintf(stderr, "ERROR: Found no files to audit in %s.\n", optarg);
+					pdp_scheduler_free(sched);
+					sched = NULL;
+					break;
+				}
+				/* Every file is due when first added, so one run audits them all */
+				pdp_scheduler_stats(sched, &sched_stats);
+				if(pdp_scheduler_run(sched, time(NULL), sched_stats.files) < 0){
+					fprintf(stderr, "ERROR: Could not audit the files in %s.\n", optarg);
+					pdp_scheduler_free(sched);
+					sched = NULL;
+					break;
+				}
+				pdp_scheduler_stats(sched, &sched_stats);
+				for(i = 0; (record = pdp_scheduler_record(sched, i)) != NULL; i++){
+					if(record->last_status == PDP_AUDIT_FAILED) fprintf(stdout, "Cheating! %s on %s\n", record->filepath, record->peer);
+					if(record->last_status == PDP_AUDIT_ERROR) fprintf(stdout, "No proof of %s on %s\n", record->filepath, record->peer);
+				}
+				fprintf(stdout, "Audited %llu files on %llu peers: %llu passed, %llu failed, %llu without a proof\n",
+					(unsigned long long)sched_stats.audits, (unsigned long long)sched_stats.peers,
+					(unsigned long long)sched_stats.passed, (unsigned long long)sched_stats.failed,
+					(unsigned long long)sched_stats.errors);
+				if(sched_stats.slow) fprintf(stdout, "%llu proofs were slower than local disks explain\n", (unsigned long long)sched_stats.slow);
+				pdp_latency_report(pdp_scheduler_latency(sched), stdout);
+				pdp_scheduler_free(sched);
+				sched = NULL;
+				break;
+
 			case 's':
 #ifdef USE_S3
 				memset(tagfilepath, 0, MAXPATHLEN);
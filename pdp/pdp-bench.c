@@ -0,0 +1,701 @@
+/* 
+* pdp-bench.c
+*
+* Copyright (c) 2008, Zachary N J Peterson <zachary@jhu.edu>
+* All rights reserved.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*     * Redistributions of source code must retain the above copyright
+*       notice, this list of conditions and the following disclaimer.
+*     * Redistributions in binary form must reproduce the above copyright
+*       notice, this list of conditions and the following disclaimer in the
+*       documentation and/or other materials provided with the distribution.
+*     * The name of the Zachary N J Peterson may be used to endorse or promote products
+*       derived from this software without specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY ZACHARY N J PETERSON ``AS IS'' AND ANY
+* EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL ZACHARY N J PETERSON BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+
+/* pdp-bench is the benchmark harness run by make bench.  It times key generation, tagging,
+*  proving and verifying across modulus sizes, block sizes, thread counts and file sizes, with
+*  warmup runs, repeated samples and their percentiles, and writes the results as JSON so runs of
+*  different builds can be compared.  Blocks are tagged and proved in memory, where the block size
+*  can vary, and files through a context, in PDP_BLOCKSIZE blocks from the page cache.  E-PDP and
+*  S-PDP are chosen at compile time, so make bench builds and runs it once for each.
+*/
+
+#define _GNU_SOURCE
+#include "pdp.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/param.h>
+#include <sys/stat.h>
+#include <sys/utsname.h>
+#include <openssl/crypto.h>
+
+#define BENCH_MODULI "1024,2048"			/* Modulus sizes in bits */
+#define BENCH_BLOCK_SIZES "1K,4K,16K"		/* Block sizes of in-memory tagging and proving */
+#define BENCH_THREADS "1,0"				/* Tagging threads; 0 is every CPU */
+#define BENCH_FILE_SIZES "1M,4M"
+#define BENCH_BLOCKS 512					/* Blocks tagged per in-memory sample; a full challenge */
+#define BENCH_WARMUP 1						/* Unrecorded runs before the samples of each configuration */
+#define BENCH_REPETITIONS 5
+#define BENCH_KEYGEN_REPETITIONS 1			/* Safe prime search is slow and varies widely */
+#define BENCH_OUTPUT "pdp-bench.json"
+#define BENCH_PASSWORD "pdp-bench"			/* Of the key written out to tag files with */
+#define BENCH_MAX_VALUES 16				/* Values of each dimension */
+
+#ifdef USE_E_PDP
+#define BENCH_MODE "E-PDP"
+#else
+#define BENCH_MODE "S-PDP"
+#endif
+
+static struct option longopts[] = {
+	{"moduli", required_argument, NULL, 'm'},
+	{"block-sizes", required_argument, NULL, 'b'},
+	{"threads", required_argument, NULL, 't'},
+	{"file-sizes", required_argument, NULL, 'f'},
+	{"blocks", required_argument, NULL, 'n'},
+	{"warmup", required_argument, NULL, 'w'},
+	{"repetitions", required_argument, NULL, 'r'},
+	{"keygen-repetitions", required_argument, NULL, 'k'},
+	{"output", required_argument, NULL, 'o'},
+	{"help", no_argument, NULL, 'h'},
+	{NULL, 0, NULL, 0}
+};
+
+typedef struct bench_params_struct bench_params;
+
+struct bench_params_struct{
+
+	uint64_t moduli[BENCH_MAX_VALUES];
+	int nummoduli;
+	uint64_t blocksizes[BENCH_MAX_VALUES];
+	int numblocksizes;
+	uint64_t threads[BENCH_MAX_VALUES];
+	int numthreads;
+	uint64_t filesizes[BENCH_MAX_VALUES];
+	int numfilesizes;
+	uint64_t blocks;
+	int warmup;
+	int repetitions;
+	int keygen_repetitions;
+	char *output;
+};
+
+/* One result: an operation timed under one configuration.  Fields that do not apply are 0 */
+typedef struct bench_config_struct bench_config;
+
+struct bench_config_struct{
+
+	const char *op;
+	int modulus_bits;
+	uint64_t block_size;
+	uint64_t threads;
+	uint64_t file_size;
+	uint64_t blocks;			/* Blocks tagged or challenged per sample */
+	uint64_t bytes;				/* Bytes tagged or read per sample, for bytes_per_sec */
+	int failures;				/* Samples that did not succeed, or proofs that did not verify */
+};
+
+typedef struct bench_tag_arg_struct bench_tag_arg;
+
+struct bench_tag_arg_struct{
+
+	PDP_key *key;
+	unsigned char *blocks;
+	PDP_tag **tags;
+	uint64_t blocksize;
+	uint64_t first;
+	uint64_t numblocks;
+	int failed;
+};
+
+static int numresults = 0;
+
+/* parse_list: Parses a comma separated list of sizes, each with an optional K, M or G suffix, into
+*  values.  Returns the number of values or -1 if the list is malformed.
+*/
+static int parse_list(char *list, uint64_t *values){
+
+	char *p = list, *end = NULL;
+	unsigned long long value = 0;
+	int n = 0;
+
+	while(*p){
+		if(n == BENCH_MAX_VALUES) return -1;
+		errno = 0;
+		value = strtoull(p, &end, 10);
+		if(errno || end == p) return -1;
+		switch(*end){
+			case 'G': case 'g': value <<= 10; /* fall through */
+			case 'M': case 'm': value <<= 10; /* fall through */
+			case 'K': case 'k': value <<= 10; end++; break;
+		}
+		if(*end == ',') end++;
+		else if(*end) return -1;
+		values[n++] = value;
+		p = end;
+	}
+
+	return n;
+}
+
+/* compare_double: Orders doubles for qsort */
+static int compare_double(const void *a, const void *b){
+
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return (x > y) - (x < y);
+}
+
+/* percentile: Returns the nearest-rank q-th percentile of n sorted samples */
+static double percentile(double *sorted, int n, double q){
+
+	int rank = (int)ceil(q * n);
+
+	if(rank < 1) rank = 1;
+	if(rank > n) rank = n;
+
+	return sorted[rank - 1];
+}
+
+/* emit_result: Writes the statistics of n samples, in seconds, of cfg's operation as the next JSON
+*  result in out, and a line about it to stderr.
+*/
+static void emit_result(FILE *out, bench_config *cfg, double *samples, int n){
+
+	double mean = 0, var = 0;
+	int i = 0;
+
+	if(n < 1){
+		fprintf(stderr, "%-11s modulus=%d block=%llu threads=%llu file=%llu failed\n", cfg->op, cfg->modulus_bits,
+			(unsigned long long)cfg->block_size, (unsigned long long)cfg->threads, (unsigned long long)cfg->file_size);
+		return;
+	}
+
+	qsort(samples, n, sizeof(double), compare_double);
+	for(i = 0; i < n; i++) mean += samples[i];
+	mean /= n;
+	for(i = 0; i < n; i++) var += (samples[i] - mean) * (samples[i] - mean);
+	var = (n > 1) ? var / (n - 1) : 0;
+
+	fprintf(out, "%s\n    {\"op\": \"%s\", \"mode\": \"%s\", \"modulus_bits\": %d, \"block_size\": %llu, \"threads\": %llu, "
+		"\"file_size\": %llu, \"blocks\": %llu, \"samples\": %d, \"failures\": %d,\n",
+		numresults ? "," : "", cfg->op, BENCH_MODE, cfg->modulus_bits, (unsigned long long)cfg->block_size,
+		(unsigned long long)cfg->threads, (unsigned long long)cfg->file_size, (unsigned long long)cfg->blocks, n,
+		cfg->failures);
+	fprintf(out, "     \"seconds\": {\"mean\": %.9f, \"stddev\": %.9f, \"min\": %.9f, \"p50\": %.9f, \"p90\": %.9f, "
+		"\"p99\": %.9f, \"max\": %.9f},\n", mean, sqrt(var), samples[0], percentile(samples, n, 0.50),
+		percentile(samples, n, 0.90), percentile(samples, n, 0.99), samples[n - 1]);
+	fprintf(out, "     \"ops_per_sec\": %.3f, \"blocks_per_sec\": %.3f, \"bytes_per_sec\": %.1f}",
+		(mean > 0) ? 1 / mean : 0, (mean > 0) ? cfg->blocks / mean : 0, (mean > 0) ? cfg->bytes / mean : 0);
+	fflush(out);
+	numresults++;
+
+	fprintf(stderr, "%-11s modulus=%d block=%llu threads=%llu file=%llu p50=%.3fms p99=%.3fms blocks/s=%.0f MB/s=%.2f%s\n",
+		cfg->op, cfg->modulus_bits, (unsigned long long)cfg->block_size, (unsigned long long)cfg->threads,
+		(unsigned long long)cfg->file_size, 1000 * percentile(samples, n, 0.50), 1000 * percentile(samples, n, 0.99),
+		(mean > 0) ? cfg->blocks / mean : 0, (mean > 0) ? cfg->bytes / mean / 1048576 : 0,
+		cfg->failures ? " FAILURES" : "");
+}
+
+/* tag_worker: Tags a thread's range of the in-memory blocks */
+static void *tag_worker(void *arg){
+
+	bench_tag_arg *t = (bench_tag_arg *)arg;
+	uint64_t i = 0;
+
+	for(i = t->first; i < t->first + t->numblocks; i++){
+		if( ((t->tags[i] = pdp_tag_block(t->key, t->blocks + (i * t->blocksize), t->blocksize, i)) == NULL)){
+			t->failed = 1;
+			break;
+		}
+	}
+
+	return NULL;
+}
+
+/* free_tags: Frees numblocks tags and clears their slots */
+static void free_tags(PDP_tag **tags, uint64_t numblocks){
+
+	uint64_t i = 0;
+
+	for(i = 0; i < numblocks; i++){
+		if(tags[i]) destroy_pdp_tag(tags[i]);
+		tags[i] = NULL;
+	}
+}
+
+/* tag_blocks: Tags numblocks in-memory blocks on numthreads threads, each a contiguous range.
+*  Returns 1 on success, 0 on failure.
+*/
+static int tag_blocks(PDP_key *key, unsigned char *blocks, PDP_tag **tags, uint64_t blocksize, uint64_t numblocks,
+	uint64_t numthreads){
+
+	pthread_t threads[numthreads];
+	bench_tag_arg args[numthreads];
+	uint64_t t = 0, first = 0;
+	int ok = 1;
+
+	for(t = 0; t < numthreads; t++){
+		args[t].key = key;
+		args[t].blocks = blocks;
+		args[t].tags = tags;
+		args[t].blocksize = blocksize;
+		args[t].first = first;
+		args[t].numblocks = (numblocks / numthreads) + ((t < numblocks % numthreads) ? 1 : 0);
+		args[t].failed = 0;
+		first += args[t].numblocks;
+		if(pthread_create(&(threads[t]), NULL, tag_worker, &(args[t])) != 0){
+			args[t].failed = 1;
+			tag_worker(&(args[t]));
+		}
+	}
+	for(t = 0; t < numthreads; t++){
+		pthread_join(threads[t], NULL);
+		if(args[t].failed) ok = 0;
+	}
+
+	return ok;
+}
+
+/* prove_blocks: Proves possession of the in-memory blocks for server_challenge.  Returns the proof
+*  or NULL on failure.
+*/
+static PDP_proof *prove_blocks(PDP_key *key, PDP_challenge *server_challenge, unsigned char *blocks, PDP_tag **tags,
+	uint64_t blocksize){
+
+	PDP_proof *proof = NULL;
+	uint64_t *indices = NULL;
+	unsigned int j = 0;
+
+	if( ((indices = generate_prp_pi(server_challenge)) == NULL)) return NULL;
+	for(j = 0; j < server_challenge->c; j++){
+		proof = pdp_generate_proof_update(key, server_challenge, tags[indices[j]], proof,
+			blocks + (indices[j] * blocksize), blocksize, j);
+		if(!proof) goto cleanup;
+	}
+	proof = pdp_generate_proof_final(key, server_challenge, proof);
+
+cleanup:
+	sfree(indices, server_challenge->c * sizeof(uint64_t));
+
+	return proof;
+}
+
+/* bench_keygen: Times generating and precomputing a key of modulus_bits bits.  Returns the key of
+*  the last sample, or NULL on failure.
+*/
+static PDP_key *bench_keygen(FILE *out, bench_params *params, int modulus_bits){
+
+	bench_config cfg;
+	PDP_key *key = NULL;
+	double samples[params->keygen_repetitions];
+	uint64_t start = 0;
+	int i = 0, n = 0;
+
+	memset(&cfg, 0, sizeof(bench_config));
+	cfg.op = "keygen";
+	cfg.modulus_bits = modulus_bits;
+	cfg.threads = 1;
+
+	for(i = 0; i < params->keygen_repetitions; i++){
+		if(key) destroy_pdp_key(key);
+		start = pdp_monotonic_ns();
+		key = generate_pdp_key_size(modulus_bits);
+		if(key && !pdp_key_precompute(key)){
+			destroy_pdp_key(key);
+			key = NULL;
+		}
+		if(!key){
+			cfg.failures++;
+			continue;
+		}
+		samples[n++] = (pdp_monotonic_ns() - start) / 1e9;
+	}
+	emit_result(out, &cfg, samples, n);
+
+	return key;
+}
+
+/* bench_blocks: Times tagging params->blocks in-memory blocks of blocksize bytes on each thread
+*  count, then proving and verifying challenges of them.
+*/
+static void bench_blocks(FILE *out, bench_params *params, PDP_key *key, int modulus_bits, uint64_t blocksize){
+
+	bench_config cfg;
+	PDP_challenge *challenge = NULL;
+	PDP_challenge *server_challenge = NULL;
+	PDP_proof *proof = NULL;
+	unsigned char *blocks = NULL;
+	PDP_tag **tags = NULL;
+	double tag_samples[params->repetitions], prove_samples[params->repetitions], verify_samples[params->repetitions];
+	uint64_t start = 0, c = 0;
+	int i = 0, t = 0, n = 0, verified = 0, tagged = 0;
+
+	if( ((blocks = malloc(params->blocks * blocksize)) == NULL)) goto cleanup;
+	if( ((tags = calloc(params->blocks, sizeof(PDP_tag *))) == NULL)) goto cleanup;
+	if(!RAND_bytes(blocks, params->blocks * blocksize)) goto cleanup;
+
+	memset(&cfg, 0, sizeof(bench_config));
+	cfg.op = "tag";
+	cfg.modulus_bits = modulus_bits;
+	cfg.block_size = blocksize;
+	cfg.blocks = params->blocks;
+	cfg.bytes = params->blocks * blocksize;
+	for(t = 0; t < params->numthreads; t++){
+		cfg.threads = params->threads[t];
+		cfg.failures = n = 0;
+		for(i = -params->warmup; i < params->repetitions; i++){
+			free_tags(tags, params->blocks);
+			start = pdp_monotonic_ns();
+			if(!tag_blocks(key, blocks, tags, blocksize, params->blocks, cfg.threads)){
+				cfg.failures++;
+				continue;
+			}
+			if(i >= 0) tag_samples[n++] = (pdp_monotonic_ns() - start) / 1e9;
+			tagged = 1;
+		}
+		emit_result(out, &cfg, tag_samples, n);
+	}
+	if(!tagged) goto cleanup;
+
+	/* Proofs of the tags of the last sample, on one thread as a prover answers one challenge */
+	cfg.threads = 1;
+	cfg.failures = n = 0;
+	for(i = -params->warmup; i < params->repetitions; i++){
+		if( ((challenge = pdp_challenge(key, params->blocks)) == NULL)) goto cleanup;
+		if( ((server_challenge = sanitize_pdp_challenge(challenge)) == NULL)) goto cleanup;
+		c = challenge->c;
+
+		start = pdp_monotonic_ns();
+		proof = prove_blocks(key, server_challenge, blocks, tags, blocksize);
+		if(i >= 0 && proof) prove_samples[n] = (pdp_monotonic_ns() - start) / 1e9;
+
+		start = pdp_monotonic_ns();
+		verified = proof ? pdp_verify_proof(key, challenge, proof) : 0;
+		if(i >= 0 && proof) verify_samples[n++] = (pdp_monotonic_ns() - start) / 1e9;
+		if(i >= 0 && !verified) cfg.failures++;
+
+		if(proof) destroy_pdp_proof(proof);
+		destroy_pdp_challenge(server_challenge);
+		destroy_pdp_challenge(challenge);
+		proof = NULL;
+		server_challenge = challenge = NULL;
+	}
+	cfg.op = "prove";
+	cfg.blocks = c;
+	cfg.bytes = c * blocksize;
+	emit_result(out, &cfg, prove_samples, n);
+	cfg.op = "verify";
+	cfg.bytes = 0;
+	emit_result(out, &cfg, verify_samples, n);
+
+cleanup:
+	if(tags){
+		free_tags(tags, params->blocks);
+		free(tags);
+	}
+	if(blocks) free(blocks);
+}
+
+/* bench_files: Times tagging a file of each size through ctx, with the key written out to keypath,
+*  on each thread count, then proving and verifying challenges of it.  Without THREADING a context
+*  tags on worker processes instead of threads.
+*/
+static void bench_files(FILE *out, bench_params *params, PDP_ctx *ctx, PDP_key *key, int modulus_bits,
+	char *keypath, char *basedir){
+
+	bench_config cfg;
+	PDP_challenge *challenge = NULL;
+	PDP_challenge *server_challenge = NULL;
+	PDP_proof *proof = NULL;
+	FILE *file = NULL;
+	unsigned char buf[PDP_BLOCKSIZE];
+	char filepath[MAXPATHLEN] = "";
+	char tagfilepath[MAXPATHLEN] = "";
+	double tag_samples[params->repetitions], prove_samples[params->repetitions], verify_samples[params->repetitions];
+	uint64_t start = 0, written = 0, numfileblocks = 0, c = 0;
+	int f = 0, t = 0, i = 0, n = 0, verified = 0, tagged = 0;
+
+	memset(&cfg, 0, sizeof(bench_config));
+	cfg.modulus_bits = modulus_bits;
+	cfg.block_size = PDP_BLOCKSIZE;
+
+	for(f = 0; f < params->numfilesizes; f++){
+		cfg.file_size = params->filesizes[f];
+		numfileblocks = (cfg.file_size + PDP_BLOCKSIZE - 1) / PDP_BLOCKSIZE;
+		if(!numfileblocks) continue;
+		/* Named for the key and size, since the context keeps the files of earlier ones open */
+		snprintf(filepath, MAXPATHLEN, "%s/data-%d-%llu", basedir, modulus_bits, (unsigned long long)cfg.file_size);
+		snprintf(tagfilepath, MAXPATHLEN, "%s.tag", filepath);
+
+		if( ((file = fopen(filepath, "w")) == NULL)) goto cleanup;
+		for(written = 0; written < cfg.file_size; written += sizeof(buf)){
+			RAND_bytes(buf, sizeof(buf));
+			if(fwrite(buf, 1, MIN(sizeof(buf), cfg.file_size - written), file) < 1) goto cleanup;
+		}
+		if(fclose(file) != 0){
+			file = NULL;
+			goto cleanup;
+		}
+		file = NULL;
+
+		cfg.op = "tag_file";
+		cfg.blocks = numfileblocks;
+		cfg.bytes = cfg.file_size;
+		tagged = 0;
+		for(t = 0; t < params->numthreads; t++){
+			cfg.threads = params->threads[t];
+#ifdef THREADING
+			ctx->numthreads = cfg.threads;
+#else
+			ctx->numprocs = (cfg.threads > 1) ? cfg.threads : 0;
+#endif
+			cfg.failures = n = 0;
+			for(i = -params->warmup; i < params->repetitions; i++){
+				unlink(tagfilepath);
+				start = pdp_monotonic_ns();
+				if(!pdp_ctx_tag_file(ctx, filepath, strlen(filepath), NULL, 0, keypath, BENCH_PASSWORD, 0)){
+					cfg.failures++;
+					continue;
+				}
+				if(i >= 0) tag_samples[n++] = (pdp_monotonic_ns() - start) / 1e9;
+				tagged = 1;
+			}
+			emit_result(out, &cfg, tag_samples, n);
+		}
+		if(!tagged) continue;
+
+		cfg.threads = 1;
+		cfg.failures = n = 0;
+		for(i = -params->warmup; i < params->repetitions; i++){
+			if( ((challenge = pdp_challenge(key, numfileblocks)) == NULL)) goto cleanup;
+			if( ((server_challenge = sanitize_pdp_challenge(challenge)) == NULL)) goto cleanup;
+			c = challenge->c;
+
+			start = pdp_monotonic_ns();
+			proof = pdp_ctx_prove_file(ctx, filepath, strlen(filepath), NULL, 0, server_challenge, key);
+			if(i >= 0 && proof) prove_samples[n] = (pdp_monotonic_ns() - start) / 1e9;
+
+			start = pdp_monotonic_ns();
+			verified = proof ? pdp_verify_proof(key, challenge, proof) : 0;
+			if(i >= 0 && proof) verify_samples[n++] = (pdp_monotonic_ns() - start) / 1e9;
+			if(i >= 0 && !verified) cfg.failures++;
+
+			if(proof) destroy_pdp_proof(proof);
+			destroy_pdp_challenge(server_challenge);
+			destroy_pdp_challenge(challenge);
+			proof = NULL;
+			server_challenge = challenge = NULL;
+		}
+		cfg.op = "prove_file";
+		cfg.blocks = c;
+		cfg.bytes = c * PDP_BLOCKSIZE;
+		emit_result(out, &cfg, prove_samples, n);
+		cfg.op = "verify_file";
+		cfg.bytes = 0;
+		emit_result(out, &cfg, verify_samples, n);
+
+		unlink(tagfilepath);
+		unlink(filepath);
+	}
+
+cleanup:
+	if(file) fclose(file);
+	if(server_challenge) destroy_pdp_challenge(server_challenge);
+	if(challenge) destroy_pdp_challenge(challenge);
+	if(*tagfilepath) unlink(tagfilepath);
+	if(*filepath) unlink(filepath);
+}
+
+/* emit_header: Writes what was built and where it ran, and the parameters of the run, opening the JSON document */
+static void emit_header(FILE *out, bench_params *params){
+
+	struct utsname uts;
+	char date[32];
+	time_t now = time(NULL);
+	int i = 0;
+
+	memset(&uts, 0, sizeof(struct utsname));
+	uname(&uts);
+	strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%SZ", gmtime(&now));
+
+	fprintf(out, "{\n  \"build\": {\"mode\": \"%s\", \"threading\": %s, \"pdp_blocksize\": %d, \"compiler\": \"%s\", "
+		"\"openssl\": \"%s\"},\n", BENCH_MODE,
+#ifdef THREADING
+		"true",
+#else
+		"false",
+#endif
+		PDP_BLOCKSIZE, __VERSION__, OpenSSL_version(OPENSSL_VERSION));
+	fprintf(out, "  \"machine\": {\"host\": \"%s\", \"os\": \"%s %s\", \"arch\": \"%s\", \"cpus\": %ld},\n",
+		uts.nodename, uts.sysname, uts.release, uts.machine, sysconf(_SC_NPROCESSORS_ONLN));
+	fprintf(out, "  \"date\": \"%s\",\n", date);
+	fprintf(out, "  \"params\": {\"warmup\": %d, \"repetitions\": %d, \"keygen_repetitions\": %d, \"blocks\": %llu, \"moduli\": [",
+		params->warmup, params->repetitions, params->keygen_repetitions, (unsigned long long)params->blocks);
+	for(i = 0; i < params->nummoduli; i++) fprintf(out, "%s%llu", i ? ", " : "", (unsigned long long)params->moduli[i]);
+	fprintf(out, "], \"block_sizes\": [");
+	for(i = 0; i < params->numblocksizes; i++) fprintf(out, "%s%llu", i ? ", " : "", (unsigned long long)params->blocksizes[i]);
+	fprintf(out, "], \"threads\": [");
+	for(i = 0; i < params->numthreads; i++) fprintf(out, "%s%llu", i ? ", " : "", (unsigned long long)params->threads[i]);
+	fprintf(out, "], \"file_sizes\": [");
+	for(i = 0; i < params->numfilesizes; i++) fprintf(out, "%s%llu", i ? ", " : "", (unsigned long long)params->filesizes[i]);
+	fprintf(out, "]},\n  \"results\": [");
+}
+
+void usage(){
+
+	fprintf(stdout, "usage: pdp-bench [options]\n\n");
+	fprintf(stdout, "Times key generation, tagging, proving and verifying, writing the results as JSON.\n");
+	fprintf(stdout, "Lists are comma separated and sizes take a K, M or G suffix.\n\n");
+	fprintf(stdout, "-m, --moduli [list]\t\t modulus sizes in bits (%s)\n", BENCH_MODULI);
+	fprintf(stdout, "-b, --block-sizes [list]\t block sizes of in-memory tagging and proving (%s)\n", BENCH_BLOCK_SIZES);
+	fprintf(stdout, "-t, --threads [list]\t\t tagging threads, 0 for every CPU (%s)\n", BENCH_THREADS);
+	fprintf(stdout, "-f, --file-sizes [list]\t\t sizes of the files tagged and proved (%s)\n", BENCH_FILE_SIZES);
+	fprintf(stdout, "-n, --blocks [blocks]\t\t blocks tagged per in-memory sample (%d)\n", BENCH_BLOCKS);
+	fprintf(stdout, "-w, --warmup [runs]\t\t unrecorded runs before each configuration's samples (%d)\n", BENCH_WARMUP);
+	fprintf(stdout, "-r, --repetitions [runs]\t samples of each configuration (%d)\n", BENCH_REPETITIONS);
+	fprintf(stdout, "-k, --keygen-repetitions [runs]\t keys generated per modulus size (%d)\n", BENCH_KEYGEN_REPETITIONS);
+	fprintf(stdout, "-o, --output [file]\t\t JSON results (%s)\n\n", BENCH_OUTPUT);
+	exit(0);
+}
+
+int main(int argc, char **argv){
+
+	bench_params params;
+	PDP_ctx *ctx = NULL;
+	PDP_key *key = NULL;
+	FILE *out = NULL;
+	char basedir[] = "/tmp/pdp-bench-XXXXXX";
+	char path[MAXPATHLEN];
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	int opt = -1, m = 0, b = 0, i = 0, status = 1;
+
+	memset(&params, 0, sizeof(bench_params));
+	params.nummoduli = parse_list(BENCH_MODULI, params.moduli);
+	params.numblocksizes = parse_list(BENCH_BLOCK_SIZES, params.blocksizes);
+	params.numthreads = parse_list(BENCH_THREADS, params.threads);
+	params.numfilesizes = parse_list(BENCH_FILE_SIZES, params.filesizes);
+	params.blocks = BENCH_BLOCKS;
+	params.warmup = BENCH_WARMUP;
+	params.repetitions = BENCH_REPETITIONS;
+	params.keygen_repetitions = BENCH_KEYGEN_REPETITIONS;
+	params.output = BENCH_OUTPUT;
+
+	while((opt = getopt_long(argc, argv, "m:b:t:f:n:w:r:k:o:h", longopts, NULL)) != -1){
+		switch(opt){
+			case 'm':
+				params.nummoduli = parse_list(optarg, params.moduli);
+				break;
+			case 'b':
+				params.numblocksizes = parse_list(optarg, params.blocksizes);
+				break;
+			case 't':
+				params.numthreads = parse_list(optarg, params.threads);
+				break;
+			case 'f':
+				params.numfilesizes = parse_list(optarg, params.filesizes);
+				break;
+			case 'n':
+				params.blocks = strtoull(optarg, NULL, 10);
+				break;
+			case 'w':
+				params.warmup = atoi(optarg);
+				break;
+			case 'r':
+				params.repetitions = atoi(optarg);
+				break;
+			case 'k':
+				params.keygen_repetitions = atoi(optarg);
+				break;
+			case 'o':
+				params.output = optarg;
+				break;
+			case 'h':
+			default:
+				usage();
+		}
+	}
+	if(params.nummoduli < 1 || params.numblocksizes < 0 || params.numthreads < 1 || params.numfilesizes < 0 ||
+		params.blocks < 1 || params.warmup < 0 || params.repetitions < 1 || params.keygen_repetitions < 1){
+		fprintf(stderr, "ERROR: Malformed benchmark parameters; see --help.\n");
+		return 1;
+	}
+
+	/* 0 threads is every CPU, and the same count is not run twice */
+	for(i = 0; i < params.numthreads; i++) if(!params.threads[i]) params.threads[i] = (cpus > 0) ? cpus : 1;
+	for(i = 1; i < params.numthreads; i++){
+		if(params.threads[i] != params.threads[i - 1]) continue;
+		memmove(&(params.threads[i]), &(params.threads[i + 1]), (params.numthreads - i - 1) * sizeof(uint64_t));
+		params.numthreads--;
+		i--;
+	}
+
+	if( ((out = fopen(params.output, "w")) == NULL)){
+		fprintf(stderr, "ERROR: Was not able to open %s for writing.\n", params.output);
+		return 1;
+	}
+	if(!mkdtemp(basedir) || ((ctx = pdp_ctx_new()) == NULL)){
+		fprintf(stderr, "ERROR: Was not able to set up the benchmark in /tmp.\n");
+		goto cleanup;
+	}
+	snprintf(path, MAXPATHLEN, "%s/keys", basedir);
+	if(mkdir(path, 0700) < 0) goto cleanup;
+
+	emit_header(out, &params);
+	for(m = 0; m < params.nummoduli; m++){
+		if( ((key = bench_keygen(out, &params, params.moduli[m])) == NULL)) goto cleanup;
+		for(b = 0; b < params.numblocksizes; b++)
+			if(params.blocksizes[b]) bench_blocks(out, &params, key, params.moduli[m], params.blocksizes[b]);
+
+		/* Files are tagged with the key read back from disk, as pdp_ctx_tag_file reads it */
+		if(params.numfilesizes){
+			if(!write_pdp_keypair(key, BENCH_PASSWORD, path)) goto cleanup;
+			pdp_key_cache_flush(ctx->keycache);
+			bench_files(out, &params, ctx, key, params.moduli[m], path, basedir);
+		}
+		destroy_pdp_key(key);
+		key = NULL;
+	}
+	fprintf(out, "\n  ]\n}\n");
+	status = 0;
+	fprintf(stderr, "Wrote %d results to %s\n", numresults, params.output);
+
+cleanup:
+	if(status) fprintf(stderr, "ERROR: The benchmark did not finish; %s is incomplete.\n", params.output);
+	if(key) destroy_pdp_key(key);
+	pdp_ctx_free(ctx);
+	if(out) fclose(out);
+	snprintf(path, MAXPATHLEN, "%s/keys/pdp.pri", basedir);
+	unlink(path);
+	snprintf(path, MAXPATHLEN, "%s/keys/pdp.pub", basedir);
+	unlink(path);
+	snprintf(path, MAXPATHLEN, "%s/keys/%s", basedir, PDP_KEY_BUNDLE_FILE);
+	unlink(path);
+	snprintf(path, MAXPATHLEN, "%s/keys", basedir);
+	rmdir(path);
+	rmdir(basedir);
+
+	return status;
+}
@@ -0,0 +1,289 @@
+/* 
+* pdp-budget.c
+*
+* Copyright (c) 2008, Zachary N J Peterson <zachary@jhu.edu>
+* All rights reserved.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*     * Redistributions of source code must retain the above copyright
+*       notice, this list of conditions and the following disclaimer.
+*     * Redistributions in binary form must reproduce the above copyright
+*       notice, this list of conditions and the following disclaimer in the
+*       documentation and/or other materials provided with the distribution.
+*     * The name of the Zachary N J Peterson may be used to endorse or promote products
+*       derived from this software without specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY ZACHARY N J PETERSON ``AS IS'' AND ANY
+* EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL ZACHARY N J PETERSON BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+
+/* pdp-budget.c contains the CPU and I/O budgets that throttle tagging and proving.  Each budget is a
+*  token bucket shared by every tagging and proving thread of a PDP_ctx.  CPU time is charged after
+*  each block is tagged or proven and bytes are charged before each chunk or block is read; a thread that runs the bucket
+*  into debt sleeps until the debt has been repaid at the budgeted rate.  Budgets can be changed
+*  at any time, and take effect within PDP_BUDGET_BURST_MS.
+*/
+
+#include "pdp.h"
+#include <errno.h>
+#include <stdlib.h>
+#include <time.h>
+#include <pthread.h>
+
+typedef struct PDP_token_bucket_struct PDP_token_bucket;
+
+struct PDP_token_bucket_struct{
+
+	double rate;				/* Tokens added per second; 0 means unlimited */
+	double tokens;				/* May go negative when a charge exceeds what was available */
+	uint64_t last_refill;		/* Monotonic time of the last refill in nanoseconds */
+
+	/* Accounting since the last call to pdp_budget_stats */
+	double consumed;
+	uint64_t throttled_ns;
+};
+
+struct PDP_budget_struct{
+
+	pthread_mutex_t lock;
+	PDP_token_bucket cpu;		/* Tokens are nanoseconds of CPU time */
+	PDP_token_bucket io;		/* Tokens are bytes */
+	uint64_t stats_start;
+};
+
+/* refill: Adds the tokens earned since the last refill, keeping at most PDP_BUDGET_BURST_MS
+*  worth so an idle bucket cannot release a large burst.  Call with the budget's lock held.
+*/
+static void refill(PDP_token_bucket *bucket, uint64_t now){
+
+	double burst = 0;
+
+	if(bucket->rate > 0){
+		bucket->tokens += bucket->rate * ((double)(now - bucket->last_refill) / 1000000000.0);
+		burst = bucket->rate * PDP_BUDGET_BURST_MS / 1000.0;
+		if(bucket->tokens > burst) bucket->tokens = burst;
+	}else{
+		bucket->tokens = 0;
+	}
+	bucket->last_refill = now;
+}
+
+/* consume: Charges amount tokens to one of budget's buckets and sleeps while the bucket is in debt */
+static void consume(PDP_budget *budget, PDP_token_bucket *bucket, double amount){
+
+	struct timespec ts;
+	uint64_t now = 0, wait = 0;
+
+	pthread_mutex_lock(&(budget->lock));
+	if(!budget->stats_start) budget->stats_start = pdp_monotonic_ns();
+	now = pdp_monotonic_ns();
+	refill(bucket, now);
+	bucket->consumed += amount;
+	bucket->tokens -= amount;
+
+	/* Sleep in slices of at most PDP_BUDGET_BURST_MS so budget changes are picked up quickly */
+	while(bucket->rate > 0 && bucket->tokens < 0){
+		wait = (uint64_t)((-bucket->tokens / bucket->rate) * 1000000000.0);
+		if(wait > PDP_BUDGET_BURST_MS * 1000000ULL) wait = PDP_BUDGET_BURST_MS * 1000000ULL;
+		if(wait == 0) break;
+		pthread_mutex_unlock(&(budget->lock));
+
+		ts.tv_sec = wait / 1000000000ULL;
+		ts.tv_nsec = wait % 1000000000ULL;
+		while(nanosleep(&ts, &ts) != 0 && errno == EINTR);
+
+		pthread_mutex_lock(&(budget->lock));
+		refill(bucket, pdp_monotonic_ns());
+	}
+	bucket->throttled_ns += pdp_monotonic_ns() - now;
+	pthread_mutex_unlock(&(budget->lock));
+}
+
+/* pdp_budget_new: Returns an allocated budget with no limits, or NULL on failure */
+PDP_budget *pdp_budget_new(){
+
+	PDP_budget *budget = NULL;
+
+	if( ((budget = malloc(sizeof(PDP_budget))) == NULL)) return NULL;
+	memset(budget, 0, sizeof(PDP_budget));
+	if(pthread_mutex_init(&(budget->lock), NULL) != 0){
+		free(budget);
+		return NULL;
+	}
+
+	return budget;
+}
+
+/* pdp_budget_free: Frees a budget.  No thread may be charging it */
+void pdp_budget_free(PDP_budget *budget){
+
+	if(!budget) return;
+	pthread_mutex_destroy(&(budget->lock));
+	free(budget);
+}
+
+/* pdp_budget_set: Sets the budgets tagging runs under.  cpu_cores is the CPU time tagging may
+*  use per second of wall time, across all its threads (e.g. 1.5 cores); io_bytes_per_sec is the rate
+*  at which data files may be read.  A budget of 0 is unlimited.  Can be called at any time, from any
+*  thread, including while files are being tagged.
+*/
+void pdp_budget_set(PDP_budget *budget, double cpu_cores, uint64_t io_bytes_per_sec){
+
+	uint64_t now = 0;
+
+	if(!budget) return;
+
+	pthread_mutex_lock(&(budget->lock));
+	now = pdp_monotonic_ns();
+	refill(&(budget->cpu), now);
+	refill(&(budget->io), now);
+	budget->cpu.rate = (cpu_cores > 0) ? (cpu_cores * 1000000000.0) : 0;
+	budget->io.rate = (double)io_bytes_per_sec;
+	pthread_mutex_unlock(&(budget->lock));
+}
+
+/* pdp_budget_stats: Reports the budgets in effect and the CPU and I/O tagging actually used,
+*  averaged since the previous call (or the first charge), and restarts the averaging window.
+*/
+void pdp_budget_stats(PDP_budget *budget, PDP_budget_stats *stats){
+
+	uint64_t now = 0;
+	double elapsed = 0;
+
+	if(!budget || !stats) return;
+	memset(stats, 0, sizeof(PDP_budget_stats));
+
+	pthread_mutex_lock(&(budget->lock));
+	now = pdp_monotonic_ns();
+	if(budget->stats_start && now > budget->stats_start) elapsed = (double)(now - budget->stats_start) / 1000000000.0;
+
+	stats->cpu_cores_budget = budget->cpu.rate / 1000000000.0;
+	stats->io_bytes_per_sec_budget = budget->io.rate;
+	stats->elapsed = elapsed;
+	if(elapsed > 0){
+		stats->cpu_cores_used = (budget->cpu.consumed / 1000000000.0) / elapsed;
+		stats->io_bytes_per_sec_used = budget->io.consumed / elapsed;
+	}
+	stats->cpu_throttled = (double)budget->cpu.throttled_ns / 1000000000.0;
+	stats->io_throttled = (double)budget->io.throttled_ns / 1000000000.0;
+
+	budget->cpu.consumed = budget->io.consumed = 0;
+	budget->cpu.throttled_ns = budget->io.throttled_ns = 0;
+	budget->stats_start = now;
+	pthread_mutex_unlock(&(budget->lock));
+}
+
+/* pdp_budget_split: Returns an allocated budget with a share of budget's rates, 1/n of each, for
+*  one of n worker processes, which cannot charge a budget living in another process's memory.
+*  Returns NULL on failure.
+*/
+PDP_budget *pdp_budget_split(PDP_budget *budget, int n){
+
+	PDP_budget *share = NULL;
+
+	if( ((share = pdp_budget_new()) == NULL)) return NULL;
+	if(!budget || n < 1) return share;
+
+	pthread_mutex_lock(&(budget->lock));
+	share->cpu.rate = budget->cpu.rate / n;
+	share->io.rate = budget->io.rate / n;
+	pthread_mutex_unlock(&(budget->lock));
+
+	return share;
+}
+
+/* pdp_tag_budget_set: Sets the budgets of the default context, see pdp_budget_set */
+void pdp_tag_budget_set(double cpu_cores, uint64_t io_bytes_per_sec){
+
+	PDP_ctx *ctx = pdp_default_ctx();
+
+	if(ctx) pdp_budget_set(ctx->budget, cpu_cores, io_bytes_per_sec);
+}
+
+/* pdp_tag_budget_stats: Reports the budgets of the default context, see pdp_budget_stats */
+void pdp_tag_budget_stats(PDP_budget_stats *stats){
+
+	PDP_ctx *ctx = pdp_default_ctx();
+
+	if(ctx) pdp_budget_stats(ctx->budget, stats);
+	else if(stats) memset(stats, 0, sizeof(PDP_budget_stats));
+}
+
+/* pdp_budget_charge_io: Charges a read of len bytes to the I/O budget, sleeping if it is exhausted.
+*  A NULL budget is unlimited.
+*/
+void pdp_budget_charge_io(PDP_budget *budget, size_t len){
+
+	if(budget) consume(budget, &(budget->io), (double)len);
+}
+
+/* pdp_budget_try_io: Charges a read of len bytes to the I/O budget if it is not in debt, without
+*  sleeping, for callers that have other work to do when it is exhausted.  Returns 1 if the read was
+*  charged and 0 if the budget is exhausted.  A NULL budget is unlimited.
+*/
+int pdp_budget_try_io(PDP_budget *budget, size_t len){
+
+	int charged = 1;
+
+	if(!budget) return 1;
+
+	pthread_mutex_lock(&(budget->lock));
+	if(!budget->stats_start) budget->stats_start = pdp_monotonic_ns();
+	refill(&(budget->io), pdp_monotonic_ns());
+	if(budget->io.rate > 0 && budget->io.tokens < 0){
+		charged = 0;
+	}else{
+		budget->io.consumed += len;
+		budget->io.tokens -= len;
+	}
+	pthread_mutex_unlock(&(budget->lock));
+
+	return charged;
+}
+
+/* pdp_budget_refund_io: Gives back len bytes charged by pdp_budget_try_io for a read that will not
+*  be made after all.  A NULL budget is unlimited.
+*/
+void pdp_budget_refund_io(PDP_budget *budget, size_t len){
+
+	if(!budget) return;
+
+	pthread_mutex_lock(&(budget->lock));
+	budget->io.consumed -= len;
+	if(budget->io.consumed < 0) budget->io.consumed = 0;
+	if(budget->io.rate > 0) budget->io.tokens += len;
+	pthread_mutex_unlock(&(budget->lock));
+}
+
+/* pdp_budget_thread_cpu: Returns the CPU time used by the calling thread in nanoseconds */
+uint64_t pdp_budget_thread_cpu(){
+
+	struct timespec ts;
+
+	if(clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) != 0) return 0;
+
+	return ((uint64_t)ts.tv_sec * 1000000000ULL) + ts.tv_nsec;
+}
+
+/* pdp_budget_charge_cpu: Charges the CPU time a thread has used since since_ns, as returned by
+*  pdp_budget_thread_cpu, to the CPU budget, sleeping if it is exhausted.  A NULL budget is unlimited.
+*/
+void pdp_budget_charge_cpu(PDP_budget *budget, uint64_t since_ns){
+
+	uint64_t now = 0;
+
+	if(!budget) return;
+	now = pdp_budget_thread_cpu();
+	if(now > since_ns) consume(budget, &(budget->cpu), (double)(now - since_ns));
+}
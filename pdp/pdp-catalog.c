@@ -0,0 +1,598 @@
+/* 
+* pdp-catalog.c
+*
+* Copyright (c) 2008, Zachary N J Peterson <zachary@jhu.edu>
+* All rights reserved.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*     * Redistributions of source code must retain the above copyright
+*       notice, this list of conditions and the following disclaimer.
+*     * Redistributions in binary form must reproduce the above copyright
+*       notice, this list of conditions and the following disclaimer in the
+*       documentation and/or other materials provided with the distribution.
+*     * The name of the Zachary N J Peterson may be used to endorse or promote products
+*       derived from this software without specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY ZACHARY N J PETERSON ``AS IS'' AND ANY
+* EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL ZACHARY N J PETERSON BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+/* pdp-catalog.c contains the metadata catalog, which records for each tagged file, by path or CID,
+*  what a verifier needs to challenge it: its size in blocks, the key it was tagged with, where its
+*  tags are, when it was tagged and how its last audit went.  The catalog is one file: a header, a
+*  power of two of fixed-size slots forming an open-addressing hash table with linear probing, and
+*  a string area the slots' names and tag paths are appended to, all mapped into memory so lookups
+*  and iterating over every entry touch no more than the pages they read.  The string area grows in
+*  place when it fills.  Deleted entries are left as tombstones, and the strings of replaced and
+*  deleted entries as garbage, until the table is rebuilt, which writes a new file and renames it
+*  over the old one.  A catalog is safe to use from many threads of one process.  The file is
+*  locked while open, so a second process cannot open it and lose updates to the first, whose
+*  rebuilds would rename their own file over it.
+*/
+
+#include "pdp.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+typedef struct PDP_catalog_header_struct PDP_catalog_header;
+
+struct PDP_catalog_header_struct{
+
+	char magic[PDP_CATALOG_MAGIC_SIZE];	/* PDP_CATALOG_MAGIC */
+	uint32_t version;
+	uint32_t slot_size;				/* PDP_CATALOG_SLOT_SIZE */
+	uint64_t capacity;				/* Slots, a power of two */
+	uint64_t count;					/* Slots in use */
+	uint64_t deleted;				/* Tombstones */
+	uint64_t strings_size;			/* Bytes in the string area */
+	uint64_t strings_used;			/* Bytes appended to it */
+	uint64_t strings_garbage;		/* Bytes of those no slot refers to any more */
+	unsigned char reserved[PDP_CATALOG_SLOT_SIZE - PDP_CATALOG_MAGIC_SIZE - 8 - 48];
+};
+
+typedef struct PDP_catalog_slot_struct PDP_catalog_slot;
+
+/* A catalog entry as it is stored, with its strings in the string area */
+struct PDP_catalog_slot_struct{
+
+	uint64_t hash;					/* pdp_hash_name of the name, compared before the name itself */
+	uint64_t name_offset;			/* Into the string area, NUL-terminated */
+	uint64_t tagpath_offset;
+	uint32_t name_length;			/* Without the NUL */
+	uint32_t tagpath_length;
+	uint64_t numfileblocks;
+	uint64_t file_size;
+	uint32_t blocksize;
+	uint32_t state;					/* PDP_CATALOG_* */
+	unsigned char key_id[SHA_DIGEST_LENGTH];
+	int32_t last_status;
+	int64_t tagged_at;
+	int64_t last_audit;
+	unsigned char reserved[PDP_CATALOG_SLOT_SIZE - 96];
+};
+
+struct PDP_catalog_struct{
+
+	pthread_rwlock_t lock;
+	char path[MAXPATHLEN];
+	int fd;
+	unsigned char *map;
+	size_t map_size;
+	PDP_catalog_header *header;		/* At the start of map */
+	PDP_catalog_slot *slots;		/* Right after the header */
+	char *strings;					/* Right after the slots */
+};
+
+/* set_map: Points the catalog at map, of map_size bytes, holding a catalog file */
+static void set_map(PDP_catalog *catalog, unsigned char *map, size_t map_size){
+
+	catalog->map = map;
+	catalog->map_size = map_size;
+	catalog->header = (PDP_catalog_header *)map;
+	catalog->slots = (PDP_catalog_slot *)(map + sizeof(PDP_catalog_header));
+	catalog->strings = (char *)(map + sizeof(PDP_catalog_header) + (catalog->header->capacity * PDP_CATALOG_SLOT_SIZE));
+}
+
+/* map_catalog: Opens and locks the catalog file at path, creating it with capacity slots and a
+*  string area of strings_size bytes if it does not exist (or if truncate is set), and maps it.
+*  Returns 1 on success and 0 on failure, including when another process holds the lock.
+*/
+static int map_catalog(PDP_catalog *catalog, char *path, uint64_t capacity, uint64_t strings_size, int truncate){
+
+	PDP_catalog_header header;
+	struct stat st, pathst;
+	unsigned char *map = NULL;
+	size_t map_size = 0;
+	int created = 0;
+
+	/* A rebuild may rename a new file over path between the open and the lock; the lock is only good
+	 * on the file path still names */
+	for(;;){
+		catalog->fd = open(path, O_RDWR | O_CREAT | (truncate ? O_TRUNC : 0), 0600);
+		if(catalog->fd < 0) return 0;
+		if(flock(catalog->fd, LOCK_EX | LOCK_NB) < 0){
+			if(errno == EWOULDBLOCK) fprintf(stderr, "ERROR: %s is in use by another process.\n", path);
+			goto cleanup;
+		}
+		if(fstat(catalog->fd, &st) < 0 || stat(path, &pathst) < 0) goto cleanup;
+		if(st.st_dev == pathst.st_dev && st.st_ino == pathst.st_ino) break;
+		close(catalog->fd);
+	}
+
+	if(st.st_size == 0){
+		memset(&header, 0, sizeof(PDP_catalog_header));
+		memcpy(header.magic, PDP_CATALOG_MAGIC, PDP_CATALOG_MAGIC_SIZE);
+		header.version = PDP_CATALOG_VERSION;
+		header.slot_size = PDP_CATALOG_SLOT_SIZE;
+		header.capacity = capacity;
+		header.strings_size = strings_size;
+		if(pwrite(catalog->fd, &header, sizeof(PDP_catalog_header), 0) != sizeof(PDP_catalog_header)) goto cleanup;
+		/* The slots start out as holes, which read as PDP_CATALOG_EMPTY */
+		if(ftruncate(catalog->fd, sizeof(PDP_catalog_header) + (capacity * PDP_CATALOG_SLOT_SIZE) + strings_size) < 0) goto cleanup;
+		created = 1;
+	}else if(pread(catalog->fd, &header, sizeof(PDP_catalog_header), 0) != sizeof(PDP_catalog_header)){
+		goto cleanup;
+	}
+
+	if(memcmp(header.magic, PDP_CATALOG_MAGIC, PDP_CATALOG_MAGIC_SIZE) != 0 || header.version != PDP_CATALOG_VERSION ||
+		header.slot_size != PDP_CATALOG_SLOT_SIZE || !header.capacity || (header.capacity & (header.capacity - 1)) ||
+		!header.strings_size || header.strings_used > header.strings_size || header.strings_garbage > header.strings_used){
+		fprintf(stderr, "ERROR: %s is not a PDP catalog.\n", path);
+		goto cleanup;
+	}
+
+	map_size = sizeof(PDP_catalog_header) + (header.capacity * PDP_CATALOG_SLOT_SIZE) + header.strings_size;
+	if(!created && fstat(catalog->fd, &st) == 0 && (size_t)st.st_size < map_size){
+		fprintf(stderr, "ERROR: %s is truncated.\n", path);
+		goto cleanup;
+	}
+	map = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, catalog->fd, 0);
+	if(map == MAP_FAILED) goto cleanup;
+	set_map(catalog, map, map_size);
+
+	return 1;
+
+cleanup:
+	close(catalog->fd);
+	catalog->fd = -1;
+
+	return 0;
+}
+
+/* unmap_catalog: Unmaps and closes the catalog file */
+static void unmap_catalog(PDP_catalog *catalog){
+
+	if(catalog->map) munmap(catalog->map, catalog->map_size);
+	if(catalog->fd >= 0) close(catalog->fd);
+	catalog->map = NULL;
+	catalog->header = NULL;
+	catalog->slots = NULL;
+	catalog->strings = NULL;
+	catalog->fd = -1;
+}
+
+/* grow_strings: Doubles the string area until need more bytes fit, extending the file and mapping
+*  it again.  Call with the write lock held.  Returns 1 on success and 0 on failure.
+*/
+static int grow_strings(PDP_catalog *catalog, uint64_t need){
+
+	uint64_t strings_size = catalog->header->strings_size;
+	unsigned char *map = NULL;
+	size_t map_size = 0;
+
+	while(strings_size - catalog->header->strings_used < need) strings_size *= 2;
+	map_size = catalog->map_size - catalog->header->strings_size + strings_size;
+
+	if(ftruncate(catalog->fd, map_size) < 0) return 0;
+	map = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, catalog->fd, 0);
+	if(map == MAP_FAILED) return 0;
+	munmap(catalog->map, catalog->map_size);
+	set_map(catalog, map, map_size);
+	catalog->header->strings_size = strings_size;
+
+	return 1;
+}
+
+/* add_string: Appends the length bytes of s and a NUL to the string area, which must have room,
+*  and returns their offset.  Call with the write lock held.
+*/
+static uint64_t add_string(PDP_catalog *catalog, char *s, uint32_t length){
+
+	uint64_t offset = catalog->header->strings_used;
+
+	memcpy(catalog->strings + offset, s, length);
+	catalog->strings[offset + length] = '\0';
+	catalog->header->strings_used += length + 1;
+
+	return offset;
+}
+
+/* slot_string: Returns the string of length bytes at offset in the string area, or NULL if it
+*  does not lie within the used part of it or is not NUL-terminated, as in a damaged catalog.
+*/
+static char *slot_string(PDP_catalog *catalog, uint64_t offset, uint32_t length){
+
+	if(offset >= catalog->header->strings_used || length >= catalog->header->strings_used - offset) return NULL;
+	if(catalog->strings[offset + length] != '\0') return NULL;
+
+	return catalog->strings + offset;
+}
+
+/* read_slot: Copies the entry in slot, strings and all, into entry.  Returns 1 on success and 0 if
+*  its strings are damaged.
+*/
+static int read_slot(PDP_catalog *catalog, PDP_catalog_slot *slot, PDP_catalog_entry *entry){
+
+	char *name = NULL, *tagpath = NULL;
+
+	if(slot->name_length >= PDP_CATALOG_NAME_SIZE || slot->tagpath_length >= PDP_CATALOG_PATH_SIZE) return 0;
+	if( ((name = slot_string(catalog, slot->name_offset, slot->name_length)) == NULL)) return 0;
+	if( ((tagpath = slot_string(catalog, slot->tagpath_offset, slot->tagpath_length)) == NULL)) return 0;
+
+	memcpy(entry->name, name, slot->name_length + 1);
+	memcpy(entry->tagpath, tagpath, slot->tagpath_length + 1);
+	entry->numfileblocks = slot->numfileblocks;
+	entry->file_size = slot->file_size;
+	entry->blocksize = slot->blocksize;
+	entry->state = slot->state;
+	memcpy(entry->key_id, slot->key_id, SHA_DIGEST_LENGTH);
+	entry->last_status = slot->last_status;
+	entry->tagged_at = slot->tagged_at;
+	entry->last_audit = slot->last_audit;
+
+	return 1;
+}
+
+/* find_slot: Returns the slot holding name, or if it is absent and insert is set the slot it
+*  should go in, reusing the first tombstone on its probe sequence, or -1.  Call with the lock held.
+*/
+static int64_t find_slot(PDP_catalog *catalog, char *name, int insert){
+
+	uint64_t mask = catalog->header->capacity - 1;
+	uint64_t hash = pdp_hash_name(name), slot = hash & mask, probes = 0;
+	int64_t tombstone = -1;
+	PDP_catalog_slot *entry = NULL;
+	char *entry_name = NULL;
+
+	for(probes = 0; probes <= mask; probes++, slot = (slot + 1) & mask){
+		entry = &(catalog->slots[slot]);
+		if(entry->state == PDP_CATALOG_EMPTY) return insert ? ((tombstone >= 0) ? tombstone : (int64_t)slot) : -1;
+		if(entry->state == PDP_CATALOG_DELETED){
+			if(tombstone < 0) tombstone = slot;
+			continue;
+		}
+		if(entry->hash != hash) continue;
+		entry_name = slot_string(catalog, entry->name_offset, entry->name_length);
+		if(entry_name && strcmp(entry_name, name) == 0) return slot;
+	}
+
+	return insert ? tombstone : -1;
+}
+
+/* rebuild: Rewrites the catalog into a new file with capacity slots, dropping tombstones and the
+*  strings no slot refers to, and renames it over the old one.  Call with the write lock held.
+*  Returns 1 on success and 0 on failure.
+*/
+static int rebuild(PDP_catalog *catalog, uint64_t capacity){
+
+	PDP_catalog fresh;
+	PDP_catalog_slot *old = NULL, *new = NULL;
+	char tmppath[MAXPATHLEN];
+	char *name = NULL, *tagpath = NULL;
+	uint64_t i = 0, live = 0, strings_size = PDP_CATALOG_STRINGS_INITIAL;
+	int64_t slot = 0;
+
+	if(snprintf(tmppath, MAXPATHLEN, "%s%s", catalog->path, PDP_TAG_TMP_EXT) >= MAXPATHLEN) return 0;
+
+	/* Leave the live strings as much room again to grow into */
+	live = catalog->header->strings_used - catalog->header->strings_garbage;
+	while(strings_size < 2 * live) strings_size *= 2;
+
+	memset(&fresh, 0, sizeof(PDP_catalog));
+	if(!map_catalog(&fresh, tmppath, capacity, strings_size, 1)) return 0;
+	for(i = 0; i < catalog->header->capacity; i++){
+		old = &(catalog->slots[i]);
+		if(old->state != PDP_CATALOG_USED) continue;
+		if( ((name = slot_string(catalog, old->name_offset, old->name_length)) == NULL)) continue;
+		if( ((tagpath = slot_string(catalog, old->tagpath_offset, old->tagpath_length)) == NULL)) continue;
+		slot = find_slot(&fresh, name, 1);
+		new = &(fresh.slots[slot]);
+		memcpy(new, old, sizeof(PDP_catalog_slot));
+		new->name_offset = add_string(&fresh, name, old->name_length);
+		new->tagpath_offset = add_string(&fresh, tagpath, old->tagpath_length);
+		fresh.header->count++;
+	}
+
+	if(msync(fresh.map, fresh.map_size, MS_SYNC) < 0 || rename(tmppath, catalog->path) < 0){
+		unmap_catalog(&fresh);
+		unlink(tmppath);
+		return 0;
+	}
+
+	unmap_catalog(catalog);
+	catalog->fd = fresh.fd;
+	set_map(catalog, fresh.map, fresh.map_size);
+
+	return 1;
+}
+
+/* pdp_catalog_open: Opens the catalog at path, creating an empty one if there is none.  Returns an
+*  allocated catalog to be closed with pdp_catalog_close, or NULL on failure.
+*/
+PDP_catalog *pdp_catalog_open(char *path){
+
+	PDP_catalog *catalog = NULL;
+
+	if(!path || strlen(path) >= MAXPATHLEN - strlen(PDP_TAG_TMP_EXT)) return NULL;
+
+	if( ((catalog = calloc(1, sizeof(PDP_catalog))) == NULL)) return NULL;
+	catalog->fd = -1;
+	strcpy(catalog->path, path);
+	if(pthread_rwlock_init(&(catalog->lock), NULL) != 0){
+		free(catalog);
+		return NULL;
+	}
+	if(!map_catalog(catalog, path, PDP_CATALOG_INITIAL, PDP_CATALOG_STRINGS_INITIAL, 0)){
+		fprintf(stderr, "ERROR: Was not able to open catalog %s.\n", path);
+		pdp_catalog_close(catalog);
+		return NULL;
+	}
+
+	return catalog;
+}
+
+/* pdp_catalog_close: Flushes and closes a catalog.  No call may still be using it */
+void pdp_catalog_close(PDP_catalog *catalog){
+
+	if(!catalog) return;
+
+	if(catalog->map) msync(catalog->map, catalog->map_size, MS_SYNC);
+	unmap_catalog(catalog);
+	pthread_rwlock_destroy(&(catalog->lock));
+	free(catalog);
+}
+
+/* pdp_catalog_put: Adds entry to the catalog, or replaces the entry of the same name.  The name and
+*  tag path must be NUL-terminated within their fields.  Returns 1 on success and 0 on failure.
+*/
+int pdp_catalog_put(PDP_catalog *catalog, PDP_catalog_entry *entry){
+
+	PDP_catalog_slot *s = NULL;
+	char *tagpath = NULL;
+	uint64_t capacity = 0, need = 0;
+	uint32_t name_length = 0, tagpath_length = 0;
+	int64_t slot = 0;
+	int used = 0, new_tagpath = 1, ok = 0;
+
+	if(!catalog || !entry || !entry->name[0]) return 0;
+	name_length = strnlen(entry->name, PDP_CATALOG_NAME_SIZE);
+	tagpath_length = strnlen(entry->tagpath, PDP_CATALOG_PATH_SIZE);
+	if(name_length == PDP_CATALOG_NAME_SIZE || tagpath_length == PDP_CATALOG_PATH_SIZE) return 0;
+
+	pthread_rwlock_wrlock(&(catalog->lock));
+
+	/* Grow before the used and deleted slots pass PDP_CATALOG_LOAD; only purge tombstones if that is
+	 * enough.  Compact the string area once most of it is garbage. */
+	capacity = catalog->header->capacity;
+	if((double)(catalog->header->count + catalog->header->deleted + 1) > PDP_CATALOG_LOAD * capacity){
+		if((double)(catalog->header->count + 1) > (PDP_CATALOG_LOAD / 2) * capacity) capacity *= 2;
+		if(!rebuild(catalog, capacity)) goto cleanup;
+	}else if(catalog->header->strings_garbage >= PDP_CATALOG_STRINGS_INITIAL &&
+		catalog->header->strings_garbage > catalog->header->strings_used / 2){
+		if(!rebuild(catalog, capacity)) goto cleanup;
+	}
+
+	if( ((slot = find_slot(catalog, entry->name, 1)) < 0)) goto cleanup;
+
+	/* A replaced entry keeps its name, and its tag path too if that has not changed */
+	s = &(catalog->slots[slot]);
+	used = (s->state == PDP_CATALOG_USED);
+	if(used){
+		tagpath = slot_string(catalog, s->tagpath_offset, s->tagpath_length);
+		new_tagpath = (!tagpath || strcmp(tagpath, entry->tagpath) != 0);
+	}
+	need = (used ? 0 : name_length + 1) + (new_tagpath ? tagpath_length + 1 : 0);
+	if(catalog->header->strings_size - catalog->header->strings_used < need && !grow_strings(catalog, need)) goto cleanup;
+
+	s = &(catalog->slots[slot]);
+	if(!used){
+		if(s->state == PDP_CATALOG_DELETED) catalog->header->deleted--;
+		catalog->header->count++;
+		s->hash = pdp_hash_name(entry->name);
+		s->name_offset = add_string(catalog, entry->name, name_length);
+		s->name_length = name_length;
+	}
+	if(new_tagpath){
+		if(used) catalog->header->strings_garbage += s->tagpath_length + 1;
+		s->tagpath_offset = add_string(catalog, entry->tagpath, tagpath_length);
+		s->tagpath_length = tagpath_length;
+	}
+	s->numfileblocks = entry->numfileblocks;
+	s->file_size = entry->file_size;
+	s->blocksize = entry->blocksize;
+	memcpy(s->key_id, entry->key_id, SHA_DIGEST_LENGTH);
+	s->last_status = entry->last_status;
+	s->tagged_at = entry->tagged_at;
+	s->last_audit = entry->last_audit;
+	s->state = PDP_CATALOG_USED;
+	ok = 1;
+
+cleanup:
+	pthread_rwlock_unlock(&(catalog->lock));
+
+	return ok;
+}
+
+/* pdp_catalog_get: Copies the entry called name into entry.  Returns 1 if found and 0 if not */
+int pdp_catalog_get(PDP_catalog *catalog, char *name, PDP_catalog_entry *entry){
+
+	int64_t slot = 0;
+	int found = 0;
+
+	if(!catalog || !name || !entry) return 0;
+
+	pthread_rwlock_rdlock(&(catalog->lock));
+	if( ((slot = find_slot(catalog, name, 0)) >= 0)) found = read_slot(catalog, &(catalog->slots[slot]), entry);
+	pthread_rwlock_unlock(&(catalog->lock));
+
+	return found;
+}
+
+/* pdp_catalog_remove: Removes the entry called name.  Returns 1 if it was there and 0 if not */
+int pdp_catalog_remove(PDP_catalog *catalog, char *name){
+
+	PDP_catalog_slot *s = NULL;
+	int64_t slot = 0;
+
+	if(!catalog || !name) return 0;
+
+	pthread_rwlock_wrlock(&(catalog->lock));
+	if( ((slot = find_slot(catalog, name, 0)) >= 0)){
+		s = &(catalog->slots[slot]);
+		catalog->header->strings_garbage += s->name_length + 1 + s->tagpath_length + 1;
+		memset(s, 0, sizeof(PDP_catalog_slot));
+		s->state = PDP_CATALOG_DELETED;
+		catalog->header->count--;
+		catalog->header->deleted++;
+	}
+	pthread_rwlock_unlock(&(catalog->lock));
+
+	return slot >= 0;
+}
+
+/* pdp_catalog_record_audit: Records the PDP_AUDIT_* status of an audit of the file called name at
+*  when.  Returns 1 on success and 0 if it is not in the catalog.
+*/
+int pdp_catalog_record_audit(PDP_catalog *catalog, char *name, int status, int64_t when){
+
+	int64_t slot = 0;
+
+	if(!catalog || !name) return 0;
+
+	pthread_rwlock_wrlock(&(catalog->lock));
+	if( ((slot = find_slot(catalog, name, 0)) >= 0)){
+		catalog->slots[slot].last_status = status;
+		catalog->slots[slot].last_audit = when;
+	}
+	pthread_rwlock_unlock(&(catalog->lock));
+
+	return slot >= 0;
+}
+
+/* pdp_catalog_iterate: Calls fn with a copy of each entry of the catalog, in no particular order,
+*  until it returns 0.  fn must not change the catalog.  Entries whose strings are damaged are
+*  skipped.  Returns the entries visited, or -1 on error.
+*/
+int64_t pdp_catalog_iterate(PDP_catalog *catalog, int (*fn)(PDP_catalog_entry *entry, void *arg), void *arg){
+
+	PDP_catalog_entry entry;
+	uint64_t i = 0;
+	int64_t visited = 0;
+
+	if(!catalog || !fn) return -1;
+
+	pthread_rwlock_rdlock(&(catalog->lock));
+	for(i = 0; i < catalog->header->capacity; i++){
+		if(catalog->slots[i].state != PDP_CATALOG_USED) continue;
+		if(!read_slot(catalog, &(catalog->slots[i]), &entry)) continue;
+		visited++;
+		if(!fn(&entry, arg)) break;
+	}
+	pthread_rwlock_unlock(&(catalog->lock));
+
+	return visited;
+}
+
+/* pdp_catalog_count: Returns the entries in the catalog */
+uint64_t pdp_catalog_count(PDP_catalog *catalog){
+
+	uint64_t count = 0;
+
+	if(!catalog) return 0;
+
+	pthread_rwlock_rdlock(&(catalog->lock));
+	count = catalog->header->count;
+	pthread_rwlock_unlock(&(catalog->lock));
+
+	return count;
+}
+
+/* pdp_catalog_sync: Flushes the catalog to disk.  Returns 1 on success and 0 on failure */
+int pdp_catalog_sync(PDP_catalog *catalog){
+
+	int ok = 0;
+
+	if(!catalog) return 0;
+
+	pthread_rwlock_rdlock(&(catalog->lock));
+	ok = (msync(catalog->map, catalog->map_size, MS_SYNC) == 0);
+	pthread_rwlock_unlock(&(catalog->lock));
+
+	return ok;
+}
+
+/* pdp_catalog_add_file: Records the file at filepath, tagged into tagfilepath (filepath with a .tag
+*  extension if NULL) with the key whose pdp_key_fingerprint is key_id, in the catalog as name
+*  (filepath if NULL), tagged now.  Returns 1 on success and 0 on failure.
+*/
+int pdp_catalog_add_file(PDP_catalog *catalog, char *name, char *filepath, char *tagfilepath, unsigned char *key_id){
+
+	PDP_catalog_entry entry;
+	struct stat st;
+
+	if(!catalog || !filepath || !key_id) return 0;
+	if(!name) name = filepath;
+	if(stat(filepath, &st) < 0) return 0;
+
+	memset(&entry, 0, sizeof(PDP_catalog_entry));
+	if(snprintf(entry.name, PDP_CATALOG_NAME_SIZE, "%s", name) >= PDP_CATALOG_NAME_SIZE) return 0;
+	if(tagfilepath){
+		if(snprintf(entry.tagpath, PDP_CATALOG_PATH_SIZE, "%s", tagfilepath) >= PDP_CATALOG_PATH_SIZE) return 0;
+	}else{
+		if(snprintf(entry.tagpath, PDP_CATALOG_PATH_SIZE, "%s.tag", filepath) >= PDP_CATALOG_PATH_SIZE) return 0;
+	}
+	entry.numfileblocks = (st.st_size + PDP_BLOCKSIZE - 1) / PDP_BLOCKSIZE;
+	entry.file_size = st.st_size;
+	entry.blocksize = PDP_BLOCKSIZE;
+	memcpy(entry.key_id, key_id, SHA_DIGEST_LENGTH);
+	entry.last_status = PDP_AUDIT_NONE;
+	entry.tagged_at = time(NULL);
+
+	return pdp_catalog_put(catalog, &entry);
+}
+
+/* pdp_catalog_challenge: Generates a challenge of the file called name from its catalog entry,
+*  without touching its data or tags.  Fails if the file was tagged with another key or block size.
+*  Returns an allocated challenge, or NULL on failure.
+*/
+PDP_challenge *pdp_catalog_challenge(PDP_catalog *catalog, PDP_key *key, char *name){
+
+	PDP_catalog_entry entry;
+	unsigned char key_id[SHA_DIGEST_LENGTH];
+
+	if(!pdp_catalog_get(catalog, name, &entry)) return NULL;
+	if(!pdp_key_fingerprint(key, key_id) || memcmp(key_id, entry.key_id, SHA_DIGEST_LENGTH) != 0){
+		fprintf(stderr, "ERROR: %s was tagged with another key.\n", name);
+		return NULL;
+	}
+	if(entry.blocksize != PDP_BLOCKSIZE) return NULL;
+
+	return pdp_challenge(key, entry.numfileblocks);
+}
@@ -27,14 +27,43 @@
 */
 
 #include "pdp.h"
+#include <stdlib.h>
+#include <limits.h>
 
-PDP_params params;
+/* pdp_fixed_base_exp: Computes r = g^m mod N from the key's fixed-base table, one Montgomery
+*  multiplication per non-zero window of m.  Falls back to BN_mod_exp_mont when there is no table or m
+*  is wider than it.  Returns 1 on success and 0 on failure.
+*/
+static int pdp_fixed_base_exp(BIGNUM *r, PDP_key *key, BIGNUM *m, BN_CTX *ctx){
+
+	size_t i = 0;
+	int j = 0, digit = 0, started = 0;
+
+	if(!key->g_table || !key->mont_n || BN_is_negative(m)
+		|| BN_num_bits(m) > key->g_table_windows * PDP_FIXED_BASE_WINDOW)
+		return BN_mod_exp_mont(r, key->g, m, RSA_get0_n(key->rsa), ctx, key->mont_n);
+
+	for(i = 0; i < key->g_table_windows; i++){
+		digit = 0;
+		for(j = PDP_FIXED_BASE_WINDOW - 1; j >= 0; j--)
+			digit = (digit << 1) | BN_is_bit_set(m, (i * PDP_FIXED_BASE_WINDOW) + j);
+		if(!digit) continue;
+		if(!started){
+			if(!BN_copy(r, key->g_table[(i * PDP_FIXED_BASE_DIGITS) + digit - 1])) return 0;
+			started = 1;
+		}else if(!BN_mod_mul_montgomery(r, r, key->g_table[(i * PDP_FIXED_BASE_DIGITS) + digit - 1], key->mont_n, ctx))
+			return 0;
+	}
+	if(!started) return BN_one(r);
+
+	return BN_from_montgomery(r, r, key->mont_n, ctx);
+}
 
 /* pdp_tag_block: Client-side function that takes pdp-keys, a generator of QR_N, and block of data, its
  * size and its logical index and creates a pdp tag to be stored with it at the server.  Returns an allocated 
  * pdp-tag structure.
  */
-PDP_tag *pdp_tag_block(PDP_key *key, unsigned char *block, size_t blocksize, unsigned int index){
+PDP_tag *pdp_tag_block(PDP_key *key, unsigned char *block, size_t blocksize, uint64_t index){
 	
 	PDP_tag *tag = NULL;
 	BN_CTX * ctx = NULL;
@@ -76,20 +105,22 @@ PDP_tag *pdp_tag_block(PDP_key *key, unsigned char *block, size_t blocksize, uns
 	message = BN_bin2bn(block, blocksize, NULL);
 	if(!message) goto cleanup;
 	
-	/* Calculate phi */
-	if (!BN_sub(r0, RSA_get0_p(key->rsa), BN_value_one())) goto cleanup;	/* p-1 */
-	if (!BN_sub(r1, RSA_get0_q(key->rsa), BN_value_one())) goto cleanup;	/* q-1 */
-	if (!BN_mul(phi, r0, r1, ctx)) goto cleanup;	/* phi = (p-1)(q-1) */
+	/* Calculate phi, unless it was precomputed with the key */
+	if(!key->phi){
+		if (!BN_sub(r0, RSA_get0_p(key->rsa), BN_value_one())) goto cleanup;	/* p-1 */
+		if (!BN_sub(r1, RSA_get0_q(key->rsa), BN_value_one())) goto cleanup;	/* q-1 */
+		if (!BN_mul(phi, r0, r1, ctx)) goto cleanup;	/* phi = (p-1)(q-1) */
+	}
 	
 	/* Reduce the message by modulo phi(N) */
-	if(!BN_mod(message, message, phi, ctx)) goto cleanup;
+	if(!BN_mod(message, message, key->phi ? key->phi : phi, ctx)) goto cleanup;
 	
 	/* r0 = g^m */
-	if(!BN_mod_exp(r0, key->g, message, RSA_get0_n(key->rsa), ctx)) goto cleanup;
+	if(!pdp_fixed_base_exp(r0, key, message, ctx)) goto cleanup;
 	/* r1 = h(W_i) * g^m */
 	if(!BN_mul(r1, fdh_hash, r0, ctx)) goto cleanup;
 	/* T_im = (h(W_i) * g^m)^d mod N */
-	if(!BN_mod_exp(tag->Tim, r1, RSA_get0_d(key->rsa), RSA_get0_n(key->rsa), ctx)) goto cleanup;
+	if(!BN_mod_exp_mont(tag->Tim, r1, RSA_get0_d(key->rsa), RSA_get0_n(key->rsa), ctx, key->mont_n)) goto cleanup;
 	
 	if(message) BN_clear_free(message);
 	if(phi) BN_clear_free(phi);
@@ -112,18 +143,14 @@ cleanup:
 	return NULL;
 }
 
-/* pdp_challenge: A client-side function to generate a random challenge for the server to prove data possession.
- *  Takes pdp-keys, the generator of QR_N and the filesize in blocks.  
- *  Returns an allocated pdp-challenge structure.
- *  It's important to note that s must be kept secret from the server.  A server challenge is <c, k1, k2, g_s>.
- */
-PDP_challenge *pdp_challenge(PDP_key *key, unsigned int numfileblocks){
+/* new_challenge: Generates a random challenge to sample c of the numfileblocks blocks of a file */
+static PDP_challenge *new_challenge(PDP_key *key, uint64_t numfileblocks, uint64_t c){
 	
 	PDP_challenge *challenge = NULL;
 	BIGNUM *r0 = NULL;
 	BN_CTX *ctx = NULL;
 	
-	if(!key || !numfileblocks) return NULL;
+	if(!key || !numfileblocks || !c || c > numfileblocks || c > UINT_MAX) return NULL;
 
 	/* Verify keys */
 	if(!RSA_get0_n(key->rsa)) return NULL;
@@ -147,14 +174,9 @@ PDP_challenge *pdp_challenge(PDP_key *key, unsigned int numfileblocks){
 	if(!RAND_bytes(challenge->k1, PRP_KEY_SIZE)) goto cleanup;
 	if(!RAND_bytes(challenge->k2, PRF_KEY_SIZE)) goto cleanup;
 
-	/* Challenge the server to test at least 460 blocks (MAGIC_NUM_CHALLENGE_BLOCKS) of the file 
-	*  (see paper for details on choice of c ) */
-	if(numfileblocks < MAGIC_NUM_CHALLENGE_BLOCKS)
-		challenge->c = numfileblocks;
-	else
-		challenge->c = MAGIC_NUM_CHALLENGE_BLOCKS;
-
+	challenge->c = c;
 	challenge->numfileblocks = numfileblocks;
+	pdp_challenge_issue(challenge);
 
 	if(r0) BN_clear_free(r0);	
 	if(ctx) BN_CTX_free(ctx);
@@ -169,6 +191,72 @@ cleanup:
 	return NULL;
 }
 
+/* pdp_challenge: A client-side function to generate a random challenge for the server to prove data possession.
+ *  Takes pdp-keys, the generator of QR_N and the filesize in blocks.  
+ *  Returns an allocated pdp-challenge structure.
+ *  It's important to note that s must be kept secret from the server.  A server challenge is <c, k1, k2, g_s>.
+ */
+PDP_challenge *pdp_challenge(PDP_key *key, uint64_t numfileblocks){
+
+	/* Challenge the server to test at least 460 blocks (MAGIC_NUM_CHALLENGE_BLOCKS) of the file 
+	*  (see paper for details on choice of c ) */
+	if(numfileblocks < MAGIC_NUM_CHALLENGE_BLOCKS)
+		return new_challenge(key, numfileblocks, numfileblocks);
+	else
+		return new_challenge(key, numfileblocks, MAGIC_NUM_CHALLENGE_BLOCKS);
+}
+
+/* pdp_challenge_size: Returns the fewest blocks c a challenge of a file of numfileblocks blocks must
+*  sample to catch, with probability at least detection, a server that has lost or corrupted a
+*  corrupt_fraction of them (at least one block).  Sampling c distinct blocks of n when t are bad
+*  misses them all with probability
+*
+*      P(miss) = prod_{j<c} (n - t - j) / (n - j)
+*
+*  which is multiplied out until it falls to 1 - detection, so the cost is O(c).  A detection of 1
+*  needs n - t + 1 blocks.  Returns 0 if detection or corrupt_fraction is not in (0, 1].
+*/
+uint64_t pdp_challenge_size(uint64_t numfileblocks, double detection, double corrupt_fraction){
+
+	long double miss = 1;
+	uint64_t bad = 0, c = 0;
+
+	if(!numfileblocks || !(detection > 0 && detection <= 1) || !(corrupt_fraction > 0 && corrupt_fraction <= 1)) return 0;
+
+	/* Round the bad blocks up */
+	bad = corrupt_fraction * (double)numfileblocks;
+	if((double)bad < corrupt_fraction * (double)numfileblocks) bad++;
+	if(bad < 1) bad = 1;
+	if(bad > numfileblocks) bad = numfileblocks;
+
+	while(miss > 1 - (long double)detection && c <= numfileblocks - bad){
+		miss *= (long double)(numfileblocks - bad - c) / (long double)(numfileblocks - c);
+		c++;
+	}
+
+	return c;
+}
+
+/* pdp_challenge_target: Like pdp_challenge, but samples as many blocks as pdp_challenge_size
+*  finds are needed to detect the loss of a corrupt_fraction of the file with probability detection,
+*  instead of MAGIC_NUM_CHALLENGE_BLOCKS.  Returns an allocated challenge, or NULL on error.
+*/
+PDP_challenge *pdp_challenge_target(PDP_key *key, uint64_t numfileblocks, double detection, double corrupt_fraction){
+
+	return new_challenge(key, numfileblocks, pdp_challenge_size(numfileblocks, detection, corrupt_fraction));
+}
+
+/* pdp_challenge_issue: Marks a challenge as issued now, to time the proof that answers it.
+*  Challenges are marked when they are generated; a verifier that sends one later marks it again.
+*  The timing itself is in pdp-latency.c, which keeps libm off the challenge path.
+*/
+void pdp_challenge_issue(PDP_challenge *challenge){
+
+	if(!challenge) return;
+
+	challenge->issued_ns = pdp_monotonic_ns();
+}
+
 /* pdp_generate_proof_update: Creates or updates a PDP proof structure.  It should be called
 *  for each block of the file challenged.  A called to pdp_generate_proof_final must be called
 *  after all calls to update are finished.  It takes in a PDP key, a challenge, the tag of challenged
@@ -318,7 +406,7 @@ int pdp_verify_proof(PDP_key *key, PDP_challenge *challenge, PDP_proof *proof){
 	size_t H_result_size = 0;
 	unsigned int j = 0;
 	int result = 0;
-	unsigned int *indices = NULL;
+	uint64_t *indices = NULL;
 
 	if(!key || !challenge || !proof) return -1;
 
@@ -408,7 +496,7 @@ int pdp_verify_proof(PDP_key *key, PDP_challenge *challenge, PDP_proof *proof){
 	if(ctx) BN_CTX_free(ctx);
 	if(prf_result && (prf_result_size > 0)) sfree(prf_result, prf_result_size);	
 	if(H_result && (H_result_size > 0)) sfree(H_result, H_result_size);	
-	if(indices) sfree(indices, (challenge->c * sizeof(unsigned int)));
+	if(indices) sfree(indices, (challenge->c * sizeof(uint64_t)));
 	
 	return result;
 
@@ -423,10 +511,141 @@ cleanup:
 	if(index_prf && (index_prf_size > 0)) sfree(index_prf, index_prf_size);
 	if(prf_result && (prf_result_size > 0)) sfree(prf_result, prf_result_size);
 	if(H_result && (H_result_size > 0)) sfree(H_result, H_result_size);
-	if(indices) sfree(indices, (challenge->c * sizeof(unsigned int)));
+	if(indices) sfree(indices, (challenge->c * sizeof(uint64_t)));
 	
 	return 0;
 }
 
+/* pdp_verify_tags_batch: Checks the tags of many blocks at once against the blocks themselves,
+*  without a challenge.  Each tag satisfies T_i^e = h(W_i) * g^m_i mod N; the numslots equations of
+*  the tags in slots of tags (every slot below tags->count if slots is NULL), whose blocks lie
+*  blocksize bytes apart in blocks, are combined with random PDP_BATCH_WEIGHT_BITS-bit weights r_i
+*  into one:
+*
+*      (prod T_i^r_i)^e = prod h(W_i)^r_i * g^(sum r_i * m_i) mod N
+*
+*  The products are taken in a single pass over the weights' bits, sharing its squarings, so the
+*  batch costs about one exponentiation of g plus a few multiplications per block.  A batch with any
+*  bad tag or block passes with probability at most 2^-PDP_BATCH_WEIGHT_BITS.  Needs the secret
+*  PRF key to recompute W_i.  Returns 1 if every tag is valid, 0 if any is not and -1 on error.
+*/
+int pdp_verify_tags_batch(PDP_key *key, PDP_tag_batch *tags, unsigned char *blocks, size_t blocksize,
+	uint64_t *slots, uint64_t numslots){
+
+	BIGNUM **T = NULL;			/* T_i in Montgomery form */
+	BIGNUM **h = NULL;			/* h(W_i) in Montgomery form */
+	BIGNUM **r = NULL;			/* The weights */
+	BIGNUM *sum = NULL;
+	BIGNUM *message = NULL;
+	BIGNUM *lhs = NULL;
+	BIGNUM *rhs = NULL;
+	BIGNUM *fdh_hash = NULL;
+	BN_MONT_CTX *mont = NULL;
+	BN_CTX *ctx = NULL;
+	unsigned char *index_prf = NULL;
+	size_t index_prf_size = 0;
+	uint64_t i = 0, slot = 0;
+	int bit = 0;
+	int result = -1;
+
+	if(!key || !key->rsa || !key->g || !tags || !blocks || !blocksize || !numslots) return -1;
+	if(!RSA_get0_n(key->rsa) || !RSA_get0_e(key->rsa)) return -1;
+
+	if( ((ctx = BN_CTX_new()) == NULL)) goto cleanup;
+	if(key->mont_n){
+		mont = key->mont_n;
+	}else{
+		if( ((mont = BN_MONT_CTX_new()) == NULL)) goto cleanup;
+		if(!BN_MONT_CTX_set(mont, RSA_get0_n(key->rsa), ctx)) goto cleanup;
+	}
+
+	if( ((T = calloc(numslots, sizeof(BIGNUM *))) == NULL)) goto cleanup;
+	if( ((h = calloc(numslots, sizeof(BIGNUM *))) == NULL)) goto cleanup;
+	if( ((r = calloc(numslots, sizeof(BIGNUM *))) == NULL)) goto cleanup;
+	if( ((sum = BN_new()) == NULL)) goto cleanup;
+	if( ((message = BN_new()) == NULL)) goto cleanup;
+	if( ((lhs = BN_new()) == NULL)) goto cleanup;
+	if( ((rhs = BN_new()) == NULL)) goto cleanup;
+	BN_zero(sum);
+
+	for(i = 0; i < numslots; i++){
+		slot = slots ? slots[i] : i;
+		if(slot >= tags->count) goto cleanup;
 
+		/* W_i must be the PRF of the block's own index, or the tag was moved */
+		index_prf = generate_prf_w(key, tags->indices[slot], &index_prf_size);
+		if(!index_prf) goto cleanup;
+		if(index_prf_size != tags->index_prf_size ||
+			memcmp(index_prf, PDP_TAG_BATCH_INDEX_PRF(tags, slot), index_prf_size) != 0){
+			result = 0;
+			goto cleanup;
+		}
+		fdh_hash = generate_fdh_h(key, index_prf, index_prf_size);
+		if(!fdh_hash) goto cleanup;
+		sfree(index_prf, index_prf_size);
+		index_prf = NULL;
+
+		if( ((T[i] = BN_lebin2bn(PDP_TAG_BATCH_TIM(tags, slot), tags->limb_size, NULL)) == NULL)) goto cleanup;
+		if(!BN_to_montgomery(T[i], T[i], mont, ctx)) goto cleanup;
+		if( ((h[i] = BN_new()) == NULL)) goto cleanup;
+		if(!BN_to_montgomery(h[i], fdh_hash, mont, ctx)) goto cleanup;
+		BN_clear_free(fdh_hash);
+		fdh_hash = NULL;
+
+		/* sum += r_i * m_i, with r_i odd so it is never zero */
+		if( ((r[i] = BN_new()) == NULL)) goto cleanup;
+		if(!BN_rand(r[i], PDP_BATCH_WEIGHT_BITS, BN_RAND_TOP_ANY, BN_RAND_BOTTOM_ODD)) goto cleanup;
+		if(!BN_bin2bn(blocks + (slot * blocksize), blocksize, message)) goto cleanup;
+		if(!BN_mul(message, message, r[i], ctx)) goto cleanup;
+		if(!BN_add(sum, sum, message)) goto cleanup;
+	}
 
+	/* lhs = prod T_i^r_i and rhs = prod h(W_i)^r_i, most significant weight bit first */
+	if(!BN_to_montgomery(lhs, BN_value_one(), mont, ctx)) goto cleanup;
+	if(!BN_copy(rhs, lhs)) goto cleanup;
+	for(bit = PDP_BATCH_WEIGHT_BITS - 1; bit >= 0; bit--){
+		if(!BN_mod_mul_montgomery(lhs, lhs, lhs, mont, ctx)) goto cleanup;
+		if(!BN_mod_mul_montgomery(rhs, rhs, rhs, mont, ctx)) goto cleanup;
+		for(i = 0; i < numslots; i++){
+			if(!BN_is_bit_set(r[i], bit)) continue;
+			if(!BN_mod_mul_montgomery(lhs, lhs, T[i], mont, ctx)) goto cleanup;
+			if(!BN_mod_mul_montgomery(rhs, rhs, h[i], mont, ctx)) goto cleanup;
+		}
+	}
+	if(!BN_from_montgomery(lhs, lhs, mont, ctx)) goto cleanup;
+	if(!BN_from_montgomery(rhs, rhs, mont, ctx)) goto cleanup;
+
+	/* lhs = lhs^e */
+	if(!BN_mod_exp_mont(lhs, lhs, RSA_get0_e(key->rsa), RSA_get0_n(key->rsa), ctx, mont)) goto cleanup;
+
+	/* rhs = rhs * g^sum, with sum reduced modulo phi(N) when the key has it precomputed */
+	if(key->phi && !BN_mod(sum, sum, key->phi, ctx)) goto cleanup;
+	if(key->mont_n){
+		if(!pdp_fixed_base_exp(message, key, sum, ctx)) goto cleanup;
+	}else{
+		if(!BN_mod_exp_mont(message, key->g, sum, RSA_get0_n(key->rsa), ctx, mont)) goto cleanup;
+	}
+	if(!BN_mod_mul(rhs, rhs, message, RSA_get0_n(key->rsa), ctx)) goto cleanup;
+
+	result = (BN_cmp(lhs, rhs) == 0);
+
+cleanup:
+	for(i = 0; i < numslots; i++){
+		if(T && T[i]) BN_clear_free(T[i]);
+		if(h && h[i]) BN_clear_free(h[i]);
+		if(r && r[i]) BN_clear_free(r[i]);
+	}
+	if(T) free(T);
+	if(h) free(h);
+	if(r) free(r);
+	if(sum) BN_clear_free(sum);
+	if(message) BN_clear_free(message);
+	if(lhs) BN_clear_free(lhs);
+	if(rhs) BN_clear_free(rhs);
+	if(fdh_hash) BN_clear_free(fdh_hash);
+	if(index_prf) sfree(index_prf, index_prf_size);
+	if(mont && mont != key->mont_n) BN_MONT_CTX_free(mont);
+	if(ctx) BN_CTX_free(ctx);
+
+	return result;
+}
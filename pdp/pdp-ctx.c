@@ -0,0 +1,132 @@
+/* 
+* pdp-ctx.c
+*
+* Copyright (c) 2008, Zachary N J Peterson <zachary@jhu.edu>
+* All rights reserved.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*     * Redistributions of source code must retain the above copyright
+*       notice, this list of conditions and the following disclaimer.
+*     * Redistributions in binary form must reproduce the above copyright
+*       notice, this list of conditions and the following disclaimer in the
+*       documentation and/or other materials provided with the distribution.
+*     * The name of the Zachary N J Peterson may be used to endorse or promote products
+*       derived from this software without specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY ZACHARY N J PETERSON ``AS IS'' AND ANY
+* EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL ZACHARY N J PETERSON BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+/* pdp-ctx.c contains the library context.  A PDP_ctx owns the configuration, budgets, key cache,
+*  descriptor cache and tag cache that tagging and proving run with, so several contexts, e.g. one per tenant or service, can be used in one
+*  process without sharing state.  The entry points without a context run on a default context
+*  that is created the first time one of them is called.
+*/
+
+#include "pdp.h"
+#include <stdlib.h>
+#include <unistd.h>
+#include <pwd.h>
+#include <pthread.h>
+#include <openssl/crypto.h>
+
+static pthread_once_t default_ctx_once = PTHREAD_ONCE_INIT;
+static PDP_ctx *default_ctx = NULL;
+
+/* pdp_ctx_new: Returns an allocated context with the compiled-in defaults: keys are read from
+*  ~/.pdp, files are tagged on NUM_THREADS threads with THREADING, data and tag files are accessed
+*  directly with USE_DIRECT_IO, tag files are flushed to disk only at checkpoints, budgets are
+*  unlimited, keys are not cached, tags are cached up to $PDP_TAG_CACHE_MB megabytes if it is set
+*  and not otherwise, and up to PDP_FD_CACHE_SIZE files are kept open.  Files are tagged through the
+*  tagging daemon whose socket $PDP_TAGGER_SOCKET names, if it is set, and by $PDP_TAG_PROCESSES
+*  worker processes otherwise, if it is above 1.  Tagged files are recorded in the catalog
+*  $PDP_CATALOG names, if it is set and can be opened.  OpenSSL is initialised here,
+*  once per process, rather than on the tagging path.  Returns NULL on failure.
+*/
+PDP_ctx *pdp_ctx_new(){
+
+	PDP_ctx *ctx = NULL;
+	struct passwd *pw = NULL;
+	char *home = NULL;
+	char *tagger = NULL;
+	char *procs = NULL;
+	char *catalog = NULL;
+	char *cachemb = NULL;
+
+	if(!OPENSSL_init_crypto(OPENSSL_INIT_ADD_ALL_CIPHERS | OPENSSL_INIT_ADD_ALL_DIGESTS, NULL)) return NULL;
+
+	if( ((ctx = malloc(sizeof(PDP_ctx))) == NULL)) return NULL;
+	memset(ctx, 0, sizeof(PDP_ctx));
+
+	/* Resolve the home directory once, instead of on every key lookup */
+	if( ((home = getenv("HOME")) == NULL) && ((pw = getpwuid(getuid())) != NULL)) home = pw->pw_dir;
+	if(snprintf(ctx->keypath, MAXPATHLEN, "%s/.pdp", home ? home : ".") >= MAXPATHLEN) goto cleanup;
+
+	if( ((tagger = getenv(PDP_TAGGER_SOCKET_ENV)) != NULL) &&
+		snprintf(ctx->taggerpath, MAXPATHLEN, "%s", tagger) >= MAXPATHLEN) goto cleanup;
+	if( ((procs = getenv(PDP_TAG_PROCESSES_ENV)) != NULL)) ctx->numprocs = atoi(procs);
+
+#ifdef THREADING
+	ctx->numthreads = NUM_THREADS;
+#else
+	ctx->numthreads = 1;
+#endif
+#ifdef USE_DIRECT_IO
+	ctx->io_flags = PDP_IO_DIRECT;
+#endif
+
+	if( ((ctx->budget = pdp_budget_new()) == NULL)) goto cleanup;
+	if( ((ctx->keycache = pdp_key_cache_new(0)) == NULL)) goto cleanup;
+	if( ((ctx->fdcache = pdp_fd_cache_new(PDP_FD_CACHE_SIZE)) == NULL)) goto cleanup;
+	if( ((ctx->tagcache = pdp_tag_cache_new(0)) == NULL)) goto cleanup;
+	if( ((cachemb = getenv(PDP_TAG_CACHE_ENV)) != NULL)) pdp_tag_cache_set_budget(ctx->tagcache, (size_t)strtoull(cachemb, NULL, 10) << 20);
+	/* The catalog only records what was tagged and audited; tagging and auditing go on without it */
+	if( ((catalog = getenv(PDP_CATALOG_ENV)) != NULL) && ((ctx->catalog = pdp_catalog_open(catalog)) == NULL))
+		fprintf(stderr, "WARNING: Continuing without the catalog %s.\n", catalog);
+
+	return ctx;
+
+cleanup:
+	pdp_ctx_free(ctx);
+	return NULL;
+}
+
+/* pdp_ctx_free: Frees a context with its budgets, cached keys, descriptors, tags and catalog.  No call may still be
+*  using it.
+*/
+void pdp_ctx_free(PDP_ctx *ctx){
+
+	if(!ctx) return;
+	if(ctx->catalog) pdp_catalog_close(ctx->catalog);
+	if(ctx->tagcache) pdp_tag_cache_free(ctx->tagcache);
+	if(ctx->fdcache) pdp_fd_cache_free(ctx->fdcache);
+	if(ctx->keycache) pdp_key_cache_free(ctx->keycache);
+	if(ctx->budget) pdp_budget_free(ctx->budget);
+	free(ctx);
+}
+
+/* default_ctx_init: Creates the default context */
+static void default_ctx_init(){
+
+	default_ctx = pdp_ctx_new();
+}
+
+/* pdp_default_ctx: Returns the context the entry points without a context use, or NULL if it could
+*  not be created.  It lives as long as the process.
+*/
+PDP_ctx *pdp_default_ctx(){
+
+	pthread_once(&default_ctx_once, default_ctx_init);
+
+	return default_ctx;
+}
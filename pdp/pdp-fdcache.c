@@ -0,0 +1,239 @@
+/* 
+* pdp-fdcache.c
+*
+* Copyright (c) 2008, Zachary N J Peterson <zachary@jhu.edu>
+* All rights reserved.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*     * Redistributions of source code must retain the above copyright
+*       notice, this list of conditions and the following disclaimer.
+*     * Redistributions in binary form must reproduce the above copyright
+*       notice, this list of conditions and the following disclaimer in the
+*       documentation and/or other materials provided with the distribution.
+*     * The name of the Zachary N J Peterson may be used to endorse or promote products
+*       derived from this software without specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY ZACHARY N J PETERSON ``AS IS'' AND ANY
+* EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL ZACHARY N J PETERSON BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+/* pdp-fdcache.c contains the descriptor cache, which keeps data and tag files open between
+*  proofs.  Concurrent challenges against the same file share one descriptor, read with pread, and
+*  so share its page cache without any locking around the reads.  A cached descriptor is checked
+*  against the path on every open, so a tag file replaced by rename is reopened, never read stale.
+*  Unused descriptors are closed least recently used first once more than the cache's limit are open.
+*/
+
+#include "pdp.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+typedef struct PDP_fd_cache_entry_struct PDP_fd_cache_entry;
+
+struct PDP_fd_cache_entry_struct{
+
+	char path[MAXPATHLEN];
+	int fd;
+	dev_t dev;					/* Identify the file the descriptor is open on */
+	ino_t ino;
+	unsigned int refs;			/* Callers holding the descriptor */
+	int stale;					/* The path now names another file; close once unused */
+
+	/* Least recently used list; the head is the most recently used */
+	PDP_fd_cache_entry *prev;
+	PDP_fd_cache_entry *next;
+};
+
+struct PDP_fd_cache_struct{
+
+	pthread_mutex_t lock;
+	size_t max_fds;				/* Unused descriptors are closed beyond this many */
+	PDP_fd_cache_entry *head;
+	PDP_fd_cache_entry *tail;
+	PDP_fd_cache_stats stats;
+};
+
+/* lru_unlink: Removes entry from the least recently used list.  Call with the cache's lock held */
+static void lru_unlink(PDP_fd_cache *cache, PDP_fd_cache_entry *entry){
+
+	if(entry->prev) entry->prev->next = entry->next;
+	else cache->head = entry->next;
+	if(entry->next) entry->next->prev = entry->prev;
+	else cache->tail = entry->prev;
+	entry->prev = entry->next = NULL;
+}
+
+/* lru_push: Makes entry the most recently used.  Call with the cache's lock held */
+static void lru_push(PDP_fd_cache *cache, PDP_fd_cache_entry *entry){
+
+	entry->prev = NULL;
+	entry->next = cache->head;
+	if(cache->head) cache->head->prev = entry;
+	cache->head = entry;
+	if(!cache->tail) cache->tail = entry;
+}
+
+/* destroy_entry: Unlinks entry, closes its descriptor and frees it.  Call with the cache's lock held */
+static void destroy_entry(PDP_fd_cache *cache, PDP_fd_cache_entry *entry){
+
+	lru_unlink(cache, entry);
+	close(entry->fd);
+	cache->stats.open_fds--;
+	free(entry);
+}
+
+/* trim: Closes unused descriptors, least recently used first, until at most max_fds are open.
+*  Call with the cache's lock held.
+*/
+static void trim(PDP_fd_cache *cache){
+
+	PDP_fd_cache_entry *entry = cache->tail;
+	PDP_fd_cache_entry *prev = NULL;
+
+	while(entry && cache->stats.open_fds > cache->max_fds){
+		prev = entry->prev;
+		if(entry->refs == 0){
+			destroy_entry(cache, entry);
+			cache->stats.evictions++;
+		}
+		entry = prev;
+	}
+}
+
+/* pdp_fd_cache_new: Returns an allocated descriptor cache that keeps up to max_fds descriptors open
+*  while unused, or NULL on failure.
+*/
+PDP_fd_cache *pdp_fd_cache_new(size_t max_fds){
+
+	PDP_fd_cache *cache = NULL;
+
+	if( ((cache = malloc(sizeof(PDP_fd_cache))) == NULL)) return NULL;
+	memset(cache, 0, sizeof(PDP_fd_cache));
+	if(pthread_mutex_init(&(cache->lock), NULL) != 0){
+		free(cache);
+		return NULL;
+	}
+	cache->max_fds = max_fds;
+
+	return cache;
+}
+
+/* pdp_fd_cache_free: Closes every descriptor and frees the cache.  No descriptor may still be in use */
+void pdp_fd_cache_free(PDP_fd_cache *cache){
+
+	if(!cache) return;
+
+	while(cache->head) destroy_entry(cache, cache->head);
+	pthread_mutex_destroy(&(cache->lock));
+	free(cache);
+}
+
+/* pdp_fd_cache_open: Returns a read-only descriptor for path, shared with every other caller that
+*  has path open, or -1 on failure.  The descriptor must only be read with pread and must be
+*  returned with pdp_fd_cache_close.
+*/
+int pdp_fd_cache_open(PDP_fd_cache *cache, char *path){
+
+	PDP_fd_cache_entry *entry = NULL;
+	struct stat st;
+	int fd = -1;
+
+	if(!path || strlen(path) >= MAXPATHLEN) return -1;
+	if(!cache) return open(path, O_RDONLY);
+
+	/* stat outside the lock; it is how a replaced file is noticed */
+	if(stat(path, &st) < 0) return -1;
+
+	pthread_mutex_lock(&(cache->lock));
+	for(entry = cache->head; entry; entry = entry->next){
+		if(entry->stale || strcmp(entry->path, path) != 0) continue;
+		if(entry->dev == st.st_dev && entry->ino == st.st_ino) break;
+		/* path was replaced; let the holders of the old file finish with it */
+		entry->stale = 1;
+		if(entry->refs == 0) destroy_entry(cache, entry);
+		entry = NULL;
+		break;
+	}
+	if(entry){
+		entry->refs++;
+		lru_unlink(cache, entry);
+		lru_push(cache, entry);
+		cache->stats.hits++;
+		fd = entry->fd;
+		pthread_mutex_unlock(&(cache->lock));
+		return fd;
+	}
+	cache->stats.misses++;
+	pthread_mutex_unlock(&(cache->lock));
+
+	/* Open outside the lock; a concurrent miss on the same path may briefly open it twice */
+	if( ((fd = open(path, O_RDONLY)) < 0)) return -1;
+	if(fstat(fd, &st) < 0 || ((entry = malloc(sizeof(PDP_fd_cache_entry))) == NULL)){
+		close(fd);
+		return -1;
+	}
+	memset(entry, 0, sizeof(PDP_fd_cache_entry));
+	strcpy(entry->path, path);
+	entry->fd = fd;
+	entry->dev = st.st_dev;
+	entry->ino = st.st_ino;
+	entry->refs = 1;
+
+	pthread_mutex_lock(&(cache->lock));
+	lru_push(cache, entry);
+	cache->stats.open_fds++;
+	trim(cache);
+	pthread_mutex_unlock(&(cache->lock));
+
+	return fd;
+}
+
+/* pdp_fd_cache_close: Returns a descriptor from pdp_fd_cache_open */
+void pdp_fd_cache_close(PDP_fd_cache *cache, int fd){
+
+	PDP_fd_cache_entry *entry = NULL;
+
+	if(fd < 0) return;
+	if(!cache){
+		close(fd);
+		return;
+	}
+
+	pthread_mutex_lock(&(cache->lock));
+	for(entry = cache->head; entry; entry = entry->next)
+		if(entry->fd == fd && entry->refs > 0) break;
+	if(entry){
+		entry->refs--;
+		if(entry->stale && entry->refs == 0) destroy_entry(cache, entry);
+		else trim(cache);
+	}
+	pthread_mutex_unlock(&(cache->lock));
+
+	if(!entry) close(fd);
+}
+
+/* pdp_fd_cache_stats: Fills in stats with the cache's counters since it was created */
+void pdp_fd_cache_stats(PDP_fd_cache *cache, PDP_fd_cache_stats *stats){
+
+	if(!stats) return;
+	memset(stats, 0, sizeof(PDP_fd_cache_stats));
+	if(!cache) return;
+
+	pthread_mutex_lock(&(cache->lock));
+	memcpy(stats, &(cache->stats), sizeof(PDP_fd_cache_stats));
+	pthread_mutex_unlock(&(cache->lock));
+}
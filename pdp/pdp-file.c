@@ -33,6 +33,7 @@
 */
 
 #include "pdp.h"
+#include <fcntl.h>
 #include <unistd.h>
 #include <sys/stat.h>
 #include <sys/types.h>
@@ -42,193 +43,560 @@
 #endif
 
 
-/* write_pdp_tag: Write a PDP tag to disk.  Takes in an open file structure and a PDP tag structure
-*  and serializes the tag.  The tagfile must be open for writing. Returns 1 on success and 0 failure.
-*  NOTE: This function is not thread safe.  It should be called sequentially with a ordered list of tags.
+/* pdp_tag_header_init: Fills in the header of a fixed-width tag file for tags made with key.
+*  Returns 1 on success and 0 on failure.
 */
-static int write_pdp_tag(FILE *tagfile, PDP_tag *tag){
+int pdp_tag_header_init(PDP_tag_header *header, PDP_key *key){
 
-	unsigned char *tim = NULL;
-	size_t tim_size = 0;
-	
-	if(!tagfile || !tag || !tag->Tim) return 0;
+	if(!header || !key || !key->rsa || !RSA_get0_n(key->rsa)) return 0;
+
+	memset(header, 0, PDP_TAG_HEADER_SIZE);
+	memcpy(header->magic, PDP_TAG_MAGIC, PDP_TAG_MAGIC_SIZE);
+	header->version = PDP_TAG_VERSION;
+	header->tim_size = BN_num_bytes(RSA_get0_n(key->rsa));
+	header->index_size = sizeof(uint64_t);
+	header->index_prf_size = SHA_DIGEST_LENGTH;
+	header->record_size = header->tim_size + header->index_size + header->index_prf_size;
+
+	return 1;
+}
 
-	OpenSSL_add_all_algorithms();
+/* pdp_tag_header_parse: Parses the first buf_len bytes of a tag file into header.  Returns 1 if
+*  they hold a valid header and 0 otherwise, in which case the tag file is in the legacy
+*  variable-width layout.
+*/
+int pdp_tag_header_parse(PDP_tag_header *header, unsigned char *buf, size_t buf_len){
 
-	/* Write Tim to disk */
-	tim_size = BN_num_bytes(tag->Tim);
-	fwrite(&tim_size, sizeof(size_t), 1, tagfile);
-	if(ferror(tagfile)) goto cleanup;
-	if( ((tim = malloc(tim_size)) == NULL)) goto cleanup;
-	memset(tim, 0, tim_size);
-	if(!BN_bn2bin(tag->Tim, tim)) goto cleanup;
-	fwrite(tim, tim_size, 1, tagfile);
-	if(ferror(tagfile)) goto cleanup;
+	if(!header || !buf || buf_len < PDP_TAG_HEADER_SIZE) return 0;
 
-	/* write index */
-	fwrite(&(tag->index), sizeof(unsigned int), 1, tagfile);
-	if(ferror(tagfile)) goto cleanup;
-	
-	/* write index prf */
-	fwrite(&(tag->index_prf_size), sizeof(size_t), 1, tagfile);
-	if(ferror(tagfile)) goto cleanup;
-	fwrite(tag->index_prf, tag->index_prf_size, 1, tagfile);
-	if(ferror(tagfile)) goto cleanup;
+	memcpy(header, buf, PDP_TAG_HEADER_SIZE);
+	if(memcmp(header->magic, PDP_TAG_MAGIC, PDP_TAG_MAGIC_SIZE) != 0) return 0;
+	if(header->version == PDP_TAG_VERSION){
+		if(header->index_size != sizeof(uint64_t)) return 0;
+	}else if(header->version == PDP_TAG_VERSION_32BIT_INDEX){
+		if(header->index_size != sizeof(uint32_t)) return 0;
+	}else return 0;
+	if(!header->tim_size || !header->index_prf_size) return 0;
+	if(header->record_size != header->tim_size + header->index_size + header->index_prf_size) return 0;
 
-	// if(tim) sfree(tim, tim_size);
 	return 1;
-	
+}
+
+/* pdp_tag_record_offset: Returns the byte offset of the tag record for block index in a
+*  fixed-width tag file described by header.
+*/
+off_t pdp_tag_record_offset(PDP_tag_header *header, uint64_t index){
+
+	return (off_t)PDP_TAG_HEADER_SIZE + ((off_t)index * header->record_size);
+}
+
+/* pdp_tag_record_encode: Serializes tag into record, a buffer of header->record_size bytes.
+*  Returns 1 on success and 0 on failure.
+*/
+int pdp_tag_record_encode(PDP_tag_header *header, PDP_tag *tag, unsigned char *record){
+
+	if(!header || !tag || !tag->Tim || !record) return 0;
+	if(tag->index_prf_size != header->index_prf_size) return 0;
+	if(header->index_size != sizeof(uint64_t)) return 0;
+
+	/* Tim is zero-padded on the left to the width of N */
+	if(BN_bn2binpad(tag->Tim, record, header->tim_size) < 0) return 0;
+	memcpy(record + header->tim_size, &(tag->index), header->index_size);
+	memcpy(record + header->tim_size + header->index_size, tag->index_prf, header->index_prf_size);
+
+	return 1;
+}
+
+/* pdp_tag_record_decode: Deserializes a tag record of header->record_size bytes.  Returns an
+*  allocated PDP tag structure or NULL on failure.
+*/
+PDP_tag *pdp_tag_record_decode(PDP_tag_header *header, unsigned char *record){
+
+	PDP_tag *tag = NULL;
+	uint32_t index32 = 0;
+
+	if(!header || !record) return NULL;
+
+	if( ((tag = generate_pdp_tag()) == NULL)) goto cleanup;
+
+	if(!BN_bin2bn(record, header->tim_size, tag->Tim)) goto cleanup;
+	if(header->index_size == sizeof(uint32_t)){
+		memcpy(&index32, record + header->tim_size, sizeof(uint32_t));
+		tag->index = index32;
+	}else{
+		memcpy(&(tag->index), record + header->tim_size, sizeof(uint64_t));
+	}
+
+	tag->index_prf_size = header->index_prf_size;
+	if( ((tag->index_prf = malloc(tag->index_prf_size)) == NULL)) goto cleanup;
+	memcpy(tag->index_prf, record + header->tim_size + header->index_size, tag->index_prf_size);
+
+	return tag;
+
 cleanup:
-	// if(tim) sfree(tim, tim_size);
-	return 0;
+	if(tag) destroy_pdp_tag(tag);
+
+	return NULL;
 }
 
-/* read_pdp_tag: Reads a PDP tag from disk.  Takes an open file structure and the index of a PDP tag
-*  and reads from disk, returning a PDP tag structure or NULL on failure.  The tagfile must be open for
-*  reading. 
+/* read_pdp_tag_legacy: Reads the tag for block index from a tag file in the legacy variable-width
+*  layout, where each tag's offset is only found by walking all tags before it.
 */
-PDP_tag *read_pdp_tag(FILE *tagfile, unsigned int index){
+static PDP_tag *read_pdp_tag_legacy(int fd, uint64_t index){
 	
 	PDP_tag *tag = NULL;
 	unsigned char *tim = NULL;
 	size_t tim_size = 0;
 	size_t index_prf_size = 0;
-	int i = 0;
+	unsigned int index32 = 0;
+	off_t offset = 0;
+	uint64_t i = 0;
 	
-	if(!tagfile) return NULL;
+	if(fd < 0) return NULL;
 	
 	/* Allocate memory */
 	if( ((tag = generate_pdp_tag()) == NULL)) goto cleanup;
 	
-	/* Seek to start of tag file */
-	if(fseek(tagfile, 0, SEEK_SET) < 0) goto cleanup;
-	
-	/* Seek to tag offset index */
+	/* Walk to tag offset index */
 	for(i = 0; i < index; i++){
-		fread(&tim_size, sizeof(size_t), 1, tagfile);
-		if(ferror(tagfile)) goto cleanup;
-		if(fseek(tagfile, (tim_size + sizeof(unsigned int)), SEEK_CUR) < 0) goto cleanup;
-		fread(&(index_prf_size), sizeof(size_t), 1, tagfile);
-		if(fseek(tagfile, (index_prf_size), SEEK_CUR) < 0) goto cleanup;
+		if(!pdp_pread_full(fd, &tim_size, sizeof(size_t), offset)) goto cleanup;
+		offset += sizeof(size_t) + tim_size + sizeof(unsigned int);
+		if(!pdp_pread_full(fd, &index_prf_size, sizeof(size_t), offset)) goto cleanup;
+		offset += sizeof(size_t) + index_prf_size;
 	}
 	
 	/*Read in Tim */
-	fread(&tim_size, sizeof(size_t), 1, tagfile);
-	if(ferror(tagfile)) goto cleanup;
+	if(!pdp_pread_full(fd, &tim_size, sizeof(size_t), offset)) goto cleanup;
+	offset += sizeof(size_t);
 	if( ((tim = malloc((unsigned int)tim_size)) == NULL)) goto cleanup;
 	memset(tim, 0, (unsigned int)tim_size);
-	fread(tim, (unsigned int)tim_size, 1, tagfile);
-	if(ferror(tagfile)) goto cleanup;
+	if(!pdp_pread_full(fd, tim, (unsigned int)tim_size, offset)) goto cleanup;
+	offset += tim_size;
 
 	if(!BN_bin2bn(tim, tim_size, tag->Tim)) goto cleanup;
 
 	/* read index */
-	fread(&(tag->index), sizeof(unsigned int), 1, tagfile);
-	if(ferror(tagfile)) goto cleanup;
+	if(!pdp_pread_full(fd, &index32, sizeof(unsigned int), offset)) goto cleanup;
+	offset += sizeof(unsigned int);
+	tag->index = index32;
 	
-	/* write index prf */
-	fread(&(tag->index_prf_size), sizeof(size_t), 1, tagfile);
-	if(ferror(tagfile)) goto cleanup;
+	/* read index prf */
+	if(!pdp_pread_full(fd, &(tag->index_prf_size), sizeof(size_t), offset)) goto cleanup;
+	offset += sizeof(size_t);
 	if( ((tag->index_prf = malloc((unsigned int)tag->index_prf_size)) == NULL)) goto cleanup;
 	memset(tag->index_prf, 0, (unsigned int)tag->index_prf_size);
-	fread(tag->index_prf, (unsigned int)tag->index_prf_size, 1, tagfile);
-	if(ferror(tagfile)) goto cleanup;
+	if(!pdp_pread_full(fd, tag->index_prf, (unsigned int)tag->index_prf_size, offset)) goto cleanup;
 
 	if(tim) sfree(tim, tim_size);
 	
 	return tag;
 	
 cleanup:
-	if(tag->index_prf) sfree(tag->index_prf, tag->index_prf_size);
 	if(tag) destroy_pdp_tag(tag);
 	if(tim) sfree(tim, tim_size);
 
 	return NULL;
 }
 
+/* pdp_read_tag_fd: Reads the PDP tag of block index from the tag file open on fd.  Every read is a
+*  pread at an offset computed from index, so any number of threads can read tags through the same
+*  descriptor at once.  Returns an allocated PDP tag structure or NULL on failure.
+*/
+PDP_tag *pdp_read_tag_fd(int fd, uint64_t index){
+
+	PDP_tag_header header;
+	PDP_tag *tag = NULL;
+	unsigned char hbuf[PDP_TAG_HEADER_SIZE];
+	unsigned char *record = NULL;
+
+	if(fd < 0) return NULL;
+
+	memset(hbuf, 0, PDP_TAG_HEADER_SIZE);
+
+	/* Read the header to find out which layout the tag file is in */
+	if(!pdp_pread_full(fd, hbuf, PDP_TAG_HEADER_SIZE, 0) || !pdp_tag_header_parse(&header, hbuf, PDP_TAG_HEADER_SIZE))
+		return read_pdp_tag_legacy(fd, index);
+
+	/* Read the fixed-width record directly */
+	if( ((record = malloc(header.record_size)) == NULL)) goto cleanup;
+	if(!pdp_pread_full(fd, record, header.record_size, pdp_tag_record_offset(&header, index))) goto cleanup;
+
+	tag = pdp_tag_record_decode(&header, record);
+	if(!tag) goto cleanup;
+	if(tag->index != index) goto cleanup;
+
+	sfree(record, header.record_size);
+
+	return tag;
+
+cleanup:
+	if(tag) destroy_pdp_tag(tag);
+	if(record) sfree(record, header.record_size);
+
+	return NULL;
+}
+
+/* pdp_read_tag_batch_fd: Reads the tags of the numtags blocks in indices from the tag file open on
+*  fd into a batch, the tag of indices[j] in slot j.  The header is read once for the whole batch.
+*  Returns an allocated batch or NULL on failure, including for tag files in the legacy layout.
+*/
+PDP_tag_batch *pdp_read_tag_batch_fd(int fd, uint64_t *indices, uint64_t numtags){
+
+	PDP_tag_header header;
+	PDP_tag_batch *batch = NULL;
+	unsigned char hbuf[PDP_TAG_HEADER_SIZE];
+	unsigned char *record = NULL;
+	uint64_t j = 0;
+
+	if(fd < 0 || !indices || !numtags) return NULL;
+
+	memset(hbuf, 0, PDP_TAG_HEADER_SIZE);
+	if(!pdp_pread_full(fd, hbuf, PDP_TAG_HEADER_SIZE, 0) || !pdp_tag_header_parse(&header, hbuf, PDP_TAG_HEADER_SIZE))
+		return NULL;
+
+	if( ((batch = pdp_tag_batch_new(&header, numtags)) == NULL)) goto cleanup;
+	if( ((record = malloc(header.record_size)) == NULL)) goto cleanup;
+
+	for(j = 0; j < numtags; j++){
+		if(!pdp_pread_full(fd, record, header.record_size, pdp_tag_record_offset(&header, indices[j]))) goto cleanup;
+		if(!pdp_tag_batch_decode(batch, &header, j, record)) goto cleanup;
+		if(batch->indices[j] != indices[j]) goto cleanup;
+	}
+	batch->count = numtags;
+
+	sfree(record, header.record_size);
+
+	return batch;
+
+cleanup:
+	if(batch) pdp_tag_batch_free(batch);
+	if(record) sfree(record, header.record_size);
+
+	return NULL;
+}
+
+/* read_pdp_tag: Reads a PDP tag from disk.  Takes an open file structure and the index of a PDP tag
+*  and reads from disk, returning a PDP tag structure or NULL on failure.  The tagfile must be open for
+*  reading.  The stream's position is neither used nor moved; see pdp_read_tag_fd.
+*/
+PDP_tag *read_pdp_tag(FILE *tagfile, uint64_t index){
+
+	if(!tagfile) return NULL;
+
+	return pdp_read_tag_fd(fileno(tagfile), index);
+}
+
 #ifdef THREADING
 
 struct thread_arguments{
 
-	FILE *file;		/* File to tag; a unique file descriptor to this thread */
+	char *filepath;	/* File to tag; each thread opens its own reader */
 	PDP_key *key;	/* PDP key pair */
-	int threadid;	/* The ID of the thread used to determine which blocks to tag */
-	int numblocks;	/* The number blocks this thread needs to tag */
-	PDP_tag **tags;	/* Shared memory between threads used to store the result tags */
+	uint64_t first_block;	/* The first block of the contiguous range this thread tags */
+	uint64_t numblocks;	/* The number blocks this thread needs to tag */
+	PDP_tag_batch *tags;	/* Shared between threads; each stores the tags of its range in their slots */
+	uint64_t tags_base;	/* The block index of slot 0 */
+	int node;	/* The NUMA node this thread runs on */
+	int io_flags;	/* PDP_IO_* flags to read the file with */
+	PDP_budget *budget;	/* Budget to charge reads and CPU time to */
+	int started;	/* Whether the thread was spawned */
 };
 
 void *pdp_tag_thread(void *threadargs_ptr){
 
 	PDP_tag *tag = NULL;
-	int block;
+	PDP_key *key = NULL;
+	PDP_block_reader *reader = NULL;
+	unsigned char *block = NULL;
+	uint64_t index = 0;
+	uint64_t cpu = 0;
 	int *ret = NULL;
-	unsigned char buf[PDP_BLOCKSIZE];
 	struct thread_arguments *threadargs = threadargs_ptr;
-	int i = 0;
-	
-	if(!threadargs || !threadargs->file || !threadargs->tags || !threadargs->key || !threadargs->numblocks) goto cleanup;
 	
 	/* Allocate memory for return value - this should be freed by the checker */
 	ret = malloc(sizeof(int));
 	if(!ret) goto cleanup;
 	*ret = 0;
+
+	if(!threadargs || !threadargs->filepath || !threadargs->tags || !threadargs->key || !threadargs->numblocks) goto cleanup;
+
+	/* Move to this thread's node before allocating anything, so the key replica, the reader's
+	 * buffers and its prefetch thread all stay on the node */
+	if(pdp_numa_num_nodes() > 1) pdp_numa_bind_thread(threadargs->node);
+	key = pdp_key_replicate(threadargs->key);
+	if(!key) goto cleanup;
 	
-	/* For N threads, read in and tag each Nth block */
-	block = threadargs->threadid;
-	for(i = 0; i < threadargs->numblocks; i++){
-		memset(buf, 0, PDP_BLOCKSIZE);
-		fseek(threadargs->file, block*PDP_BLOCKSIZE, SEEK_SET);
-		fread(buf, PDP_BLOCKSIZE, 1, threadargs->file);
-		if(ferror(threadargs->file))goto cleanup;
-		tag = pdp_tag_block(threadargs->key, buf, PDP_BLOCKSIZE, block);
+	/* Each thread reads and tags its own contiguous range of blocks, so every reader streams
+	 * large sequential chunks */
+	reader = pdp_block_reader_open(threadargs->filepath, threadargs->first_block, threadargs->numblocks,
+		threadargs->io_flags, threadargs->budget);
+	if(!reader) goto cleanup;
+	while((block = pdp_block_reader_next(reader, &index)) != NULL){
+		cpu = pdp_budget_thread_cpu();
+		tag = pdp_tag_block(key, block, PDP_BLOCKSIZE, index);
 		if(!tag) goto cleanup;
-		/* Store the tag in a buffer until all threads are done. Writer should destroy tags. */
-		threadargs->tags[block] = tag;
-		block += NUM_THREADS;
+		pdp_budget_charge_cpu(threadargs->budget, cpu);
+		/* Store the tag in the batch until all threads are done */
+		if(!pdp_tag_batch_set(threadargs->tags, index - threadargs->tags_base, tag)) goto cleanup;
+		destroy_pdp_tag(tag);
+		tag = NULL;
 	}
+	if(pdp_block_reader_error(reader)) goto cleanup;
 
 	*ret = 1;
-	pthread_exit(ret);
 
 cleanup:
+	if(tag) destroy_pdp_tag(tag);
+	if(reader) pdp_block_reader_close(reader);
+	if(key) destroy_pdp_key(key);
 	pthread_exit(ret);
 	
 }
 
 #endif 
 
+/* pdp_key_fingerprint: Computes the SHA1 of the public parts of key, N and g, into fingerprint.
+*  Returns 1 on success and 0 on failure.
+*/
+int pdp_key_fingerprint(PDP_key *key, unsigned char *fingerprint){
+
+	SHA_CTX ctx;
+	unsigned char *buf = NULL;
+	size_t buf_size = 0;
+
+	if(!key || !key->rsa || !RSA_get0_n(key->rsa) || !key->g || !fingerprint) return 0;
+
+	buf_size = BN_num_bytes(RSA_get0_n(key->rsa));
+	if((size_t)BN_num_bytes(key->g) > buf_size) buf_size = BN_num_bytes(key->g);
+	if( ((buf = malloc(buf_size)) == NULL)) return 0;
+
+	SHA1_Init(&ctx);
+	SHA1_Update(&ctx, buf, BN_bn2binpad(RSA_get0_n(key->rsa), buf, buf_size));
+	SHA1_Update(&ctx, buf, BN_bn2binpad(key->g, buf, buf_size));
+	SHA1_Final(fingerprint, &ctx);
+
+	free(buf);
+
+	return 1;
+}
+
+/* write_pdp_checkpoint: Atomically replaces the checkpoint journal at ckptpath with ckpt.
+*  Returns 1 on success and 0 on failure.
+*/
+static int write_pdp_checkpoint(char *ckptpath, PDP_checkpoint *ckpt){
+
+	FILE *ckptfile = NULL;
+	char tmppath[MAXPATHLEN];
+
+	if(!ckptpath || !ckpt) return 0;
+	if( snprintf(tmppath, MAXPATHLEN, "%s%s", ckptpath, PDP_TAG_TMP_EXT) >= MAXPATHLEN ) return 0;
+
+	ckptfile = fopen(tmppath, "w");
+	if(!ckptfile) return 0;
+	if(fwrite(ckpt, sizeof(PDP_checkpoint), 1, ckptfile) != 1) goto cleanup;
+	if(fflush(ckptfile) != 0) goto cleanup;
+	if(fdatasync(fileno(ckptfile)) != 0) goto cleanup;
+	if(fclose(ckptfile) != 0){
+		ckptfile = NULL;
+		goto cleanup;
+	}
+	ckptfile = NULL;
+
+	if(rename(tmppath, ckptpath) != 0) goto cleanup;
+
+	return 1;
+
+cleanup:
+	if(ckptfile) fclose(ckptfile);
+	unlink(tmppath);
+	return 0;
+}
+
+/* pdp_tag_checkpoint: Flushes the tags written so far and, if more of them are now durable, records
+*  that in the checkpoint journal.  Returns 1 on success and 0 on failure.
+*/
+static int pdp_tag_checkpoint(PDP_tag_writer *tagwriter, char *ckptpath, PDP_checkpoint *ckpt){
+
+	off_t durable = 0;
+	uint64_t numblocks = 0;
+
+	durable = pdp_tag_writer_sync(tagwriter);
+	if(durable < 0) return 0;
+	if(durable < (off_t)PDP_TAG_HEADER_SIZE) return 1;
+
+	numblocks = (durable - PDP_TAG_HEADER_SIZE) / ckpt->header.record_size;
+	if(numblocks <= ckpt->numblocks) return 1;
+
+	ckpt->numblocks = numblocks;
+
+	return write_pdp_checkpoint(ckptpath, ckpt);
+}
+
+/* pdp_tag_matches: Recomputes the tag of a block of filepath and compares it with the one stored
+*  in tagfile.  Returns 1 if they are the same and 0 otherwise.
+*/
+static int pdp_tag_matches(PDP_key *key, FILE *file, FILE *tagfile, uint64_t index){
+
+	PDP_tag *tag = NULL, *stored = NULL;
+	unsigned char buf[PDP_BLOCKSIZE];
+	int result = 0;
+
+	memset(buf, 0, PDP_BLOCKSIZE);
+	if(fseeko(file, ((off_t)PDP_BLOCKSIZE * index), SEEK_SET) < 0) return 0;
+	fread(buf, PDP_BLOCKSIZE, 1, file);
+	if(ferror(file)) return 0;
+
+	stored = read_pdp_tag(tagfile, index);
+	if(!stored) goto cleanup;
+	tag = pdp_tag_block(key, buf, PDP_BLOCKSIZE, index);
+	if(!tag) goto cleanup;
+
+	if(BN_cmp(tag->Tim, stored->Tim) != 0) goto cleanup;
+	if(tag->index_prf_size != stored->index_prf_size) goto cleanup;
+	if(memcmp(tag->index_prf, stored->index_prf, tag->index_prf_size) != 0) goto cleanup;
+
+	result = 1;
+
+cleanup:
+	if(tag) destroy_pdp_tag(tag);
+	if(stored) destroy_pdp_tag(stored);
+	return result;
+}
+
+/* resume_pdp_checkpoint: Validates the checkpoint journal at ckptpath and the temporary tag file it
+*  describes against the checkpoint the current run would write, expected.  The prefix is only
+*  trusted if it was made with the same key, for the same unmodified data file, and a sample of its
+*  tags recompute correctly.  Returns the number of blocks that need not be tagged again, 0 if
+*  tagging must start over.
+*/
+static uint64_t resume_pdp_checkpoint(char *ckptpath, char *tmptagfilepath, char *filepath, PDP_key *key, PDP_checkpoint *expected){
+
+	PDP_checkpoint ckpt;
+	FILE *ckptfile = NULL, *file = NULL, *tagfile = NULL;
+	struct stat st;
+	uint64_t numblocks = 0;
+	uint64_t sample = 0;
+	int i = 0;
+
+	memset(&ckpt, 0, sizeof(PDP_checkpoint));
+
+	ckptfile = fopen(ckptpath, "r");
+	if(!ckptfile) return 0;
+	if(fread(&ckpt, sizeof(PDP_checkpoint), 1, ckptfile) != 1) goto cleanup;
+
+	if(memcmp(ckpt.magic, PDP_CHECKPOINT_MAGIC, PDP_CHECKPOINT_MAGIC_SIZE) != 0) goto cleanup;
+	if(ckpt.version != PDP_CHECKPOINT_VERSION) goto cleanup;
+	if(memcmp(ckpt.key_fingerprint, expected->key_fingerprint, SHA_DIGEST_LENGTH) != 0) goto cleanup;
+	if(ckpt.file_size != expected->file_size || ckpt.file_mtime != expected->file_mtime) goto cleanup;
+	if(memcmp(&(ckpt.header), &(expected->header), PDP_TAG_HEADER_SIZE) != 0) goto cleanup;
+	if(ckpt.numblocks == 0) goto cleanup;
+
+	/* The temporary tag file must still hold every record the journal says is durable */
+	if(stat(tmptagfilepath, &st) < 0) goto cleanup;
+	if(st.st_size < pdp_tag_record_offset(&(ckpt.header), ckpt.numblocks)) goto cleanup;
+
+	/* Spot check the prefix, always including its last tag */
+	file = fopen(filepath, "r");
+	if(!file) goto cleanup;
+	tagfile = fopen(tmptagfilepath, "r");
+	if(!tagfile) goto cleanup;
+	for(i = 0; i < PDP_CHECKPOINT_VERIFY_BLOCKS; i++){
+		if(i == 0){
+			sample = ckpt.numblocks - 1;
+		}else{
+			if(!RAND_bytes((unsigned char *)&sample, sizeof(uint64_t))) goto cleanup;
+			sample %= ckpt.numblocks;
+		}
+		if(!pdp_tag_matches(key, file, tagfile, sample)) goto cleanup;
+	}
+
+	numblocks = ckpt.numblocks;
+
+cleanup:
+	if(ckptfile) fclose(ckptfile);
+	if(file) fclose(file);
+	if(tagfile) fclose(tagfile);
+	return numblocks;
+}
+
 /* pdp_tag_file: PDP tags the given file.  Takes in a path to a file, opens it, and performs a PDP
 *  tagging of the data.  The output is written to a a file specified by tagfilepath or to the filepath
 *  with a .tag extension.  Returns 1 on success and 0 on failure.
 */
 int pdp_tag_file(char *filepath, size_t filepath_len, char *tagfilepath, size_t tagfilepath_len,char* keypath,char* password){
 
+	return pdp_tag_file_resumable(filepath, filepath_len, tagfilepath, tagfilepath_len, keypath, password, 0);
+}
+
+/* pdp_tag_file_resumable: Like pdp_tag_file, but checkpoints its progress as it goes.  With the
+*  PDP_TAG_RESUME flag, a run that finds a valid checkpoint left by an interrupted run continues
+*  from there; otherwise tagging starts from the first block.  The tag file only appears under its
+*  final name once every tag is on disk.  Runs on the default context.  Returns 1 on success and 0 on failure.
+*/
+int pdp_tag_file_resumable(char *filepath, size_t filepath_len, char *tagfilepath, size_t tagfilepath_len,
+	char* keypath, char* password, int flags){
+
+	PDP_ctx *ctx = pdp_default_ctx();
+
+	if(!ctx) return 0;
+
+	return pdp_ctx_tag_file(ctx, filepath, filepath_len, tagfilepath, tagfilepath_len, keypath, password, flags);
+}
+
+/* catalog_tagged: Records a file just tagged with the key whose fingerprint is key_id in the
+*  context's catalog, if it has one.  A file that could not be recorded is still tagged, so this
+*  only warns.
+*/
+static void catalog_tagged(PDP_ctx *ctx, char *filepath, char *tagfilepath, unsigned char *key_id){
+
+	if(!ctx->catalog) return;
+
+	if(!pdp_catalog_add_file(ctx->catalog, NULL, filepath, tagfilepath, key_id))
+		fprintf(stderr, "WARNING: Was not able to record %s in the catalog.\n", filepath);
+}
+
+/* pdp_ctx_tag_file: pdp_tag_file_resumable on the given context.  The key comes from the context's
+*  key cache, from ctx->keypath when keypath is NULL, and the run is held to the context's budgets.
+*  Unless resuming, a file is tagged by the context's tagging daemon instead, if it has one and it
+*  holds the same key, or else by ctx->numprocs worker processes if that is above 1.  A tagged file
+*  is recorded in the context's catalog, if it has one.  Returns 1 on success and 0 on failure.
+*/
+int pdp_ctx_tag_file(PDP_ctx *ctx, char *filepath, size_t filepath_len, char *tagfilepath, size_t tagfilepath_len,
+	char *keypath, char *password, int flags){
+
 	PDP_key *key = NULL;
-	FILE *file = NULL;
-	FILE *tagfile = NULL;
-	unsigned int index = 0;
-	char yesorno = 0;
+	PDP_tag_writer *tagwriter = NULL;
+	PDP_checkpoint ckpt;
+	struct stat st;
+	uint64_t numfileblocks = 0;
+	uint64_t resume_block = 0;
 	char realtagfilepath[MAXPATHLEN];
+	char tmptagfilepath[MAXPATHLEN];
+	char ckptpath[MAXPATHLEN];
 	// char 
 #ifdef THREADING
-	pthread_t threads[NUM_THREADS];
 	int *thread_return = NULL;
-	struct thread_arguments threadargs[NUM_THREADS];
-	struct stat st;
-	size_t numfileblocks = 0;
+	pthread_t *threads = NULL;
+	struct thread_arguments *threadargs = NULL;
+	int threads_ok = 1;
+	uint64_t window = 0, window_blocks = 0;
+	int numthreads = 0, t = 0;
 
-	PDP_tag **tags = NULL;
-
-	memset(threads, 0, sizeof(pthread_t) * NUM_THREADS);
-	memset(&st, 0, sizeof(struct stat));
+	PDP_tag_batch *tags = NULL;
 #else
-	unsigned char buf[PDP_BLOCKSIZE];
+	PDP_block_reader *reader = NULL;
+	PDP_tag_batch *tags = NULL;
+	unsigned char *block = NULL;
 	PDP_tag *tag = NULL;
+	uint64_t index = 0;
+	uint64_t cpu = 0;
 #endif
 
 	memset(realtagfilepath, 0, MAXPATHLEN);
+	memset(&st, 0, sizeof(struct stat));
+	memset(&ckpt, 0, sizeof(PDP_checkpoint));
 	
-	if(!filepath) return 0;
+	if(!ctx || !filepath) return 0;
 	if(filepath_len >= MAXPATHLEN) return 0;
 	if(tagfilepath_len >= MAXPATHLEN) return 0;
 	
@@ -239,134 +607,209 @@ int pdp_tag_file(char *filepath, size_t filepath_len, char *tagfilepath, size_t
 
 	/* If no tag file path is specified, add a .tag extension to the filepath */
 	if(!tagfilepath && (filepath_len < MAXPATHLEN - 5)){
-		if( snprintf(realtagfilepath, MAXPATHLEN, "%s.tag", filepath) >= MAXPATHLEN ) goto cleanup;
+		if( snprintf(realtagfilepath, MAXPATHLEN, "%s.tag", filepath) >= MAXPATHLEN ) return 0;
 	}else{
 		strcpy(realtagfilepath,tagfilepath);
 		snprintf(tagfilepath, sizeof(tagfilepath)+sizeof(filepath), "/%s.tag", filepath);
 		strcat(realtagfilepath,tagfilepath);
 	}
-	
-	/* Check to see if the tag file exists */
-	if( access(realtagfilepath, F_OK) == 0){
-// #ifdef DEBUG_MODE
-// 		yesorno = 'y';
-// #else
-// 		fprintf(stdout, "WARNING: %s already exists; do you want to overwrite (y/N)?", realtagfilepath);
-// 		scanf("%c", &yesorno);
-// #endif
-// 		if(yesorno != 'y') goto exit;
-	}
-	
-	tagfile = fopen(realtagfilepath, "w");
-	if(!tagfile){
-		fprintf(stderr, "ERROR: Was not able to create %s.\n", realtagfilepath);
-		goto cleanup;
+	if( snprintf(tmptagfilepath, MAXPATHLEN, "%s%s", realtagfilepath, PDP_TAG_TMP_EXT) >= MAXPATHLEN ) return 0;
+	if( snprintf(ckptpath, MAXPATHLEN, "%s%s", realtagfilepath, PDP_CHECKPOINT_EXT) >= MAXPATHLEN ) return 0;
+
+	/* A tagging daemon already holds the key, its table and warm threads; tag here only without one */
+	if(ctx->taggerpath[0] && !(flags & PDP_TAG_RESUME) &&
+		pdp_tagger_tag_file(ctx->taggerpath, keypath ? keypath : ctx->keypath, filepath, realtagfilepath, ckpt.key_fingerprint)){
+		/* The daemon sends its key's fingerprint, so the catalog entry needs no key loaded here */
+		catalog_tagged(ctx, filepath, realtagfilepath, ckpt.key_fingerprint);
+		return 1;
 	}
 	
 	/* Get the PDP key */
-	key = pdp_get_keypair_temp(keypath,password);
+	key = pdp_key_cache_get(ctx->keycache, keypath ? keypath : ctx->keypath, password);
 	if(!key) goto cleanup;
 
-	/* For each block of the file, tag it and write the tag to disk */
-	
-#ifdef THREADING
 	/* Calculate the number pdp blocks in the file */
-	if(stat(filepath, &st) < 0) return 0;
+	if(stat(filepath, &st) < 0){
+		fprintf(stderr, "ERROR: Was not able to open %s for reading.\n", filepath);
+		goto cleanup;
+	}
 	numfileblocks = (st.st_size/PDP_BLOCKSIZE);
 	if(st.st_size%PDP_BLOCKSIZE) numfileblocks++;
 
-	/* Allocate buffer to hold tags until we write them out */
-	if( ((tags = malloc( (sizeof(PDP_tag *) * numfileblocks) )) == NULL)) goto cleanup;
-	memset(tags, 0, (sizeof(PDP_tag *) * numfileblocks));
-
-	for(index = 0; index < NUM_THREADS; index++){
-		/* Open a unique file descriptor for each thread to avoid race conditions */
-		threadargs[index].file = fopen(filepath, "r");
-		if(!threadargs[index].file) goto cleanup;
-		threadargs[index].key = key;
-		threadargs[index].threadid = index;
-		threadargs[index].numblocks = numfileblocks/NUM_THREADS;
-		threadargs[index].tags = tags;
-		
-		/* If there is not an equal number of blocks to tag, add the extra blocks to
-		 * the corresponding threads */
-		if(index < numfileblocks%NUM_THREADS)
-			threadargs[index].numblocks++;
-		/* If the thread has blocks to tag, spawn it */
-		if(threadargs[index].numblocks > 0)
-			if(pthread_create(&threads[index], NULL, pdp_tag_thread, (void *) &threadargs[index]) != 0) goto cleanup;
-	}
-	/* Check to see all tags were generated */
-	for(index = 0; index < NUM_THREADS; index++){
-		if(threads[index]){
-			if(pthread_join(threads[index], (void **)&thread_return) != 0) goto cleanup;
-			if(!thread_return || !(*thread_return))goto cleanup;
-			else free(thread_return);
-			/* Close the file */
-			if(threadargs[index].file)
-				fclose(threadargs[index].file);
+	/* Describe this run the way its checkpoints will */
+	memcpy(ckpt.magic, PDP_CHECKPOINT_MAGIC, PDP_CHECKPOINT_MAGIC_SIZE);
+	ckpt.version = PDP_CHECKPOINT_VERSION;
+	if(!pdp_key_fingerprint(key, ckpt.key_fingerprint)) goto cleanup;
+	ckpt.file_size = st.st_size;
+	ckpt.file_mtime = st.st_mtime;
+	if(!pdp_tag_header_init(&(ckpt.header), key)) goto cleanup;
+
+	/* Tag in worker processes that write their records straight into the tag file.  A run this way
+	 * is not checkpointed, so it starts over if interrupted. */
+	if(ctx->numprocs > 1 && !(flags & PDP_TAG_RESUME)){
+		unlink(ckptpath);
+		if(!pdp_tag_file_forked(ctx, key, filepath, numfileblocks, &(ckpt.header), tmptagfilepath)) goto cleanup;
+		pdp_key_cache_put(ctx->keycache, key);
+		key = NULL;
+		if(rename(tmptagfilepath, realtagfilepath) != 0){
+			fprintf(stderr, "ERROR: Was not able to create %s.\n", realtagfilepath);
+			goto cleanup;
 		}
+		catalog_tagged(ctx, filepath, realtagfilepath, ckpt.key_fingerprint);
+		return 1;
+	}
+
+	if(flags & PDP_TAG_RESUME){
+		resume_block = resume_pdp_checkpoint(ckptpath, tmptagfilepath, filepath, key, &ckpt);
+		if(resume_block > numfileblocks) resume_block = 0;
 	}
+
+	if(resume_block > 0){
+		fprintf(stdout, "Resuming %s at block %llu.\n", filepath, (unsigned long long)resume_block);
+		ckpt.numblocks = resume_block;
+		tagwriter = pdp_tag_writer_resume(tmptagfilepath, pdp_tag_record_offset(&(ckpt.header), resume_block), ctx->io_flags);
+	}else{
+		/* A stale checkpoint must never describe the new temporary file */
+		unlink(ckptpath);
+		tagwriter = pdp_tag_writer_open(tmptagfilepath, ctx->io_flags);
+		/* Start the tag file with the header describing its fixed-width records */
+		if(tagwriter && !pdp_tag_writer_append(tagwriter, (unsigned char *)&(ckpt.header), PDP_TAG_HEADER_SIZE)) goto cleanup;
+	}
+	if(!tagwriter){
+		fprintf(stderr, "ERROR: Was not able to create %s.\n", tmptagfilepath);
+		goto cleanup;
+	}
+	pdp_tag_writer_set_sync(tagwriter, ctx->sync_bytes);
+
+	/* For each block of the file, tag it and write the tag to disk */
 	
-	/* Write the tags out */
-	for(index = 0; index < numfileblocks; index++){
-		if(!tags[index]) goto cleanup;
-		if(!write_pdp_tag(tagfile, tags[index])) goto cleanup;
-		destroy_pdp_tag(tags[index]);
-		tags[index] = NULL;
+#ifdef THREADING
+	/* Tag the file in windows of PDP_CHECKPOINT_BLOCKS blocks, writing out and checkpointing the
+	 * tags of each window before starting the next.  The tags of a window are held in one flat
+	 * batch and written out as one run of records. */
+	if( ((tags = pdp_tag_batch_new(&(ckpt.header), PDP_CHECKPOINT_BLOCKS)) == NULL)) goto cleanup;
+	numthreads = (ctx->numthreads > 0) ? ctx->numthreads : 1;
+	if( ((threads = malloc(sizeof(pthread_t) * numthreads)) == NULL)) goto cleanup;
+	if( ((threadargs = malloc(sizeof(struct thread_arguments) * numthreads)) == NULL)) goto cleanup;
+
+	for(window = resume_block; window < numfileblocks; window += window_blocks){
+		window_blocks = numfileblocks - window;
+		if(window_blocks > PDP_CHECKPOINT_BLOCKS) window_blocks = PDP_CHECKPOINT_BLOCKS;
+
+		memset(threadargs, 0, sizeof(struct thread_arguments) * numthreads);
+		for(t = 0; t < numthreads; t++){
+			threadargs[t].filepath = filepath;
+			threadargs[t].key = key;
+			threadargs[t].tags = tags;
+			threadargs[t].tags_base = window;
+			threadargs[t].node = pdp_numa_worker_node(t, numthreads);
+			threadargs[t].io_flags = ctx->io_flags;
+			threadargs[t].budget = ctx->budget;
+			
+			/* Split the window into numthreads contiguous ranges.  If there is not an equal number of
+			 * blocks to tag, the first threads take one extra block each */
+			threadargs[t].numblocks = window_blocks/numthreads;
+			threadargs[t].first_block = window + (t * threadargs[t].numblocks) +
+				((t < window_blocks%numthreads) ? t : window_blocks%numthreads);
+			if(t < window_blocks%numthreads)
+				threadargs[t].numblocks++;
+
+			/* If the thread has blocks to tag, spawn it */
+			if(threadargs[t].numblocks > 0){
+				if(pthread_create(&threads[t], NULL, pdp_tag_thread, (void *) &threadargs[t]) != 0){
+					threads_ok = 0;
+					break;
+				}
+				threadargs[t].started = 1;
+			}
+		}
+		/* Check to see all tags were generated */
+		for(t = 0; t < numthreads; t++){
+			if(!threadargs[t].started) continue;
+			if(pthread_join(threads[t], (void **)&thread_return) != 0 || !thread_return || !(*thread_return))
+				threads_ok = 0;
+			if(thread_return) free(thread_return);
+			thread_return = NULL;
+		}
+		if(!threads_ok) goto cleanup;
+		
+		/* Write the tags out */
+		tags->count = window_blocks;
+		if(!pdp_tag_writer_append_batch(tagwriter, &(ckpt.header), tags, 0, window_blocks)) goto cleanup;
+		if(!pdp_tag_checkpoint(tagwriter, ckptpath, &ckpt)) goto cleanup;
 	}
-	sfree(tags, (sizeof(PDP_tag *) * numfileblocks));
+	pdp_tag_batch_free(tags);
+	tags = NULL;
+	free(threads);
+	threads = NULL;
+	free(threadargs);
+	threadargs = NULL;
 #else
-	file = fopen(filepath, "r");
-	if(!file){
+	reader = pdp_block_reader_open(filepath, resume_block, numfileblocks - resume_block, ctx->io_flags, ctx->budget);
+	if(!reader){
 		fprintf(stderr, "ERROR: Was not able to open %s for reading.\n", filepath);
 		goto cleanup;
 	}
 
-	do{
-		memset(buf, 0, PDP_BLOCKSIZE);
-		fread(buf, PDP_BLOCKSIZE, 1, file);
-		if(ferror(file)) goto cleanup;
-		tag = pdp_tag_block(key, buf, PDP_BLOCKSIZE, index);
+	/* Collect PDP_TAG_WRITER_BATCH tags at a time and hand them to the writer together */
+	if( ((tags = pdp_tag_batch_new(&(ckpt.header), PDP_TAG_WRITER_BATCH)) == NULL)) goto cleanup;
+	while((block = pdp_block_reader_next(reader, &index)) != NULL){
+		cpu = pdp_budget_thread_cpu();
+		tag = pdp_tag_block(key, block, PDP_BLOCKSIZE, index);
 		if(!tag) goto cleanup;
-		if(!write_pdp_tag(tagfile, tag)) goto cleanup;
-		index++;
+		if(!pdp_tag_batch_set(tags, tags->count, tag)) goto cleanup;
+		tags->count++;
+		pdp_budget_charge_cpu(ctx->budget, cpu);
 		destroy_pdp_tag(tag);
 		tag = NULL;
-	}while(!feof(file));	
+		if(tags->count == tags->capacity || ((index + 1) % PDP_CHECKPOINT_BLOCKS) == 0){
+			if(!pdp_tag_writer_append_batch(tagwriter, &(ckpt.header), tags, 0, tags->count)) goto cleanup;
+			tags->count = 0;
+		}
+		if(((index + 1) % PDP_CHECKPOINT_BLOCKS) == 0)
+			if(!pdp_tag_checkpoint(tagwriter, ckptpath, &ckpt)) goto cleanup;
+	}
+	if(pdp_block_reader_error(reader)) goto cleanup;
+	if(tags->count > 0 && !pdp_tag_writer_append_batch(tagwriter, &(ckpt.header), tags, 0, tags->count)) goto cleanup;
+	pdp_tag_batch_free(tags);
+	tags = NULL;
+	pdp_block_reader_close(reader);
+	reader = NULL;
 #endif
 
-exit:
-	destroy_pdp_key(key);
-	if(file) fclose(file);
-	if(tagfile) fclose(tagfile);
+	pdp_key_cache_put(ctx->keycache, key);
+	key = NULL;
+	if(!pdp_tag_writer_close(tagwriter)){
+		tagwriter = NULL;
+		goto cleanup;
+	}
+	tagwriter = NULL;
+
+	/* Every tag is on disk; move the tag file into place and retire the journal */
+	if(rename(tmptagfilepath, realtagfilepath) != 0){
+		fprintf(stderr, "ERROR: Was not able to create %s.\n", realtagfilepath);
+		goto cleanup;
+	}
+	unlink(ckptpath);
+	catalog_tagged(ctx, filepath, realtagfilepath, ckpt.key_fingerprint);
 	
 	return 1;
 
 cleanup:
 	fprintf(stderr, "ERROR: Was unable to create tag file.\n");
 #ifdef THREADING
-	for(index = 0; index < NUM_THREADS; index++){
-		if(threads[index] != NULL) pthread_cancel(threads[index]);
-		if(threadargs[index].file) fclose(threadargs[index].file);
-	}
-
-	for(index = 0; index < numfileblocks; index++){
-		if(tags[index]){
-			destroy_pdp_tag(tags[index]);
-			tags[index] = NULL;
-		}
-	}
-	if(tags) sfree(tags, (sizeof(PDP_tag *) * numfileblocks));
+	if(threads) free(threads);
+	if(threadargs) free(threadargs);
+#else
+	if(tag) destroy_pdp_tag(tag);
+	if(reader) pdp_block_reader_close(reader);
 #endif
+	if(tags) pdp_tag_batch_free(tags);
 
-	destroy_pdp_key(key);
-	if(file) fclose(file);
-	if(tagfile){ 
-		ftruncate(fileno(tagfile), 0);
-		unlink(realtagfilepath);
-		fclose(tagfile);
-	}
+	if(key) pdp_key_cache_put(ctx->keycache, key);
+	if(tagwriter) pdp_tag_writer_close(tagwriter);
+	/* Keep a checkpointed prefix around for a resumed run */
+	if(ckpt.numblocks == 0) unlink(tmptagfilepath);
 	return 0;
 }
 
@@ -374,7 +817,7 @@ cleanup:
  * the file to be challenged.  Returns an allocated challenge structure or NULL on error.
  * 
 */
-PDP_challenge *pdp_challenge_file(unsigned int numfileblocks){
+PDP_challenge *pdp_challenge_file(uint64_t numfileblocks){
 
 	PDP_key *key = NULL;
 	PDP_challenge *challenge = NULL;
@@ -400,29 +843,70 @@ cleanup:
 	return NULL;
 }
 
+/* pdp_ctx_challenge_file: pdp_challenge_file with the key in keypath (the context's keypath if NULL),
+*  opened with password and taken from the context's key cache.  Returns an allocated challenge or
+*  NULL on error.
+*/
+PDP_challenge *pdp_ctx_challenge_file(PDP_ctx *ctx, uint64_t numfileblocks, char *keypath, char *password){
+
+	PDP_key *key = NULL;
+	PDP_challenge *challenge = NULL;
+
+	if(!ctx || !numfileblocks) return NULL;
+
+	key = pdp_key_cache_get(ctx->keycache, keypath ? keypath : ctx->keypath, password);
+	if(!key) return NULL;
+
+	challenge = pdp_challenge(key, numfileblocks);
+	pdp_key_cache_put(ctx->keycache, key);
+
+	return challenge;
+}
+
 /* pdp_prove_file: Computes the server-side proof.
  * Takes in the file to be proven, its corresponding tag file, and a "sanitized" challenge and key structure.
- * Returns an allocated proof structure or NULL on error.
+ * Runs on the default context.  Returns an allocated proof structure or NULL on error.
 */
 PDP_proof *pdp_prove_file(char *filepath, size_t filepath_len, char *tagfilepath, size_t tagfilepath_len, PDP_challenge *challenge, PDP_key *key){
 
+	PDP_ctx *ctx = pdp_default_ctx();
+
+	if(!ctx) return NULL;
+
+	return pdp_ctx_prove_file(ctx, filepath, filepath_len, tagfilepath, tagfilepath_len, challenge, key);
+}
+
+/* pdp_ctx_prove_file: pdp_prove_file on the given context.  The data and tag files are opened
+*  through the context's descriptor cache and read with pread, so any number of proofs over the
+*  same files can run at once.  Tags come from the context's tag cache if it has a budget, and are
+*  otherwise read into a flat batch in one pass.
+*  Proofs are charged to the context's budgets like tagging is.
+*  Returns an allocated proof structure or NULL on error.
+*/
+PDP_proof *pdp_ctx_prove_file(PDP_ctx *ctx, char *filepath, size_t filepath_len, char *tagfilepath, size_t tagfilepath_len,
+	PDP_challenge *challenge, PDP_key *key){
+
 	PDP_proof *proof = NULL;
 	PDP_tag *tag = NULL;
-	unsigned int *indices = NULL;
-	FILE *file = NULL;
-	FILE *tagfile = NULL;
+	PDP_tag_batch *tags = NULL;
+	PDP_tag slot;
+	uint64_t *indices = NULL;
+	int fd = -1;
+	int tagfd = -1;
 	char realtagfilepath[MAXPATHLEN];
 	unsigned char buf[PDP_BLOCKSIZE];
+	uint64_t cpu_start = 0;
 	int j = 0;
 
 	memset(realtagfilepath, 0, MAXPATHLEN);
+	memset(&slot, 0, sizeof(PDP_tag));
 	
-	if(!filepath || !challenge || !key) return NULL;
+	if(!ctx || !filepath || !challenge || !key) return NULL;
 	if(filepath_len >= MAXPATHLEN) return NULL;
 	if(tagfilepath_len >= MAXPATHLEN) return NULL;
 	
-	file = fopen(filepath, "r");
-	if(!file){
+	fd = pdp_fd_cache_open(ctx->fdcache, filepath);
+	if(fd < 0){
 		fprintf(stderr, "ERROR: Was unable to open %s\n", filepath);
 		return NULL;
 	}
@@ -434,49 +918,60 @@ PDP_proof *pdp_prove_file(char *filepath, size_t filepath_len, char *tagfilepath
 		memcpy(realtagfilepath, tagfilepath, tagfilepath_len);
 	}
 	
-	tagfile = fopen(realtagfilepath, "r");
-	if(!tagfile) goto cleanup;
+	tagfd = pdp_fd_cache_open(ctx->fdcache, realtagfilepath);
+	if(tagfd < 0) goto cleanup;
 	
 	/* Compute the indices i_j = pi_k1(j); the block indices to sample */
 	indices = generate_prp_pi(challenge);
 	if(!indices) goto cleanup;
+
+	/* Without a tag cache, read every sampled tag into one flat batch up front and accumulate
+	 * from it through a single reused tag.  Legacy tag files are read tag by tag. */
+	if(!pdp_tag_cache_enabled(ctx->tagcache) && ((tags = pdp_read_tag_batch_fd(tagfd, indices, challenge->c)) != NULL))
+		if( ((slot.Tim = BN_new()) == NULL)) goto cleanup;
 	
 	for(j = 0; j < challenge->c; j++){
-		memset(buf, 0, PDP_BLOCKSIZE);
 
-		/* Seek to data block at indices[j] */
-		if(fseek(file, (PDP_BLOCKSIZE * (indices[j])), SEEK_SET) < 0) goto cleanup;
-
-		/* Read data block */
-		fread(buf, PDP_BLOCKSIZE, 1, file);
-		if(ferror(file)) goto cleanup;
+		/* Read data block at indices[j] */
+		pdp_budget_charge_io(ctx->budget, PDP_BLOCKSIZE);
+		if(!pdp_read_block_fd(fd, indices[j], buf)) goto cleanup;
 		
-		/* Read tag for data block at indices[j] */
-		tag = read_pdp_tag(tagfile, indices[j]);
-		if(!tag) goto cleanup;
+		/* Read tag for data block at indices[j], or take it from the context's tag cache */
+		if(tags){
+			if(!pdp_tag_batch_get(tags, j, &slot)) goto cleanup;
+		}else{
+			tag = pdp_tag_cache_get(ctx->tagcache, tagfd, indices[j]);
+			if(!tag) goto cleanup;
+		}
 		
-		proof = pdp_generate_proof_update(key, challenge, tag, proof, buf, PDP_BLOCKSIZE, j);
+		cpu_start = pdp_budget_thread_cpu();
+		proof = pdp_generate_proof_update(key, challenge, tags ? &slot : tag, proof, buf, PDP_BLOCKSIZE, j);
 		if(!proof) goto cleanup;
+		pdp_budget_charge_cpu(ctx->budget, cpu_start);
 		
-		destroy_pdp_tag(tag);
+		if(tag) pdp_tag_cache_put(ctx->tagcache, tag);
 		tag = NULL;
 	}
 
 	proof = pdp_generate_proof_final(key, challenge, proof);
 	if(!proof) goto cleanup;
 	
-	if(indices) sfree(indices, (challenge->c * sizeof(unsigned int)));
-	if(file) fclose(file);
-	if(tagfile) fclose(tagfile);
+	if(indices) sfree(indices, (challenge->c * sizeof(uint64_t)));
+	if(tags) pdp_tag_batch_free(tags);
+	if(slot.Tim) BN_clear_free(slot.Tim);
+	pdp_fd_cache_close(ctx->fdcache, fd);
+	pdp_fd_cache_close(ctx->fdcache, tagfd);
 	
 	return proof;
 
 cleanup:
-	if(indices) sfree(indices, (challenge->c * sizeof(unsigned int)));
+	if(indices) sfree(indices, (challenge->c * sizeof(uint64_t)));
 	if(proof) destroy_pdp_proof(proof);
-	if(tag) destroy_pdp_tag(tag);
-	if(file) fclose(file);
-	if(tagfile) fclose(tagfile);
+	if(tag) pdp_tag_cache_put(ctx->tagcache, tag);
+	if(tags) pdp_tag_batch_free(tags);
+	if(slot.Tim) BN_clear_free(slot.Tim);
+	if(fd >= 0) pdp_fd_cache_close(ctx->fdcache, fd);
+	if(tagfd >= 0) pdp_fd_cache_close(ctx->fdcache, tagfd);
 	return NULL;
 }
 
@@ -498,6 +993,26 @@ int pdp_verify_file(PDP_challenge *challenge, PDP_proof *proof){
 	return result;
 }
 
+/* pdp_ctx_verify_file: pdp_verify_file with the key in keypath (the context's keypath if NULL),
+*  opened with password and taken from the context's key cache.  Returns 1 if the proof verifies and
+*  0 otherwise.
+*/
+int pdp_ctx_verify_file(PDP_ctx *ctx, PDP_challenge *challenge, PDP_proof *proof, char *keypath, char *password){
+
+	PDP_key *key = NULL;
+	int result = 0;
+
+	if(!ctx || !challenge || !proof) return 0;
+
+	key = pdp_key_cache_get(ctx->keycache, keypath ? keypath : ctx->keypath, password);
+	if(!key) return 0;
+
+	result = pdp_verify_proof(key, challenge, proof);
+	pdp_key_cache_put(ctx->keycache, key);
+
+	return result;
+}
+
 /* pdp_challenge_and_verify_file: Creates an challenge and PDP verifies the contents of a file.  Takes in the path
 *  to a file and its corresponding tag file.  If the path to the tag file is NULL, .tag is added to the
 *  file path and attempted to be open.  Returns 1 on verification and 0 on failure.
@@ -511,10 +1026,10 @@ int pdp_challenge_and_verify_file(char *filepath, size_t filepath_len, char *tag
 	FILE *file = NULL;
 	FILE *tagfile = NULL;
 	struct stat st;
-	unsigned int numfileblocks = 0;
+	uint64_t numfileblocks = 0;
 	int j = 0;
 	int result = 0;		
-	unsigned int *indices = NULL;
+	uint64_t *indices = NULL;
 	char realtagfilepath[MAXPATHLEN];
 	unsigned char buf[PDP_BLOCKSIZE];
 
@@ -525,10 +1040,7 @@ int pdp_challenge_and_verify_file(char *filepath, size_t filepath_len, char *tag
 	if(tagfilepath_len >= MAXPATHLEN) return 0;
 	
 	file = fopen(filepath, "r");
-	fseek(file,0,SEEK_END);
-	int size = ftell(file);
-	fseek(file,0,SEEK_SET);
-	if(!file||size==0){
+	if(!file){
 		fprintf(stderr, "ERROR: Was unable to open %s\n", filepath);
 		return 0;
 	}
@@ -546,7 +1058,11 @@ int pdp_challenge_and_verify_file(char *filepath, size_t filepath_len, char *tag
 		goto cleanup;
 	}
 	
-	if(stat(filepath, &st) < 0) goto cleanup;
+	if(fstat(fileno(file), &st) < 0) goto cleanup;
+	if(st.st_size == 0){
+		fprintf(stderr, "ERROR: %s is empty\n", filepath);
+		goto cleanup;
+	}
 	
 	/* Calculate the number pdp blocks in the file */
 	numfileblocks = (st.st_size/PDP_BLOCKSIZE);
@@ -569,7 +1085,7 @@ int pdp_challenge_and_verify_file(char *filepath, size_t filepath_len, char *tag
 		memset(buf, 0, PDP_BLOCKSIZE);
 
 		/* Seek to data block at indices[j] */
-		if(fseek(file, (PDP_BLOCKSIZE * (indices[j])), SEEK_SET) < 0) goto cleanup;
+		if(fseeko(file, ((off_t)PDP_BLOCKSIZE * indices[j]), SEEK_SET) < 0) goto cleanup;
 
 		/* Read data block */
 		fread(buf, PDP_BLOCKSIZE, 1, file);
@@ -590,7 +1106,7 @@ int pdp_challenge_and_verify_file(char *filepath, size_t filepath_len, char *tag
 
 	result = pdp_verify_proof(key, challenge, proof);
 
-	if(indices) sfree(indices, (challenge->c * sizeof(unsigned int)));
+	if(indices) sfree(indices, (challenge->c * sizeof(uint64_t)));
 	if(challenge) destroy_pdp_challenge(challenge);
 	if(proof) destroy_pdp_proof(proof);
 	if(key) destroy_pdp_key(key);
@@ -601,7 +1117,7 @@ int pdp_challenge_and_verify_file(char *filepath, size_t filepath_len, char *tag
 	
 cleanup:
 	fprintf(stderr, "ERROR: There was an error verifying.\n");
-	if(indices) sfree(indices, (challenge->c * sizeof(unsigned int)));
+	if(indices) sfree(indices, (challenge->c * sizeof(uint64_t)));
 	if(challenge) destroy_pdp_challenge(challenge);
 	if(proof) destroy_pdp_proof(proof);
 	if(key) destroy_pdp_key(key);
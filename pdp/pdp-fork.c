@@ -0,0 +1,371 @@
+/* 
+* pdp-fork.c
+*
+* Copyright (c) 2008, Zachary N J Peterson <zachary@jhu.edu>
+* All rights reserved.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*     * Redistributions of source code must retain the above copyright
+*       notice, this list of conditions and the following disclaimer.
+*     * Redistributions in binary form must reproduce the above copyright
+*       notice, this list of conditions and the following disclaimer in the
+*       documentation and/or other materials provided with the distribution.
+*     * The name of the Zachary N J Peterson may be used to endorse or promote products
+*       derived from this software without specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY ZACHARY N J PETERSON ``AS IS'' AND ANY
+* EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL ZACHARY N J PETERSON BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+
+
+/* pdp-fork.c contains multi-process tagging.  Tagging through cgo runs on the calling service's own
+*  threads, so a fault while tagging takes the whole service down.  Here the parent sizes and maps
+*  the tag file, writes its header and forks worker processes that inherit the loaded key and its
+*  table.  Each worker reads its own contiguous range of blocks and writes every tag record straight
+*  into its slot in the shared mapping, so no tag passes through the parent.  Workers report progress
+*  on a bounded lock-free ring in shared memory; the parent only drains the ring and reaps its
+*  children, restarting a worker that dies from the last progress it reported.  Workers call only
+*  the library after fork, which relies on the C library and OpenSSL resetting their locks in the
+*  child, as glibc and OpenSSL 3 do.
+*/
+
+#include "pdp.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+/* While a worker writes report pos, its slot's seq holds PDP_FORK_CLAIMED with the low bits of pos,
+*  the worker and the attempt (its retries when forked) of the process writing it, so the parent can
+*  tell when the writer has died and been reaped.  PDP_FORK_MAX_PROCS and PDP_FORK_RETRIES must fit
+*  their 8 bits. */
+#define PDP_FORK_CLAIMED (1ULL << 63)
+#define PDP_FORK_POS_MASK ((1ULL << 47) - 1)
+#define PDP_FORK_CLAIM(pos, worker, attempt) (PDP_FORK_CLAIMED | ((uint64_t)((worker) & 0xff) << 55) | \
+	((uint64_t)((attempt) & 0xff) << 47) | ((pos) & PDP_FORK_POS_MASK))
+#define PDP_FORK_CLAIM_WORKER(seq) (((seq) >> 55) & 0xff)
+#define PDP_FORK_CLAIM_ATTEMPT(seq) (((seq) >> 47) & 0xff)
+
+typedef struct PDP_fork_slot_struct PDP_fork_slot;
+
+struct PDP_fork_slot_struct{
+
+	_Atomic uint64_t seq;		/* pos while free for report pos, then its PDP_FORK_CLAIM while being written,
+								 * pos + 1 once written and pos + PDP_FORK_RING_SIZE once read */
+	uint32_t worker;
+	uint32_t attempt;			/* The worker's retries when the reporting process was forked */
+	uint32_t numblocks;			/* Blocks the worker finished since its previous report */
+};
+
+typedef struct PDP_fork_ring_struct PDP_fork_ring;
+
+struct PDP_fork_ring_struct{
+
+	_Atomic uint64_t tail;		/* The next report a worker will claim; moves past a slot once it is claimed */
+	uint64_t head;				/* The next report the parent will read; only the parent uses it */
+	PDP_fork_slot slots[PDP_FORK_RING_SIZE];
+};
+
+typedef struct PDP_fork_worker_struct PDP_fork_worker;
+
+struct PDP_fork_worker_struct{
+
+	pid_t pid;					/* 0 once the worker has finished its range */
+	uint64_t first_block;		/* The range still to tag by this worker's current process */
+	uint64_t numblocks;
+	uint64_t done;				/* Blocks of the range reported done */
+	int retries;
+	PDP_budget *budget;			/* This worker's share of the context's budgets */
+};
+
+/* sleep_us: Sleeps for about us microseconds */
+static void sleep_us(long us){
+
+	struct timespec ts;
+
+	ts.tv_sec = us / 1000000;
+	ts.tv_nsec = (us % 1000000) * 1000;
+	while(nanosleep(&ts, &ts) != 0 && errno == EINTR);
+}
+
+/* ring_push: Reports that worker, on the given attempt, finished numblocks more blocks.  Multiple
+*  workers may push at once; a worker only waits if the parent has fallen a whole ring behind.  The
+*  slot is claimed before the tail moves past it, so a report position is never held by a worker
+*  without its slot saying which one.
+*/
+static void ring_push(PDP_fork_ring *ring, uint32_t worker, uint32_t attempt, uint32_t numblocks){
+
+	PDP_fork_slot *slot = NULL;
+	uint64_t pos = 0, seq = 0;
+
+	for(;;){
+		pos = atomic_load_explicit(&(ring->tail), memory_order_acquire);
+		slot = &(ring->slots[pos % PDP_FORK_RING_SIZE]);
+		seq = atomic_load_explicit(&(slot->seq), memory_order_acquire);
+		if(seq == pos){
+			if(!atomic_compare_exchange_strong_explicit(&(slot->seq), &seq, PDP_FORK_CLAIM(pos, worker, attempt),
+				memory_order_acq_rel, memory_order_relaxed)) continue;
+			atomic_compare_exchange_strong_explicit(&(ring->tail), &pos, pos + 1, memory_order_release, memory_order_relaxed);
+			break;
+		}
+		/* Move the tail past a slot another worker claimed for pos, in case it died before doing so;
+		 * a claim from the ring's previous lap is waited out like any unread report */
+		if(seq & PDP_FORK_CLAIMED){
+			if((seq & PDP_FORK_POS_MASK) == (pos & PDP_FORK_POS_MASK))
+				atomic_compare_exchange_strong_explicit(&(ring->tail), &pos, pos + 1, memory_order_release, memory_order_relaxed);
+			else
+				sleep_us(PDP_FORK_POLL_US);
+			continue;
+		}
+		/* The slot still holds a report the parent has not read */
+		if((int64_t)(seq - pos) < 0) sleep_us(PDP_FORK_POLL_US);
+	}
+
+	slot->worker = worker;
+	slot->attempt = attempt;
+	slot->numblocks = numblocks;
+	atomic_store_explicit(&(slot->seq), pos + 1, memory_order_release);
+}
+
+/* ring_pop: Reads the next report, if there is one.  Only the parent may pop.  Returns 1 if a report
+*  was read and 0 if the ring is empty.
+*/
+static int ring_pop(PDP_fork_ring *ring, uint32_t *worker, uint32_t *attempt, uint32_t *numblocks){
+
+	PDP_fork_slot *slot = &(ring->slots[ring->head % PDP_FORK_RING_SIZE]);
+
+	if(atomic_load_explicit(&(slot->seq), memory_order_acquire) != ring->head + 1) return 0;
+
+	*worker = slot->worker;
+	*attempt = slot->attempt;
+	*numblocks = slot->numblocks;
+	atomic_store_explicit(&(slot->seq), ring->head + PDP_FORK_RING_SIZE, memory_order_release);
+	ring->head++;
+
+	return 1;
+}
+
+/* ring_skip: Gives up on the report at the head of the ring if it was claimed by a worker process
+*  that was reaped before writing it.  Only the parent may skip.  Returns 1 if it was skipped and 0
+*  if the head is not such a report.
+*/
+static int ring_skip(PDP_fork_ring *ring, PDP_fork_worker *workers, uint32_t numworkers){
+
+	PDP_fork_slot *slot = &(ring->slots[ring->head % PDP_FORK_RING_SIZE]);
+	uint64_t seq = atomic_load_explicit(&(slot->seq), memory_order_acquire);
+	uint64_t pos = ring->head;
+	uint32_t worker = 0;
+
+	if(!(seq & PDP_FORK_CLAIMED)) return 0;
+	worker = PDP_FORK_CLAIM_WORKER(seq);
+	if(worker < numworkers && workers[worker].pid > 0 && (uint64_t)workers[worker].retries == PDP_FORK_CLAIM_ATTEMPT(seq)) return 0;
+
+	/* The claimer may have died before moving the tail on */
+	atomic_compare_exchange_strong_explicit(&(ring->tail), &pos, pos + 1, memory_order_release, memory_order_relaxed);
+	atomic_store_explicit(&(slot->seq), ring->head + PDP_FORK_RING_SIZE, memory_order_release);
+	ring->head++;
+
+	return 1;
+}
+
+/* fork_worker_run: The body of a worker process.  Tags its range of filepath into the mapped tag
+*  file, reporting progress every PDP_FORK_CHUNK_BLOCKS blocks, and exits with status 0 once every
+*  block is done or 1 on failure.  Never returns.
+*/
+static void fork_worker_run(PDP_ctx *ctx, PDP_key *key, char *filepath, PDP_tag_header *header,
+	unsigned char *map, PDP_fork_ring *ring, PDP_fork_worker *worker, uint32_t w){
+
+	PDP_block_reader *reader = NULL;
+	PDP_tag *tag = NULL;
+	unsigned char *block = NULL;
+	uint64_t index = 0, cpu = 0;
+	uint32_t pending = 0;
+	int ok = 0;
+
+	reader = pdp_block_reader_open(filepath, worker->first_block, worker->numblocks, ctx->io_flags, worker->budget);
+	if(!reader) _exit(1);
+
+	while((block = pdp_block_reader_next(reader, &index)) != NULL){
+		cpu = pdp_budget_thread_cpu();
+		tag = pdp_tag_block(key, block, PDP_BLOCKSIZE, index);
+		if(!tag) goto done;
+		if(!pdp_tag_record_encode(header, tag, map + pdp_tag_record_offset(header, index))) goto done;
+		destroy_pdp_tag(tag);
+		tag = NULL;
+		pdp_budget_charge_cpu(worker->budget, cpu);
+
+		if(++pending == PDP_FORK_CHUNK_BLOCKS){
+			ring_push(ring, w, worker->retries, pending);
+			pending = 0;
+		}
+	}
+	if(pdp_block_reader_error(reader)) goto done;
+	if(pending) ring_push(ring, w, worker->retries, pending);
+	ok = 1;
+
+done:
+	/* Exit without running the parent's exit handlers or flushing its stdio buffers */
+	_exit(ok ? 0 : 1);
+}
+
+/* fork_worker_report: Counts a report of numblocks blocks done by worker's given attempt.  A report
+*  left on the ring by an attempt that was since restarted is dropped: the restart began from the
+*  blocks counted when its process was reaped, so the new attempt tags those blocks again.
+*/
+static void fork_worker_report(PDP_fork_worker *workers, uint32_t numworkers, uint32_t worker, uint32_t attempt,
+	uint32_t numblocks){
+
+	if(worker >= numworkers || attempt != (uint32_t)workers[worker].retries) return;
+
+	workers[worker].done += numblocks;
+}
+
+/* fork_worker_start: Forks a process for a worker's remaining range.  Returns 1 on success and 0 on failure */
+static int fork_worker_start(PDP_ctx *ctx, PDP_key *key, char *filepath, PDP_tag_header *header,
+	unsigned char *map, PDP_fork_ring *ring, PDP_fork_worker *workers, uint32_t w){
+
+	pid_t pid = fork();
+
+	if(pid < 0) return 0;
+	if(pid == 0) fork_worker_run(ctx, key, filepath, header, map, ring, &(workers[w]), w);
+	workers[w].pid = pid;
+
+	return 1;
+}
+
+/* pdp_tag_file_forked: Tags the numfileblocks blocks of filepath with key into tagfilepath on
+*  ctx->numprocs worker processes.  The tag file is created with header and a record slot for every
+*  block, and is on disk when this returns.  The caller renames it into place.  Returns 1 on success
+*  and 0 on failure, after every worker has been reaped.
+*/
+int pdp_tag_file_forked(PDP_ctx *ctx, PDP_key *key, char *filepath, uint64_t numfileblocks,
+	PDP_tag_header *header, char *tagfilepath){
+
+	PDP_fork_worker *workers = NULL;
+	PDP_fork_ring *ring = NULL;
+	unsigned char *map = NULL;
+	size_t maplen = 0;
+	uint64_t per_worker = 0;
+	uint32_t w = 0, reported = 0, attempt = 0, numblocks = 0;
+	int numprocs = 0, live = 0, status = 0, progress = 0, result = 0;
+	int fd = -1;
+	pid_t pid = 0;
+
+	if(!ctx || !key || !filepath || !header || !tagfilepath) return 0;
+
+	numprocs = ctx->numprocs;
+	if(numprocs > PDP_FORK_MAX_PROCS) numprocs = PDP_FORK_MAX_PROCS;
+	if((uint64_t)numprocs > numfileblocks) numprocs = numfileblocks;
+	if(numprocs < 1) numprocs = 1;
+
+	/* Size the tag file for every record and map it shared with the workers */
+	maplen = pdp_tag_record_offset(header, numfileblocks);
+	if( ((fd = open(tagfilepath, O_RDWR | O_CREAT | O_TRUNC, 0600)) < 0)) goto cleanup;
+	if(ftruncate(fd, maplen) != 0) goto cleanup;
+	map = mmap(NULL, maplen, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if(map == MAP_FAILED){
+		map = NULL;
+		goto cleanup;
+	}
+	memcpy(map, header, PDP_TAG_HEADER_SIZE);
+
+	ring = mmap(NULL, sizeof(PDP_fork_ring), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if(ring == MAP_FAILED){
+		ring = NULL;
+		goto cleanup;
+	}
+	atomic_init(&(ring->tail), 0);
+	ring->head = 0;
+	for(w = 0; w < PDP_FORK_RING_SIZE; w++) atomic_init(&(ring->slots[w].seq), w);
+
+	/* Split the file into numprocs contiguous ranges, the first ones a block longer if it does not divide */
+	if( ((workers = calloc(numprocs, sizeof(PDP_fork_worker))) == NULL)) goto cleanup;
+	per_worker = numfileblocks / numprocs;
+	for(w = 0; w < numprocs; w++){
+		workers[w].numblocks = per_worker + ((w < numfileblocks % numprocs) ? 1 : 0);
+		workers[w].first_block = (w == 0) ? 0 : workers[w - 1].first_block + workers[w - 1].numblocks;
+		if( ((workers[w].budget = pdp_budget_split(ctx->budget, numprocs)) == NULL)) goto cleanup;
+	}
+	for(w = 0; w < numprocs; w++){
+		if(!fork_worker_start(ctx, key, filepath, header, map, ring, workers, w)) goto cleanup;
+		live++;
+	}
+
+	while(live > 0){
+		progress = 0;
+		while(ring_pop(ring, &reported, &attempt, &numblocks)){
+			fork_worker_report(workers, numprocs, reported, attempt, numblocks);
+			progress = 1;
+		}
+
+		for(w = 0; w < numprocs; w++){
+			if(workers[w].pid <= 0) continue;
+			if( ((pid = waitpid(workers[w].pid, &status, WNOHANG)) == 0)) continue;
+			if(pid < 0 && errno == EINTR) continue;
+			progress = 1;
+
+			/* Every report a worker made is on the ring before it exits */
+			while(ring_pop(ring, &reported, &attempt, &numblocks))
+				fork_worker_report(workers, numprocs, reported, attempt, numblocks);
+
+			/* Every record a worker reported is in the mapping, whatever became of it after */
+			workers[w].pid = 0;
+			if(workers[w].done == workers[w].numblocks){
+				live--;
+				continue;
+			}
+
+			/* Restart the worker from the last block it reported */
+			if(workers[w].retries++ >= PDP_FORK_RETRIES || workers[w].done > workers[w].numblocks){
+				fprintf(stderr, "ERROR: A tagging worker for %s failed.\n", filepath);
+				live--;
+				goto cleanup;
+			}
+			workers[w].first_block += workers[w].done;
+			workers[w].numblocks -= workers[w].done;
+			workers[w].done = 0;
+			if(!fork_worker_start(ctx, key, filepath, header, map, ring, workers, w)){
+				live--;
+				goto cleanup;
+			}
+		}
+
+		/* A worker that died between claiming a report and writing it would hold up the ring */
+		if(!progress && ring_skip(ring, workers, numprocs)) progress = 1;
+		if(!progress) sleep_us(PDP_FORK_POLL_US);
+	}
+
+	if(msync(map, maplen, MS_SYNC) != 0) goto cleanup;
+	result = 1;
+
+cleanup:
+	/* Stop and reap any workers still running */
+	for(w = 0; workers && w < numprocs; w++){
+		if(workers[w].pid > 0){
+			kill(workers[w].pid, SIGKILL);
+			while(waitpid(workers[w].pid, &status, 0) < 0 && errno == EINTR);
+		}
+		if(workers[w].budget) pdp_budget_free(workers[w].budget);
+	}
+	if(workers) free(workers);
+	if(ring) munmap(ring, sizeof(PDP_fork_ring));
+	if(map) munmap(map, maplen);
+	if(fd >= 0) close(fd);
+	return result;
+}
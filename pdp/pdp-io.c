@@ -0,0 +1,595 @@
+/* 
+* pdp-io.c
+*
+* Copyright (c) 2008, Zachary N J Peterson <zachary@jhu.edu>
+* All rights reserved.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*     * Redistributions of source code must retain the above copyright
+*       notice, this list of conditions and the following disclaimer.
+*     * Redistributions in binary form must reproduce the above copyright
+*       notice, this list of conditions and the following disclaimer in the
+*       documentation and/or other materials provided with the distribution.
+*     * The name of the Zachary N J Peterson may be used to endorse or promote products
+*       derived from this software without specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY ZACHARY N J PETERSON ``AS IS'' AND ANY
+* EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL ZACHARY N J PETERSON BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+/* pdp-io.c contains the block reader and tag writer used when tagging files.  The reader
+*  prefetches large, aligned chunks of the data file on a helper thread so that I/O overlaps
+*  with tag computation.  The writer serializes batches of tags straight into a large aligned
+*  staging buffer and writes it out PDP_TAG_WRITER_CHUNKS chunks at a time.  Both can bypass the page cache (PDP_IO_DIRECT) or drop the pages they
+*  touched (PDP_IO_DONTNEED), so that tagging a large file does not evict the working set of
+*  co-located services.
+*/
+
+#define _GNU_SOURCE
+#include "pdp.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#define PDP_IO_CHUNK_SIZE (PDP_IO_CHUNK_BLOCKS * PDP_BLOCKSIZE)
+#define PDP_TAG_WRITER_SIZE (PDP_TAG_WRITER_CHUNKS * PDP_IO_CHUNK_SIZE)
+
+struct PDP_block_reader_struct{
+
+	int fd;
+	int flags;					/* PDP_IO_* flags actually in effect */
+	uint64_t first_block;		/* The first block of the range being read */
+	uint64_t numblocks;			/* The number of blocks in the range */
+	uint64_t next_block;		/* The next block handed to the caller */
+	PDP_budget *budget;			/* Reads are charged to its I/O budget; may be NULL */
+
+	/* A ring of PDP_IO_DEPTH chunks filled by the prefetch thread */
+	unsigned char *chunks[PDP_IO_DEPTH];
+	size_t chunk_blocks[PDP_IO_DEPTH];	/* The blocks held by each chunk */
+	unsigned int filled;		/* Chunks filled by the prefetch thread */
+	unsigned int consumed;		/* Chunks released by the caller */
+	int error;
+	int stop;
+
+	pthread_t thread;
+	int thread_started;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+};
+
+struct PDP_tag_writer_struct{
+
+	pthread_mutex_t lock;		/* Serializes callers */
+	int fd;
+	int flags;
+	unsigned char *buf;			/* Aligned staging buffer of PDP_TAG_WRITER_SIZE bytes */
+	size_t len;					/* The bytes staged in buf */
+	off_t offset;				/* The file offset of buf */
+	off_t synced;				/* Data before this offset has been dropped from the page cache */
+	off_t durable;				/* Data before this offset has been flushed to disk */
+	uint64_t sync_bytes;		/* Flush to disk after this many bytes are written; 0 for never */
+	int error;
+};
+
+/* open_with_flags: Opens path, asking for O_DIRECT when PDP_IO_DIRECT is set.  If the file system
+*  does not support O_DIRECT, PDP_IO_DIRECT is replaced by PDP_IO_DONTNEED in *flags.
+*/
+static int open_with_flags(char *path, int oflags, int *flags){
+
+	int fd = -1;
+
+#ifdef O_DIRECT
+	if(*flags & PDP_IO_DIRECT){
+		fd = open(path, oflags | O_DIRECT, 0600);
+		if(fd >= 0 || errno != EINVAL) return fd;
+	}
+#endif
+	if(*flags & PDP_IO_DIRECT)
+		*flags = (*flags & ~PDP_IO_DIRECT) | PDP_IO_DONTNEED;
+
+	return open(path, oflags, 0600);
+}
+
+/* drop_cached: Drops the given range of a file from the page cache */
+static void drop_cached(int fd, off_t offset, off_t len){
+
+#ifdef POSIX_FADV_DONTNEED
+	posix_fadvise(fd, offset, len, POSIX_FADV_DONTNEED);
+#endif
+}
+
+static void *pdp_block_reader_thread(void *reader_ptr){
+
+	PDP_block_reader *reader = reader_ptr;
+	unsigned int slot = 0;
+	uint64_t block = reader->first_block;
+	uint64_t end = reader->first_block + reader->numblocks;
+	size_t want = 0;
+	size_t got = 0;
+	ssize_t n = 0;
+	off_t offset = 0;
+
+	while(block < end){
+
+		/* Wait for a free chunk */
+		pthread_mutex_lock(&(reader->lock));
+		while(!reader->stop && reader->filled - reader->consumed >= PDP_IO_DEPTH)
+			pthread_cond_wait(&(reader->cond), &(reader->lock));
+		if(reader->stop){
+			pthread_mutex_unlock(&(reader->lock));
+			break;
+		}
+		slot = reader->filled % PDP_IO_DEPTH;
+		pthread_mutex_unlock(&(reader->lock));
+
+		/* Read the next chunk.  Short reads at the end of the file leave the last block zero-padded. */
+		reader->chunk_blocks[slot] = (end - block < PDP_IO_CHUNK_BLOCKS) ? (end - block) : PDP_IO_CHUNK_BLOCKS;
+		want = reader->chunk_blocks[slot] * PDP_BLOCKSIZE;
+		offset = (off_t)block * PDP_BLOCKSIZE;
+		pdp_budget_charge_io(reader->budget, want);
+		got = 0;
+		while(got < want){
+			n = pread(reader->fd, reader->chunks[slot] + got, want - got, offset + got);
+			if(n < 0 && errno == EINTR) continue;
+			if(n <= 0) break;
+			got += n;
+		}
+		if(n < 0) reader->error = 1;
+		if(got < want) memset(reader->chunks[slot] + got, 0, want - got);
+		if(reader->flags & PDP_IO_DONTNEED) drop_cached(reader->fd, offset, got);
+
+		block += reader->chunk_blocks[slot];
+
+		pthread_mutex_lock(&(reader->lock));
+		reader->filled++;
+		pthread_cond_broadcast(&(reader->cond));
+		pthread_mutex_unlock(&(reader->lock));
+		if(reader->error) break;
+	}
+
+	return NULL;
+}
+
+/* pdp_block_reader_open: Opens a reader over numblocks PDP blocks of a file, starting at first_block.
+*  flags is a combination of PDP_IO_* flags.  Reads are charged to budget, unless it is NULL.
+*  Returns an allocated reader or NULL on failure.
+*/
+PDP_block_reader *pdp_block_reader_open(char *filepath, uint64_t first_block, uint64_t numblocks, int flags,
+	PDP_budget *budget){
+
+	PDP_block_reader *reader = NULL;
+	int i = 0;
+
+	if(!filepath) return NULL;
+
+	if( ((reader = malloc(sizeof(PDP_block_reader))) == NULL)) return NULL;
+	memset(reader, 0, sizeof(PDP_block_reader));
+	reader->fd = -1;
+	reader->flags = flags;
+	reader->first_block = first_block;
+	reader->numblocks = numblocks;
+	reader->next_block = first_block;
+	reader->budget = budget;
+	pthread_mutex_init(&(reader->lock), NULL);
+	pthread_cond_init(&(reader->cond), NULL);
+
+	reader->fd = open_with_flags(filepath, O_RDONLY, &(reader->flags));
+	if(reader->fd < 0) goto cleanup;
+#ifdef POSIX_FADV_SEQUENTIAL
+	if(!(reader->flags & PDP_IO_DIRECT))
+		posix_fadvise(reader->fd, (off_t)first_block * PDP_BLOCKSIZE, (off_t)numblocks * PDP_BLOCKSIZE, POSIX_FADV_SEQUENTIAL);
+#endif
+
+	/* O_DIRECT needs buffers aligned to the device's logical block size */
+	for(i = 0; i < PDP_IO_DEPTH; i++)
+		if(posix_memalign((void **)&(reader->chunks[i]), PDP_IO_ALIGN, PDP_IO_CHUNK_SIZE) != 0) goto cleanup;
+
+	if(numblocks > 0){
+		if(pthread_create(&(reader->thread), NULL, pdp_block_reader_thread, reader) != 0) goto cleanup;
+		reader->thread_started = 1;
+	}
+
+	return reader;
+
+cleanup:
+	pdp_block_reader_close(reader);
+
+	return NULL;
+}
+
+/* pdp_block_reader_next: Returns a pointer to the next PDP_BLOCKSIZE block of the range and stores
+*  its index in *index.  The block is only valid until the next call.  Returns NULL at the end of the
+*  range or on a read error; use pdp_block_reader_error to tell them apart.
+*/
+unsigned char *pdp_block_reader_next(PDP_block_reader *reader, uint64_t *index){
+
+	unsigned int chunk = 0;
+	uint64_t block_in_chunk = 0;
+	unsigned int slot = 0;
+
+	if(!reader || reader->next_block >= reader->first_block + reader->numblocks) return NULL;
+
+	chunk = (reader->next_block - reader->first_block) / PDP_IO_CHUNK_BLOCKS;
+	block_in_chunk = (reader->next_block - reader->first_block) % PDP_IO_CHUNK_BLOCKS;
+	slot = chunk % PDP_IO_DEPTH;
+
+	pthread_mutex_lock(&(reader->lock));
+	/* Release the previous chunk once we move past it */
+	if(block_in_chunk == 0 && chunk > 0){
+		reader->consumed++;
+		pthread_cond_broadcast(&(reader->cond));
+	}
+	while(reader->filled <= chunk && !reader->error)
+		pthread_cond_wait(&(reader->cond), &(reader->lock));
+	pthread_mutex_unlock(&(reader->lock));
+	if(reader->error) return NULL;
+
+	if(index) *index = reader->next_block;
+	reader->next_block++;
+
+	return reader->chunks[slot] + (block_in_chunk * PDP_BLOCKSIZE);
+}
+
+/* pdp_block_reader_error: Returns 1 if the reader hit a read error and 0 otherwise */
+int pdp_block_reader_error(PDP_block_reader *reader){
+
+	if(!reader) return 1;
+
+	return reader->error;
+}
+
+/* pdp_block_reader_close: Stops the prefetch thread and frees the reader */
+void pdp_block_reader_close(PDP_block_reader *reader){
+
+	int i = 0;
+
+	if(!reader) return;
+
+	if(reader->thread_started){
+		pthread_mutex_lock(&(reader->lock));
+		reader->stop = 1;
+		pthread_cond_broadcast(&(reader->cond));
+		pthread_mutex_unlock(&(reader->lock));
+		pthread_join(reader->thread, NULL);
+	}
+	for(i = 0; i < PDP_IO_DEPTH; i++)
+		if(reader->chunks[i]) free(reader->chunks[i]);
+	if(reader->fd >= 0) close(reader->fd);
+	pthread_mutex_destroy(&(reader->lock));
+	pthread_cond_destroy(&(reader->cond));
+	free(reader);
+}
+
+/* pdp_read_block_fd: Reads PDP block index of the file open on fd into block, which must hold
+*  PDP_BLOCKSIZE bytes.  A block cut short by the end of the file is zero-padded, as when tagging.
+*  Uses pread, so threads can read through the same descriptor at once.  Returns 1 on success and
+*  0 on failure.
+*/
+int pdp_read_block_fd(int fd, uint64_t index, unsigned char *block){
+
+	ssize_t n = 0;
+	size_t got = 0;
+	off_t offset = (off_t)index * PDP_BLOCKSIZE;
+
+	if(fd < 0 || !block) return 0;
+
+	while(got < PDP_BLOCKSIZE){
+		n = pread(fd, block + got, PDP_BLOCKSIZE - got, offset + got);
+		if(n < 0 && errno == EINTR) continue;
+		if(n < 0) return 0;
+		if(n == 0) break;
+		got += n;
+	}
+	if(got < PDP_BLOCKSIZE) memset(block + got, 0, PDP_BLOCKSIZE - got);
+
+	return 1;
+}
+
+/* write_all: Writes len bytes of buf at offset.  Returns 1 on success and 0 on failure. */
+static int write_all(int fd, unsigned char *buf, size_t len, off_t offset){
+
+	ssize_t n = 0;
+
+	while(len > 0){
+		n = pwrite(fd, buf, len, offset);
+		if(n < 0 && errno == EINTR) continue;
+		if(n <= 0) return 0;
+		buf += n;
+		offset += n;
+		len -= n;
+	}
+
+	return 1;
+}
+
+/* pdp_tag_writer_flush: Writes out the staging buffer once it is full, with one write, and flushes
+*  the file to disk if sync_bytes have been written since it last was.  Call with the writer's lock
+*  held.
+*/
+static int pdp_tag_writer_flush(PDP_tag_writer *writer){
+
+	if(writer->len < PDP_TAG_WRITER_SIZE) return 1;
+
+	if(!write_all(writer->fd, writer->buf, PDP_TAG_WRITER_SIZE, writer->offset)) return 0;
+	writer->offset += PDP_TAG_WRITER_SIZE;
+	writer->len = 0;
+
+	if(writer->sync_bytes && (uint64_t)(writer->offset - writer->durable) >= writer->sync_bytes){
+		if(fdatasync(writer->fd) != 0) return 0;
+		writer->durable = writer->offset;
+	}
+
+#ifdef SYNC_FILE_RANGE_WRITE
+	/* Start write-back of these chunks, wait for the ones before them and drop those from the page
+	 * cache.  Dirty pages cannot be dropped, so this lags one write behind. */
+	if(writer->flags & PDP_IO_DONTNEED){
+		sync_file_range(writer->fd, writer->offset - PDP_TAG_WRITER_SIZE, PDP_TAG_WRITER_SIZE, SYNC_FILE_RANGE_WRITE);
+		if(writer->offset - writer->synced >= 2 * PDP_TAG_WRITER_SIZE){
+			sync_file_range(writer->fd, writer->synced, PDP_TAG_WRITER_SIZE,
+				SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+			drop_cached(writer->fd, writer->synced, PDP_TAG_WRITER_SIZE);
+			writer->synced += PDP_TAG_WRITER_SIZE;
+		}
+	}
+#endif
+
+	return 1;
+}
+
+/* stage: Copies len bytes of data into the staging buffer, writing it out each time it fills.
+*  Call with the writer's lock held.  Returns 1 on success and 0 on failure.
+*/
+static int stage(PDP_tag_writer *writer, unsigned char *data, size_t len){
+
+	size_t n = 0;
+
+	while(len > 0){
+		n = PDP_TAG_WRITER_SIZE - writer->len;
+		if(n > len) n = len;
+		memcpy(writer->buf + writer->len, data, n);
+		writer->len += n;
+		data += n;
+		len -= n;
+		if(!pdp_tag_writer_flush(writer)) return 0;
+	}
+
+	return 1;
+}
+
+/* pdp_tag_writer_new: Allocates a writer, with no file open yet, and its staging buffer.  Returns NULL on failure */
+static PDP_tag_writer *pdp_tag_writer_new(int flags){
+
+	PDP_tag_writer *writer = NULL;
+
+	if( ((writer = malloc(sizeof(PDP_tag_writer))) == NULL)) return NULL;
+	memset(writer, 0, sizeof(PDP_tag_writer));
+	writer->fd = -1;
+	writer->flags = flags;
+
+	if(posix_memalign((void **)&(writer->buf), PDP_IO_ALIGN, PDP_TAG_WRITER_SIZE) != 0){
+		writer->buf = NULL;
+		goto cleanup;
+	}
+	if(pthread_mutex_init(&(writer->lock), NULL) != 0) goto cleanup;
+
+	return writer;
+
+cleanup:
+	if(writer->buf) free(writer->buf);
+	free(writer);
+
+	return NULL;
+}
+
+/* pdp_tag_writer_destroy: Closes the writer's file and frees it.  Returns 0 if close fails */
+static int pdp_tag_writer_destroy(PDP_tag_writer *writer){
+
+	int result = 1;
+
+	if(writer->fd >= 0 && close(writer->fd) != 0) result = 0;
+	pthread_mutex_destroy(&(writer->lock));
+	free(writer->buf);
+	free(writer);
+
+	return result;
+}
+
+/* pdp_tag_writer_open: Creates (or truncates) a tag file for writing.  flags is a combination of
+*  PDP_IO_* flags.  Returns an allocated writer or NULL on failure.
+*/
+PDP_tag_writer *pdp_tag_writer_open(char *tagfilepath, int flags){
+
+	PDP_tag_writer *writer = NULL;
+
+	if(!tagfilepath) return NULL;
+
+	if( ((writer = pdp_tag_writer_new(flags)) == NULL)) return NULL;
+
+	writer->fd = open_with_flags(tagfilepath, O_WRONLY | O_CREAT | O_TRUNC, &(writer->flags));
+	if(writer->fd < 0) goto cleanup;
+
+	return writer;
+
+cleanup:
+	pdp_tag_writer_destroy(writer);
+
+	return NULL;
+}
+
+/* pdp_tag_writer_resume: Reopens a partially written tag file to continue appending at offset.
+*  Anything past offset is discarded.  Returns an allocated writer or NULL on failure.
+*/
+PDP_tag_writer *pdp_tag_writer_resume(char *tagfilepath, off_t offset, int flags){
+
+	PDP_tag_writer *writer = NULL;
+	size_t want = 0;
+	ssize_t n = 0;
+
+	if(!tagfilepath || offset < 0) return NULL;
+
+	if( ((writer = pdp_tag_writer_new(flags)) == NULL)) return NULL;
+
+	writer->fd = open_with_flags(tagfilepath, O_RDWR, &(writer->flags));
+	if(writer->fd < 0) goto cleanup;
+	if(ftruncate(writer->fd, offset) != 0) goto cleanup;
+
+	/* Writes stay aligned to the staging buffer, so stage the partial buffer the file ends with */
+	writer->offset = offset - (offset % PDP_TAG_WRITER_SIZE);
+	writer->synced = writer->offset;
+	writer->durable = writer->offset;
+	writer->len = offset % PDP_TAG_WRITER_SIZE;
+	want = (writer->len + PDP_IO_ALIGN - 1) & ~((size_t)PDP_IO_ALIGN - 1);
+	while(writer->len > 0){
+		n = pread(writer->fd, writer->buf, want, writer->offset);
+		if(n < 0 && errno == EINTR) continue;
+		if(n < (ssize_t)writer->len) goto cleanup;
+		break;
+	}
+
+	return writer;
+
+cleanup:
+	pdp_tag_writer_destroy(writer);
+
+	return NULL;
+}
+
+/* pdp_tag_writer_set_sync: Makes the writer flush the tag file to disk every time at least bytes
+*  more of it have been written, on top of pdp_tag_writer_sync and pdp_tag_writer_close.  0, the
+*  default, flushes only then.
+*/
+void pdp_tag_writer_set_sync(PDP_tag_writer *writer, uint64_t bytes){
+
+	if(!writer) return;
+
+	pthread_mutex_lock(&(writer->lock));
+	writer->sync_bytes = bytes;
+	pthread_mutex_unlock(&(writer->lock));
+}
+
+/* pdp_tag_writer_append: Appends len bytes to the tag file.  Any number of threads may append;
+*  each append is written whole and in the order the calls are made.  Returns 1 on success and 0
+*  on failure.
+*/
+int pdp_tag_writer_append(PDP_tag_writer *writer, unsigned char *data, size_t len){
+
+	int result = 0;
+
+	if(!writer) return 0;
+
+	pthread_mutex_lock(&(writer->lock));
+	if(!writer->error){
+		result = stage(writer, data, len);
+		if(!result) writer->error = 1;
+	}
+	pthread_mutex_unlock(&(writer->lock));
+
+	return result;
+}
+
+/* pdp_tag_writer_append_batch: Appends the records of the numtags tags from slot first of batch,
+*  laid out as header describes.  Records are encoded straight into the staging buffer; only one
+*  that straddles its end is encoded on the side.  Thread safe like pdp_tag_writer_append.
+*  Returns 1 on success and 0 on failure.
+*/
+int pdp_tag_writer_append_batch(PDP_tag_writer *writer, PDP_tag_header *header, PDP_tag_batch *batch,
+	uint64_t first, uint64_t numtags){
+
+	unsigned char record[header ? header->record_size : 1];
+	uint64_t n = 0;
+	int result = 0;
+
+	if(!writer || !header || !batch || first + numtags > batch->count) return 0;
+
+	pthread_mutex_lock(&(writer->lock));
+	if(writer->error) goto cleanup;
+
+	while(numtags > 0){
+		n = (PDP_TAG_WRITER_SIZE - writer->len) / header->record_size;
+		if(n > numtags) n = numtags;
+		if(n > 0){
+			if(!pdp_tag_batch_encode(batch, header, first, n, writer->buf + writer->len)) goto cleanup;
+			writer->len += n * header->record_size;
+			if(!pdp_tag_writer_flush(writer)) goto cleanup;
+		}else{
+			if(!pdp_tag_batch_encode(batch, header, first, 1, record)) goto cleanup;
+			if(!stage(writer, record, header->record_size)) goto cleanup;
+			n = 1;
+		}
+		first += n;
+		numtags -= n;
+	}
+	result = 1;
+
+cleanup:
+	if(!result) writer->error = 1;
+	pthread_mutex_unlock(&(writer->lock));
+
+	return result;
+}
+
+/* pdp_tag_writer_sync: Makes the data written out so far durable.  Returns the length of the
+*  durable prefix of the tag file, or -1 on failure.  Staged data past it is not yet on disk.
+*/
+off_t pdp_tag_writer_sync(PDP_tag_writer *writer){
+
+	off_t durable = -1;
+
+	if(!writer) return -1;
+
+	pthread_mutex_lock(&(writer->lock));
+	if(!writer->error){
+		if(writer->durable == writer->offset || fdatasync(writer->fd) == 0){
+			writer->durable = writer->offset;
+			durable = writer->durable;
+		}else{
+			writer->error = 1;
+		}
+	}
+	pthread_mutex_unlock(&(writer->lock));
+
+	return durable;
+}
+
+/* pdp_tag_writer_close: Writes out any staged data, flushes the tag file to disk and closes it.
+*  No other thread may still be using the writer.  Returns 1 if every write succeeded and 0
+*  otherwise.
+*/
+int pdp_tag_writer_close(PDP_tag_writer *writer){
+
+	int result = 0;
+
+	if(!writer) return 0;
+
+	result = !writer->error;
+
+	if(result && writer->len > 0){
+#ifdef O_DIRECT
+		/* The tail of the file is not a whole number of aligned blocks, so it is written buffered */
+		if(writer->flags & PDP_IO_DIRECT)
+			fcntl(writer->fd, F_SETFL, fcntl(writer->fd, F_GETFL) & ~O_DIRECT);
+#endif
+		result = write_all(writer->fd, writer->buf, writer->len, writer->offset);
+		writer->offset += writer->len;
+	}
+	/* The tag file is renamed into place after this, so it must be on disk first */
+	if(result && fdatasync(writer->fd) != 0) result = 0;
+	if(result && (writer->flags & PDP_IO_DONTNEED))
+		drop_cached(writer->fd, 0, writer->offset);
+
+	if(!pdp_tag_writer_destroy(writer)) result = 0;
+
+	return result;
+}
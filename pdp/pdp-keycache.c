@@ -0,0 +1,341 @@
+/* 
+* pdp-keycache.c
+*
+* Copyright (c) 2008, Zachary N J Peterson <zachary@jhu.edu>
+* All rights reserved.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*     * Redistributions of source code must retain the above copyright
+*       notice, this list of conditions and the following disclaimer.
+*     * Redistributions in binary form must reproduce the above copyright
+*       notice, this list of conditions and the following disclaimer in the
+*       documentation and/or other materials provided with the distribution.
+*     * The name of the Zachary N J Peterson may be used to endorse or promote products
+*       derived from this software without specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY ZACHARY N J PETERSON ``AS IS'' AND ANY
+* EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL ZACHARY N J PETERSON BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+/* pdp-keycache.c contains the key cache, which keeps the keys of many tenants loaded and
+*  precomputed between tagging runs.  Each PDP_ctx has its own.  Keys are cached by keypath under a memory budget.  A key is
+*  handed out with a reference that pdp_key_cache_put returns; keys that are in use are never
+*  evicted, and others are evicted least recently used first once the cache is over budget.
+*  A cached key is only handed to callers that present the password it was loaded with.
+*/
+
+#include "pdp.h"
+#include <stdlib.h>
+#include <pthread.h>
+#include <sys/param.h>
+#include <openssl/evp.h>
+
+typedef struct PDP_key_cache_entry_struct PDP_key_cache_entry;
+
+struct PDP_key_cache_entry_struct{
+
+	char keypath[MAXPATHLEN];
+	unsigned char password_mac[SHA_DIGEST_LENGTH];	/* HMAC of the password under cache_secret */
+	PDP_key *key;				/* NULL while the key is being loaded */
+	size_t bytes;				/* Memory held by key, see pdp_key_memory */
+	unsigned int refs;			/* Callers holding the key */
+
+	/* Least recently used list; the head is the most recently used */
+	PDP_key_cache_entry *prev;
+	PDP_key_cache_entry *next;
+};
+
+struct PDP_key_cache_struct{
+
+	pthread_mutex_t lock;
+	pthread_cond_t loaded;		/* Signalled when a key finishes loading */
+	unsigned char secret[SHA_DIGEST_LENGTH];	/* Passwords are authenticated under this */
+
+	/* Least recently used list; the head is the most recently used */
+	PDP_key_cache_entry *head;
+	PDP_key_cache_entry *tail;
+
+	PDP_key_cache_stats stats;	/* stats.budget is the budget; 0 disables the cache */
+};
+
+/* BIGNUM is opaque; this is the size of its structure on LP64 */
+#define PDP_BIGNUM_OVERHEAD 24
+
+/* password_mac: Computes the HMAC of password under the cache's secret into mac, so the cache can
+*  compare passwords without keeping them.
+*/
+static void password_mac(PDP_key_cache *cache, char *password, unsigned char *mac){
+
+	unsigned int mac_len = SHA_DIGEST_LENGTH;
+
+	HMAC(EVP_sha1(), cache->secret, SHA_DIGEST_LENGTH, (unsigned char *)password, strlen(password), mac, &mac_len);
+}
+
+/* pdp_key_memory: Estimates the memory held by key and its precomputed values in bytes */
+static size_t pdp_key_memory(PDP_key *key){
+
+	const BIGNUM *components[8];
+	size_t bytes = sizeof(PDP_key) + PRF_KEY_SIZE;
+	size_t modulus_size = 0, i = 0;
+
+	if(!key->rsa) return bytes;
+
+	RSA_get0_key(key->rsa, &components[0], &components[1], &components[2]);
+	RSA_get0_factors(key->rsa, &components[3], &components[4]);
+	RSA_get0_crt_params(key->rsa, &components[5], &components[6], &components[7]);
+	for(i = 0; i < 8; i++)
+		if(components[i]) bytes += PDP_BIGNUM_OVERHEAD + BN_num_bytes(components[i]);
+	modulus_size = BN_num_bytes(RSA_get0_n(key->rsa));
+
+	if(key->g) bytes += PDP_BIGNUM_OVERHEAD + BN_num_bytes(key->g);
+	if(key->phi) bytes += PDP_BIGNUM_OVERHEAD + BN_num_bytes(key->phi);
+	if(key->mont_n) bytes += 3 * (PDP_BIGNUM_OVERHEAD + modulus_size);	/* RR, N and Ni */
+	if(key->g_table)
+		bytes += key->g_table_windows * PDP_FIXED_BASE_DIGITS * (sizeof(BIGNUM *) + PDP_BIGNUM_OVERHEAD + modulus_size);
+
+	return bytes;
+}
+
+/* lru_unlink: Removes entry from the least recently used list.  Call with the cache's lock held */
+static void lru_unlink(PDP_key_cache *cache, PDP_key_cache_entry *entry){
+
+	if(entry->prev) entry->prev->next = entry->next;
+	else cache->head = entry->next;
+	if(entry->next) entry->next->prev = entry->prev;
+	else cache->tail = entry->prev;
+	entry->prev = entry->next = NULL;
+}
+
+/* lru_push: Makes entry the most recently used.  Call with the cache's lock held */
+static void lru_push(PDP_key_cache *cache, PDP_key_cache_entry *entry){
+
+	entry->prev = NULL;
+	entry->next = cache->head;
+	if(cache->head) cache->head->prev = entry;
+	cache->head = entry;
+	if(!cache->tail) cache->tail = entry;
+}
+
+/* destroy_entry: Unlinks entry and frees it with its key.  Call with the cache's lock held */
+static void destroy_entry(PDP_key_cache *cache, PDP_key_cache_entry *entry){
+
+	lru_unlink(cache, entry);
+	cache->stats.bytes -= entry->bytes;
+	cache->stats.entries--;
+	if(entry->key) destroy_pdp_key(entry->key);
+	sfree(entry, sizeof(PDP_key_cache_entry));
+}
+
+/* evict: Evicts unused keys, least recently used first, until the cache holds at most bytes.
+*  Call with the cache's lock held.
+*/
+static void evict(PDP_key_cache *cache, size_t bytes){
+
+	PDP_key_cache_entry *entry = cache->tail;
+	PDP_key_cache_entry *prev = NULL;
+
+	while(entry && cache->stats.bytes > bytes){
+		prev = entry->prev;
+		if(entry->key && entry->refs == 0){
+			destroy_entry(cache, entry);
+			cache->stats.evictions++;
+		}
+		entry = prev;
+	}
+}
+
+/* find_entry: Returns the entry for keypath or NULL.  Call with the cache's lock held */
+static PDP_key_cache_entry *find_entry(PDP_key_cache *cache, char *keypath){
+
+	PDP_key_cache_entry *entry = NULL;
+
+	for(entry = cache->head; entry; entry = entry->next)
+		if(strcmp(entry->keypath, keypath) == 0) return entry;
+
+	return NULL;
+}
+
+/* load_key: Loads and precomputes the key in keypath.  Returns an allocated PDP_key or NULL */
+static PDP_key *load_key(char *keypath, char *password){
+
+	PDP_key *key = NULL;
+
+	if( ((key = pdp_get_keypair_temp(keypath, password)) == NULL)) return NULL;
+	if(!pdp_key_precompute(key)){
+		destroy_pdp_key(key);
+		return NULL;
+	}
+
+	return key;
+}
+
+/* pdp_key_cache_new: Returns an allocated, empty key cache that may hold budget bytes, or NULL on
+*  failure.  A budget of 0 disables caching; keys are then loaded for every pdp_key_cache_get and
+*  freed by pdp_key_cache_put.
+*/
+PDP_key_cache *pdp_key_cache_new(size_t budget){
+
+	PDP_key_cache *cache = NULL;
+
+	if( ((cache = malloc(sizeof(PDP_key_cache))) == NULL)) return NULL;
+	memset(cache, 0, sizeof(PDP_key_cache));
+	if(!RAND_bytes(cache->secret, SHA_DIGEST_LENGTH)) goto cleanup;
+	if(pthread_mutex_init(&(cache->lock), NULL) != 0) goto cleanup;
+	if(pthread_cond_init(&(cache->loaded), NULL) != 0){
+		pthread_mutex_destroy(&(cache->lock));
+		goto cleanup;
+	}
+	cache->stats.budget = budget;
+
+	return cache;
+
+cleanup:
+	sfree(cache, sizeof(PDP_key_cache));
+	return NULL;
+}
+
+/* pdp_key_cache_free: Frees a cache and every key it holds.  No key may still be in use */
+void pdp_key_cache_free(PDP_key_cache *cache){
+
+	if(!cache) return;
+
+	while(cache->head) destroy_entry(cache, cache->head);
+	pthread_cond_destroy(&(cache->loaded));
+	pthread_mutex_destroy(&(cache->lock));
+	sfree(cache, sizeof(PDP_key_cache));
+}
+
+/* pdp_key_cache_set_budget: Sets the memory the cache may hold in bytes and evicts unused keys
+*  until it is within it.  A budget of 0 disables caching.
+*/
+void pdp_key_cache_set_budget(PDP_key_cache *cache, size_t bytes){
+
+	if(!cache) return;
+
+	pthread_mutex_lock(&(cache->lock));
+	cache->stats.budget = bytes;
+	evict(cache, bytes);
+	pthread_mutex_unlock(&(cache->lock));
+}
+
+/* pdp_key_cache_get: Returns the precomputed key in keypath, loading it on a miss.  Concurrent
+*  misses on the same keypath load it once.  The key is shared and must be treated as read-only,
+*  and returned with pdp_key_cache_put.  Returns NULL if the key cannot be loaded with password.
+*/
+PDP_key *pdp_key_cache_get(PDP_key_cache *cache, char *keypath, char *password){
+
+	PDP_key_cache_entry *entry = NULL;
+	PDP_key *key = NULL;
+	unsigned char mac[SHA_DIGEST_LENGTH];
+	uint64_t start = 0;
+
+	if(!keypath || !password || strlen(keypath) >= MAXPATHLEN) return NULL;
+	if(!cache) return load_key(keypath, password);
+
+	password_mac(cache, password, mac);
+
+	pthread_mutex_lock(&(cache->lock));
+	while( ((entry = find_entry(cache, keypath)) != NULL) && !entry->key)
+		pthread_cond_wait(&(cache->loaded), &(cache->lock));
+
+	if(entry && CRYPTO_memcmp(entry->password_mac, mac, SHA_DIGEST_LENGTH) == 0){
+		entry->refs++;
+		lru_unlink(cache, entry);
+		lru_push(cache, entry);
+		cache->stats.hits++;
+		pthread_mutex_unlock(&(cache->lock));
+		return entry->key;
+	}
+	cache->stats.misses++;
+
+	/* A wrong password, or a disabled cache, gets a key of its own if the password opens it */
+	if(entry || !cache->stats.budget){
+		pthread_mutex_unlock(&(cache->lock));
+		return load_key(keypath, password);
+	}
+
+	/* Hold the keypath while loading so concurrent misses wait for this load */
+	if( ((entry = malloc(sizeof(PDP_key_cache_entry))) == NULL)){
+		pthread_mutex_unlock(&(cache->lock));
+		return NULL;
+	}
+	memset(entry, 0, sizeof(PDP_key_cache_entry));
+	strcpy(entry->keypath, keypath);
+	memcpy(entry->password_mac, mac, SHA_DIGEST_LENGTH);
+	lru_push(cache, entry);
+	cache->stats.entries++;
+	pthread_mutex_unlock(&(cache->lock));
+
+	start = pdp_monotonic_ns();
+	key = load_key(keypath, password);
+
+	pthread_mutex_lock(&(cache->lock));
+	cache->stats.load_ns += pdp_monotonic_ns() - start;
+	if(!key){
+		cache->stats.load_failures++;
+		destroy_entry(cache, entry);
+	}else{
+		entry->key = key;
+		entry->refs = 1;
+		entry->bytes = pdp_key_memory(key);
+		cache->stats.bytes += entry->bytes;
+		evict(cache, cache->stats.budget);
+	}
+	pthread_cond_broadcast(&(cache->loaded));
+	pthread_mutex_unlock(&(cache->lock));
+
+	return key;
+}
+
+/* pdp_key_cache_put: Returns a key from pdp_key_cache_get.  A key the cache does not hold is freed */
+void pdp_key_cache_put(PDP_key_cache *cache, PDP_key *key){
+
+	PDP_key_cache_entry *entry = NULL;
+
+	if(!key) return;
+
+	if(cache){
+		pthread_mutex_lock(&(cache->lock));
+		for(entry = cache->head; entry; entry = entry->next)
+			if(entry->key == key) break;
+		if(entry){
+			entry->refs--;
+			evict(cache, cache->stats.budget);
+		}
+		pthread_mutex_unlock(&(cache->lock));
+	}
+
+	if(!entry) destroy_pdp_key(key);
+}
+
+/* pdp_key_cache_flush: Evicts every key that is not in use */
+void pdp_key_cache_flush(PDP_key_cache *cache){
+
+	if(!cache) return;
+
+	pthread_mutex_lock(&(cache->lock));
+	evict(cache, 0);
+	pthread_mutex_unlock(&(cache->lock));
+}
+
+/* pdp_key_cache_stats: Fills in stats with the cache's counters since it was created */
+void pdp_key_cache_stats(PDP_key_cache *cache, PDP_key_cache_stats *stats){
+
+	if(!stats) return;
+	memset(stats, 0, sizeof(PDP_key_cache_stats));
+	if(!cache) return;
+
+	pthread_mutex_lock(&(cache->lock));
+	memcpy(stats, &(cache->stats), sizeof(PDP_key_cache_stats));
+	pthread_mutex_unlock(&(cache->lock));
+}
@@ -29,6 +29,7 @@
 
 #include "pdp.h"
 #include <arpa/inet.h>
+#include <errno.h>
 #include <sys/types.h>
 #include <sys/param.h>
 #include <sys/stat.h>
@@ -42,6 +43,10 @@
 #include <signal.h>
 #include <paths.h>
 #include <stdio.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <sys/mman.h>
 
 /* Define some paths for storing keys */
 #define PATH_PDP_USER_DIR ".pdp"
@@ -165,7 +170,7 @@ static unsigned char *nist_key_unwrap(unsigned char *enckey, size_t enckey_size,
 	if( ((r_array = malloc(8 * n)) == NULL)) return NULL;	
 
 	/* Setup the AES key */
-	if(AES_set_decrypt_key(kek, kek_size * 8, &aes_key) != 0) return NULL;
+	if(AES_set_decrypt_key(kek, kek_size * 8, &aes_key) != 0) goto cleanup;
 
 	/* Initialize A and the R array */
 	memcpy(A, enckey, 8);
@@ -296,17 +301,69 @@ cleanup:
 }
   
 
+/* HMAC-SHA1 keyed with the password.  The key XOR ipad and key XOR opad blocks are hashed once into
+ * the inner and outer states, so each PRF call below only hashes its message and the inner digest:
+ * two SHA1 compressions instead of the four, plus EVP setup, of a one-shot HMAC(). */
+struct pbkdf2_prf{
+
+	SHA_CTX inner;
+	SHA_CTX outer;
+};
+
+/* pbkdf2_prf_init: Precomputes the inner and outer HMAC states for password */
+static void pbkdf2_prf_init(struct pbkdf2_prf *prf, unsigned char *password, size_t password_len){
+
+	unsigned char pad[SHA_CBLOCK];
+	unsigned char hashed[SHA_DIGEST_LENGTH];
+	int k = 0;
+
+	/* Keys longer than a block are hashed first, as HMAC specifies */
+	if(password_len > SHA_CBLOCK){
+		SHA1(password, password_len, hashed);
+		password = hashed;
+		password_len = SHA_DIGEST_LENGTH;
+	}
+
+	memset(pad, 0x36, SHA_CBLOCK);
+	for(k = 0; k < password_len; k++) pad[k] ^= password[k];
+	SHA1_Init(&(prf->inner));
+	SHA1_Update(&(prf->inner), pad, SHA_CBLOCK);
+
+	memset(pad, 0x5c, SHA_CBLOCK);
+	for(k = 0; k < password_len; k++) pad[k] ^= password[k];
+	SHA1_Init(&(prf->outer));
+	SHA1_Update(&(prf->outer), pad, SHA_CBLOCK);
+
+	OPENSSL_cleanse(pad, SHA_CBLOCK);
+	OPENSSL_cleanse(hashed, SHA_DIGEST_LENGTH);
+}
+
+/* pbkdf2_prf: Computes HMAC-SHA1(password, in) into out, which may be the same buffer as in */
+static void pbkdf2_prf(struct pbkdf2_prf *prf, unsigned char *in, size_t in_len, unsigned char *out){
+
+	SHA_CTX ctx;
+
+	memcpy(&ctx, &(prf->inner), sizeof(SHA_CTX));
+	SHA1_Update(&ctx, in, in_len);
+	SHA1_Final(out, &ctx);
+
+	memcpy(&ctx, &(prf->outer), sizeof(SHA_CTX));
+	SHA1_Update(&ctx, out, SHA_DIGEST_LENGTH);
+	SHA1_Final(out, &ctx);
+
+	OPENSSL_cleanse(&ctx, sizeof(SHA_CTX));
+}
+
 /* PBKDF2_F: A support function for PBKDF2 below.  See the PKCS5 specification for details */
-static int PBKDF2_F(unsigned char *T, unsigned char *password, size_t password_len, unsigned char *salt, size_t salt_len, int c, int i){
+static int PBKDF2_F(unsigned char *T, struct pbkdf2_prf *prf, unsigned char *salt, size_t salt_len, int c, int i){
 
 	unsigned char U[SHA_DIGEST_LENGTH];
 	unsigned char *U1 = NULL;
 	unsigned int swapped_i = 0;
-	unsigned int U_len = 0;
 	int j = 0;
 	int k = 0;
 	
-	if(!T || !password || !password_len || !salt || !salt_len || !c) return 0;
+	if(!T || !prf || !salt || !salt_len || !c) return 0;
 	
 	if( ((U1 = malloc(salt_len + sizeof(unsigned int))) == NULL)) return 0;
 	
@@ -319,26 +376,21 @@ static int PBKDF2_F(unsigned char *T, unsigned char *password, size_t password_l
 	memcpy(U1 + salt_len, &swapped_i, sizeof(unsigned int));
 	
 	/* Perform the initial PRF, U_1 = PRF(P, S | i) */
-	HMAC(EVP_sha1(), password, password_len, U1, salt_len + sizeof(unsigned int), U, &U_len);
-	if(U_len != SHA_DIGEST_LENGTH) goto cleanup;
+	pbkdf2_prf(prf, U1, salt_len + sizeof(unsigned int), U);
 	
 	for(j = 0; j < c; j++){
 		/* XOR the last value of U into T, the final U value */
 		for(k = 0; k < SHA_DIGEST_LENGTH; k++) T[k] ^= U[k];
 		/* U_i = PRF(P, U_i-c) */
-		HMAC(EVP_sha1(), password, password_len, U, SHA_DIGEST_LENGTH, U, &U_len);
-		if(U_len != SHA_DIGEST_LENGTH) goto cleanup;
+		pbkdf2_prf(prf, U, SHA_DIGEST_LENGTH, U);
 	}
 	/* Perform the final XOR */
 	for(k = 0; k < SHA_DIGEST_LENGTH; k++) T[k] ^= U[k];
 	
+	OPENSSL_cleanse(U, SHA_DIGEST_LENGTH);
 	if(U1) sfree(U1, salt_len + sizeof(unsigned int));
 	
 	return 1;
-
-cleanup:
-	if(U1) sfree(U1, salt_len + sizeof(unsigned int));
-	return 0;
 }
 
 /* PBKDF2: The PKCS5-based password-based key derivation function.  It takes a password, salt, iteration count and
@@ -349,11 +401,14 @@ static unsigned char *PBKDF2(unsigned char *password, size_t password_len, unsig
 	unsigned int r = 0;
 	unsigned char *dk = NULL;
 	unsigned char T[SHA_DIGEST_LENGTH];
+	struct pbkdf2_prf prf;
 	size_t remaining_bytes = dkey_len;
 	int i = 0;
 
 	if(!password || !password_len || !salt || !salt_len || !c || !dkey_len) return NULL;
 
+	pbkdf2_prf_init(&prf, password, password_len);
+
 	if ( ((dk = malloc(dkey_len)) == NULL)) return NULL;
 
 	memset(dk, 0, dkey_len);
@@ -370,7 +425,7 @@ static unsigned char *PBKDF2(unsigned char *password, size_t password_len, unsig
 	/* Compute T_i */
 	for(i = 0; i < l; i++){
 		
-		if(!PBKDF2_F(T, password, password_len, salt, salt_len, c, i)) goto cleanup;
+		if(!PBKDF2_F(T, &prf, salt, salt_len, c, i)) goto cleanup;
 		
 		/* Add T_i to the derived key */
 		if(remaining_bytes >= SHA_DIGEST_LENGTH){
@@ -382,9 +437,13 @@ static unsigned char *PBKDF2(unsigned char *password, size_t password_len, unsig
 		}
 	}
 	
+	OPENSSL_cleanse(&prf, sizeof(struct pbkdf2_prf));
+	OPENSSL_cleanse(T, SHA_DIGEST_LENGTH);
+
 	return dk;
 	
 cleanup:
+	OPENSSL_cleanse(&prf, sizeof(struct pbkdf2_prf));
 	if(dk) sfree(dk, dkey_len);
 
 	return NULL;
@@ -678,6 +737,11 @@ int write_pdp_keypair(PDP_key *key, char *password,char *keypath){
 
 	
 
+	/* A bundle of the old key would be loaded ahead of the new PEM pair, so it goes first */
+	if(snprintf(pdpkeypath, MAXPATHLEN, "%s/%s", (keypath) ? keypath : ".pdp", PDP_KEY_BUNDLE_FILE) >= MAXPATHLEN) goto cleanup;
+	if(unlink(pdpkeypath) != 0 && errno != ENOENT) goto cleanup;
+	memset(pdpkeypath, 0, MAXPATHLEN);
+
 	/* Open, create and truncate the key files */
 	// if( snprintf(pdpkeypath, MAXPATHLEN, "%s/%s", pw->pw_dir, PathPDPPrivateKey) < 0 ) goto cleanup;
 	pri_key = fopen(PathPDPPrivateKey, "w");
@@ -730,6 +794,9 @@ int write_pdp_keypair(PDP_key *key, char *password,char *keypath){
 	if(!BN_bn2bin(key->g, gen)) goto cleanup;
 	fwrite(gen, gen_size, 1, pub_key);
 
+	/* The PEM pair stays authoritative, but a key written without its bundle would load slowly */
+	if(!write_pdp_key_bundle(key, password, keypath)) goto cleanup;
+
 	endpwent();
 	if(pri_key) fclose(pri_key);
 	if(pub_key) fclose(pub_key);
@@ -759,6 +826,258 @@ cleanup:
 	return 0;
 }
 
+/* write_pdp_key_bundle: Writes key, with its precomputed values, as a key bundle in keypath (or .pdp
+*  when keypath is NULL).  The bundle is written to a temporary file that is renamed into place.
+*  Returns 1 on success and 0 on failure.
+*/
+int write_pdp_key_bundle(PDP_key *key, char *password, char *keypath){
+
+	PDP_key_bundle_header header;
+	EVP_CIPHER_CTX *cctx = NULL;
+	const BIGNUM *n = NULL, *e = NULL, *d = NULL, *p = NULL, *q = NULL;
+	const BIGNUM *dmp1 = NULL, *dmq1 = NULL, *iqmp = NULL;
+	const BIGNUM *components[PDP_KEY_BUNDLE_COMPONENTS];
+	unsigned char *payload = NULL;
+	unsigned char *ciphertext = NULL;
+	unsigned char *dk = NULL;
+	unsigned char *ptr = NULL;
+	char bundlepath[MAXPATHLEN];
+	char tmppath[MAXPATHLEN];
+	size_t modulus_size = 0, payload_size = 0, entries = 0, width = 0, i = 0;
+	int len = 0, fd = -1;
+
+	if(!key || !key->rsa || !key->g || !key->v || !password) return 0;
+	if(!pdp_key_precompute(key) || !key->phi || !key->g_table) return 0;
+
+	if(snprintf(bundlepath, MAXPATHLEN, "%s/%s", (keypath) ? keypath : ".pdp", PDP_KEY_BUNDLE_FILE) >= MAXPATHLEN) return 0;
+	if(snprintf(tmppath, MAXPATHLEN, "%s%s", bundlepath, PDP_TAG_TMP_EXT) >= MAXPATHLEN) return 0;
+
+	RSA_get0_key(key->rsa, &n, &e, &d);
+	RSA_get0_factors(key->rsa, &p, &q);
+	RSA_get0_crt_params(key->rsa, &dmp1, &dmq1, &iqmp);
+	components[0] = n; components[1] = e; components[2] = d; components[3] = p; components[4] = q;
+	components[5] = dmp1; components[6] = dmq1; components[7] = iqmp; components[PDP_KEY_BUNDLE_G] = key->g; components[9] = key->phi;
+
+	modulus_size = BN_num_bytes(n);
+	entries = key->g_table_windows * PDP_FIXED_BASE_DIGITS;
+	payload_size = PDP_KEY_BUNDLE_V_SIZE + ((PDP_KEY_BUNDLE_COMPONENTS + 1 + entries) * modulus_size);
+
+	memset(&header, 0, sizeof(PDP_key_bundle_header));
+	memcpy(header.magic, PDP_KEY_BUNDLE_MAGIC, PDP_KEY_BUNDLE_MAGIC_SIZE);
+	header.version = PDP_KEY_BUNDLE_VERSION;
+	header.modulus_size = modulus_size;
+	header.window = PDP_FIXED_BASE_WINDOW;
+	header.table_windows = key->g_table_windows;
+	header.payload_size = payload_size;
+	if(!RAND_bytes(header.salt, PRF_KEY_SIZE)) goto cleanup;
+	if(!RAND_bytes(header.iv, PDP_KEY_BUNDLE_IV_SIZE)) goto cleanup;
+
+	if( ((payload = malloc(payload_size)) == NULL)) goto cleanup;
+	if( ((ciphertext = malloc(payload_size)) == NULL)) goto cleanup;
+	memset(payload, 0, payload_size);
+
+	/* Lay out the payload */
+	ptr = payload;
+	memcpy(ptr, key->v, PRF_KEY_SIZE);
+	ptr += PDP_KEY_BUNDLE_V_SIZE;
+	for(i = 0; i < PDP_KEY_BUNDLE_COMPONENTS; i++){
+		width = (i == PDP_KEY_BUNDLE_G) ? 2 * modulus_size : modulus_size;
+		if(!components[i]) goto cleanup;
+		if(BN_bn2lebinpad(components[i], ptr, width) < 0) goto cleanup;
+		ptr += width;
+	}
+	for(i = 0; i < entries; i++, ptr += modulus_size)
+		if(BN_bn2lebinpad(key->g_table[i], ptr, modulus_size) < 0) goto cleanup;
+
+	/* Generate a password-based key using PKCS5-PBKDF2 and seal the payload */
+	dk = PBKDF2((unsigned char *)password, strlen(password), header.salt, PRF_KEY_SIZE, 10000, PDP_KEY_BUNDLE_KEY_SIZE);
+	if(!dk) goto cleanup;
+	if( ((cctx = EVP_CIPHER_CTX_new()) == NULL)) goto cleanup;
+	if(!EVP_EncryptInit_ex(cctx, EVP_aes_256_gcm(), NULL, NULL, NULL)) goto cleanup;
+	if(!EVP_CIPHER_CTX_ctrl(cctx, EVP_CTRL_GCM_SET_IVLEN, PDP_KEY_BUNDLE_IV_SIZE, NULL)) goto cleanup;
+	if(!EVP_EncryptInit_ex(cctx, NULL, NULL, dk, header.iv)) goto cleanup;
+	if(!EVP_EncryptUpdate(cctx, NULL, &len, (unsigned char *)&header, offsetof(PDP_key_bundle_header, tag))) goto cleanup;
+	if(!EVP_EncryptUpdate(cctx, ciphertext, &len, payload, payload_size)) goto cleanup;
+	if(!EVP_EncryptFinal_ex(cctx, ciphertext + len, &len)) goto cleanup;
+	if(!EVP_CIPHER_CTX_ctrl(cctx, EVP_CTRL_GCM_GET_TAG, PDP_KEY_BUNDLE_TAG_SIZE, header.tag)) goto cleanup;
+
+	/* Write and rename into place */
+	if( ((fd = open(tmppath, O_WRONLY | O_CREAT | O_TRUNC, 0600)) < 0)) goto cleanup;
+	if(write(fd, &header, sizeof(PDP_key_bundle_header)) != sizeof(PDP_key_bundle_header)) goto cleanup;
+	if(write(fd, ciphertext, payload_size) != (ssize_t)payload_size) goto cleanup;
+	if(fsync(fd) != 0) goto cleanup;
+	close(fd);
+	fd = -1;
+	if(rename(tmppath, bundlepath) != 0) goto cleanup;
+
+	EVP_CIPHER_CTX_free(cctx);
+	sfree(dk, PDP_KEY_BUNDLE_KEY_SIZE);
+	sfree(payload, payload_size);
+	free(ciphertext);
+
+	return 1;
+
+cleanup:
+	fprintf(stderr, "ERROR: Did not write key bundle.\n");
+	if(fd >= 0){
+		close(fd);
+		unlink(tmppath);
+	}
+	if(cctx) EVP_CIPHER_CTX_free(cctx);
+	if(dk) sfree(dk, PDP_KEY_BUNDLE_KEY_SIZE);
+	if(payload) sfree(payload, payload_size);
+	if(ciphertext) free(ciphertext);
+
+	return 0;
+}
+
+/* bundle_matches_pubkey: Checks that rsa has the N and e of the public key in keypath (or .pdp when
+*  keypath is NULL), so a bundle left behind by an older key is not used in place of the key pair.
+*  Returns 1 if they match and 0 if not or if the public key cannot be read.
+*/
+static int bundle_matches_pubkey(char *keypath, RSA *rsa){
+
+	char pubpath[MAXPATHLEN];
+	FILE *pub_key = NULL;
+	RSA *pub = NULL;
+	int match = 0;
+
+	if(snprintf(pubpath, MAXPATHLEN, "%s/%s", (keypath) ? keypath : ".pdp", "pdp.pub") >= MAXPATHLEN) return 0;
+	if( ((pub_key = fopen(pubpath, "r")) == NULL)) return 0;
+	if( ((pub = PEM_read_RSAPublicKey(pub_key, NULL, NULL, NULL)) != NULL))
+		match = BN_cmp(RSA_get0_n(pub), RSA_get0_n(rsa)) == 0 && BN_cmp(RSA_get0_e(pub), RSA_get0_e(rsa)) == 0;
+	if(pub) RSA_free(pub);
+	fclose(pub_key);
+
+	return match;
+}
+
+/* read_pdp_key_bundle: Reads the key bundle in keypath (or .pdp when keypath is NULL) and returns a
+*  PDP_key with its precomputed values, ready for tagging.  The bundle is mapped and decrypted in a
+*  single pass; a wrong password or a modified bundle fails the GCM tag check, and a bundle whose N
+*  and e differ from the public key beside it is ignored.
+*  Returns an allocated PDP_key or NULL on failure.
+*/
+PDP_key *read_pdp_key_bundle(char *keypath, char *password){
+
+	PDP_key *key = NULL;
+	PDP_key_bundle_header header;
+	EVP_CIPHER_CTX *cctx = NULL;
+	BIGNUM *components[PDP_KEY_BUNDLE_COMPONENTS];
+	BN_CTX *ctx = NULL;
+	struct stat st;
+	unsigned char *map = NULL;
+	unsigned char *payload = NULL;
+	unsigned char *dk = NULL;
+	unsigned char *ptr = NULL;
+	char bundlepath[MAXPATHLEN];
+	size_t modulus_size = 0, payload_size = 0, entries = 0, map_size = 0, width = 0, i = 0;
+	int len = 0, fd = -1;
+
+	if(!password) return NULL;
+
+	memset(components, 0, sizeof(components));
+	if(snprintf(bundlepath, MAXPATHLEN, "%s/%s", (keypath) ? keypath : ".pdp", PDP_KEY_BUNDLE_FILE) >= MAXPATHLEN) return NULL;
+
+	if( ((fd = open(bundlepath, O_RDONLY)) < 0)) return NULL;
+	if(fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(PDP_key_bundle_header)) goto cleanup;
+	map_size = st.st_size;
+	if( ((map = mmap(NULL, map_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED)){
+		map = NULL;
+		goto cleanup;
+	}
+
+	/* Check the header before trusting any of its sizes */
+	memcpy(&header, map, sizeof(PDP_key_bundle_header));
+	if(memcmp(header.magic, PDP_KEY_BUNDLE_MAGIC, PDP_KEY_BUNDLE_MAGIC_SIZE) != 0) goto cleanup;
+	if(header.version != PDP_KEY_BUNDLE_VERSION) goto cleanup;
+	if(header.window != PDP_FIXED_BASE_WINDOW) goto cleanup;
+	modulus_size = header.modulus_size;
+	if(!modulus_size || modulus_size > (OPENSSL_RSA_MAX_MODULUS_BITS / 8)) goto cleanup;
+	if(!header.table_windows || header.table_windows > ((modulus_size * 8) + PDP_FIXED_BASE_WINDOW - 1) / PDP_FIXED_BASE_WINDOW) goto cleanup;
+	entries = header.table_windows * PDP_FIXED_BASE_DIGITS;
+	payload_size = PDP_KEY_BUNDLE_V_SIZE + ((PDP_KEY_BUNDLE_COMPONENTS + 1 + entries) * modulus_size);
+	if(header.payload_size != payload_size || map_size != sizeof(PDP_key_bundle_header) + payload_size) goto cleanup;
+
+	/* Decrypt and authenticate the payload */
+	if( ((payload = malloc(payload_size)) == NULL)) goto cleanup;
+	dk = PBKDF2((unsigned char *)password, strlen(password), header.salt, PRF_KEY_SIZE, 10000, PDP_KEY_BUNDLE_KEY_SIZE);
+	if(!dk) goto cleanup;
+	if( ((cctx = EVP_CIPHER_CTX_new()) == NULL)) goto cleanup;
+	if(!EVP_DecryptInit_ex(cctx, EVP_aes_256_gcm(), NULL, NULL, NULL)) goto cleanup;
+	if(!EVP_CIPHER_CTX_ctrl(cctx, EVP_CTRL_GCM_SET_IVLEN, PDP_KEY_BUNDLE_IV_SIZE, NULL)) goto cleanup;
+	if(!EVP_DecryptInit_ex(cctx, NULL, NULL, dk, header.iv)) goto cleanup;
+	if(!EVP_DecryptUpdate(cctx, NULL, &len, (unsigned char *)&header, offsetof(PDP_key_bundle_header, tag))) goto cleanup;
+	if(!EVP_DecryptUpdate(cctx, payload, &len, map + sizeof(PDP_key_bundle_header), payload_size)) goto cleanup;
+	if(!EVP_CIPHER_CTX_ctrl(cctx, EVP_CTRL_GCM_SET_TAG, PDP_KEY_BUNDLE_TAG_SIZE, header.tag)) goto cleanup;
+	if(EVP_DecryptFinal_ex(cctx, payload + len, &len) <= 0){
+		fprintf(stderr, "ERROR: Failed to decrypt key bundle.\n");
+		goto cleanup;
+	}
+
+	/* Rebuild the key from the payload */
+	if( ((key = malloc(sizeof(PDP_key))) == NULL)) goto cleanup;
+	memset(key, 0, sizeof(PDP_key));
+	if( ((key->v = malloc(PRF_KEY_SIZE)) == NULL)) goto cleanup;
+	ptr = payload;
+	memcpy(key->v, ptr, PRF_KEY_SIZE);
+	ptr += PDP_KEY_BUNDLE_V_SIZE;
+	for(i = 0; i < PDP_KEY_BUNDLE_COMPONENTS; i++){
+		width = (i == PDP_KEY_BUNDLE_G) ? 2 * modulus_size : modulus_size;
+		if( ((components[i] = BN_lebin2bn(ptr, width, NULL)) == NULL)) goto cleanup;
+		ptr += width;
+	}
+	BN_set_flags(components[2], BN_FLG_CONSTTIME);
+
+	if( ((key->rsa = RSA_new()) == NULL)) goto cleanup;
+	if(!RSA_set0_key(key->rsa, components[0], components[1], components[2])) goto cleanup;
+	components[0] = components[1] = components[2] = NULL;
+	if(!RSA_set0_factors(key->rsa, components[3], components[4])) goto cleanup;
+	components[3] = components[4] = NULL;
+	if(!RSA_set0_crt_params(key->rsa, components[5], components[6], components[7])) goto cleanup;
+	components[5] = components[6] = components[7] = NULL;
+	if(!bundle_matches_pubkey(keypath, key->rsa)){
+		fprintf(stderr, "WARNING: Ignoring %s, which holds a different key than the key pair.\n", bundlepath);
+		goto cleanup;
+	}
+	key->g = components[PDP_KEY_BUNDLE_G];
+	key->phi = components[9];
+	components[PDP_KEY_BUNDLE_G] = components[9] = NULL;
+
+	if( ((key->g_table = malloc(sizeof(BIGNUM *) * entries)) == NULL)) goto cleanup;
+	memset(key->g_table, 0, sizeof(BIGNUM *) * entries);
+	key->g_table_windows = header.table_windows;
+	for(i = 0; i < entries; i++, ptr += modulus_size)
+		if( ((key->g_table[i] = BN_lebin2bn(ptr, modulus_size, NULL)) == NULL)) goto cleanup;
+
+	/* The Montgomery context is opaque, so it is rebuilt from N */
+	if( ((ctx = BN_CTX_new()) == NULL)) goto cleanup;
+	if( ((key->mont_n = BN_MONT_CTX_new()) == NULL)) goto cleanup;
+	if(!BN_MONT_CTX_set(key->mont_n, RSA_get0_n(key->rsa), ctx)) goto cleanup;
+
+	BN_CTX_free(ctx);
+	EVP_CIPHER_CTX_free(cctx);
+	sfree(dk, PDP_KEY_BUNDLE_KEY_SIZE);
+	sfree(payload, payload_size);
+	munmap(map, map_size);
+	close(fd);
+
+	return key;
+
+cleanup:
+	for(i = 0; i < PDP_KEY_BUNDLE_COMPONENTS; i++)
+		if(components[i]) BN_clear_free(components[i]);
+	if(key) destroy_pdp_key(key);
+	if(ctx) BN_CTX_free(ctx);
+	if(cctx) EVP_CIPHER_CTX_free(cctx);
+	if(dk) sfree(dk, PDP_KEY_BUNDLE_KEY_SIZE);
+	if(payload) sfree(payload, payload_size);
+	if(map) munmap(map, map_size);
+	if(fd >= 0) close(fd);
+
+	return NULL;
+}
+
 /* pdp_create_new_keypair: Generates and writes a new PDP key pair to disk.
 *  returns an allocated and populated PDP_key structure or NULL on failure.
 */
@@ -927,7 +1246,6 @@ cleanup:
 PDP_key *pdp_get_keypair_temp(char* keypath,char* password){
 
 	PDP_key *key = NULL;
-	struct passwd *pw = NULL;
 	char pdpkeypath[MAXPATHLEN];
 	FILE *pri_key = NULL;
 	FILE *pub_key = NULL;
@@ -940,8 +1258,9 @@ PDP_key *pdp_get_keypair_temp(char* keypath,char* password){
 	strcpy(pdpprikey,keypath);
 	strcat(pdpprikey,"/pdp.pri");
 
-	if( ((pw = getpwuid(getuid())) == NULL) ) goto cleanup;
-	
+	/* Prefer the key bundle, which loads without parsing or precomputing anything */
+	if(password && ((key = read_pdp_key_bundle(keypath, password)) != NULL)) return key;
+
 	memset(pdpkeypath, 0, MAXPATHLEN);
 	
 	/* Create the paths to the PDP keys */
@@ -988,13 +1307,11 @@ PDP_key *pdp_get_keypair_temp(char* keypath,char* password){
 	
 	if(pri_key) fclose(pri_key);
 	if(pub_key) fclose(pub_key);
-	endpwent();
 	
 	return key;
 	
 cleanup:
 	fprintf(stderr, "ERROR: Unable to access your PDP keys.\n");
-	endpwent();
 	if(key) destroy_pdp_key(key);
 	if(pri_key) fclose(pri_key);
 	if(pub_key) fclose(pub_key);
@@ -1051,21 +1368,368 @@ cleanup:
 }
 
 /* destroy_pdp_key: Zero and free the memory in a PDP_key structure */
+/* destroy_g_table: Frees a fixed-base table of the given number of windows */
+static void destroy_g_table(BIGNUM **table, size_t windows){
+
+	size_t i = 0;
+
+	for(i = 0; i < windows * PDP_FIXED_BASE_DIGITS; i++)
+		if(table[i]) BN_clear_free(table[i]);
+	sfree(table, sizeof(BIGNUM *) * windows * PDP_FIXED_BASE_DIGITS);
+}
+
+/* build_g_table: Builds the fixed-base table of g for exponents below phi(N) into key.  Entry
+*  (i * PDP_FIXED_BASE_DIGITS) + j - 1 holds g^(j * 2^(w*i)) in Montgomery form.  Returns 1 on success
+*  and 0 on failure.
+*/
+static int build_g_table(PDP_key *key, BN_CTX *ctx){
+
+	BIGNUM **table = NULL;
+	BIGNUM *base = NULL;
+	size_t windows = 0, i = 0;
+	int j = 0;
+
+	windows = (BN_num_bits(key->phi) + PDP_FIXED_BASE_WINDOW - 1) / PDP_FIXED_BASE_WINDOW;
+	if( ((table = malloc(sizeof(BIGNUM *) * windows * PDP_FIXED_BASE_DIGITS)) == NULL)) return 0;
+	memset(table, 0, sizeof(BIGNUM *) * windows * PDP_FIXED_BASE_DIGITS);
+	if( ((base = BN_new()) == NULL)) goto cleanup;
+
+	/* base = g^(2^(w*i)); g is a square that was never reduced modulo N */
+	if(!BN_nnmod(base, key->g, RSA_get0_n(key->rsa), ctx)) goto cleanup;
+	if(!BN_to_montgomery(base, base, key->mont_n, ctx)) goto cleanup;
+	for(i = 0; i < windows; i++){
+		for(j = 0; j < PDP_FIXED_BASE_DIGITS; j++){
+			if( ((table[(i * PDP_FIXED_BASE_DIGITS) + j] = BN_new()) == NULL)) goto cleanup;
+			if(j == 0){
+				if(!BN_copy(table[i * PDP_FIXED_BASE_DIGITS], base)) goto cleanup;
+			}else{
+				if(!BN_mod_mul_montgomery(table[(i * PDP_FIXED_BASE_DIGITS) + j],
+					table[(i * PDP_FIXED_BASE_DIGITS) + j - 1], base, key->mont_n, ctx)) goto cleanup;
+			}
+		}
+		for(j = 0; j < PDP_FIXED_BASE_WINDOW; j++)
+			if(!BN_mod_mul_montgomery(base, base, base, key->mont_n, ctx)) goto cleanup;
+	}
+
+	BN_clear_free(base);
+	key->g_table = table;
+	key->g_table_windows = windows;
+
+	return 1;
+
+cleanup:
+	if(base) BN_clear_free(base);
+	destroy_g_table(table, windows);
+	return 0;
+}
+
 void destroy_pdp_key(PDP_key *key){
 	
 	if(!key) return;
 	if(key->rsa) RSA_free(key->rsa);
 	if(key->v)  sfree(key->v, PRF_KEY_SIZE);
 	if(key->g) destroy_pdp_generator(key->g);
+	if(key->phi) BN_clear_free(key->phi);
+	if(key->mont_n) BN_MONT_CTX_free(key->mont_n);
+	if(key->g_table) destroy_g_table(key->g_table, key->g_table_windows);
 	if(key) sfree(key, sizeof(PDP_key));
 	key = NULL;
 }
 
-/* generate_pdp_key: Generate a new PDP key pair and popular a PDP_key structure.
+/* pdp_key_precompute: Computes the values pdp_tag_block would otherwise derive from the key for
+*  every block: the Montgomery form of N and, when the private key is present, phi(N) and the
+*  fixed-base table of g.  Values already present are kept.  Returns 1 on success and 0 on failure.
+*/
+int pdp_key_precompute(PDP_key *key){
+
+	BN_CTX *ctx = NULL;
+	BIGNUM *r0 = NULL;
+	BIGNUM *r1 = NULL;
+
+	if(!key || !key->rsa || !RSA_get0_n(key->rsa)) return 0;
+
+	if( ((ctx = BN_CTX_new()) == NULL)) goto cleanup;
+
+	if(!key->mont_n){
+		if( ((key->mont_n = BN_MONT_CTX_new()) == NULL)) goto cleanup;
+		if(!BN_MONT_CTX_set(key->mont_n, RSA_get0_n(key->rsa), ctx)) goto cleanup;
+	}
+
+	if(!key->phi && RSA_get0_p(key->rsa) && RSA_get0_q(key->rsa)){
+		if( ((r0 = BN_new()) == NULL)) goto cleanup;
+		if( ((r1 = BN_new()) == NULL)) goto cleanup;
+		if( ((key->phi = BN_new()) == NULL)) goto cleanup;
+		if(!BN_sub(r0, RSA_get0_p(key->rsa), BN_value_one())) goto cleanup;	/* p-1 */
+		if(!BN_sub(r1, RSA_get0_q(key->rsa), BN_value_one())) goto cleanup;	/* q-1 */
+		if(!BN_mul(key->phi, r0, r1, ctx)) goto cleanup;	/* phi = (p-1)(q-1) */
+	}
+
+	/* Exponents of g are reduced modulo phi(N), so the table is only needed with the private key */
+	if(!key->g_table && key->phi && key->g)
+		if(!build_g_table(key, ctx)) goto cleanup;
+
+	if(r0) BN_clear_free(r0);
+	if(r1) BN_clear_free(r1);
+	BN_CTX_free(ctx);
+
+	return 1;
+
+cleanup:
+	if(key->mont_n) BN_MONT_CTX_free(key->mont_n);
+	key->mont_n = NULL;
+	if(key->phi) BN_clear_free(key->phi);
+	key->phi = NULL;
+	if(r0) BN_clear_free(r0);
+	if(r1) BN_clear_free(r1);
+	if(ctx) BN_CTX_free(ctx);
+
+	return 0;
+}
+
+/* pdp_key_replicate: Makes a deep copy of key with its precomputed values, copying those already
+*  computed rather than computing them again.  Every allocation is made by the calling thread,
+*  so a thread pinned to a NUMA node gets a copy in that node's memory.
+*  Returns an allocated PDP_key structure or NULL on failure.
+*/
+PDP_key *pdp_key_replicate(PDP_key *key){
+
+	PDP_key *replica = NULL;
+	size_t i = 0;
+
+	if(!key || !key->rsa || !key->g) return NULL;
+
+	if( (replica = malloc(sizeof(PDP_key))) == NULL) return NULL;
+	memset(replica, 0, sizeof(PDP_key));
+
+	if(RSA_get0_d(key->rsa))
+		replica->rsa = RSAPrivateKey_dup(key->rsa);
+	else
+		replica->rsa = RSAPublicKey_dup(key->rsa);
+	if(!replica->rsa) goto cleanup;
+	if( ((replica->g = BN_dup(key->g)) == NULL)) goto cleanup;
+	if(key->v){
+		if( ((replica->v = malloc(PRF_KEY_SIZE)) == NULL)) goto cleanup;
+		memcpy(replica->v, key->v, PRF_KEY_SIZE);
+	}
+	if(key->phi && ((replica->phi = BN_dup(key->phi)) == NULL)) goto cleanup;
+	if(key->g_table){
+		if( ((replica->g_table = malloc(sizeof(BIGNUM *) * key->g_table_windows * PDP_FIXED_BASE_DIGITS)) == NULL)) goto cleanup;
+		memset(replica->g_table, 0, sizeof(BIGNUM *) * key->g_table_windows * PDP_FIXED_BASE_DIGITS);
+		replica->g_table_windows = key->g_table_windows;
+		for(i = 0; i < key->g_table_windows * PDP_FIXED_BASE_DIGITS; i++)
+			if( ((replica->g_table[i] = BN_dup(key->g_table[i])) == NULL)) goto cleanup;
+	}
+	if(!pdp_key_precompute(replica)) goto cleanup;
+
+	return replica;
+
+cleanup:
+	destroy_pdp_key(replica);
+
+	return NULL;
+}
+
+/* The small odd primes candidates are sieved with, filled in once by sieve_init */
+static pthread_once_t sieve_once = PTHREAD_ONCE_INIT;
+static BN_ULONG sieve_primes[PDP_SIEVE_PRIMES];
+
+/* sieve_init: Finds the first PDP_SIEVE_PRIMES odd primes with the sieve of Eratosthenes */
+static void sieve_init(){
+
+	unsigned char *composite = NULL;
+	size_t limit = 16 * PDP_SIEVE_PRIMES;	/* Comfortably above the PDP_SIEVE_PRIMES'th prime */
+	size_t i = 0, j = 0;
+	int found = 0;
+
+	if( ((composite = calloc(limit, 1)) == NULL)) return;
+	for(i = 3; i < limit && found < PDP_SIEVE_PRIMES; i += 2){
+		if(composite[i]) continue;
+		sieve_primes[found++] = i;
+		for(j = i * i; j < limit; j += 2 * i) composite[j] = 1;
+	}
+	free(composite);
+}
+
+struct safe_prime_search{
+
+	int bits;					/* The size of the safe primes in bits */
+	BIGNUM *found[2];			/* The safe primes, p and q */
+	int numfound;
+	int done;					/* Set once both primes are found or on error */
+	int error;
+	pthread_mutex_t lock;
+};
+
+/* safe_prime_search_cb: Aborts a primality test in flight once the search is over */
+static int safe_prime_search_cb(int a, int b, BN_GENCB *cb){
+
+	struct safe_prime_search *search = BN_GENCB_get_arg(cb);
+
+	return !__atomic_load_n(&(search->done), __ATOMIC_ACQUIRE);
+}
+
+/* fermat_base2: Returns 1 if 2^(n-1) = 1 mod n, a cheap filter for composite n, and 0 otherwise */
+static int fermat_base2(BIGNUM *n, BIGNUM *r, BN_CTX *ctx){
+
+	BIGNUM *n1 = NULL;
+	int result = 0;
+
+	BN_CTX_start(ctx);
+	if( ((n1 = BN_CTX_get(ctx)) == NULL)) goto cleanup;
+	if(!BN_sub(n1, n, BN_value_one())) goto cleanup;
+	if(!BN_set_word(r, 2)) goto cleanup;
+	if(!BN_mod_exp(r, r, n1, n, ctx)) goto cleanup;
+	result = BN_is_one(r);
+
+cleanup:
+	BN_CTX_end(ctx);
+	return result;
+}
+
+/* safe_prime_worker: Searches for safe primes p = 2q' + 1 until the search is over.  Starting from
+*  a random odd q', candidates are stepped through by two.  The residues of the start modulo the
+*  small primes are computed once, so sieving a candidate costs a few thousand word operations: a
+*  candidate is dropped if q' or p has a small factor.  Survivors must pass a base 2 Fermat test on
+*  q' and p before the full Miller-Rabin tests.
+*/
+static void *safe_prime_worker(void *arg){
+
+	struct safe_prime_search *search = arg;
+	BN_CTX *ctx = NULL;
+	BN_GENCB *cb = NULL;
+	BIGNUM *start = NULL, *qp = NULL, *p = NULL, *r = NULL;
+	BN_ULONG *mods = NULL;
+	BN_ULONG delta = 0, m = 0;
+	int i = 0;
+
+	if( ((ctx = BN_CTX_new()) == NULL)) goto cleanup;
+	if( ((cb = BN_GENCB_new()) == NULL)) goto cleanup;
+	if( ((start = BN_new()) == NULL)) goto cleanup;
+	if( ((qp = BN_new()) == NULL)) goto cleanup;
+	if( ((p = BN_new()) == NULL)) goto cleanup;
+	if( ((r = BN_new()) == NULL)) goto cleanup;
+	if( ((mods = malloc(sizeof(BN_ULONG) * PDP_SIEVE_PRIMES)) == NULL)) goto cleanup;
+	BN_GENCB_set(cb, safe_prime_search_cb, search);
+
+	while(!__atomic_load_n(&(search->done), __ATOMIC_ACQUIRE)){
+
+		/* q' has its top two bits set, so p does and N = pq has its full length */
+		if(!BN_priv_rand(start, search->bits - 1, BN_RAND_TOP_TWO, BN_RAND_BOTTOM_ODD)) goto cleanup;
+		for(i = 0; i < PDP_SIEVE_PRIMES; i++){
+			if((mods[i] = BN_mod_word(start, sieve_primes[i])) == (BN_ULONG)-1) goto cleanup;
+		}
+
+		for(delta = 0; delta < PDP_SIEVE_MAX_DELTA; delta += 2){
+			if(__atomic_load_n(&(search->done), __ATOMIC_ACQUIRE)) break;
+
+			/* Drop candidates where q' = 0 or p = 2q' + 1 = 0 mod a small prime */
+			for(i = 0; i < PDP_SIEVE_PRIMES; i++){
+				m = (mods[i] + delta) % sieve_primes[i];
+				if(m == 0 || m == (sieve_primes[i] - 1) / 2) break;
+			}
+			if(i < PDP_SIEVE_PRIMES) continue;
+
+			if(!BN_copy(qp, start)) goto cleanup;
+			if(!BN_add_word(qp, delta)) goto cleanup;
+			if(BN_num_bits(qp) != search->bits - 1) break;
+			if(!BN_lshift1(p, qp)) goto cleanup;
+			if(!BN_add_word(p, 1)) goto cleanup;
+
+			if(!fermat_base2(qp, r, ctx) || !fermat_base2(p, r, ctx)) continue;
+			if(BN_check_prime(qp, ctx, cb) != 1) continue;
+			if(BN_check_prime(p, ctx, cb) != 1) continue;
+
+			pthread_mutex_lock(&(search->lock));
+			if(!search->done && (search->numfound == 0 || BN_cmp(search->found[0], p) != 0)){
+				if(!BN_copy(search->found[search->numfound], p)) search->error = 1;
+				search->numfound++;
+				if(search->numfound == 2 || search->error)
+					__atomic_store_n(&(search->done), 1, __ATOMIC_RELEASE);
+			}
+			pthread_mutex_unlock(&(search->lock));
+			break;
+		}
+	}
+
+	if(mods) free(mods);
+	BN_clear_free(r);
+	BN_clear_free(p);
+	BN_clear_free(qp);
+	BN_clear_free(start);
+	BN_GENCB_free(cb);
+	BN_CTX_free(ctx);
+
+	return NULL;
+
+cleanup:
+	pthread_mutex_lock(&(search->lock));
+	search->error = 1;
+	__atomic_store_n(&(search->done), 1, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&(search->lock));
+	if(mods) free(mods);
+	if(r) BN_clear_free(r);
+	if(p) BN_clear_free(p);
+	if(qp) BN_clear_free(qp);
+	if(start) BN_clear_free(start);
+	if(cb) BN_GENCB_free(cb);
+	if(ctx) BN_CTX_free(ctx);
+
+	return NULL;
+}
+
+/* pdp_generate_safe_primes: Generates two distinct safe primes p and q of bits bits, searching on
+*  numthreads threads at once; 0 uses one thread per online CPU, up to PDP_KEYGEN_MAX_THREADS.  The
+*  first two safe primes found by any thread are used, and the other threads are then cancelled.
+*  Returns 1 on success and 0 on failure.
+*/
+int pdp_generate_safe_primes(BIGNUM *p, BIGNUM *q, int bits, int numthreads){
+
+	struct safe_prime_search search;
+	pthread_t threads[PDP_KEYGEN_MAX_THREADS];
+	int started = 0;
+	int i = 0;
+
+	if(!p || !q || bits < 16) return 0;
+
+	if(numthreads <= 0) numthreads = sysconf(_SC_NPROCESSORS_ONLN);
+	if(numthreads <= 0) numthreads = 1;
+	if(numthreads > PDP_KEYGEN_MAX_THREADS) numthreads = PDP_KEYGEN_MAX_THREADS;
+
+	pthread_once(&sieve_once, sieve_init);
+	if(!sieve_primes[PDP_SIEVE_PRIMES - 1]) return 0;
+
+	memset(&search, 0, sizeof(struct safe_prime_search));
+	search.bits = bits;
+	search.found[0] = p;
+	search.found[1] = q;
+	pthread_mutex_init(&(search.lock), NULL);
+
+	for(i = 0; i < numthreads; i++){
+		if(pthread_create(&threads[i], NULL, safe_prime_worker, &search) != 0) break;
+		started++;
+	}
+	if(started == 0) search.error = 1;
+	for(i = 0; i < started; i++)
+		pthread_join(threads[i], NULL);
+
+	pthread_mutex_destroy(&(search.lock));
+
+	return (!search.error && search.numfound == 2);
+}
+
+/* generate_pdp_key: Generate a new PDP key pair of RSA_KEY_SIZE bits and popular a PDP_key structure.
 *  Returns an allocated PDP_key strucutre or NULL on failure.
 */
 PDP_key *generate_pdp_key(){
 
+	return generate_pdp_key_size(RSA_KEY_SIZE);
+}
+
+/* generate_pdp_key_size: Generates a new PDP key pair with a modulus of modulus_bits bits, as
+*  generate_pdp_key does.  Returns an allocated PDP_key structure or NULL on failure.
+*/
+PDP_key *generate_pdp_key_size(int modulus_bits){
+
 	PDP_key *key = NULL;
 	BN_CTX *ctx = NULL;
 	BIGNUM *r1 = NULL;
@@ -1080,6 +1744,7 @@ PDP_key *generate_pdp_key(){
 	BIGNUM *dmq1 = NULL;
 	BIGNUM *iqmp = NULL;
 
+	if(modulus_bits < 32) return NULL;
 	if( (key = malloc(sizeof(PDP_key))) == NULL) return NULL;
 	memset(key, 0, sizeof(PDP_key));
 	
@@ -1103,11 +1768,7 @@ PDP_key *generate_pdp_key(){
 
 
 	/* Generate two safe primes p and q */
-  	if(!BN_generate_prime_ex(p, (RSA_KEY_SIZE/2), 1, NULL, NULL, NULL)) goto cleanup;
-	if(!BN_is_prime_ex(p, BN_prime_checks, ctx, NULL)) goto cleanup;
-	
-  	if(!BN_generate_prime(q, (RSA_KEY_SIZE/2), 1, NULL, NULL, NULL, NULL)) goto cleanup;
-	if(!BN_is_prime(q, BN_prime_checks, NULL, ctx, NULL)) goto cleanup;
+	if(!pdp_generate_safe_primes(p, q, (modulus_bits/2), 0)) goto cleanup;
 	if(BN_cmp(p,q) == 0) goto cleanup;
 	
 	/* Create an RSA modulus N*/
@@ -1136,7 +1797,7 @@ PDP_key *generate_pdp_key(){
 	if(	(RSA_set0_crt_params(key->rsa,dmp1,dmq1,iqmp)==NULL)) goto cleanup;
 	
 #else
-	if( ((key->rsa = RSA_generate_key(RSA_KEY_SIZE, RSA_E, NULL, NULL)) == NULL)) goto cleanup;
+	if( ((key->rsa = RSA_generate_key(modulus_bits, RSA_E, NULL, NULL)) == NULL)) goto cleanup;
 #endif
 
 	/* Check the RSA key pair */
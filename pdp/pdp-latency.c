@@ -0,0 +1,435 @@
+/* 
+* pdp-latency.c
+*
+* Copyright (c) 2008, Zachary N J Peterson <zachary@jhu.edu>
+* All rights reserved.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*     * Redistributions of source code must retain the above copyright
+*       notice, this list of conditions and the following disclaimer.
+*     * Redistributions in binary form must reproduce the above copyright
+*       notice, this list of conditions and the following disclaimer in the
+*       documentation and/or other materials provided with the distribution.
+*     * The name of the Zachary N J Peterson may be used to endorse or promote products
+*       derived from this software without specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY ZACHARY N J PETERSON ``AS IS'' AND ANY
+* EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL ZACHARY N J PETERSON BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+
+/* pdp-latency.c contains the verifier's fingerprint of how long provers take to answer challenges.
+*  A prover reading c random blocks and their tags from its own disk answers in about
+*  base + c * block of a cost model of local disks; one fetching the data from elsewhere on demand,
+*  to pass audits without storing the file, answers slower.  Each proof's latency, from when its
+*  challenge was issued to when the proof came back, is compared to the model and kept, as the ratio
+*  of observed to expected, in a histogram and a moving average for the peer that sent it.  Proofs
+*  far slower than the model are flagged, and the per-peer distributions are reported for
+*  dashboards.  A tracker may be shared by threads.
+*/
+
+#include "pdp.h"
+#include <math.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+
+typedef struct PDP_latency_peer_struct PDP_latency_peer;
+
+struct PDP_latency_peer_struct{
+
+	char *name;
+	uint64_t proofs;
+	uint64_t outliers;
+	uint64_t blocks;
+	uint64_t fileblocks;
+	double total_ns;
+	double max_ns;
+	double ratio_mean;			/* Running mean of the ratios, by Welford */
+	double ratio_ewma;
+	uint64_t last_outlier_ns;
+	uint64_t bins[PDP_LATENCY_BINS];
+	int64_t next;				/* Next peer in the same hash bucket, or -1 */
+};
+
+struct PDP_latency_tracker_struct{
+
+	PDP_latency_model model;
+	pthread_mutex_t lock;
+
+	PDP_latency_peer *peers;
+	uint64_t numpeers;
+	uint64_t capacity;
+	int64_t *buckets;			/* Heads of the peer hash chains */
+	uint64_t numbuckets;
+};
+
+/* lookup_peer: Returns the index of the peer called name, or -1 if it has sent no proofs */
+static int64_t lookup_peer(PDP_latency_tracker *tracker, char *name){
+
+	int64_t p = 0;
+
+	for(p = tracker->buckets[pdp_hash_name(name) % tracker->numbuckets]; p >= 0; p = tracker->peers[p].next)
+		if(strcmp(tracker->peers[p].name, name) == 0) return p;
+
+	return -1;
+}
+
+/* find_peer: Returns the index of the peer called name, adding it if it is new, or -1 on error */
+static int64_t find_peer(PDP_latency_tracker *tracker, char *name){
+
+	PDP_latency_peer *peers = NULL;
+	int64_t *buckets = NULL;
+	uint64_t bucket = 0, i = 0, numbuckets = 0;
+	int64_t p = 0;
+
+	if( ((p = lookup_peer(tracker, name)) >= 0)) return p;
+
+	if(tracker->numpeers == tracker->capacity){
+		tracker->capacity = tracker->capacity ? tracker->capacity * 2 : 64;
+		if( ((peers = realloc(tracker->peers, tracker->capacity * sizeof(PDP_latency_peer))) == NULL)) return -1;
+		tracker->peers = peers;
+	}
+
+	/* Keep the chains short by doubling the buckets along with the peers */
+	if(tracker->numpeers >= tracker->numbuckets){
+		numbuckets = tracker->numbuckets * 2;
+		if( ((buckets = malloc(numbuckets * sizeof(int64_t))) == NULL)) return -1;
+		for(i = 0; i < numbuckets; i++) buckets[i] = -1;
+		for(i = 0; i < tracker->numpeers; i++){
+			bucket = pdp_hash_name(tracker->peers[i].name) % numbuckets;
+			tracker->peers[i].next = buckets[bucket];
+			buckets[bucket] = i;
+		}
+		free(tracker->buckets);
+		tracker->buckets = buckets;
+		tracker->numbuckets = numbuckets;
+	}
+
+	p = tracker->numpeers;
+	memset(&(tracker->peers[p]), 0, sizeof(PDP_latency_peer));
+	if( ((tracker->peers[p].name = strdup(name)) == NULL)) return -1;
+	bucket = pdp_hash_name(name) % tracker->numbuckets;
+	tracker->peers[p].next = tracker->buckets[bucket];
+	tracker->buckets[bucket] = p;
+	tracker->numpeers++;
+
+	return p;
+}
+
+/* ratio_bin: Returns the histogram bin of a ratio of observed to expected latency */
+static int ratio_bin(double ratio){
+
+	double bin = 0;
+
+	if(ratio <= 0) return 0;
+	bin = floor((log2(ratio) - PDP_LATENCY_MIN_OCTAVE) * PDP_LATENCY_BINS_PER_OCTAVE);
+	if(bin < 0) return 0;
+	if(bin >= PDP_LATENCY_BINS) return PDP_LATENCY_BINS - 1;
+
+	return (int)bin;
+}
+
+/* bin_bound: Returns the upper bound of the ratios in histogram bin */
+static double bin_bound(int bin){
+
+	return exp2(PDP_LATENCY_MIN_OCTAVE + ((double)(bin + 1) / PDP_LATENCY_BINS_PER_OCTAVE));
+}
+
+/* percentile: Returns the upper bound of the bin the fraction q of a peer's proofs fall in */
+static double percentile(PDP_latency_peer *peer, double q){
+
+	uint64_t rank = 0, seen = 0;
+	int i = 0;
+
+	if(!peer->proofs) return 0;
+
+	rank = (uint64_t)ceil(q * peer->proofs);
+	if(rank < 1) rank = 1;
+	for(i = 0; i < PDP_LATENCY_BINS; i++){
+		seen += peer->bins[i];
+		if(seen >= rank) break;
+	}
+	if(i == PDP_LATENCY_BINS) i--;
+
+	return bin_bound(i);
+}
+
+/* peer_stats: Fills stats from a peer's counters.  The tracker must be locked */
+static void peer_stats(PDP_latency_peer *peer, PDP_latency_stats *stats){
+
+	memset(stats, 0, sizeof(PDP_latency_stats));
+	stats->peer = peer->name;
+	stats->proofs = peer->proofs;
+	stats->outliers = peer->outliers;
+	stats->blocks = peer->blocks;
+	stats->fileblocks = peer->fileblocks;
+	stats->mean_ns = peer->proofs ? peer->total_ns / peer->proofs : 0;
+	stats->max_ns = peer->max_ns;
+	stats->ratio_mean = peer->ratio_mean;
+	stats->ratio_ewma = peer->ratio_ewma;
+	stats->ratio_p50 = percentile(peer, 0.50);
+	stats->ratio_p90 = percentile(peer, 0.90);
+	stats->ratio_p99 = percentile(peer, 0.99);
+	stats->last_outlier_ns = peer->last_outlier_ns;
+}
+
+/* pdp_latency_model_init: Sets a cost model to the defaults, PDP_LATENCY_BASE_US and
+*  PDP_LATENCY_BLOCK_US, flagging proofs PDP_LATENCY_OUTLIER times slower.
+*/
+void pdp_latency_model_init(PDP_latency_model *model){
+
+	if(!model) return;
+
+	model->base_ns = PDP_LATENCY_BASE_US * 1000.0;
+	model->block_ns = PDP_LATENCY_BLOCK_US * 1000.0;
+	model->outlier = PDP_LATENCY_OUTLIER;
+}
+
+/* pdp_latency_expected_ns: Returns the latency the model expects of a proof of c blocks */
+double pdp_latency_expected_ns(PDP_latency_model *model, uint64_t c){
+
+	if(!model) return 0;
+
+	return model->base_ns + (model->block_ns * c);
+}
+
+/* pdp_latency_model_calibrate: Fits the base and per-block cost of model to proofs of the local
+*  file filepath, with its tags in tagfilepath (filepath with a .tag extension if NULL), made with
+*  ctx for the given key.  Each of a few blocks and of MAGIC_NUM_CHALLENGE_BLOCKS (or every block of
+*  a smaller file) is proved PDP_LATENCY_CALIBRATE_ROUNDS times and the fastest of each kept.  It
+*  is meant to be run on a machine with disks like the provers', and the file is likely cached
+*  after the first round, so the model it gives is a lower bound.  Leaves the outlier factor
+*  alone.  Returns 1 on success, 0 on failure.
+*/
+int pdp_latency_model_calibrate(PDP_latency_model *model, PDP_ctx *ctx, PDP_key *key, char *filepath, char *tagfilepath){
+
+	PDP_challenge *challenge = NULL;
+	PDP_challenge *server_challenge = NULL;
+	PDP_proof *proof = NULL;
+	struct stat st;
+	uint64_t numfileblocks = 0, c[2] = {0, 0}, best[2] = {0, 0}, start = 0, elapsed = 0;
+	double block_ns = 0;
+	int i = 0, round = 0;
+
+	if(!model || !ctx || !key || !filepath) return 0;
+
+	if(stat(filepath, &st) < 0){
+		fprintf(stderr, "ERROR: Was not able to open %s for reading.\n", filepath);
+		return 0;
+	}
+	numfileblocks = (st.st_size + PDP_BLOCKSIZE - 1) / PDP_BLOCKSIZE;
+	if(numfileblocks < 2) return 0;
+
+	c[1] = (numfileblocks < MAGIC_NUM_CHALLENGE_BLOCKS) ? numfileblocks : MAGIC_NUM_CHALLENGE_BLOCKS;
+	c[0] = (c[1] / 16) ? c[1] / 16 : 1;
+
+	for(i = 0; i < 2; i++){
+		for(round = 0; round < PDP_LATENCY_CALIBRATE_ROUNDS; round++){
+			if( ((challenge = pdp_challenge(key, numfileblocks)) == NULL)) goto cleanup;
+			challenge->c = c[i];
+			if( ((server_challenge = sanitize_pdp_challenge(challenge)) == NULL)) goto cleanup;
+
+			start = pdp_monotonic_ns();
+			proof = pdp_ctx_prove_file(ctx, filepath, strlen(filepath), tagfilepath, tagfilepath ? strlen(tagfilepath) : 0,
+				server_challenge, key);
+			elapsed = pdp_monotonic_ns() - start;
+			if(!proof || !pdp_verify_proof(key, challenge, proof)) goto cleanup;
+			if(!best[i] || elapsed < best[i]) best[i] = elapsed;
+
+			destroy_pdp_proof(proof);
+			destroy_pdp_challenge(server_challenge);
+			destroy_pdp_challenge(challenge);
+			proof = NULL;
+			server_challenge = NULL;
+			challenge = NULL;
+		}
+	}
+
+	/* A line through the two points, kept to non-negative costs */
+	block_ns = (best[1] > best[0]) ? (double)(best[1] - best[0]) / (c[1] - c[0]) : (double)best[1] / c[1];
+	model->block_ns = block_ns;
+	model->base_ns = (best[0] > block_ns * c[0]) ? best[0] - (block_ns * c[0]) : 0;
+
+	return 1;
+
+cleanup:
+	if(proof) destroy_pdp_proof(proof);
+	if(server_challenge) destroy_pdp_challenge(server_challenge);
+	if(challenge) destroy_pdp_challenge(challenge);
+
+	return 0;
+}
+
+/* pdp_latency_tracker_new: Returns an allocated tracker of proof latencies against model (the
+*  defaults if NULL), or NULL on failure.
+*/
+PDP_latency_tracker *pdp_latency_tracker_new(PDP_latency_model *model){
+
+	PDP_latency_tracker *tracker = NULL;
+	uint64_t i = 0;
+
+	if( ((tracker = calloc(1, sizeof(PDP_latency_tracker))) == NULL)) return NULL;
+	if(model) memcpy(&(tracker->model), model, sizeof(PDP_latency_model));
+	else pdp_latency_model_init(&(tracker->model));
+
+	tracker->numbuckets = 64;
+	if( ((tracker->buckets = malloc(tracker->numbuckets * sizeof(int64_t))) == NULL)){
+		free(tracker);
+		return NULL;
+	}
+	for(i = 0; i < tracker->numbuckets; i++) tracker->buckets[i] = -1;
+	if(pthread_mutex_init(&(tracker->lock), NULL) != 0){
+		free(tracker->buckets);
+		free(tracker);
+		return NULL;
+	}
+
+	return tracker;
+}
+
+/* pdp_latency_tracker_free: Frees a tracker and the latencies it has kept */
+void pdp_latency_tracker_free(PDP_latency_tracker *tracker){
+
+	uint64_t i = 0;
+
+	if(!tracker) return;
+
+	for(i = 0; i < tracker->numpeers; i++) free(tracker->peers[i].name);
+	if(tracker->peers) free(tracker->peers);
+	if(tracker->buckets) free(tracker->buckets);
+	pthread_mutex_destroy(&(tracker->lock));
+	free(tracker);
+}
+
+/* pdp_latency_record: Records that peer proved c of a file's numfileblocks blocks latency_ns after
+*  being challenged.  Returns 1 if the proof took more than the model's outlier factor times the
+*  expected latency, 0 if not, or -1 on error.
+*/
+int pdp_latency_record(PDP_latency_tracker *tracker, char *peer, uint64_t c, uint64_t numfileblocks, uint64_t latency_ns){
+
+	PDP_latency_peer *p = NULL;
+	double expected = 0, ratio = 0;
+	int64_t i = 0;
+	int outlier = 0;
+
+	if(!tracker || !peer || !c) return -1;
+
+	expected = pdp_latency_expected_ns(&(tracker->model), c);
+	ratio = (expected > 0) ? latency_ns / expected : 0;
+	outlier = (expected > 0) && (ratio > tracker->model.outlier);
+
+	pthread_mutex_lock(&(tracker->lock));
+	if( ((i = find_peer(tracker, peer)) < 0)){
+		pthread_mutex_unlock(&(tracker->lock));
+		return -1;
+	}
+	p = &(tracker->peers[i]);
+
+	p->proofs++;
+	p->blocks += c;
+	p->fileblocks += numfileblocks;
+	p->total_ns += latency_ns;
+	if(latency_ns > p->max_ns) p->max_ns = latency_ns;
+	p->ratio_mean += (ratio - p->ratio_mean) / p->proofs;
+	p->ratio_ewma = (p->proofs == 1) ? ratio : p->ratio_ewma + (PDP_LATENCY_EWMA * (ratio - p->ratio_ewma));
+	p->bins[ratio_bin(ratio)]++;
+	if(outlier){
+		p->outliers++;
+		p->last_outlier_ns = latency_ns;
+	}
+	pthread_mutex_unlock(&(tracker->lock));
+
+	return outlier;
+}
+
+/* pdp_verify_proof_timed: Verifies proof as pdp_verify_proof does, first recording in tracker (if
+*  not NULL) that peer took from when challenge was issued until now to send it.  Sets outlier, if
+*  not NULL, to whether the proof was flagged as slow.  Returns 1 if verified, 0 otherwise.
+*/
+int pdp_verify_proof_timed(PDP_key *key, PDP_challenge *challenge, PDP_proof *proof, PDP_latency_tracker *tracker,
+	char *peer, int *outlier){
+
+	uint64_t now = pdp_monotonic_ns();
+	int slow = 0;
+
+	if(tracker && peer && challenge && challenge->issued_ns && now >= challenge->issued_ns)
+		slow = pdp_latency_record(tracker, peer, challenge->c, challenge->numfileblocks, now - challenge->issued_ns);
+	if(outlier) *outlier = (slow > 0);
+
+	return pdp_verify_proof(key, challenge, proof);
+}
+
+/* pdp_latency_peer_stats: Fills stats with the latencies of the proofs peer has sent.  Returns 1
+*  if the peer has sent any, 0 if not.
+*/
+int pdp_latency_peer_stats(PDP_latency_tracker *tracker, char *peer, PDP_latency_stats *stats){
+
+	int64_t p = 0;
+
+	if(!stats) return 0;
+	memset(stats, 0, sizeof(PDP_latency_stats));
+	if(!tracker || !peer) return 0;
+
+	pthread_mutex_lock(&(tracker->lock));
+	if( ((p = lookup_peer(tracker, peer)) >= 0)) peer_stats(&(tracker->peers[p]), stats);
+	pthread_mutex_unlock(&(tracker->lock));
+
+	return p >= 0;
+}
+
+/* pdp_latency_iterate: Calls fn with the latencies of each peer, in the order they first sent a
+*  proof, until it returns 0.  The tracker is locked and fn must not record into it.  Returns the
+*  peers visited, or -1 on error.
+*/
+int64_t pdp_latency_iterate(PDP_latency_tracker *tracker, int (*fn)(PDP_latency_stats *stats, void *arg), void *arg){
+
+	PDP_latency_stats stats;
+	uint64_t i = 0;
+	int64_t visited = 0;
+
+	if(!tracker || !fn) return -1;
+
+	pthread_mutex_lock(&(tracker->lock));
+	for(i = 0; i < tracker->numpeers; i++){
+		peer_stats(&(tracker->peers[i]), &stats);
+		visited++;
+		if(!fn(&stats, arg)) break;
+	}
+	pthread_mutex_unlock(&(tracker->lock));
+
+	return visited;
+}
+
+/* report_peer: Prints one peer's line of a latency report */
+static int report_peer(PDP_latency_stats *stats, void *arg){
+
+	fprintf((FILE *)arg, "%-24s %8llu %8llu %10.2f %10.2f %7.2f %7.2f %7.2f %7.2f %7.2f\n",
+		stats->peer, (unsigned long long)stats->proofs, (unsigned long long)stats->outliers,
+		stats->mean_ns / 1000000.0, stats->max_ns / 1000000.0, stats->ratio_mean, stats->ratio_ewma,
+		stats->ratio_p50, stats->ratio_p90, stats->ratio_p99);
+
+	return 1;
+}
+
+/* pdp_latency_report: Prints the model and a line of latencies per peer to out, for dashboards */
+void pdp_latency_report(PDP_latency_tracker *tracker, FILE *out){
+
+	if(!tracker || !out) return;
+
+	fprintf(out, "model: %.3f ms + %.3f ms per block, outliers over %.1fx\n",
+		tracker->model.base_ns / 1000000.0, tracker->model.block_ns / 1000000.0, tracker->model.outlier);
+	fprintf(out, "%-24s %8s %8s %10s %10s %7s %7s %7s %7s %7s\n",
+		"peer", "proofs", "slow", "mean ms", "max ms", "ratio", "ewma", "p50", "p90", "p99");
+	pdp_latency_iterate(tracker, report_peer, out);
+}
@@ -26,26 +26,1283 @@
 * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 */
 
-/* pdp-app is a simple user interface providing the fundemental PDP file operations and
-*  basic key management.  The application allows you to generate a PDP key pair, tag
-*  files and challenge and verify files that have been tagged.
+/* pdp-measurements is pdp-app with experiments for profiling, built with -pg as pdp-m: each
+*  option times one subsystem and prints what it found.  The benchmark suite comparing builds
+*  is pdp-bench.c, run by make bench.
 */
 
+#define _GNU_SOURCE
 #include "pdp.h"
 #include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <getopt.h>
+#include <pthread.h>
+#include <unistd.h>
 #include <sys/param.h>
 #include <sys/time.h>
 #include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
 
 static struct option longopts[] = {
 	{"gen-key", no_argument, NULL, 'g'}, //TODO optional argument for key location
 	{"tag", no_argument, NULL, 't'},
 	{"verify", no_argument, NULL, 'v'},
-	{"blocksize", no_argument, NULL ,'b'},
+	{"keypath", required_argument, NULL, 'K'},
+	{"password", required_argument, NULL, 'P'},
+	{"numa", required_argument, NULL, 'n'},
+	{"keygen-bench", required_argument, NULL, 'G'},
+	{"keyload-bench", no_argument, NULL, 'L'},
+	{"keycache-bench", required_argument, NULL, 'C'},
+	{"prover-bench", required_argument, NULL, 'R'},
+	{"tagger-bench", required_argument, NULL, 'W'},
+	{"tagcache-bench", required_argument, NULL, 'H'},
+	{"writer-bench", required_argument, NULL, 'X'},
+	{"scrub-bench", required_argument, NULL, 'V'},
+	{"challenge-bench", required_argument, NULL, 'A'},
+	{"scheduler-bench", required_argument, NULL, 'Q'},
+	{"catalog-bench", required_argument, NULL, 'O'},
+	{"latency-bench", required_argument, NULL, 'F'},
 	{NULL, 0, NULL, 0}
 };
 
+#define NUMA_BENCH_ROUNDS 4		/* Passes each worker makes over its blocks */
+
+struct numa_bench_worker{
+
+	PDP_key *key;			/* The key this worker tags with */
+	unsigned char *blocks;	/* The blocks this worker tags */
+	uint64_t numblocks;
+	char *filepath;			/* When set, the worker reads its own blocks from here */
+	uint64_t first_block;
+	int node;				/* The node to pin to and replicate the key on, or -1 */
+};
+
+#define KEYGEN_BENCH_TRIALS 3		/* Key pairs generated per method and key size */
+
+/* keygen_bench_run: Times generating the two safe primes of a modulus_bits RSA modulus, first with
+*  OpenSSL's sequential BN_generate_prime_ex, then with pdp_generate_safe_primes on one thread and on
+*  every CPU.  Safe prime search times vary widely, so the mean of KEYGEN_BENCH_TRIALS is printed.
+*/
+static void keygen_bench_run(int modulus_bits){
+
+	BIGNUM *p = BN_new(), *q = BN_new();
+	struct timeval tv1, tv2;
+	double total = 0;
+	int method = 0, trial = 0, ok = 1;
+	static const char *methods[] = {"openssl", "sieve-1", "sieve-all"};
+
+	if(!p || !q) goto cleanup;
+
+	for(method = 0; method < 3; method++){
+		total = 0;
+		for(trial = 0; trial < KEYGEN_BENCH_TRIALS && ok; trial++){
+			gettimeofday(&tv1, NULL);
+			if(method == 0)
+				ok = BN_generate_prime_ex(p, modulus_bits/2, 1, NULL, NULL, NULL) &&
+					BN_generate_prime_ex(q, modulus_bits/2, 1, NULL, NULL, NULL);
+			else
+				ok = pdp_generate_safe_primes(p, q, modulus_bits/2, (method == 1) ? 1 : 0);
+			gettimeofday(&tv2, NULL);
+			total += (double)(tv2.tv_sec - tv1.tv_sec) + ((double)(tv2.tv_usec - tv1.tv_usec) / 1000000);
+		}
+		if(!ok){
+			printf("keygen bits=%d %s failed\n", modulus_bits, methods[method]);
+			break;
+		}
+		printf("keygen bits=%d %-9s threads=%ld mean=%.3fs\n", modulus_bits, methods[method],
+			(method == 2) ? sysconf(_SC_NPROCESSORS_ONLN) : 1L, total / KEYGEN_BENCH_TRIALS);
+		fflush(stdout);
+	}
+
+cleanup:
+	if(p) BN_clear_free(p);
+	if(q) BN_clear_free(q);
+}
+
+#define KEYLOAD_BENCH_TRIALS 20	/* Key pairs loaded to time key loading */
+
+PDP_key *read_pdp_keypair_temp(FILE *pri_key, FILE *pub_key, char *password_in);
+
+/* keyload_bench_load: Loads the key in keypath ready for tagging, from the PEM pair followed by
+*  pdp_key_precompute when bundle is 0, or from the key bundle otherwise.
+*/
+static PDP_key *keyload_bench_load(char *keypath, char *password, int bundle){
+
+	PDP_key *key = NULL;
+	FILE *pri_key = NULL;
+	FILE *pub_key = NULL;
+	char path[MAXPATHLEN];
+
+	if(bundle) return read_pdp_key_bundle(keypath, password);
+
+	snprintf(path, MAXPATHLEN, "%s/pdp.pri", keypath);
+	pri_key = fopen(path, "r");
+	snprintf(path, MAXPATHLEN, "%s/pdp.pub", keypath);
+	pub_key = fopen(path, "r");
+	if(pri_key && pub_key) key = read_pdp_keypair_temp(pri_key, pub_key, password);
+	if(key && !pdp_key_precompute(key)){
+		destroy_pdp_key(key);
+		key = NULL;
+	}
+	if(pri_key) fclose(pri_key);
+	if(pub_key) fclose(pub_key);
+
+	return key;
+}
+
+/* keyload_bench_run: Times loading the key pair in keypath until it is ready for tagging, from the
+*  PEM pair and from a key bundle written to a temporary directory, so keypath is left untouched.
+*/
+static void keyload_bench_run(char *keypath, char *password){
+
+	const char *sources[] = {"pem", "bundle"};
+	PDP_key *key = NULL;
+	struct timeval tv1, tv2;
+	char bundledir[] = "/tmp/pdp-keyload-XXXXXX";
+	char path[MAXPATHLEN];
+	double total = 0, elapsed = 0, best = 0;
+	int trial = 0, source = 0;
+
+	if(!mkdtemp(bundledir)){
+		printf("keyload failed\n");
+		return;
+	}
+
+	for(source = 0; source < 2; source++){
+		if(source == 1){
+			/* Write the bundle from the key the PEM pair loads */
+			key = keyload_bench_load(keypath, password, 0);
+			if(!key || !write_pdp_key_bundle(key, password, bundledir)){
+				printf("keyload %s failed\n", sources[source]);
+				break;
+			}
+			destroy_pdp_key(key);
+		}
+		total = best = 0;
+		for(trial = 0; trial < KEYLOAD_BENCH_TRIALS; trial++){
+			gettimeofday(&tv1, NULL);
+			key = keyload_bench_load((source == 1) ? bundledir : keypath, password, source);
+			gettimeofday(&tv2, NULL);
+			if(!key){
+				printf("keyload %s failed\n", sources[source]);
+				goto cleanup;
+			}
+			destroy_pdp_key(key);
+			elapsed = (double)(tv2.tv_sec - tv1.tv_sec) + ((double)(tv2.tv_usec - tv1.tv_usec) / 1000000);
+			if(trial == 0 || elapsed < best) best = elapsed;
+			total += elapsed;
+		}
+
+		printf("keyload %-6s trials=%d mean=%.2fms min=%.2fms\n", sources[source], KEYLOAD_BENCH_TRIALS,
+			1000 * total / KEYLOAD_BENCH_TRIALS, 1000 * best);
+		fflush(stdout);
+	}
+
+cleanup:
+	snprintf(path, MAXPATHLEN, "%s/%s", bundledir, PDP_KEY_BUNDLE_FILE);
+	unlink(path);
+	rmdir(bundledir);
+}
+
+#define KEYCACHE_BENCH_REQUESTS 400	/* Key lookups made by the key cache benchmark */
+#define KEYCACHE_BENCH_RESIDENT 4		/* Tenants' keys the benchmark's budget holds */
+
+/* keycache_bench_run: Times key lookups for numtenants tenants, each with its own copy of the key
+*  in keypath as a key bundle under a temporary directory.  Lookups favour the first tenants, as a
+*  cluster serving a few hot tenants would; they are made once without the cache and once with a
+*  budget for KEYCACHE_BENCH_RESIDENT keys.
+*/
+static void keycache_bench_run(char *keypath, char *password, int numtenants){
+
+	PDP_key *key = NULL;
+	PDP_key_cache *cache = NULL;
+	PDP_key_cache_stats before, stats;
+	struct timeval tv1, tv2;
+	char basedir[] = "/tmp/pdp-keycache-XXXXXX";
+	char path[MAXPATHLEN];
+	size_t key_bytes = 0;
+	double elapsed = 0, u = 0;
+	int tenant = 0, request = 0, pass = 0;
+
+	if(!mkdtemp(basedir) || ((cache = pdp_key_cache_new(0)) == NULL)){
+		printf("keycache failed\n");
+		return;
+	}
+	if( ((key = keyload_bench_load(keypath, password, 0)) == NULL)) goto cleanup;
+	for(tenant = 0; tenant < numtenants; tenant++){
+		snprintf(path, MAXPATHLEN, "%s/%d", basedir, tenant);
+		if(mkdir(path, 0700) != 0 || !write_pdp_key_bundle(key, password, path)){
+			printf("keycache failed\n");
+			goto cleanup;
+		}
+	}
+	destroy_pdp_key(key);
+	key = NULL;
+
+	for(pass = 0; pass < 2; pass++){
+		/* Size the budget from a loaded key */
+		pdp_key_cache_set_budget(cache, 0);
+		if(pass == 1){
+			pdp_key_cache_set_budget(cache, SIZE_MAX);
+			snprintf(path, MAXPATHLEN, "%s/0", basedir);
+			pdp_key_cache_put(cache, pdp_key_cache_get(cache, path, password));
+			pdp_key_cache_stats(cache, &stats);
+			key_bytes = stats.bytes;
+			pdp_key_cache_flush(cache);
+			pdp_key_cache_set_budget(cache, key_bytes * KEYCACHE_BENCH_RESIDENT);
+		}
+		pdp_key_cache_stats(cache, &before);
+
+		srand(1);
+		gettimeofday(&tv1, NULL);
+		for(request = 0; request < KEYCACHE_BENCH_REQUESTS; request++){
+			u = (double)rand() / RAND_MAX;
+			tenant = (int)(numtenants * u * u * u) % numtenants;
+			snprintf(path, MAXPATHLEN, "%s/%d", basedir, tenant);
+			if( ((key = pdp_key_cache_get(cache, path, password)) == NULL)){
+				printf("keycache failed\n");
+				goto cleanup;
+			}
+			pdp_key_cache_put(cache, key);
+			key = NULL;
+		}
+		gettimeofday(&tv2, NULL);
+		elapsed = (double)(tv2.tv_sec - tv1.tv_sec) + ((double)(tv2.tv_usec - tv1.tv_usec) / 1000000);
+
+		pdp_key_cache_stats(cache, &stats);
+		printf("keycache tenants=%d budget=%zuKB mean=%.2fms hits=%llu misses=%llu evictions=%llu resident=%zuKB load=%.0fms\n",
+			numtenants, stats.budget / 1024, 1000 * elapsed / KEYCACHE_BENCH_REQUESTS,
+			(unsigned long long)(stats.hits - before.hits), (unsigned long long)(stats.misses - before.misses),
+			(unsigned long long)(stats.evictions - before.evictions), stats.bytes / 1024,
+			(stats.load_ns - before.load_ns) / 1000000.0);
+		fflush(stdout);
+	}
+
+cleanup:
+	if(key) destroy_pdp_key(key);
+	pdp_key_cache_free(cache);
+	for(tenant = 0; tenant < numtenants; tenant++){
+		snprintf(path, MAXPATHLEN, "%s/%d/%s", basedir, tenant, PDP_KEY_BUNDLE_FILE);
+		unlink(path);
+		snprintf(path, MAXPATHLEN, "%s/%d", basedir, tenant);
+		rmdir(path);
+	}
+	rmdir(basedir);
+}
+
+/* numa_bench_thread: Tags a worker's blocks NUMA_BENCH_ROUNDS times.  A pinned worker first moves to
+*  its node, then replicates the key and reads its blocks into memory it allocated itself.
+*/
+static void *numa_bench_thread(void *arg){
+
+	struct numa_bench_worker *worker = arg;
+	PDP_key *key = worker->key;
+	PDP_tag *tag = NULL;
+	FILE *file = NULL;
+	uint64_t i = 0;
+	int round = 0;
+
+	if(worker->node >= 0){
+		pdp_numa_bind_thread(worker->node);
+		key = pdp_key_replicate(worker->key);
+		if(!key) return NULL;
+		worker->blocks = malloc(worker->numblocks * PDP_BLOCKSIZE);
+		file = fopen(worker->filepath, "r");
+		if(!worker->blocks || !file) return NULL;
+		memset(worker->blocks, 0, worker->numblocks * PDP_BLOCKSIZE);
+		fseeko(file, (off_t)worker->first_block * PDP_BLOCKSIZE, SEEK_SET);
+		fread(worker->blocks, PDP_BLOCKSIZE, worker->numblocks, file);
+		fclose(file);
+	}
+
+	for(round = 0; round < NUMA_BENCH_ROUNDS; round++){
+		for(i = 0; i < worker->numblocks; i++){
+			tag = pdp_tag_block(key, worker->blocks + (i * PDP_BLOCKSIZE), PDP_BLOCKSIZE, worker->first_block + i);
+			if(tag) destroy_pdp_tag(tag);
+		}
+	}
+
+	if(worker->node >= 0){
+		destroy_pdp_key(key);
+		free(worker->blocks);
+	}
+
+	return NULL;
+}
+
+/* open_node_counter: Opens a counter of the calling thread's (and its future threads') memory
+*  accesses that were served by a remote NUMA node.  Returns -1 if the PMU does not support it.
+*/
+static int open_node_counter(unsigned long long result){
+
+	struct perf_event_attr attr;
+
+	memset(&attr, 0, sizeof(struct perf_event_attr));
+	attr.size = sizeof(struct perf_event_attr);
+	attr.type = PERF_TYPE_HW_CACHE;
+	attr.config = PERF_COUNT_HW_CACHE_NODE | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (result << 16);
+	attr.disabled = 1;
+	attr.inherit = 1;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+
+	return syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+/* numa_bench_run: Tags the blocks of a file on one worker per CPU and prints the throughput and the
+*  node-local and remote memory reads it caused.  Unpinned, the workers share the key and a block
+*  buffer the main thread allocated; pinned, each worker runs from node-local copies.
+*/
+static void numa_bench_run(char *filepath, PDP_key *key, uint64_t numfileblocks, int pinned){
+
+	struct numa_bench_worker *workers = NULL;
+	pthread_t *threads = NULL;
+	unsigned char *blocks = NULL;
+	FILE *file = NULL;
+	struct timeval tv1, tv2;
+	long numworkers = sysconf(_SC_NPROCESSORS_ONLN);
+	long i = 0;
+	uint64_t per_worker = 0;
+	long long local = -1, remote = -1;
+	int local_fd = -1, remote_fd = -1;
+	double elapsed = 0;
+
+	if(numworkers < 1) numworkers = 1;
+	if((uint64_t)numworkers > numfileblocks) numworkers = numfileblocks;
+	per_worker = numfileblocks / numworkers;
+
+	workers = calloc(numworkers, sizeof(struct numa_bench_worker));
+	threads = calloc(numworkers, sizeof(pthread_t));
+	if(!workers || !threads) goto cleanup;
+
+	if(!pinned){
+		blocks = calloc(numfileblocks, PDP_BLOCKSIZE);
+		file = fopen(filepath, "r");
+		if(!blocks || !file) goto cleanup;
+		fread(blocks, PDP_BLOCKSIZE, numfileblocks, file);
+		fclose(file);
+	}
+
+	for(i = 0; i < numworkers; i++){
+		workers[i].key = key;
+		workers[i].filepath = filepath;
+		workers[i].first_block = i * per_worker;
+		workers[i].numblocks = per_worker;
+		workers[i].blocks = pinned ? NULL : blocks + (workers[i].first_block * PDP_BLOCKSIZE);
+		workers[i].node = pinned ? pdp_numa_worker_node(i, numworkers) : -1;
+	}
+
+	/* "Node" cache events count memory reads by whether the local or a remote node served them */
+	local_fd = open_node_counter(PERF_COUNT_HW_CACHE_RESULT_ACCESS);
+	remote_fd = open_node_counter(PERF_COUNT_HW_CACHE_RESULT_MISS);
+	if(local_fd >= 0) ioctl(local_fd, PERF_EVENT_IOC_ENABLE, 0);
+	if(remote_fd >= 0) ioctl(remote_fd, PERF_EVENT_IOC_ENABLE, 0);
+
+	gettimeofday(&tv1, NULL);
+	for(i = 0; i < numworkers; i++)
+		pthread_create(&threads[i], NULL, numa_bench_thread, &workers[i]);
+	for(i = 0; i < numworkers; i++)
+		pthread_join(threads[i], NULL);
+	gettimeofday(&tv2, NULL);
+
+	if(local_fd >= 0 && read(local_fd, &local, sizeof(long long)) != sizeof(long long)) local = -1;
+	if(remote_fd >= 0 && read(remote_fd, &remote, sizeof(long long)) != sizeof(long long)) remote = -1;
+	elapsed = (double)(tv2.tv_sec - tv1.tv_sec) + ((double)(tv2.tv_usec - tv1.tv_usec) / 1000000);
+
+	printf("%-8s nodes=%d workers=%ld blocks/s=%.1f", pinned ? "pinned" : "unpinned",
+		pdp_numa_num_nodes(), numworkers, (double)(per_worker * numworkers * NUMA_BENCH_ROUNDS) / elapsed);
+	if(local >= 0 && remote >= 0)
+		printf(" node_reads=%lld remote_reads=%lld remote=%.2f%%\n", local, remote,
+			local ? (100.0 * remote / local) : 0.0);
+	else
+		printf(" node_reads=n/a remote_reads=n/a\n");
+
+cleanup:
+	if(local_fd >= 0) close(local_fd);
+	if(remote_fd >= 0) close(remote_fd);
+	if(blocks) free(blocks);
+	if(workers) free(workers);
+	if(threads) free(threads);
+}
+
+#define PROVER_BENCH_CLIENTS 32		/* Clients challenging at once in the prover benchmark */
+#define PROVER_BENCH_REQUESTS 4		/* Challenges each client makes */
+#define PROVER_BENCH_DEADLINE_MS 1000
+
+struct prover_bench_client{
+
+	PDP_ctx *ctx;			/* Prove in-process on this context, or */
+	char *socketpath;		/* ask the prover listening here */
+	char *filepath;
+	PDP_key *key;
+	uint64_t numfileblocks;
+	double *latencies;		/* Seconds each proof took; negative if none was returned */
+	int *statuses;
+	int verified;
+};
+
+/* prover_bench_client_run: Makes a client's challenges, one after another, and verifies the proofs */
+static void *prover_bench_client_run(void *arg){
+
+	struct prover_bench_client *client = arg;
+	PDP_challenge *challenge = NULL, *server_challenge = NULL;
+	PDP_proof *proof = NULL;
+	struct timeval tv1, tv2;
+	int request = 0;
+
+	for(request = 0; request < PROVER_BENCH_REQUESTS; request++){
+		challenge = pdp_challenge(client->key, client->numfileblocks);
+		server_challenge = challenge ? sanitize_pdp_challenge(challenge) : NULL;
+		if(!server_challenge) break;
+
+		gettimeofday(&tv1, NULL);
+		if(client->socketpath){
+			proof = pdp_prover_request_proof(client->socketpath, client->filepath, NULL, server_challenge, client->key,
+				PROVER_BENCH_DEADLINE_MS, &(client->statuses[request]));
+		}else{
+			proof = pdp_ctx_prove_file(client->ctx, client->filepath, strlen(client->filepath), NULL, 0,
+				server_challenge, client->key);
+			client->statuses[request] = proof ? PDP_PROVER_OK : PDP_PROVER_FAILED;
+		}
+		gettimeofday(&tv2, NULL);
+		client->latencies[request] = (double)(tv2.tv_sec - tv1.tv_sec) + ((double)(tv2.tv_usec - tv1.tv_usec) / 1000000);
+
+		if(proof && pdp_verify_proof(client->key, challenge, proof)) client->verified++;
+		if(proof) destroy_pdp_proof(proof);
+		destroy_pdp_challenge(challenge);
+		destroy_pdp_challenge(server_challenge);
+		proof = NULL;
+	}
+
+	return NULL;
+}
+
+/* compare_double: qsort comparison of doubles */
+static int compare_double(const void *a, const void *b){
+
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return (x > y) - (x < y);
+}
+
+/* prover_bench_serve: Runs a prover until it is stopped */
+static void *prover_bench_serve(void *arg){
+
+	pdp_prover_run((PDP_prover *)arg);
+
+	return NULL;
+}
+
+/* prover_bench_run: Has PROVER_BENCH_CLIENTS clients challenge a tagged file at once, first each
+*  proving in-process without limits, as every caller did before the prover daemon, then through a
+*  prover daemon on two workers with PROVER_BENCH_DEADLINE_MS deadlines.  Prints how many requests
+*  were answered in time, turned away and verified, and the latency of those that were proven.
+*/
+static void prover_bench_run(char *filepath, PDP_key *key, uint64_t numfileblocks){
+
+	struct prover_bench_client clients[PROVER_BENCH_CLIENTS];
+	pthread_t threads[PROVER_BENCH_CLIENTS];
+	pthread_t server;
+	double latencies[PROVER_BENCH_CLIENTS * PROVER_BENCH_REQUESTS];
+	int statuses[PROVER_BENCH_CLIENTS * PROVER_BENCH_REQUESTS];
+	char basedir[] = "/tmp/pdp-prover-XXXXXX";
+	char socketpath[MAXPATHLEN];
+	PDP_ctx *ctx = NULL;
+	PDP_prover *prover = NULL;
+	PDP_prover_stats stats;
+	int i = 0, pass = 0, numproven = 0, ontime = 0, busy = 0, expired = 0, verified = 0;
+	double proven[PROVER_BENCH_CLIENTS * PROVER_BENCH_REQUESTS];
+
+	if(!mkdtemp(basedir) || ((ctx = pdp_ctx_new()) == NULL)){
+		printf("prover failed\n");
+		return;
+	}
+	snprintf(socketpath, MAXPATHLEN, "%s/prover.sock", basedir);
+
+	for(pass = 0; pass < 2; pass++){
+		if(pass == 1){
+			if( ((prover = pdp_prover_new(ctx, socketpath, 2, 0, 0)) == NULL)){
+				printf("prover failed\n");
+				break;
+			}
+			pthread_create(&server, NULL, prover_bench_serve, prover);
+		}
+
+		memset(clients, 0, sizeof(clients));
+		for(i = 0; i < PROVER_BENCH_CLIENTS; i++){
+			clients[i].ctx = ctx;
+			clients[i].socketpath = pass ? socketpath : NULL;
+			clients[i].filepath = filepath;
+			clients[i].key = key;
+			clients[i].numfileblocks = numfileblocks;
+			clients[i].latencies = latencies + (i * PROVER_BENCH_REQUESTS);
+			clients[i].statuses = statuses + (i * PROVER_BENCH_REQUESTS);
+		}
+		for(i = 0; i < PROVER_BENCH_CLIENTS; i++)
+			pthread_create(&threads[i], NULL, prover_bench_client_run, &clients[i]);
+		for(i = 0; i < PROVER_BENCH_CLIENTS; i++)
+			pthread_join(threads[i], NULL);
+
+		numproven = ontime = busy = expired = verified = 0;
+		for(i = 0; i < PROVER_BENCH_CLIENTS; i++) verified += clients[i].verified;
+		for(i = 0; i < PROVER_BENCH_CLIENTS * PROVER_BENCH_REQUESTS; i++){
+			if(statuses[i] == PDP_PROVER_BUSY) busy++;
+			if(statuses[i] == PDP_PROVER_EXPIRED) expired++;
+			if(statuses[i] != PDP_PROVER_OK) continue;
+			proven[numproven++] = latencies[i];
+			if(latencies[i] * 1000 <= PROVER_BENCH_DEADLINE_MS) ontime++;
+		}
+		qsort(proven, numproven, sizeof(double), compare_double);
+
+		printf("%-10s clients=%d requests=%d proven=%d ontime=%d busy=%d expired=%d verified=%d",
+			pass ? "daemon" : "in-process", PROVER_BENCH_CLIENTS, PROVER_BENCH_CLIENTS * PROVER_BENCH_REQUESTS,
+			numproven, ontime, busy, expired, verified);
+		if(numproven)
+			printf(" p50=%.1fms p99=%.1fms max=%.1fms", 1000 * proven[numproven / 2],
+				1000 * proven[(numproven * 99) / 100], 1000 * proven[numproven - 1]);
+		printf("\n");
+		fflush(stdout);
+
+		if(pass == 1){
+			pdp_prover_stats(prover, &stats);
+			printf("daemon     admitted=%llu rejected=%llu expired=%llu completed=%llu failed=%llu block_cost=%.0fus mean_wait=%.1fms\n",
+				(unsigned long long)stats.admitted, (unsigned long long)stats.rejected,
+				(unsigned long long)stats.expired, (unsigned long long)stats.completed,
+				(unsigned long long)stats.failed, stats.block_cost * 1000000,
+				stats.completed ? (1000 * stats.queue_wait / stats.completed) : 0.0);
+			pdp_prover_stop(prover);
+			pthread_join(server, NULL);
+			pdp_prover_free(prover);
+		}
+	}
+
+	pdp_ctx_free(ctx);
+	rmdir(basedir);
+}
+
+#define TAGGER_BENCH_RUNS 5		/* Times the tagging daemon benchmark tags the file each way */
+
+/* tagger_bench_serve: Runs a tagging daemon until it is stopped */
+static void *tagger_bench_serve(void *arg){
+
+	pdp_tagger_run((PDP_tagger *)arg);
+
+	return NULL;
+}
+
+/* tagger_bench_time: Tags filepath into tagfilepath TAGGER_BENCH_RUNS times, in-process when
+*  socketpath is NULL, and returns the mean seconds per run, or -1 on failure.
+*/
+static double tagger_bench_time(char *socketpath, char *filepath, char *tagfilepath, char *keypath, char *password){
+
+	PDP_ctx *ctx = NULL;
+	struct timeval tv1, tv2;
+	int run = 0, ok = 1;
+
+	gettimeofday(&tv1, NULL);
+	for(run = 0; run < TAGGER_BENCH_RUNS && ok; run++){
+		if(socketpath){
+			ok = pdp_tagger_tag_file(socketpath, keypath, filepath, tagfilepath, NULL);
+		}else{
+			/* Like every cgo call today, each run starts cold and loads the key */
+			if( ((ctx = pdp_ctx_new()) == NULL)) return -1;
+			ctx->taggerpath[0] = '\0';
+			ok = pdp_ctx_tag_file(ctx, filepath, strlen(filepath), NULL, 0, keypath, password, 0);
+			pdp_ctx_free(ctx);
+			ctx = NULL;
+		}
+	}
+	gettimeofday(&tv2, NULL);
+
+	if(!ok) return -1;
+	return ((double)(tv2.tv_sec - tv1.tv_sec) + ((double)(tv2.tv_usec - tv1.tv_usec) / 1000000)) / TAGGER_BENCH_RUNS;
+}
+
+/* files_equal: Returns 1 if the files at a and b have the same contents and 0 otherwise */
+static int files_equal(char *a, char *b){
+
+	FILE *fa = fopen(a, "r"), *fb = fopen(b, "r");
+	int ca = 0, cb = 0, equal = (fa && fb);
+
+	while(equal){
+		ca = fgetc(fa);
+		cb = fgetc(fb);
+		if(ca != cb) equal = 0;
+		if(ca == EOF) break;
+	}
+	if(fa) fclose(fa);
+	if(fb) fclose(fb);
+
+	return equal;
+}
+
+/* tagger_bench_run: Times tagging a file in-process, loading the key each time as the cgo callers
+*  do, and through a tagging daemon on PDP_TAGGER_WORKERS workers, and checks both make the same tag file.
+*/
+static void tagger_bench_run(char *filepath, char *keypath, char *password){
+
+	PDP_ctx *ctx = NULL;
+	PDP_tagger *tagger = NULL;
+	PDP_tagger_stats stats;
+	pthread_t server;
+	char basedir[] = "/tmp/pdp-tagger-XXXXXX";
+	char socketpath[MAXPATHLEN];
+	char tagfilepath[MAXPATHLEN];
+	char daemontagfilepath[MAXPATHLEN];
+	double inprocess = 0, daemon = 0;
+	int served = 0;
+
+	if(!mkdtemp(basedir) || ((ctx = pdp_ctx_new()) == NULL)){
+		printf("tagger failed\n");
+		return;
+	}
+	snprintf(socketpath, MAXPATHLEN, "%s/tagger.sock", basedir);
+	snprintf(tagfilepath, MAXPATHLEN, "%s.tag", filepath);
+	snprintf(daemontagfilepath, MAXPATHLEN, "%s/daemon.tag", basedir);
+
+	if( ((tagger = pdp_tagger_new(ctx, socketpath, keypath, password, 0)) == NULL)){
+		printf("tagger failed\n");
+		goto cleanup;
+	}
+	if(pthread_create(&server, NULL, tagger_bench_serve, tagger) != 0) goto cleanup;
+	served = 1;
+
+	inprocess = tagger_bench_time(NULL, filepath, tagfilepath, keypath, password);
+	daemon = tagger_bench_time(socketpath, filepath, daemontagfilepath, keypath, password);
+	pdp_tagger_stats(tagger, &stats);
+
+	printf("tagger runs=%d in-process=%.1fms daemon=%.1fms blocks=%llu same_tags=%s\n", TAGGER_BENCH_RUNS,
+		1000 * inprocess, 1000 * daemon, (unsigned long long)stats.blocks,
+		files_equal(tagfilepath, daemontagfilepath) ? "yes" : "no");
+
+cleanup:
+	if(served){
+		pdp_tagger_stop(tagger);
+		pthread_join(server, NULL);
+	}
+	pdp_tagger_free(tagger);
+	pdp_ctx_free(ctx);
+	unlink(daemontagfilepath);
+	rmdir(basedir);
+}
+
+#define TAGCACHE_BENCH_PROOFS 50		/* Proofs over the hot file per pass */
+#define TAGCACHE_BENCH_BUDGET (64 << 20)
+
+/* tagcache_bench_run: Proves possession of filepath TAGCACHE_BENCH_PROOFS times, as an auditor
+*  challenging a hot file would, once without the tag cache and once with it.  Prints the mean time
+*  of a proof and, since E-PDP proofs are dominated by multiplying the tags together, the mean time
+*  of fetching the tags of one challenge on their own, with the cache's hits and misses.
+*/
+static void tagcache_bench_run(char *filepath, PDP_key *key, uint64_t numfileblocks){
+
+	PDP_ctx *ctx = NULL;
+	PDP_challenge *challenge = NULL;
+	PDP_challenge *server_challenge = NULL;
+	PDP_proof *proof = NULL;
+	PDP_tag *tag = NULL;
+	PDP_tag_cache_stats before, stats;
+	struct timeval tv1, tv2;
+	char tagfilepath[MAXPATHLEN];
+	uint64_t *indices = NULL;
+	double elapsed = 0, fetch = 0;
+	int pass = 0, i = 0, j = 0, verified = 0;
+	int tagfd = -1;
+
+	snprintf(tagfilepath, MAXPATHLEN, "%s.tag", filepath);
+	if( ((ctx = pdp_ctx_new()) == NULL) || ((tagfd = open(tagfilepath, O_RDONLY)) < 0)){
+		printf("tagcache failed\n");
+		goto cleanup;
+	}
+
+	for(pass = 0; pass < 2; pass++){
+		pdp_tag_cache_set_budget(ctx->tagcache, pass ? TAGCACHE_BENCH_BUDGET : 0);
+		pdp_tag_cache_flush(ctx->tagcache);
+		pdp_tag_cache_stats(ctx->tagcache, &before);
+		verified = 0;
+		elapsed = fetch = 0;
+		for(i = 0; i < TAGCACHE_BENCH_PROOFS; i++){
+			if( ((challenge = pdp_challenge(key, numfileblocks)) == NULL)) goto cleanup;
+			if( ((server_challenge = sanitize_pdp_challenge(challenge)) == NULL)) goto cleanup;
+
+			gettimeofday(&tv1, NULL);
+			proof = pdp_ctx_prove_file(ctx, filepath, strlen(filepath), NULL, 0, server_challenge, key);
+			gettimeofday(&tv2, NULL);
+			elapsed += (double)(tv2.tv_sec - tv1.tv_sec) + ((double)(tv2.tv_usec - tv1.tv_usec) / 1000000);
+			if(proof) verified += pdp_verify_proof(key, challenge, proof);
+
+			/* The same challenge's tags again, without the proof arithmetic */
+			if( ((indices = generate_prp_pi(server_challenge)) == NULL)) goto cleanup;
+			gettimeofday(&tv1, NULL);
+			for(j = 0; j < server_challenge->c; j++){
+				if( ((tag = pdp_tag_cache_get(ctx->tagcache, tagfd, indices[j])) == NULL)) goto cleanup;
+				pdp_tag_cache_put(ctx->tagcache, tag);
+			}
+			gettimeofday(&tv2, NULL);
+			fetch += (double)(tv2.tv_sec - tv1.tv_sec) + ((double)(tv2.tv_usec - tv1.tv_usec) / 1000000);
+
+			sfree(indices, server_challenge->c * sizeof(uint64_t));
+			indices = NULL;
+			if(proof) destroy_pdp_proof(proof);
+			destroy_pdp_challenge(server_challenge);
+			destroy_pdp_challenge(challenge);
+			proof = NULL;
+			server_challenge = challenge = NULL;
+		}
+
+		pdp_tag_cache_stats(ctx->tagcache, &stats);
+		printf("tagcache budget=%zuKB proof=%.2fms tags=%.3fms verified=%d/%d hits=%llu misses=%llu resident=%zuKB\n",
+			stats.budget / 1024, 1000 * elapsed / TAGCACHE_BENCH_PROOFS, 1000 * fetch / TAGCACHE_BENCH_PROOFS,
+			verified, TAGCACHE_BENCH_PROOFS, (unsigned long long)(stats.hits - before.hits),
+			(unsigned long long)(stats.misses - before.misses), stats.bytes / 1024);
+		fflush(stdout);
+	}
+
+cleanup:
+	if(server_challenge){
+		if(indices) sfree(indices, server_challenge->c * sizeof(uint64_t));
+		destroy_pdp_challenge(server_challenge);
+	}
+	if(challenge) destroy_pdp_challenge(challenge);
+	if(proof) destroy_pdp_proof(proof);
+	if(tagfd >= 0) close(tagfd);
+	pdp_ctx_free(ctx);
+}
+
+#define WRITER_BENCH_SYNC_BYTES (64 << 20)	/* Durability point of the last pass */
+
+/* writer_bench_run: Writes numtags tag records through the tag writer three ways: a record at a
+*  time, as tagging did before batches, in batches of PDP_TAG_WRITER_BATCH, and in batches with the
+*  file flushed to disk every WRITER_BENCH_SYNC_BYTES.  The tags are random rather than computed, so
+*  only the writing is timed.
+*/
+static void writer_bench_run(uint64_t numtags){
+
+	PDP_tag_header header;
+	PDP_tag_batch *batch = NULL;
+	PDP_tag_writer *writer = NULL;
+	PDP_tag *tag = NULL;
+	struct timeval tv1, tv2;
+	char path[] = "/tmp/pdp-writer-XXXXXX";
+	unsigned char *record = NULL;
+	double elapsed = 0;
+	uint64_t i = 0, n = 0;
+	int fd = -1, pass = 0;
+
+	/* The layout of tags under a 1024-bit key */
+	memset(&header, 0, sizeof(PDP_tag_header));
+	memcpy(header.magic, PDP_TAG_MAGIC, PDP_TAG_MAGIC_SIZE);
+	header.version = PDP_TAG_VERSION;
+	header.tim_size = RSA_KEY_SIZE / 8;
+	header.index_size = sizeof(uint64_t);
+	header.index_prf_size = SHA_DIGEST_LENGTH;
+	header.record_size = header.tim_size + header.index_size + header.index_prf_size;
+
+	if( ((fd = mkstemp(path)) < 0)) goto cleanup;
+	close(fd);
+	if( ((batch = pdp_tag_batch_new(&header, PDP_TAG_WRITER_BATCH)) == NULL)) goto cleanup;
+	if( ((record = malloc(header.record_size)) == NULL)) goto cleanup;
+	if( ((tag = generate_pdp_tag()) == NULL)) goto cleanup;
+	tag->index_prf_size = header.index_prf_size;
+	if( ((tag->index_prf = malloc(tag->index_prf_size)) == NULL)) goto cleanup;
+	for(i = 0; i < batch->capacity; i++){
+		if(!BN_rand(tag->Tim, RSA_KEY_SIZE, BN_RAND_TOP_ANY, BN_RAND_BOTTOM_ANY)) goto cleanup;
+		if(!RAND_bytes(tag->index_prf, tag->index_prf_size)) goto cleanup;
+		tag->index = i;
+		if(!pdp_tag_batch_set(batch, i, tag)) goto cleanup;
+	}
+	batch->count = batch->capacity;
+
+	for(pass = 0; pass < 3; pass++){
+		if( ((writer = pdp_tag_writer_open(path, 0)) == NULL)) goto cleanup;
+		if(pass == 2) pdp_tag_writer_set_sync(writer, WRITER_BENCH_SYNC_BYTES);
+
+		gettimeofday(&tv1, NULL);
+		if(!pdp_tag_writer_append(writer, (unsigned char *)&header, PDP_TAG_HEADER_SIZE)) goto cleanup;
+		for(i = 0; i < numtags; i += n){
+			n = numtags - i;
+			if(n > batch->count) n = batch->count;
+			if(pass == 0){
+				/* One record at a time, each encoded from its own tag */
+				n = 1;
+				tag->index = i;
+				if(!pdp_tag_record_encode(&header, tag, record)) goto cleanup;
+				if(!pdp_tag_writer_append(writer, record, header.record_size)) goto cleanup;
+			}else{
+				if(!pdp_tag_writer_append_batch(writer, &header, batch, 0, n)) goto cleanup;
+			}
+		}
+		if(!pdp_tag_writer_close(writer)){
+			writer = NULL;
+			goto cleanup;
+		}
+		writer = NULL;
+		gettimeofday(&tv2, NULL);
+		elapsed = (double)(tv2.tv_sec - tv1.tv_sec) + ((double)(tv2.tv_usec - tv1.tv_usec) / 1000000);
+
+		printf("writer %s tags=%llu time=%.3fs rate=%.1fMB/s\n",
+			(pass == 0) ? "record" : ((pass == 1) ? "batch" : "batch+sync"), (unsigned long long)numtags,
+			elapsed, ((double)numtags * header.record_size) / (1024 * 1024) / elapsed);
+		fflush(stdout);
+	}
+
+cleanup:
+	if(pass < 3) printf("writer failed\n");
+	if(writer) pdp_tag_writer_close(writer);
+	if(tag) destroy_pdp_tag(tag);
+	if(record) free(record);
+	if(batch) pdp_tag_batch_free(batch);
+	unlink(path);
+}
+
+/* scrub_bench_time: Scrubs filepath on one thread in batches of batch_blocks, prints the time and
+*  throughput, and returns the result, or NULL on failure.
+*/
+static PDP_scrub_result *scrub_bench_time(PDP_ctx *ctx, char *filepath, char *keypath, char *password, uint64_t batch_blocks){
+
+	PDP_scrub_result *result = NULL;
+
+	if( ((result = pdp_ctx_scrub_file(ctx, filepath, NULL, keypath, password, 1, batch_blocks)) == NULL)){
+		printf("scrub failed\n");
+		return NULL;
+	}
+	printf("scrub batch=%llu blocks=%llu time=%.2fs rate=%.1fMB/s corrupt=%llu errors=%llu\n",
+		(unsigned long long)batch_blocks, (unsigned long long)result->numblocks, result->elapsed,
+		(result->numblocks * PDP_BLOCKSIZE) / (result->elapsed * 1024 * 1024),
+		(unsigned long long)result->corrupt, (unsigned long long)result->errors);
+
+	return result;
+}
+
+#define SCRUB_BENCH_CORRUPT 4			/* Blocks corrupted for the scrub to find */
+
+/* scrub_bench_run: Scrubs a copy of filepath checking one tag at a time and in batches of
+*  PDP_SCRUB_BATCH_BLOCKS, then flips a byte of SCRUB_BENCH_CORRUPT blocks, checks the batched
+*  scrub finds their batches and times localizing them with pdp_ctx_locate_corrupt.
+*/
+static void scrub_bench_run(char *filepath, char *keypath, char *password){
+
+	PDP_ctx *ctx = NULL;
+	PDP_scrub_result *result = NULL;
+	PDP_locate_result *located = NULL;
+	char basedir[] = "/tmp/pdp-scrub-XXXXXX";
+	char copypath[MAXPATHLEN];
+	char tagfilepath[MAXPATHLEN];
+	unsigned char buf[PDP_BLOCKSIZE];
+	FILE *in = NULL, *out = NULL;
+	uint64_t corrupt[SCRUB_BENCH_CORRUPT];
+	uint64_t numblocks = 0;
+	size_t n = 0;
+	int c = 0, i = 0, found = 0;
+
+	if(!mkdtemp(basedir) || ((ctx = pdp_ctx_new()) == NULL)){
+		printf("scrub failed\n");
+		return;
+	}
+	snprintf(copypath, MAXPATHLEN, "%s/data", basedir);
+	snprintf(tagfilepath, MAXPATHLEN, "%s/data.tag", basedir);
+
+	if( ((in = fopen(filepath, "r")) == NULL)) goto cleanup;
+	if( ((out = fopen(copypath, "w")) == NULL)) goto cleanup;
+	while((n = fread(buf, 1, sizeof(buf), in)) > 0)
+		if(fwrite(buf, 1, n, out) != n) goto cleanup;
+	fclose(out);
+	out = NULL;
+	if(!pdp_ctx_tag_file(ctx, copypath, strlen(copypath), NULL, 0, keypath, password, 0)) goto cleanup;
+
+	pdp_scrub_result_free(scrub_bench_time(ctx, copypath, keypath, password, 1));
+	if( ((result = scrub_bench_time(ctx, copypath, keypath, password, PDP_SCRUB_BATCH_BLOCKS)) == NULL)) goto cleanup;
+	numblocks = result->numblocks;
+	pdp_scrub_result_free(result);
+
+	/* Flip a byte in SCRUB_BENCH_CORRUPT blocks spread over the file */
+	if( ((out = fopen(copypath, "r+")) == NULL)) goto cleanup;
+	for(i = 0; i < SCRUB_BENCH_CORRUPT; i++){
+		corrupt[i] = (numblocks / (SCRUB_BENCH_CORRUPT + 1)) * (i + 1) + i;
+		fseeko(out, corrupt[i] * PDP_BLOCKSIZE, SEEK_SET);
+		c = fgetc(out);
+		fseeko(out, corrupt[i] * PDP_BLOCKSIZE, SEEK_SET);
+		fputc(c ^ 0xff, out);
+	}
+	fclose(out);
+	out = NULL;
+
+	if( ((result = scrub_bench_time(ctx, copypath, keypath, password, PDP_SCRUB_BATCH_BLOCKS)) == NULL)) goto cleanup;
+	found = 1;
+	for(i = 0; i < SCRUB_BENCH_CORRUPT; i++)
+		if(result->status[corrupt[i] / result->batch_blocks] != PDP_SCRUB_CORRUPT) found = 0;
+	printf("scrub corrupted=%d found=%s\n", SCRUB_BENCH_CORRUPT, found ? "yes" : "no");
+	pdp_scrub_result_free(result);
+
+	/* Localize them over the whole file */
+	if( ((located = pdp_ctx_locate_corrupt(ctx, copypath, NULL, keypath, password, 0, 0)) == NULL)) goto cleanup;
+	found = (located->numbad == SCRUB_BENCH_CORRUPT);
+	for(i = 0; found && i < SCRUB_BENCH_CORRUPT; i++)
+		if(located->bad[i] != corrupt[i]) found = 0;
+	printf("locate blocks=%llu checks=%llu time=%.2fs bad=%llu exact=%s\n", (unsigned long long)located->numblocks,
+		(unsigned long long)located->checks, located->elapsed, (unsigned long long)located->numbad, found ? "yes" : "no");
+	pdp_locate_result_free(located);
+
+cleanup:
+	if(in) fclose(in);
+	if(out) fclose(out);
+	pdp_ctx_free(ctx);
+	unlink(tagfilepath);
+	unlink(copypath);
+	rmdir(basedir);
+}
+
+#define CHALLENGE_BENCH_TRIALS 10000	/* Simulated audits per detection probability */
+
+/* challenge_bench_simulate: Returns the fraction of CHALLENGE_BENCH_TRIALS simulated audits
+*  sampling c distinct blocks of numfileblocks, of which the first bad are bad, that sample a bad one.
+*/
+static double challenge_bench_simulate(uint64_t numfileblocks, uint64_t bad, uint64_t c){
+
+	uint64_t trial = 0, j = 0, caught = 0;
+	uint64_t remaining = 0, badleft = 0;
+
+	for(trial = 0; trial < CHALLENGE_BENCH_TRIALS; trial++){
+		/* Draw c blocks without replacement, keeping only how many bad ones are left */
+		remaining = numfileblocks;
+		badleft = bad;
+		for(j = 0; j < c; j++){
+			if((((uint64_t)random() << 31) | random()) % remaining < badleft){
+				caught++;
+				break;
+			}
+			remaining--;
+		}
+	}
+
+	return (double)caught / CHALLENGE_BENCH_TRIALS;
+}
+
+/* challenge_bench_run: Prints the challenge size pdp_challenge_size picks for a file of
+*  numfileblocks blocks at the detection probabilities of the default challenge policy, the
+*  detection rate of simulated audits of that size, and the blocks read against
+*  MAGIC_NUM_CHALLENGE_BLOCKS.
+*/
+static void challenge_bench_run(uint64_t numfileblocks){
+
+	PDP_challenge_policy policy;
+	PDP_peer_history honest = {PDP_POLICY_HONEST_STREAK, 0, PDP_POLICY_HONEST_STREAK};
+	PDP_peer_history failed = {1, 1, 0};
+	struct { const char *name; PDP_peer_history *peer; } tiers[] = {{"new", NULL}, {"honest", &honest}, {"failed", &failed}};
+	double detection = 0;
+	uint64_t c = 0, bad = 0, fixed = 0;
+	int i = 0;
+
+	pdp_challenge_policy_init(&policy);
+	bad = policy.corrupt_fraction * numfileblocks;
+	if(bad < policy.corrupt_fraction * numfileblocks) bad++;
+	if(bad < 1) bad = 1;
+	fixed = (numfileblocks < MAGIC_NUM_CHALLENGE_BLOCKS) ? numfileblocks : MAGIC_NUM_CHALLENGE_BLOCKS;
+
+	for(i = 0; i < 3; i++){
+		detection = pdp_challenge_policy_detection(&policy, tiers[i].peer);
+		c = pdp_challenge_policy_size(&policy, tiers[i].peer, numfileblocks);
+		printf("challenge blocks=%llu peer=%s target=%.4f c=%llu simulated=%.4f io=%.2fx\n",
+			(unsigned long long)numfileblocks, tiers[i].name, detection, (unsigned long long)c,
+			challenge_bench_simulate(numfileblocks, bad, c), (double)c / fixed);
+	}
+}
+
+#define SCHEDULER_BENCH_FILES 16			/* Distinct local files the tracked entries point at */
+#define SCHEDULER_BENCH_PEERS 1000
+#define SCHEDULER_BENCH_BATCH 1024		/* Jobs asked of pdp_scheduler_next at once */
+
+/* scheduler_bench_run: Tracks numfiles files spread over SCHEDULER_BENCH_PEERS peers in a scheduler
+*  and times adding them and handing out and completing an audit of every one, first when all are
+*  newly due and again one interval later, without proving.  Then times real audits of the
+*  SCHEDULER_BENCH_FILES local files the entries point at with pdp_scheduler_run.
+*/
+static void scheduler_bench_run(uint64_t numfiles, char *keypath, char *password){
+
+	PDP_ctx *ctx = NULL;
+	PDP_scheduler *sched = NULL;
+	PDP_scheduler_stats stats;
+	PDP_audit_job *jobs = NULL;
+	char basedir[] = "/tmp/pdp-scheduler-XXXXXX";
+	char filepaths[SCHEDULER_BENCH_FILES][MAXPATHLEN];
+	char tagfilepath[MAXPATHLEN];
+	char peer[32];
+	unsigned char buf[PDP_BLOCKSIZE];
+	struct timeval tv1, tv2;
+	FILE *file = NULL;
+	uint64_t i = 0, now = 0, handed = 0, batches = 0, interval = 0;
+	size_t n = 0, j = 0;
+	int pass = 0, made = 0;
+	double elapsed = 0;
+
+	if(!mkdtemp(basedir) || ((ctx = pdp_ctx_new()) == NULL) || ((jobs = malloc(SCHEDULER_BENCH_BATCH * sizeof(PDP_audit_job))) == NULL)){
+		printf("scheduler failed\n");
+		goto cleanup;
+	}
+
+	/* Files of 1 to 16 blocks */
+	for(made = 0; made < SCHEDULER_BENCH_FILES; made++){
+		snprintf(filepaths[made], MAXPATHLEN, "%s/file%d", basedir, made);
+		if( ((file = fopen(filepaths[made], "w")) == NULL)) goto cleanup;
+		for(i = 0; i <= (uint64_t)made; i++){
+			RAND_bytes(buf, PDP_BLOCKSIZE);
+			fwrite(buf, 1, PDP_BLOCKSIZE, file);
+		}
+		fclose(file);
+		if(!pdp_ctx_tag_file(ctx, filepaths[made], strlen(filepaths[made]), NULL, 0, keypath, password, 0)){
+			made++;
+			goto cleanup;
+		}
+	}
+
+	if( ((sched = pdp_scheduler_new(ctx, keypath, password, 0)) == NULL)) goto cleanup;
+	gettimeofday(&tv1, NULL);
+	for(i = 0; i < numfiles; i++){
+		snprintf(peer, sizeof(peer), "peer%llu", (unsigned long long)(i % SCHEDULER_BENCH_PEERS));
+		if(pdp_scheduler_add(sched, peer, filepaths[i % SCHEDULER_BENCH_FILES], NULL, 0.5 + (i % 8) / 2.0) < 0) goto cleanup;
+	}
+	gettimeofday(&tv2, NULL);
+	elapsed = (double)(tv2.tv_sec - tv1.tv_sec) + ((double)(tv2.tv_usec - tv1.tv_usec) / 1000000);
+	printf("scheduler files=%llu peers=%d add=%.2fs rate=%.0f/s\n", (unsigned long long)numfiles,
+		SCHEDULER_BENCH_PEERS, elapsed, numfiles / elapsed);
+
+	/* Hand out and complete every file, as passed, on a clock that stands still */
+	for(pass = 0; pass < 2; pass++){
+		now = pass ? PDP_SCHED_INTERVAL : 1;
+		handed = batches = 0;
+		gettimeofday(&tv1, NULL);
+		while((n = pdp_scheduler_next(sched, now, jobs, SCHEDULER_BENCH_BATCH)) > 0){
+			for(j = 0; j < n; j++){
+				if(j == 0 || jobs[j].record->peer != jobs[j - 1].record->peer) batches++;
+				pdp_scheduler_complete(sched, jobs[j].id, PDP_AUDIT_PASSED, now);
+			}
+			handed += n;
+		}
+		gettimeofday(&tv2, NULL);
+		elapsed = (double)(tv2.tv_sec - tv1.tv_sec) + ((double)(tv2.tv_usec - tv1.tv_usec) / 1000000);
+		printf("scheduler %s due=%llu time=%.2fs rate=%.0f/s jobs_per_peer_batch=%.2f\n", pass ? "interval" : "initial",
+			(unsigned long long)handed, elapsed, handed / elapsed, batches ? (double)handed / batches : 0);
+	}
+	pdp_scheduler_free(sched);
+
+	/* Real audits of the local files, every one due */
+	if( ((sched = pdp_scheduler_new(ctx, keypath, password, 0)) == NULL)) goto cleanup;
+	for(i = 0; i < SCHEDULER_BENCH_FILES; i++)
+		if(pdp_scheduler_add(sched, "local", filepaths[i], NULL, 1) < 0) goto cleanup;
+	gettimeofday(&tv1, NULL);
+	for(interval = 0; interval < 8; interval++)
+		if(pdp_scheduler_run(sched, (interval + 1) * PDP_SCHED_INTERVAL, SCHEDULER_BENCH_FILES) < 0) goto cleanup;
+	gettimeofday(&tv2, NULL);
+	elapsed = (double)(tv2.tv_sec - tv1.tv_sec) + ((double)(tv2.tv_usec - tv1.tv_usec) / 1000000);
+	pdp_scheduler_stats(sched, &stats);
+	printf("scheduler local audits=%llu passed=%llu time=%.2fs rate=%.0f/s\n", (unsigned long long)stats.audits,
+		(unsigned long long)stats.passed, elapsed, stats.audits / elapsed);
+
+cleanup:
+	pdp_scheduler_free(sched);
+	pdp_ctx_free(ctx);
+	if(jobs) free(jobs);
+	for(i = 0; i < (uint64_t)made; i++){
+		snprintf(tagfilepath, MAXPATHLEN, "%s.tag", filepaths[i]);
+		unlink(tagfilepath);
+		unlink(filepaths[i]);
+	}
+	rmdir(basedir);
+}
+
+/* catalog_bench_count: Counts the entries pdp_catalog_iterate visits that were audited */
+static int catalog_bench_count(PDP_catalog_entry *entry, void *arg){
+
+	if(entry->last_status == PDP_AUDIT_PASSED) (*(uint64_t *)arg)++;
+
+	return 1;
+}
+
+/* catalog_bench_run: Fills a new catalog with numentries entries, named like CIDs, and times adding
+*  them, reopening the catalog, looking them all up in random order, recording an audit of each and
+*  iterating over them.  Then records filepath, tagged with the key in keypath, and checks a
+*  challenge generated from its entry covers the whole file.
+*/
+static void catalog_bench_run(uint64_t numentries, char *filepath, char *keypath, char *password){
+
+	PDP_catalog *catalog = NULL;
+	PDP_catalog_entry entry;
+	PDP_key *key = NULL;
+	PDP_challenge *challenge = NULL;
+	unsigned char key_id[SHA_DIGEST_LENGTH];
+	char basedir[] = "/tmp/pdp-catalog-XXXXXX";
+	char catalogpath[MAXPATHLEN];
+	char name[PDP_CATALOG_NAME_SIZE];
+	struct timeval tv1, tv2;
+	struct stat st;
+	uint64_t i = 0, j = 0, found = 0, audited = 0;
+	double elapsed[5];
+	int step = 0;
+
+	if(!mkdtemp(basedir)){
+		printf("catalog failed\n");
+		return;
+	}
+	snprintf(catalogpath, MAXPATHLEN, "%s/catalog", basedir);
+	if( ((catalog = pdp_catalog_open(catalogpath)) == NULL)) goto cleanup;
+
+	memset(&entry, 0, sizeof(PDP_catalog_entry));
+	gettimeofday(&tv1, NULL);
+	for(i = 0; i < numentries; i++){
+		snprintf(entry.name, PDP_CATALOG_NAME_SIZE, "bafybeig%051llu", (unsigned long long)i);
+		snprintf(entry.tagpath, PDP_CATALOG_PATH_SIZE, "/var/lib/pdp/tags/%llu.tag", (unsigned long long)i);
+		entry.numfileblocks = 1 + (i % 65536);
+		entry.file_size = entry.numfileblocks * PDP_BLOCKSIZE;
+		entry.blocksize = PDP_BLOCKSIZE;
+		entry.tagged_at = i;
+		if(!pdp_catalog_put(catalog, &entry)) goto cleanup;
+	}
+	gettimeofday(&tv2, NULL);
+	elapsed[step++] = (double)(tv2.tv_sec - tv1.tv_sec) + ((double)(tv2.tv_usec - tv1.tv_usec) / 1000000);
+
+	gettimeofday(&tv1, NULL);
+	pdp_catalog_close(catalog);
+	if( ((catalog = pdp_catalog_open(catalogpath)) == NULL)) goto cleanup;
+	gettimeofday(&tv2, NULL);
+	elapsed[step++] = (double)(tv2.tv_sec - tv1.tv_sec) + ((double)(tv2.tv_usec - tv1.tv_usec) / 1000000);
+
+	/* Look up in a scattered order: i * a large odd number modulo numentries */
+	gettimeofday(&tv1, NULL);
+	for(i = 0; i < numentries; i++){
+		j = (i * 2654435761ULL) % numentries;
+		snprintf(name, PDP_CATALOG_NAME_SIZE, "bafybeig%051llu", (unsigned long long)j);
+		if(pdp_catalog_get(catalog, name, &entry) && entry.numfileblocks == 1 + (j % 65536)) found++;
+	}
+	gettimeofday(&tv2, NULL);
+	elapsed[step++] = (double)(tv2.tv_sec - tv1.tv_sec) + ((double)(tv2.tv_usec - tv1.tv_usec) / 1000000);
+
+	gettimeofday(&tv1, NULL);
+	for(i = 0; i < numentries; i++){
+		snprintf(name, PDP_CATALOG_NAME_SIZE, "bafybeig%051llu", (unsigned long long)i);
+		pdp_catalog_record_audit(catalog, name, PDP_AUDIT_PASSED, i);
+	}
+	gettimeofday(&tv2, NULL);
+	elapsed[step++] = (double)(tv2.tv_sec - tv1.tv_sec) + ((double)(tv2.tv_usec - tv1.tv_usec) / 1000000);
+
+	gettimeofday(&tv1, NULL);
+	pdp_catalog_iterate(catalog, catalog_bench_count, &audited);
+	gettimeofday(&tv2, NULL);
+	elapsed[step++] = (double)(tv2.tv_sec - tv1.tv_sec) + ((double)(tv2.tv_usec - tv1.tv_usec) / 1000000);
+
+	stat(catalogpath, &st);
+	printf("catalog entries=%llu size=%lluMB put=%.0f/s reopen=%.3fs get=%.0f/s found=%llu audit=%.0f/s iterate=%.0f/s audited=%llu\n",
+		(unsigned long long)pdp_catalog_count(catalog), (unsigned long long)(st.st_blocks * 512) >> 20,
+		numentries / elapsed[0], elapsed[1], numentries / elapsed[2], (unsigned long long)found,
+		numentries / elapsed[3], numentries / elapsed[4], (unsigned long long)audited);
+
+	/* A challenge from the catalog alone */
+	if(!filepath) goto cleanup;
+	if( ((key = pdp_get_keypair_temp(keypath, password)) == NULL)) goto cleanup;
+	if(!pdp_key_fingerprint(key, key_id) || !pdp_catalog_add_file(catalog, NULL, filepath, NULL, key_id)) goto cleanup;
+	challenge = pdp_catalog_challenge(catalog, key, filepath);
+	stat(filepath, &st);
+	printf("catalog challenge file=%s numfileblocks=%llu matches=%s\n", filepath,
+		challenge ? (unsigned long long)challenge->numfileblocks : 0,
+		(challenge && challenge->numfileblocks == (uint64_t)(st.st_size + PDP_BLOCKSIZE - 1) / PDP_BLOCKSIZE) ? "yes" : "no");
+
+cleanup:
+	if(challenge) destroy_pdp_challenge(challenge);
+	if(key) destroy_pdp_key(key);
+	pdp_catalog_close(catalog);
+	unlink(catalogpath);
+	rmdir(basedir);
+}
+
+#define LATENCY_BENCH_PROOFS 20		/* Proofs each simulated peer sends */
+#define LATENCY_BENCH_FETCH_US 1000	/* Delay per challenged block of the peer fetching blocks on demand */
+#define LATENCY_BENCH_RECORDS 1000000
+
+/* latency_bench_run: Calibrates the latency model on filepath, which must be tagged, then proves it
+*  LATENCY_BENCH_PROOFS times for each of two simulated peers, one answering from local disk and one
+*  sleeping LATENCY_BENCH_FETCH_US per challenged block as if fetching each from elsewhere, and
+*  prints how many of each were flagged, the peers' latency report and the cost of recording a proof.
+*/
+static void latency_bench_run(char *filepath, PDP_key *key, uint64_t numfileblocks){
+
+	PDP_ctx *ctx = NULL;
+	PDP_latency_model model;
+	PDP_latency_tracker *tracker = NULL;
+	PDP_latency_stats stats;
+	PDP_challenge *challenge = NULL;
+	PDP_challenge *server_challenge = NULL;
+	PDP_proof *proof = NULL;
+	struct timeval tv1, tv2;
+	struct timespec ts;
+	char *peers[2] = {"local", "fetching"};
+	uint64_t delay = 0;
+	double elapsed = 0;
+	int p = 0, i = 0, verified = 0, slow = 0;
+
+	pdp_latency_model_init(&model);
+	if( ((ctx = pdp_ctx_new()) == NULL)) goto cleanup;
+
+	gettimeofday(&tv1, NULL);
+	if(!pdp_latency_model_calibrate(&model, ctx, key, filepath, NULL)){
+		printf("latency failed\n");
+		goto cleanup;
+	}
+	gettimeofday(&tv2, NULL);
+	elapsed = (double)(tv2.tv_sec - tv1.tv_sec) + ((double)(tv2.tv_usec - tv1.tv_usec) / 1000000);
+	printf("latency calibrate base=%.3fms block=%.3fms time=%.2fs\n", model.base_ns / 1000000.0,
+		model.block_ns / 1000000.0, elapsed);
+	if( ((tracker = pdp_latency_tracker_new(&model)) == NULL)) goto cleanup;
+
+	for(p = 0; p < 2; p++){
+		verified = slow = 0;
+		memset(&stats, 0, sizeof(PDP_latency_stats));
+		for(i = 0; i < LATENCY_BENCH_PROOFS; i++){
+			if( ((challenge = pdp_challenge(key, numfileblocks)) == NULL)) goto cleanup;
+			if( ((server_challenge = sanitize_pdp_challenge(challenge)) == NULL)) goto cleanup;
+
+			pdp_challenge_issue(challenge);
+			proof = pdp_ctx_prove_file(ctx, filepath, strlen(filepath), NULL, 0, server_challenge, key);
+			if(p){
+				delay = server_challenge->c * LATENCY_BENCH_FETCH_US * 1000ULL;
+				ts.tv_sec = delay / 1000000000ULL;
+				ts.tv_nsec = delay % 1000000000ULL;
+				while(nanosleep(&ts, &ts) != 0 && errno == EINTR);
+			}
+			if(proof){
+				verified += pdp_verify_proof_timed(key, challenge, proof, tracker, peers[p], &slow);
+				pdp_latency_peer_stats(tracker, peers[p], &stats);
+			}
+
+			if(proof) destroy_pdp_proof(proof);
+			destroy_pdp_challenge(server_challenge);
+			destroy_pdp_challenge(challenge);
+			proof = NULL;
+			server_challenge = challenge = NULL;
+		}
+		printf("latency peer=%s proofs=%d verified=%d flagged=%llu mean=%.2fms expected=%.2fms\n", peers[p],
+			LATENCY_BENCH_PROOFS, verified, (unsigned long long)stats.outliers, stats.mean_ns / 1000000.0,
+			pdp_latency_expected_ns(&model, stats.proofs ? stats.blocks / stats.proofs : 0) / 1000000.0);
+	}
+	pdp_latency_report(tracker, stdout);
+
+	gettimeofday(&tv1, NULL);
+	for(i = 0; i < LATENCY_BENCH_RECORDS; i++)
+		pdp_latency_record(tracker, peers[i & 1], MAGIC_NUM_CHALLENGE_BLOCKS, numfileblocks, model.base_ns + (i % 1000) * 1000);
+	gettimeofday(&tv2, NULL);
+	elapsed = (double)(tv2.tv_sec - tv1.tv_sec) + ((double)(tv2.tv_usec - tv1.tv_usec) / 1000000);
+	printf("latency records=%d time=%.2fs rate=%.0f/s\n", LATENCY_BENCH_RECORDS, elapsed, LATENCY_BENCH_RECORDS / elapsed);
+
+cleanup:
+	if(proof) destroy_pdp_proof(proof);
+	if(server_challenge) destroy_pdp_challenge(server_challenge);
+	if(challenge) destroy_pdp_challenge(challenge);
+	pdp_latency_tracker_free(tracker);
+	pdp_ctx_free(ctx);
+}
+
 void usage(){
 
 	fprintf(stdout, "pdp (provable data possesion) 1.0\n");
@@ -57,7 +1314,23 @@ void usage(){
 	fprintf(stdout, "Commands:\n\n");
 	fprintf(stdout, "-t, --tag [file]\t\t tag a file\n");
 	fprintf(stdout, "-v, --verify [file]\t\t verify data possession\n\n");
-	fprintf(stdout, "-k, --gen-key\t\t\t generate a new PDP key pair\n\n");
+	fprintf(stdout, "-k, --gen-key\t\t\t generate a new PDP key pair\n");
+	fprintf(stdout, "-K, --keypath [dir]\t\t directory holding pdp.pri and pdp.pub\n");
+	fprintf(stdout, "-P, --password [password]\t password of the private key\n");
+	fprintf(stdout, "-n, --numa [file]\t\t compare unpinned and NUMA-pinned tagging of a file\n");
+	fprintf(stdout, "-G, --keygen-bench [bits]\t time safe prime generation for a modulus size\n");
+	fprintf(stdout, "-L, --keyload-bench\t\t time loading the key pair in --keypath from PEM and from a key bundle\n");
+	fprintf(stdout, "-C, --keycache-bench [tenants]\t time key lookups for many tenants with and without the key cache\n");
+	fprintf(stdout, "-R, --prover-bench [file]\t challenge a file from many clients at once, in-process and through the prover daemon\n");
+	fprintf(stdout, "-W, --tagger-bench [file]\t time tagging a file in-process and through the tagging daemon\n");
+	fprintf(stdout, "-H, --tagcache-bench [file]\t time repeated proofs of a file with and without the tag cache\n");
+	fprintf(stdout, "-X, --writer-bench [tags]\t time writing tag records one at a time and in batches\n");
+	fprintf(stdout, "-V, --scrub-bench [file]\t time scrubbing a copy of a file one tag at a time, in batches and localizing bad blocks\n");
+	fprintf(stdout, "-A, --challenge-bench [blocks]\t size challenges of a file under the default challenge policy\n");
+	fprintf(stdout, "-Q, --scheduler-bench [files]\t time scheduling audits of many tracked files and auditing local ones\n");
+	fprintf(stdout, "-O, --catalog-bench [entries]\t time a metadata catalog of many files; with --keypath and --password,\n");
+	fprintf(stdout, "\t\t\t\t also challenge the file named last on the command line from it\n");
+	fprintf(stdout, "-F, --latency-bench [file]\t calibrate the proof latency model on a file and flag a simulated slow peer\n\n");
 	
 }
 
@@ -67,10 +1340,10 @@ int main(int argc, char **argv){
 	PDP_challenge *challenge = NULL, *server_challenge = NULL;
 	PDP_proof *proof = NULL;
 	int opt = -1;
-	unsigned int numfileblocks = 0;
+	uint64_t numfileblocks = 0;
 	struct stat st;
-	size_t pdp_blocksize = 0;
-	PDP_tag *tag = NULL;
+	char *keypath = NULL;
+	char *password = NULL;
 #ifdef USE_S3
 	char tagfilepath[MAXPATHLEN];
 #endif
@@ -82,10 +1355,148 @@ int main(int argc, char **argv){
 
 	OpenSSL_add_all_algorithms();
 
-	while((opt = getopt_long(argc, argv, "b:kt:v:s:z:", longopts, NULL)) != -1){
+	while((opt = getopt_long(argc, argv, "kt:v:s:z:K:P:n:G:LC:R:W:H:X:V:A:Q:O:F:", longopts, NULL)) != -1){
 		switch(opt){
-			case 'b':
-				pdp_blocksize = atoi(optarg);
+			case 'K':
+				keypath = optarg;
+				break;
+			case 'P':
+				password = optarg;
+				break;
+			case 'G':
+				if(atoi(optarg) < 64){
+					fprintf(stderr, "ERROR: Key size must be at least 64 bits.\n");
+					break;
+				}
+				keygen_bench_run(atoi(optarg));
+				break;
+			case 'L':
+				if(!keypath || !password){
+					fprintf(stderr, "ERROR: --keyload-bench needs --keypath and --password first.\n");
+					break;
+				}
+				keyload_bench_run(keypath, password);
+				break;
+			case 'C':
+				if(!keypath || !password || atoi(optarg) < 1){
+					fprintf(stderr, "ERROR: --keycache-bench needs --keypath, --password and a number of tenants.\n");
+					break;
+				}
+				keycache_bench_run(keypath, password, atoi(optarg));
+				break;
+			case 'R':
+				if(!keypath || !password){
+					fprintf(stderr, "ERROR: --prover-bench needs --keypath and --password first.\n");
+					break;
+				}
+				if(stat(optarg, &st) < 0 || st.st_size < PDP_BLOCKSIZE){
+					fprintf(stderr, "ERROR: %s must hold at least one block.\n", optarg);
+					break;
+				}
+				if(!pdp_tag_file(optarg, strlen(optarg), NULL, 0, keypath, password)) break;
+				key = pdp_get_keypair_temp(keypath, password);
+				if(!key) break;
+				numfileblocks = (st.st_size + PDP_BLOCKSIZE - 1) / PDP_BLOCKSIZE;
+				prover_bench_run(optarg, key, numfileblocks);
+				destroy_pdp_key(key);
+				key = NULL;
+				break;
+			case 'W':
+				if(!keypath || !password){
+					fprintf(stderr, "ERROR: --tagger-bench needs --keypath and --password first.\n");
+					break;
+				}
+				tagger_bench_run(optarg, keypath, password);
+				break;
+			case 'H':
+				if(!keypath || !password){
+					fprintf(stderr, "ERROR: --tagcache-bench needs --keypath and --password first.\n");
+					break;
+				}
+				if(stat(optarg, &st) < 0 || st.st_size < PDP_BLOCKSIZE){
+					fprintf(stderr, "ERROR: %s must hold at least one block.\n", optarg);
+					break;
+				}
+				if(!pdp_tag_file(optarg, strlen(optarg), NULL, 0, keypath, password)) break;
+				key = pdp_get_keypair_temp(keypath, password);
+				if(!key) break;
+				numfileblocks = (st.st_size + PDP_BLOCKSIZE - 1) / PDP_BLOCKSIZE;
+				tagcache_bench_run(optarg, key, numfileblocks);
+				destroy_pdp_key(key);
+				key = NULL;
+				break;
+			case 'X':
+				if(atoll(optarg) < 1){
+					fprintf(stderr, "ERROR: --writer-bench needs a number of tags.\n");
+					break;
+				}
+				writer_bench_run(atoll(optarg));
+				break;
+			case 'V':
+				if(!keypath || !password){
+					fprintf(stderr, "ERROR: --scrub-bench needs --keypath and --password first.\n");
+					break;
+				}
+				if(stat(optarg, &st) < 0 || st.st_size < PDP_BLOCKSIZE){
+					fprintf(stderr, "ERROR: %s must hold at least one block.\n", optarg);
+					break;
+				}
+				scrub_bench_run(optarg, keypath, password);
+				break;
+			case 'A':
+				if(atoll(optarg) < 1){
+					fprintf(stderr, "ERROR: --challenge-bench needs a number of blocks.\n");
+					break;
+				}
+				challenge_bench_run(atoll(optarg));
+				break;
+			case 'Q':
+				if(!keypath || !password || atoll(optarg) < 1){
+					fprintf(stderr, "ERROR: --scheduler-bench needs --keypath, --password and a number of files.\n");
+					break;
+				}
+				scheduler_bench_run(atoll(optarg), keypath, password);
+				break;
+			case 'O':
+				if(atoll(optarg) < 1){
+					fprintf(stderr, "ERROR: --catalog-bench needs a number of entries.\n");
+					break;
+				}
+				catalog_bench_run(atoll(optarg), (keypath && password && optind < argc) ? argv[argc - 1] : NULL, keypath, password);
+				break;
+			case 'F':
+				if(!keypath || !password){
+					fprintf(stderr, "ERROR: --latency-bench needs --keypath and --password first.\n");
+					break;
+				}
+				if(stat(optarg, &st) < 0 || st.st_size < 2 * PDP_BLOCKSIZE){
+					fprintf(stderr, "ERROR: %s must hold at least two blocks.\n", optarg);
+					break;
+				}
+				if(!pdp_tag_file(optarg, strlen(optarg), NULL, 0, keypath, password)) break;
+				key = pdp_get_keypair_temp(keypath, password);
+				if(!key) break;
+				numfileblocks = (st.st_size + PDP_BLOCKSIZE - 1) / PDP_BLOCKSIZE;
+				latency_bench_run(optarg, key, numfileblocks);
+				destroy_pdp_key(key);
+				key = NULL;
+				break;
+			case 'n':
+				if(!keypath || !password){
+					fprintf(stderr, "ERROR: --numa needs --keypath and --password first.\n");
+					break;
+				}
+				if(stat(optarg, &st) < 0 || st.st_size < PDP_BLOCKSIZE){
+					fprintf(stderr, "ERROR: %s must hold at least one block.\n", optarg);
+					break;
+				}
+				key = pdp_get_keypair_temp(keypath, password);
+				if(!key || !pdp_key_precompute(key)) break;
+				numfileblocks = st.st_size / PDP_BLOCKSIZE;
+				numa_bench_run(optarg, key, numfileblocks, 0);
+				numa_bench_run(optarg, key, numfileblocks, 1);
+				destroy_pdp_key(key);
+				key = NULL;
 				break;
 			case 'k':
 				key = pdp_create_new_keypair();
@@ -101,14 +1512,7 @@ int main(int argc, char **argv){
 				gettimeofday(&tv1, NULL);
 				
 #endif
-				if(pdp_blocksize == 0)
-
-
-
-				tag = pdp_tag_block(PDP_key *key, unsigned char *block, pdp_blocksize, unsigned int index);
-					
-
-				if(pdp_tag_file(optarg, strlen(optarg), NULL, 0))
+				if(pdp_tag_file(optarg, strlen(optarg), NULL, 0, keypath, password))
 					fprintf(stdout, "Done!\n");
 #ifdef DEBUG_MODE
 				gettimeofday(&tv2, NULL);
@@ -159,7 +1563,7 @@ int main(int argc, char **argv){
 				gettimeofday(&tv1, NULL);
 				fprintf(stdout, "Tagging %s...", optarg);
 				fflush(stdout);
-				if(pdp_tag_file(optarg, strlen(optarg), NULL, 0)) printf("Done.\n");
+				if(pdp_tag_file(optarg, strlen(optarg), NULL, 0, keypath, password)) printf("Done.\n");
 				gettimeofday(&tv2, NULL);
 				printf("%lf\n", (double)( (double)(double)(((double)tv2.tv_sec) + (double)((double)tv2.tv_usec/1000000)) - (double)((double)((double)tv1.tv_sec) + (double)((double)tv1.tv_usec/1000000)) ) );
 
@@ -28,7 +28,14 @@
 */
 
 #include "pdp.h"
+#include <errno.h>
 #include <limits.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
 #include <openssl/aes.h>
 #include <openssl/evp.h>
 
@@ -74,22 +81,23 @@ cleanup:
  * file size or NULL on failure.
  * In this implementation we use AES as the PRP.
  */
-unsigned int *generate_prp_pi(PDP_challenge *challenge){
+uint64_t *generate_prp_pi(PDP_challenge *challenge){
 	
 	unsigned char *prp_result = NULL;
 	unsigned char *prp_input = NULL;
 	AES_KEY aes_key;
 	unsigned int index = 0;
 	double r = 0.0;
-	int x = 0, j = 0;
-	unsigned int *indices = NULL;
+	uint64_t x = 0;
+	unsigned int j = 0;
+	uint64_t *indices = NULL;
 	
 	if(!challenge || !challenge->k1 || !challenge->numfileblocks) return NULL;
 
 	/* Allocate memory */
 	if( ((prp_result = malloc(PRP_KEY_SIZE)) == NULL)) goto cleanup;
 	if( ((prp_input = malloc(PRP_KEY_SIZE)) == NULL)) goto cleanup;
-	if( ((indices = malloc(challenge->c * sizeof(unsigned int))) == NULL)) goto cleanup;
+	if( ((indices = malloc(challenge->c * sizeof(uint64_t))) == NULL)) goto cleanup;
 	
 	memset(prp_result, 0, PRP_KEY_SIZE);
 	memset(prp_input, 0, PRP_KEY_SIZE);
@@ -101,8 +109,9 @@ unsigned int *generate_prp_pi(PDP_challenge *challenge){
 	/* Choose c blocks from 0 to numfileblocks - 1 without replacement */
 	for(x = 0; x < challenge->numfileblocks && j < challenge->c; x++){
 	
-		/* Setup in the input buffer */
-		memcpy(prp_input, &x, sizeof(int));
+		/* Setup in the input buffer.  The input block is zero-padded, so on little-endian hosts
+		 * blocks below 2^32 permute exactly as they did with 32-bit indices */
+		memcpy(prp_input, &x, sizeof(uint64_t));
 	
 		/* Perform AES on the index */
 		AES_encrypt(prp_input, prp_result, &aes_key);
@@ -129,7 +138,7 @@ unsigned int *generate_prp_pi(PDP_challenge *challenge){
 cleanup:
 	if(prp_result) sfree(prp_result, PRP_KEY_SIZE);
 	if(prp_input) sfree(prp_input, PRP_KEY_SIZE);
-	if(indices) sfree(indices, (challenge->c * sizeof(unsigned int)));
+	if(indices) sfree(indices, (challenge->c * sizeof(uint64_t)));
 	memset(&aes_key, 0, sizeof(AES_KEY));
 
 	return NULL;
@@ -203,17 +212,28 @@ cleanup:
  * It returns an allocated buffer containing the resulting PRF or NULL on failure.
  * In this implementation we use HMAC-SHA1.
  */
-unsigned char *generate_prf_w(PDP_key *key, unsigned int index, size_t *prf_result_size){
+unsigned char *generate_prf_w(PDP_key *key, uint64_t index, size_t *prf_result_size){
 	
 	unsigned char *prf_result = NULL;
+	uint32_t index32 = (uint32_t)index;
+	unsigned char *prf_input = (unsigned char *)&index;
+	size_t prf_input_size = sizeof(uint64_t);
 	
 	if(!key || !key->v || !prf_result_size) return NULL;
 	
 	if( ((prf_result = malloc(SHA_DIGEST_LENGTH)) == NULL)) goto cleanup;
 	memset(prf_result, 0, SHA_DIGEST_LENGTH);
+
+	/* Indices that fit in 32 bits are encoded in 4 bytes, as they always have been, so existing
+	 * tags stay valid.  Larger indices are encoded in 8 bytes; the input lengths differ, so the
+	 * two encodings never collide. */
+	if(index <= UINT32_MAX){
+		prf_input = (unsigned char *)&index32;
+		prf_input_size = sizeof(uint32_t);
+	}
 	
 	/* Perform the HMAC on the block index */
-	if(!HMAC(EVP_sha1(), key->v, PRF_KEY_SIZE, (unsigned char *)&index, sizeof(int), 
+	if(!HMAC(EVP_sha1(), key->v, PRF_KEY_SIZE, prf_input, prf_input_size, 
 		prf_result, (unsigned int *)prf_result_size)) goto cleanup;
 	
 	return prf_result;
@@ -448,3 +468,110 @@ cleanup:
 	return NULL;
 }
 
+/* pdp_bind_private: Binds the Unix socket fd to socketpath such that only its owner can ever
+*  connect.  It is bound inside a new 0700 directory next to socketpath, made 0600 there and then
+*  renamed into place, replacing a stale socket, so unlike setting the umask around bind it leaves
+*  the other threads of the process alone.  Returns 1 on success and 0 on failure.
+*/
+int pdp_bind_private(int fd, char *socketpath){
+
+	struct sockaddr_un addr;
+	char dirpath[MAXPATHLEN];
+	char *slash = NULL;
+	int bound = 0, ok = 0;
+
+	if(!socketpath) return 0;
+
+	if( ((slash = strrchr(socketpath, '/')) != NULL)){
+		if(snprintf(dirpath, MAXPATHLEN, "%.*s/.pdp-XXXXXX", (int)(slash - socketpath), socketpath) >= MAXPATHLEN) return 0;
+	}else{
+		strcpy(dirpath, ".pdp-XXXXXX");
+	}
+	if(!mkdtemp(dirpath)) return 0;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if(snprintf(addr.sun_path, sizeof(addr.sun_path), "%s/s", dirpath) >= sizeof(addr.sun_path)) goto cleanup;
+	if(bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) goto cleanup;
+	bound = 1;
+	if(chmod(addr.sun_path, S_IRUSR | S_IWUSR) != 0) goto cleanup;
+	if(rename(addr.sun_path, socketpath) != 0) goto cleanup;
+	ok = 1;
+
+cleanup:
+	if(bound && !ok) unlink(addr.sun_path);
+	rmdir(dirpath);
+
+	return ok;
+}
+
+/* pdp_monotonic_ns: Returns the time of the monotonic clock in nanoseconds */
+uint64_t pdp_monotonic_ns(){
+
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ((uint64_t)ts.tv_sec * 1000000000ULL) + ts.tv_nsec;
+}
+
+/* pdp_hash_name: Returns the FNV-1a hash of a NUL-terminated name */
+uint64_t pdp_hash_name(char *name){
+
+	uint64_t hash = 14695981039346656037ULL;
+
+	while(*name){
+		hash ^= (unsigned char)*name++;
+		hash *= 1099511628211ULL;
+	}
+
+	return hash;
+}
+
+/* pdp_read_full: Reads exactly len bytes from a socket.  Returns 1 on success and 0 on error, timeout or EOF */
+int pdp_read_full(int fd, void *buf, size_t len){
+
+	ssize_t r = 0;
+	size_t done = 0;
+
+	while(done < len){
+		r = recv(fd, (unsigned char *)buf + done, len - done, 0);
+		if(r < 0 && errno == EINTR) continue;
+		if(r <= 0) return 0;
+		done += r;
+	}
+
+	return 1;
+}
+
+/* pdp_write_full: Writes exactly len bytes to a socket without raising SIGPIPE.  Returns 1 on success and 0 on error */
+int pdp_write_full(int fd, void *buf, size_t len){
+
+	ssize_t r = 0;
+	size_t done = 0;
+
+	while(done < len){
+		r = send(fd, (unsigned char *)buf + done, len - done, MSG_NOSIGNAL);
+		if(r < 0 && errno == EINTR) continue;
+		if(r <= 0) return 0;
+		done += r;
+	}
+
+	return 1;
+}
+
+/* pdp_pread_full: Reads len bytes at offset from fd into buf.  Returns 1 on success and 0 on error or end of file */
+int pdp_pread_full(int fd, void *buf, size_t len, off_t offset){
+
+	ssize_t n = 0;
+	size_t got = 0;
+
+	while(got < len){
+		n = pread(fd, (unsigned char *)buf + got, len - got, offset + got);
+		if(n < 0 && errno == EINTR) continue;
+		if(n <= 0) return 0;
+		got += n;
+	}
+
+	return 1;
+}
@@ -0,0 +1,128 @@
+/* 
+* pdp-numa.c
+*
+* Copyright (c) 2008, Zachary N J Peterson <zachary@jhu.edu>
+* All rights reserved.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*     * Redistributions of source code must retain the above copyright
+*       notice, this list of conditions and the following disclaimer.
+*     * Redistributions in binary form must reproduce the above copyright
+*       notice, this list of conditions and the following disclaimer in the
+*       documentation and/or other materials provided with the distribution.
+*     * The name of the Zachary N J Peterson may be used to endorse or promote products
+*       derived from this software without specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY ZACHARY N J PETERSON ``AS IS'' AND ANY
+* EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL ZACHARY N J PETERSON BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+
+/* pdp-numa.c places tagging workers on NUMA nodes.  The topology is read from sysfs rather than
+*  through libnuma so that linking against libpdp needs no extra libraries.  Memory placement relies
+*  on the kernel's first-touch policy: a worker pinned to a node allocates and first writes its key
+*  replica and block buffers itself, so those pages land in the node's local memory.
+*/
+
+#define _GNU_SOURCE
+#include "pdp.h"
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+
+#define PDP_NUMA_SYSFS "/sys/devices/system/node"
+
+static pthread_once_t numa_once = PTHREAD_ONCE_INIT;
+static int numa_nodes = 1;
+static cpu_set_t numa_cpus[PDP_NUMA_MAX_NODES];
+
+/* parse_cpulist: Parses a sysfs CPU list such as "0-3,8-11" into set.  Returns the number of CPUs. */
+static int parse_cpulist(char *list, cpu_set_t *set){
+
+	char *p = list, *end = NULL;
+	long first = 0, last = 0, cpu = 0;
+	int count = 0;
+
+	CPU_ZERO(set);
+	while(*p && *p != '\n'){
+		first = strtol(p, &end, 10);
+		if(end == p) break;
+		last = first;
+		p = end;
+		if(*p == '-'){
+			last = strtol(p + 1, &end, 10);
+			p = end;
+		}
+		for(cpu = first; cpu <= last && cpu < CPU_SETSIZE; cpu++){
+			CPU_SET(cpu, set);
+			count++;
+		}
+		if(*p == ',') p++;
+	}
+
+	return count;
+}
+
+/* numa_discover: Reads the CPUs of each node that has any.  Without sysfs, or on a single node
+*  machine, the whole machine is treated as node 0.
+*/
+static void numa_discover(){
+
+	FILE *file = NULL;
+	char path[128];
+	char list[4096];
+	int node = 0, found = 0;
+
+	for(node = 0; node < PDP_NUMA_MAX_NODES; node++){
+		snprintf(path, sizeof(path), "%s/node%d/cpulist", PDP_NUMA_SYSFS, node);
+		file = fopen(path, "r");
+		if(!file) continue;
+		memset(list, 0, sizeof(list));
+		if(fgets(list, sizeof(list), file) && parse_cpulist(list, &numa_cpus[found]) > 0)
+			found++;
+		fclose(file);
+	}
+
+	numa_nodes = (found > 0) ? found : 1;
+	if(found == 0) sched_getaffinity(0, sizeof(cpu_set_t), &numa_cpus[0]);
+}
+
+/* pdp_numa_num_nodes: Returns the number of NUMA nodes with CPUs */
+int pdp_numa_num_nodes(){
+
+	pthread_once(&numa_once, numa_discover);
+
+	return numa_nodes;
+}
+
+/* pdp_numa_worker_node: Returns the node the worker'th of numworkers workers should run on.  Workers
+*  are split into contiguous groups, one per node, so adjacent ranges of a file are tagged on one node.
+*/
+int pdp_numa_worker_node(int worker, int numworkers){
+
+	int nodes = pdp_numa_num_nodes();
+
+	if(numworkers <= 0 || worker < 0) return 0;
+
+	return (int)(((long)worker * nodes) / numworkers) % nodes;
+}
+
+/* pdp_numa_bind_thread: Restricts the calling thread, and threads it creates later, to the CPUs of
+*  node.  Returns 1 on success and 0 on failure.
+*/
+int pdp_numa_bind_thread(int node){
+
+	if(node < 0 || node >= pdp_numa_num_nodes()) return 0;
+
+	return (pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &numa_cpus[node]) == 0);
+}
@@ -0,0 +1,105 @@
+/* 
+* pdp-policy.c
+*
+* Copyright (c) 2008, Zachary N J Peterson <zachary@jhu.edu>
+* All rights reserved.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*     * Redistributions of source code must retain the above copyright
+*       notice, this list of conditions and the following disclaimer.
+*     * Redistributions in binary form must reproduce the above copyright
+*       notice, this list of conditions and the following disclaimer in the
+*       documentation and/or other materials provided with the distribution.
+*     * The name of the Zachary N J Peterson may be used to endorse or promote products
+*       derived from this software without specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY ZACHARY N J PETERSON ``AS IS'' AND ANY
+* EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL ZACHARY N J PETERSON BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+/* pdp-policy.c contains challenge policies, which pick how many blocks to challenge a peer for
+*  from the detection probability an audit must reach and the peer's past audits.  Peers that
+*  failed an audit recently are held to a higher detection probability and peers with a long run
+*  of clean audits to a lower one, so routine audits of honest peers read fewer blocks.  The
+*  caller keeps a PDP_peer_history for each peer and records every audit in it.
+*/
+
+#include "pdp.h"
+#include <string.h>
+
+/* pdp_challenge_policy_init: Fills in policy with the default detection probabilities, corruption
+*  fraction and honest streak.
+*/
+void pdp_challenge_policy_init(PDP_challenge_policy *policy){
+
+	if(!policy) return;
+
+	memset(policy, 0, sizeof(PDP_challenge_policy));
+	policy->detection = PDP_POLICY_DETECTION;
+	policy->min_detection = PDP_POLICY_MIN_DETECTION;
+	policy->max_detection = PDP_POLICY_MAX_DETECTION;
+	policy->corrupt_fraction = PDP_POLICY_CORRUPT_FRACTION;
+	policy->honest_streak = PDP_POLICY_HONEST_STREAK;
+}
+
+/* pdp_peer_history_record: Records an audit of a peer, which passed if passed is non-zero */
+void pdp_peer_history_record(PDP_peer_history *peer, int passed){
+
+	if(!peer) return;
+
+	peer->audits++;
+	if(passed){
+		peer->streak++;
+	}else{
+		peer->failures++;
+		peer->streak = 0;
+	}
+}
+
+/* pdp_challenge_policy_detection: Returns the detection probability policy asks of an audit of a
+*  peer with history peer.  A peer with a failure and fewer than policy->honest_streak clean
+*  audits since gets max_detection, a peer with at least that many gets min_detection, and a peer
+*  without enough history, or a NULL peer, gets detection.
+*/
+double pdp_challenge_policy_detection(PDP_challenge_policy *policy, PDP_peer_history *peer){
+
+	if(!policy) return PDP_POLICY_DETECTION;
+	if(!peer) return policy->detection;
+
+	if(peer->streak >= policy->honest_streak) return policy->min_detection;
+	if(peer->failures) return policy->max_detection;
+
+	return policy->detection;
+}
+
+/* pdp_challenge_policy_size: Returns the blocks an audit of a file of numfileblocks blocks held by
+*  a peer with history peer must challenge under policy, or 0 on error.
+*/
+uint64_t pdp_challenge_policy_size(PDP_challenge_policy *policy, PDP_peer_history *peer, uint64_t numfileblocks){
+
+	if(!policy) return 0;
+
+	return pdp_challenge_size(numfileblocks, pdp_challenge_policy_detection(policy, peer), policy->corrupt_fraction);
+}
+
+/* pdp_challenge_policy: Generates a challenge for a file of numfileblocks blocks held by a peer
+*  with history peer, sampling as many blocks as policy asks of it.  Returns an allocated
+*  challenge, or NULL on error.
+*/
+PDP_challenge *pdp_challenge_policy(PDP_key *key, uint64_t numfileblocks, PDP_challenge_policy *policy,
+	PDP_peer_history *peer){
+
+	if(!policy) return NULL;
+
+	return pdp_challenge_target(key, numfileblocks, pdp_challenge_policy_detection(policy, peer), policy->corrupt_fraction);
+}
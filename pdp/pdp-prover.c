@@ -0,0 +1,605 @@
+/* 
+* pdp-prover.c
+*
+* Copyright (c) 2008, Zachary N J Peterson <zachary@jhu.edu>
+* All rights reserved.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*     * Redistributions of source code must retain the above copyright
+*       notice, this list of conditions and the following disclaimer.
+*     * Redistributions in binary form must reproduce the above copyright
+*       notice, this list of conditions and the following disclaimer in the
+*       documentation and/or other materials provided with the distribution.
+*     * The name of the Zachary N J Peterson may be used to endorse or promote products
+*       derived from this software without specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY ZACHARY N J PETERSON ``AS IS'' AND ANY
+* EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL ZACHARY N J PETERSON BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+
+
+/* pdp-prover.c contains the prover daemon, a long-lived process that answers challenges over a Unix
+*  socket.  Proofs run on a fixed pool of workers against one PDP_ctx, so data and tag files stay
+*  open between challenges and proving is held to the context's budgets.  Each request states a
+*  deadline.  The queue is ordered earliest deadline first, and admission control estimates a
+*  request's I/O and CPU from the number of blocks it samples: a request is turned away at once if
+*  the queue is full, if its reads would exceed the daemon's I/O limit, or if the work due before it
+*  means it cannot finish in time.  An audit storm is therefore shed at the door instead of growing
+*  an unbounded backlog that competes with IPFS for the disk.
+*/
+
+#include "pdp.h"
+#include <errno.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#define PDP_PROVER_MAX_N_SIZE 1024		/* Largest modulus accepted, in bytes */
+
+typedef struct PDP_prover_job_struct PDP_prover_job;
+
+struct PDP_prover_job_struct{
+
+	int fd;						/* The client's connection, answered and closed by the worker */
+	uint64_t received;			/* Monotonic times in nanoseconds */
+	uint64_t deadline;
+	uint64_t cost_ns;			/* Estimated wall time of the proof */
+	uint64_t cost_io;			/* Estimated bytes read by the proof */
+	char filepath[MAXPATHLEN];
+	char tagfilepath[MAXPATHLEN];	/* Empty for the default <filepath>.tag */
+	PDP_challenge *challenge;
+	PDP_key *key;				/* The public key; N and e only */
+};
+
+struct PDP_prover_struct{
+
+	PDP_ctx *ctx;
+	char socketpath[MAXPATHLEN];
+	int listenfd;
+	int numworkers;
+	pthread_t *workers;
+	int numstarted;				/* Workers running */
+
+	pthread_mutex_t lock;		/* Protects everything below */
+	pthread_cond_t cond;		/* Signalled when a job is queued or the prover stops */
+	int stopping;
+
+	PDP_prover_job **queue;		/* A binary heap ordered by deadline */
+	size_t queue_len;
+	size_t queue_depth;
+
+	uint64_t max_io;
+	uint64_t queued_io;			/* Estimated reads of queued and running jobs */
+	uint64_t running_ns;		/* Estimated wall time of running jobs */
+	double block_ns;			/* Estimated wall time per sampled block */
+
+	PDP_prover_stats stats;		/* Counters; queued, queue_wait and block_cost are filled in on demand */
+	uint64_t queue_wait_ns;
+};
+
+/* set_timeout: Bounds how long reads and writes on a socket may block */
+static void set_timeout(int fd, unsigned int ms){
+
+	struct timeval tv;
+
+	tv.tv_sec = ms / 1000;
+	tv.tv_usec = (ms % 1000) * 1000;
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+}
+
+/* send_reply: Answers a request with status and, on success, the proof.  Returns 1 on success and 0 on error */
+static int send_reply(int fd, int status, PDP_proof *proof){
+
+	PDP_prover_reply reply;
+	unsigned char *T = NULL;
+	int result = 0;
+
+	memset(&reply, 0, sizeof(PDP_prover_reply));
+	memcpy(reply.magic, PDP_PROVER_MAGIC, PDP_PROVER_MAGIC_SIZE);
+	reply.version = PDP_PROVER_VERSION;
+	reply.status = status;
+
+	if(status == PDP_PROVER_OK && proof){
+		reply.T_len = BN_num_bytes(proof->T);
+		reply.rho_len = proof->rho_size;
+		if( ((T = malloc(reply.T_len + 1)) == NULL)) return 0;
+		BN_bn2bin(proof->T, T);
+	}
+
+	if(!pdp_write_full(fd, &reply, sizeof(PDP_prover_reply))) goto cleanup;
+	if(T && !pdp_write_full(fd, T, reply.T_len)) goto cleanup;
+	if(T && reply.rho_len && !pdp_write_full(fd, proof->rho, reply.rho_len)) goto cleanup;
+	result = 1;
+
+cleanup:
+	if(T) free(T);
+	return result;
+}
+
+/* destroy_job: Frees a job, closing its connection if it is still open */
+static void destroy_job(PDP_prover_job *job){
+
+	if(!job) return;
+	if(job->fd >= 0) close(job->fd);
+	if(job->challenge) destroy_pdp_challenge(job->challenge);
+	if(job->key) destroy_pdp_key(job->key);
+	free(job);
+}
+
+/* finish_job: Answers a job with status, and with the proof on success, then frees it */
+static void finish_job(PDP_prover_job *job, int status, PDP_proof *proof){
+
+	send_reply(job->fd, status, proof);
+	destroy_job(job);
+}
+
+/* read_job: Reads and validates a request from a new connection.  Returns an allocated job, or NULL
+*  with *status set to PDP_PROVER_BAD_REQUEST if the request is malformed.
+*/
+static PDP_prover_job *read_job(int fd, int *status){
+
+	PDP_prover_job *job = NULL;
+	PDP_prover_request request;
+	unsigned char buf[PDP_PROVER_MAX_N_SIZE];
+	BIGNUM *n = NULL, *e = NULL;
+
+	*status = PDP_PROVER_BAD_REQUEST;
+
+	if(!pdp_read_full(fd, &request, sizeof(PDP_prover_request))) return NULL;
+	if(memcmp(request.magic, PDP_PROVER_MAGIC, PDP_PROVER_MAGIC_SIZE) != 0) return NULL;
+	if(request.version != PDP_PROVER_VERSION) return NULL;
+	if(request.filepath_len == 0 || request.filepath_len >= MAXPATHLEN) return NULL;
+	if(request.tagfilepath_len >= MAXPATHLEN) return NULL;
+	if(request.n_len == 0 || request.n_len > PDP_PROVER_MAX_N_SIZE) return NULL;
+	if(request.e_len == 0 || request.e_len > request.n_len) return NULL;
+	if(request.g_s_len == 0 || request.g_s_len > request.n_len) return NULL;
+	if(request.c == 0 || request.numfileblocks == 0 || request.c > request.numfileblocks) return NULL;
+
+	if( ((job = malloc(sizeof(PDP_prover_job))) == NULL)) return NULL;
+	memset(job, 0, sizeof(PDP_prover_job));
+	job->fd = -1;
+	job->received = pdp_monotonic_ns();
+	job->deadline = job->received + 1000000ULL * (request.deadline_ms ? request.deadline_ms : PDP_PROVER_DEADLINE_MS);
+
+	if(!pdp_read_full(fd, job->filepath, request.filepath_len)) goto cleanup;
+	if(memchr(job->filepath, '\0', request.filepath_len)) goto cleanup;
+	if(request.tagfilepath_len && !pdp_read_full(fd, job->tagfilepath, request.tagfilepath_len)) goto cleanup;
+	if(memchr(job->tagfilepath, '\0', request.tagfilepath_len)) goto cleanup;
+
+	/* Only N and e are needed to prove */
+	if( ((job->key = malloc(sizeof(PDP_key))) == NULL)) goto cleanup;
+	memset(job->key, 0, sizeof(PDP_key));
+	if( ((job->key->rsa = RSA_new()) == NULL)) goto cleanup;
+	if(!pdp_read_full(fd, buf, request.n_len)) goto cleanup;
+	if( ((n = BN_bin2bn(buf, request.n_len, NULL)) == NULL)) goto cleanup;
+	if(!pdp_read_full(fd, buf, request.e_len)) goto cleanup;
+	if( ((e = BN_bin2bn(buf, request.e_len, NULL)) == NULL)) goto cleanup;
+	if(BN_is_zero(n) || BN_is_zero(e)) goto cleanup;
+	if(!RSA_set0_key(job->key->rsa, n, e, NULL)) goto cleanup;
+	n = e = NULL;
+
+	if( ((job->challenge = generate_pdp_challenge()) == NULL)) goto cleanup;
+	job->challenge->c = request.c;
+	job->challenge->numfileblocks = request.numfileblocks;
+	if(!pdp_read_full(fd, buf, request.g_s_len)) goto cleanup;
+	if(!BN_bin2bn(buf, request.g_s_len, job->challenge->g_s)) goto cleanup;
+	if(!pdp_read_full(fd, job->challenge->k1, PRP_KEY_SIZE)) goto cleanup;
+	if(!pdp_read_full(fd, job->challenge->k2, PRF_KEY_SIZE)) goto cleanup;
+
+	job->cost_io = (uint64_t)request.c * PDP_BLOCKSIZE;
+	*status = PDP_PROVER_OK;
+
+	return job;
+
+cleanup:
+	if(n) BN_free(n);
+	if(e) BN_free(e);
+	destroy_job(job);
+	return NULL;
+}
+
+/* heap_push: Adds a job to the queue.  Call with the lock held and room in the queue */
+static void heap_push(PDP_prover *prover, PDP_prover_job *job){
+
+	size_t i = prover->queue_len++, parent = 0;
+
+	while(i > 0){
+		parent = (i - 1) / 2;
+		if(prover->queue[parent]->deadline <= job->deadline) break;
+		prover->queue[i] = prover->queue[parent];
+		i = parent;
+	}
+	prover->queue[i] = job;
+}
+
+/* heap_pop: Removes and returns the job with the earliest deadline.  Call with the lock held and a
+*  job in the queue.
+*/
+static PDP_prover_job *heap_pop(PDP_prover *prover){
+
+	PDP_prover_job *top = prover->queue[0];
+	PDP_prover_job *last = prover->queue[--prover->queue_len];
+	size_t i = 0, child = 0;
+
+	while( (child = (2 * i) + 1) < prover->queue_len){
+		if(child + 1 < prover->queue_len && prover->queue[child + 1]->deadline < prover->queue[child]->deadline)
+			child++;
+		if(last->deadline <= prover->queue[child]->deadline) break;
+		prover->queue[i] = prover->queue[child];
+		i = child;
+	}
+	if(prover->queue_len > 0) prover->queue[i] = last;
+
+	return top;
+}
+
+/* admit: Decides whether to queue a job and queues it.  The job must finish by its deadline after
+*  every queued job due no later than it, and the jobs already running, spread over the workers.
+*  Returns PDP_PROVER_OK if the job was queued and PDP_PROVER_BUSY otherwise.
+*/
+static int admit(PDP_prover *prover, PDP_prover_job *job){
+
+	uint64_t ahead_ns = 0, now = 0;
+	size_t i = 0;
+	int status = PDP_PROVER_BUSY;
+
+	pthread_mutex_lock(&(prover->lock));
+	job->cost_ns = (uint64_t)(prover->block_ns * job->challenge->c);
+
+	if(prover->stopping || prover->queue_len >= prover->queue_depth) goto done;
+	if(prover->queued_io + job->cost_io > prover->max_io) goto done;
+
+	ahead_ns = prover->running_ns;
+	for(i = 0; i < prover->queue_len; i++)
+		if(prover->queue[i]->deadline <= job->deadline) ahead_ns += prover->queue[i]->cost_ns;
+	now = pdp_monotonic_ns();
+	if(now + (ahead_ns / prover->numworkers) + job->cost_ns > job->deadline) goto done;
+
+	prover->queued_io += job->cost_io;
+	heap_push(prover, job);
+	prover->stats.admitted++;
+	pthread_cond_signal(&(prover->cond));
+	status = PDP_PROVER_OK;
+
+done:
+	if(status != PDP_PROVER_OK) prover->stats.rejected++;
+	pthread_mutex_unlock(&(prover->lock));
+
+	return status;
+}
+
+/* reduce_proof: Reduces a proof's T modulo n.  Returns 1 on success and 0 on failure */
+static int reduce_proof(PDP_proof *proof, const BIGNUM *n){
+
+	BN_CTX *ctx = NULL;
+	int result = 0;
+
+	if( ((ctx = BN_CTX_new()) == NULL)) return 0;
+	result = BN_nnmod(proof->T, proof->T, n, ctx);
+	BN_CTX_free(ctx);
+
+	return result;
+}
+
+/* prover_worker: Proves queued jobs, earliest deadline first, until the prover stops.  A job that can
+*  no longer finish in time is answered PDP_PROVER_EXPIRED without being proven.
+*/
+static void *prover_worker(void *arg){
+
+	PDP_prover *prover = (PDP_prover *)arg;
+	PDP_prover_job *job = NULL;
+	PDP_proof *proof = NULL;
+	uint64_t start = 0, elapsed = 0, cost_ns = 0, cost_io = 0;
+	unsigned int c = 0;
+
+	pthread_mutex_lock(&(prover->lock));
+	while(1){
+		while(!prover->stopping && prover->queue_len == 0)
+			pthread_cond_wait(&(prover->cond), &(prover->lock));
+		if(prover->stopping) break;
+
+		job = heap_pop(prover);
+		start = pdp_monotonic_ns();
+		if(start + job->cost_ns > job->deadline){
+			prover->queued_io -= job->cost_io;
+			prover->stats.expired++;
+			pthread_mutex_unlock(&(prover->lock));
+			finish_job(job, PDP_PROVER_EXPIRED, NULL);
+			pthread_mutex_lock(&(prover->lock));
+			continue;
+		}
+		cost_ns = job->cost_ns;
+		cost_io = job->cost_io;
+		c = job->challenge->c;
+		prover->running_ns += cost_ns;
+		prover->stats.running++;
+		prover->queue_wait_ns += start - job->received;
+		pthread_mutex_unlock(&(prover->lock));
+
+		proof = pdp_ctx_prove_file(prover->ctx, job->filepath, strlen(job->filepath),
+			job->tagfilepath[0] ? job->tagfilepath : NULL, strlen(job->tagfilepath), job->challenge, job->key);
+		elapsed = pdp_monotonic_ns() - start;
+
+		/* T is the product of the sampled tags and is verified modulo N, so send it reduced */
+		if(proof && !reduce_proof(proof, RSA_get0_n(job->key->rsa))){
+			destroy_pdp_proof(proof);
+			proof = NULL;
+		}
+		finish_job(job, proof ? PDP_PROVER_OK : PDP_PROVER_FAILED, proof);
+
+		pthread_mutex_lock(&(prover->lock));
+		prover->running_ns -= cost_ns;
+		prover->stats.running--;
+		prover->queued_io -= cost_io;
+		if(proof){
+			/* Follow the measured cost, which includes any time spent throttled by the budgets */
+			prover->block_ns = (0.8 * prover->block_ns) + (0.2 * ((double)elapsed / c));
+			prover->stats.completed++;
+			destroy_pdp_proof(proof);
+			proof = NULL;
+		}else{
+			prover->stats.failed++;
+		}
+	}
+	pthread_mutex_unlock(&(prover->lock));
+
+	return NULL;
+}
+
+/* pdp_prover_new: Returns an allocated prover that will listen on socketpath and prove with ctx, on
+*  numworkers workers (PDP_PROVER_WORKERS if 0), queueing at most queue_depth requests
+*  (PDP_PROVER_QUEUE_DEPTH if 0) that read at most max_io bytes between them (PDP_PROVER_MAX_IO if 0).
+*  The socket is only ever accessible to its owner, and replaces a stale one left at socketpath.  The
+*  prover does not own ctx.  Returns NULL on failure.
+*/
+PDP_prover *pdp_prover_new(PDP_ctx *ctx, char *socketpath, int numworkers, size_t queue_depth, uint64_t max_io){
+
+	PDP_prover *prover = NULL;
+	struct sockaddr_un addr;
+
+	if(!ctx || !socketpath) return NULL;
+	if(strlen(socketpath) >= sizeof(addr.sun_path)) return NULL;
+
+	if( ((prover = malloc(sizeof(PDP_prover))) == NULL)) return NULL;
+	memset(prover, 0, sizeof(PDP_prover));
+	prover->listenfd = -1;
+	prover->ctx = ctx;
+	prover->numworkers = numworkers > 0 ? numworkers : PDP_PROVER_WORKERS;
+	prover->queue_depth = queue_depth ? queue_depth : PDP_PROVER_QUEUE_DEPTH;
+	prover->max_io = max_io ? max_io : PDP_PROVER_MAX_IO;
+	prover->block_ns = PDP_PROVER_BLOCK_NS;
+	strcpy(prover->socketpath, socketpath);
+
+	if(pthread_mutex_init(&(prover->lock), NULL) != 0){
+		free(prover);
+		return NULL;
+	}
+	if(pthread_cond_init(&(prover->cond), NULL) != 0){
+		pthread_mutex_destroy(&(prover->lock));
+		free(prover);
+		return NULL;
+	}
+	if( ((prover->queue = malloc(prover->queue_depth * sizeof(PDP_prover_job *))) == NULL)) goto cleanup;
+	if( ((prover->workers = malloc(prover->numworkers * sizeof(pthread_t))) == NULL)) goto cleanup;
+
+	if( ((prover->listenfd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)) goto cleanup;
+	if(!pdp_bind_private(prover->listenfd, socketpath)){
+		fprintf(stderr, "ERROR: Was unable to bind %s.\n", socketpath);
+		goto cleanup;
+	}
+	if(listen(prover->listenfd, SOMAXCONN) != 0) goto cleanup;
+
+	return prover;
+
+cleanup:
+	pdp_prover_free(prover);
+	return NULL;
+}
+
+/* pdp_prover_run: Serves requests until pdp_prover_stop is called, then answers the requests still
+*  queued PDP_PROVER_BUSY and waits for the running ones.  Requests are read and admitted on the
+*  calling thread and proven on the workers.  Returns 1 after a stop and 0 if the prover could not run.
+*/
+int pdp_prover_run(PDP_prover *prover){
+
+	PDP_prover_job *job = NULL;
+	int fd = -1, status = 0, stopping = 0;
+
+	if(!prover) return 0;
+
+	for(prover->numstarted = 0; prover->numstarted < prover->numworkers; prover->numstarted++)
+		if(pthread_create(&(prover->workers[prover->numstarted]), NULL, prover_worker, prover) != 0) break;
+	if(prover->numstarted == 0) return 0;
+	prover->numworkers = prover->numstarted;
+
+	while(1){
+		fd = accept(prover->listenfd, NULL, NULL);
+
+		pthread_mutex_lock(&(prover->lock));
+		stopping = prover->stopping;
+		if(fd >= 0) prover->stats.requests++;
+		pthread_mutex_unlock(&(prover->lock));
+		if(stopping) break;
+		if(fd < 0){
+			if(errno == EINTR || errno == ECONNABORTED || errno == EMFILE || errno == ENFILE) continue;
+			break;
+		}
+
+		/* A slow client must not hold up admission of the others */
+		set_timeout(fd, PDP_PROVER_RECV_TIMEOUT_MS);
+		if( ((job = read_job(fd, &status)) == NULL)){
+			send_reply(fd, status, NULL);
+			close(fd);
+			continue;
+		}
+		job->fd = fd;
+		if(admit(prover, job) != PDP_PROVER_OK) finish_job(job, PDP_PROVER_BUSY, NULL);
+	}
+	if(fd >= 0) close(fd);
+
+	pdp_prover_stop(prover);
+	for(; prover->numstarted > 0; prover->numstarted--) pthread_join(prover->workers[prover->numstarted - 1], NULL);
+
+	pthread_mutex_lock(&(prover->lock));
+	while(prover->queue_len > 0){
+		job = heap_pop(prover);
+		prover->queued_io -= job->cost_io;
+		prover->stats.rejected++;
+		finish_job(job, PDP_PROVER_BUSY, NULL);
+	}
+	pthread_mutex_unlock(&(prover->lock));
+
+	return 1;
+}
+
+/* pdp_prover_stop: Makes pdp_prover_run return once the running requests finish.  Can be called
+*  from any thread.
+*/
+void pdp_prover_stop(PDP_prover *prover){
+
+	if(!prover) return;
+
+	pthread_mutex_lock(&(prover->lock));
+	prover->stopping = 1;
+	pthread_cond_broadcast(&(prover->cond));
+	pthread_mutex_unlock(&(prover->lock));
+
+	/* Wake the accepting thread */
+	if(prover->listenfd >= 0) shutdown(prover->listenfd, SHUT_RDWR);
+}
+
+/* pdp_prover_free: Closes and removes the prover's socket and frees it.  pdp_prover_run must have returned */
+void pdp_prover_free(PDP_prover *prover){
+
+	if(!prover) return;
+	if(prover->listenfd >= 0){
+		close(prover->listenfd);
+		unlink(prover->socketpath);
+	}
+	while(prover->queue && prover->queue_len > 0) destroy_job(heap_pop(prover));
+	if(prover->queue) free(prover->queue);
+	if(prover->workers) free(prover->workers);
+	pthread_cond_destroy(&(prover->cond));
+	pthread_mutex_destroy(&(prover->lock));
+	free(prover);
+}
+
+/* pdp_prover_stats: Reports the prover's counters since it was created and its current load */
+void pdp_prover_stats(PDP_prover *prover, PDP_prover_stats *stats){
+
+	if(!prover || !stats) return;
+
+	pthread_mutex_lock(&(prover->lock));
+	memcpy(stats, &(prover->stats), sizeof(PDP_prover_stats));
+	stats->queued = prover->queue_len;
+	stats->queue_wait = (double)prover->queue_wait_ns / 1000000000.0;
+	stats->block_cost = prover->block_ns / 1000000000.0;
+	pthread_mutex_unlock(&(prover->lock));
+}
+
+/* pdp_prover_request_proof: Asks the prover listening on socketpath to prove the file at filepath
+*  against a server challenge, with the tags in tagfilepath, or <filepath>.tag if it is NULL.  key
+*  needs only its public components.  deadline_ms is the time the proof is wanted within, 0 for the
+*  prover's default.  Returns an allocated proof, or NULL with *status, if given, set to the
+*  prover's answer or PDP_PROVER_FAILED if it could not be reached.
+*/
+PDP_proof *pdp_prover_request_proof(char *socketpath, char *filepath, char *tagfilepath, PDP_challenge *challenge,
+	PDP_key *key, unsigned int deadline_ms, int *status){
+
+	PDP_prover_request request;
+	PDP_prover_reply reply;
+	PDP_proof *proof = NULL;
+	struct sockaddr_un addr;
+	unsigned char *buf = NULL;
+	const BIGNUM *n = NULL, *e = NULL;
+	size_t len = 0;
+	int fd = -1;
+
+	if(status) *status = PDP_PROVER_FAILED;
+	if(!socketpath || !filepath || !challenge || !key || !key->rsa || !challenge->g_s) return NULL;
+	if(strlen(socketpath) >= sizeof(addr.sun_path)) return NULL;
+	if( ((n = RSA_get0_n(key->rsa)) == NULL) || ((e = RSA_get0_e(key->rsa)) == NULL)) return NULL;
+
+	memset(&request, 0, sizeof(PDP_prover_request));
+	memcpy(request.magic, PDP_PROVER_MAGIC, PDP_PROVER_MAGIC_SIZE);
+	request.version = PDP_PROVER_VERSION;
+	request.deadline_ms = deadline_ms;
+	request.c = challenge->c;
+	request.numfileblocks = challenge->numfileblocks;
+	request.filepath_len = strlen(filepath);
+	request.tagfilepath_len = tagfilepath ? strlen(tagfilepath) : 0;
+	request.n_len = BN_num_bytes(n);
+	request.e_len = BN_num_bytes(e);
+	request.g_s_len = BN_num_bytes(challenge->g_s);
+
+	/* Send the request as one message */
+	len = sizeof(PDP_prover_request) + request.filepath_len + request.tagfilepath_len + request.n_len
+		+ request.e_len + request.g_s_len + PRP_KEY_SIZE + PRF_KEY_SIZE;
+	if( ((buf = malloc(len)) == NULL)) return NULL;
+	memcpy(buf, &request, sizeof(PDP_prover_request));
+	len = sizeof(PDP_prover_request);
+	memcpy(buf + len, filepath, request.filepath_len);
+	len += request.filepath_len;
+	if(tagfilepath) memcpy(buf + len, tagfilepath, request.tagfilepath_len);
+	len += request.tagfilepath_len;
+	len += BN_bn2bin(n, buf + len);
+	len += BN_bn2bin(e, buf + len);
+	len += BN_bn2bin(challenge->g_s, buf + len);
+	memcpy(buf + len, challenge->k1, PRP_KEY_SIZE);
+	len += PRP_KEY_SIZE;
+	memcpy(buf + len, challenge->k2, PRF_KEY_SIZE);
+	len += PRF_KEY_SIZE;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, socketpath);
+	if( ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)) goto cleanup;
+	if(connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) goto cleanup;
+	set_timeout(fd, (deadline_ms ? deadline_ms : PDP_PROVER_DEADLINE_MS) + PDP_PROVER_RECV_TIMEOUT_MS);
+	if(!pdp_write_full(fd, buf, len)) goto cleanup;
+	free(buf);
+	buf = NULL;
+
+	if(!pdp_read_full(fd, &reply, sizeof(PDP_prover_reply))) goto cleanup;
+	if(memcmp(reply.magic, PDP_PROVER_MAGIC, PDP_PROVER_MAGIC_SIZE) != 0 || reply.version != PDP_PROVER_VERSION) goto cleanup;
+	if(status) *status = reply.status;
+	if(reply.status != PDP_PROVER_OK) goto cleanup;
+	if(reply.T_len == 0 || reply.T_len > PDP_PROVER_MAX_N_SIZE || reply.rho_len == 0 || reply.rho_len > EVP_MAX_MD_SIZE){
+		if(status) *status = PDP_PROVER_FAILED;
+		goto cleanup;
+	}
+
+	if( ((buf = malloc(reply.T_len)) == NULL)) goto cleanup;
+	if( ((proof = generate_pdp_proof()) == NULL)) goto cleanup;
+	if( ((proof->rho = malloc(reply.rho_len)) == NULL)) goto cleanup;
+	proof->rho_size = reply.rho_len;
+	if(!pdp_read_full(fd, buf, reply.T_len)) goto cleanup;
+	if(!BN_bin2bn(buf, reply.T_len, proof->T)) goto cleanup;
+	if(!pdp_read_full(fd, proof->rho, reply.rho_len)) goto cleanup;
+
+	free(buf);
+	close(fd);
+
+	return proof;
+
+cleanup:
+	if(status && proof) *status = PDP_PROVER_FAILED;
+	if(proof) destroy_pdp_proof(proof);
+	if(buf) free(buf);
+	if(fd >= 0) close(fd);
+	return NULL;
+}
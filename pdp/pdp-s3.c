@@ -46,10 +46,64 @@
 */
 
 
+/* The number of ranged GETs kept in flight at once while proving */
+#define PDP_S3_MAX_INFLIGHT 32
+
+/* Tag records are fetched and cached in pages, so the tags of files that are
+ * challenged often are not re-fetched from S3 on every proof */
+#define PDP_S3_TAG_PAGE_SIZE 4096
+#define PDP_S3_TAG_CACHE_PAGES 64
+
 struct buffer_pointer{
 
 	unsigned char *buf;
 	int offset;
+	int size;			/* The capacity of buf */
+	S3Status status;	/* The completion status of the request */
+};
+
+/* A ranged GET to be issued from a request context */
+struct range_get{
+
+	char *object;
+	uint64_t start;
+	struct buffer_pointer *bp;
+};
+
+/* A contiguous, page-aligned range of a tag object that holds one or more challenged tag records */
+struct tag_range{
+
+	off_t start;
+	struct buffer_pointer bp;
+};
+
+struct tag_page{
+
+	char *object;			/* The tag object the page belongs to */
+	off_t page;				/* The page number within the object */
+	size_t len;				/* The valid bytes in data; the last page of an object may be short */
+	unsigned long used;		/* The last use of the page, for LRU eviction */
+	unsigned char data[PDP_S3_TAG_PAGE_SIZE];
+};
+
+static struct tag_page tag_cache[PDP_S3_TAG_CACHE_PAGES];
+static unsigned long tag_cache_clock = 0;
+
+static S3BucketContext bucketContext =
+{
+	S3_BUCKET_NAME,
+	S3ProtocolHTTPS,
+	S3UriStylePath,
+	S3_ACCESS_KEY,
+	S3_SECRET_ACCESS_KEY
+};
+
+static S3GetConditions getConditions =
+{
+	-1, //ifModifiedSince,
+	-1, // ifNotModifiedSince,
+	0, //ifMatch,
+	0 //ifNotMatch
 };
 
 static int putObjectDataCallback(int bufferSize, char *buffer, void *callbackData)
@@ -79,6 +133,8 @@ static S3Status getObjectDataCallback(int bufferSize, const char *buffer, void *
 
 	struct buffer_pointer *bp = callbackData;
 
+	if(bp->offset + bufferSize > bp->size) return S3StatusAbortedByCallback;
+
 	memcpy((char *)bp->buf + bp->offset, (char *)buffer, bufferSize);
 	bp->offset += bufferSize;
 	
@@ -93,8 +149,162 @@ static S3Status responsePropertiesCallback(const S3ResponseProperties *propertie
 
 static void responseCompleteCallback(S3Status status, const S3ErrorDetails *error, void *callbackData){ }
 
+static void rangeCompleteCallback(S3Status status, const S3ErrorDetails *error, void *callbackData){
+
+	struct buffer_pointer *bp = callbackData;
 
-int pdp_s3_get_block(char *filepath, size_t filepath_len, unsigned char *block, size_t block_len, unsigned int index){
+	bp->status = status;
+}
+
+static S3GetObjectHandler rangeGetHandler =
+{
+	{ &responsePropertiesCallback, &rangeCompleteCallback },
+	&getObjectDataCallback
+};
+
+/* tag_cache_lookup: Returns the cached page of a tag object or NULL if it is not cached */
+static struct tag_page *tag_cache_lookup(char *object, off_t page){
+
+	int i = 0;
+
+	for(i = 0; i < PDP_S3_TAG_CACHE_PAGES; i++){
+		if(tag_cache[i].object && tag_cache[i].page == page && strcmp(tag_cache[i].object, object) == 0){
+			tag_cache[i].used = ++tag_cache_clock;
+			return &tag_cache[i];
+		}
+	}
+
+	return NULL;
+}
+
+/* tag_cache_insert: Caches a page of a tag object, evicting the least recently used page */
+static void tag_cache_insert(char *object, off_t page, unsigned char *data, size_t len){
+
+	struct tag_page *slot = NULL;
+	int i = 0;
+
+	if(len > PDP_S3_TAG_PAGE_SIZE) return;
+
+	slot = tag_cache_lookup(object, page);
+	for(i = 0; !slot && i < PDP_S3_TAG_CACHE_PAGES; i++){
+		if(!tag_cache[i].object){
+			slot = &tag_cache[i];
+			break;
+		}
+	}
+	for(i = 0; !slot && i < PDP_S3_TAG_CACHE_PAGES; i++){
+		if(!slot || tag_cache[i].used < slot->used) slot = &tag_cache[i];
+	}
+
+	if(slot->object && strcmp(slot->object, object) != 0){
+		free(slot->object);
+		slot->object = NULL;
+	}
+	if(!slot->object)
+		if( ((slot->object = strdup(object)) == NULL)) return;
+
+	slot->page = page;
+	slot->len = len;
+	slot->used = ++tag_cache_clock;
+	memcpy(slot->data, data, len);
+}
+
+/* tag_cache_read: Copies len bytes at offset of a tag object out of the page cache.
+ * Returns 1 if every page was cached and 0 otherwise. */
+static int tag_cache_read(char *object, off_t offset, unsigned char *out, size_t len){
+
+	struct tag_page *page = NULL;
+	size_t in_page = 0;
+	size_t n = 0;
+
+	while(len > 0){
+		page = tag_cache_lookup(object, offset / PDP_S3_TAG_PAGE_SIZE);
+		in_page = offset % PDP_S3_TAG_PAGE_SIZE;
+		if(!page || page->len <= in_page) return 0;
+
+		n = page->len - in_page;
+		if(n > len) n = len;
+		memcpy(out, page->data + in_page, n);
+
+		out += n;
+		offset += n;
+		len -= n;
+	}
+
+	return 1;
+}
+
+/* run_range_gets: Issues ranged GETs concurrently, keeping up to PDP_S3_MAX_INFLIGHT requests in flight.
+ * libs3 must already be initialized.  Returns 1 if every request completed and 0 otherwise. */
+static int run_range_gets(struct range_get *gets, unsigned int num_gets){
+
+	S3RequestContext *requestContext = NULL;
+	S3Status status;
+	unsigned int n = 0;
+	unsigned int k = 0;
+
+	for(n = 0; n < num_gets; n += PDP_S3_MAX_INFLIGHT){
+		if(S3_create_request_context(&requestContext) != S3StatusOK) return 0;
+
+		for(k = n; k < num_gets && k < n + PDP_S3_MAX_INFLIGHT; k++){
+			gets[k].bp->offset = 0;
+			gets[k].bp->status = S3StatusInternalError;
+			S3_get_object(&bucketContext, gets[k].object, &getConditions, gets[k].start, gets[k].bp->size,
+				requestContext, &rangeGetHandler, gets[k].bp);
+		}
+
+		status = S3_runall_request_context(requestContext);
+		S3_destroy_request_context(requestContext);
+		if(status != S3StatusOK) return 0;
+
+		for(k = n; k < num_gets && k < n + PDP_S3_MAX_INFLIGHT; k++)
+			if(gets[k].bp->status != S3StatusOK) return 0;
+	}
+
+	return 1;
+}
+
+/* get_tag_header: Reads the header of a remote tag object, fetching its first page unless it is cached.
+ * libs3 must already be initialized.  Returns 1 if the object is in the fixed-width tag layout and 0 otherwise. */
+static int get_tag_header(char *object, PDP_tag_header *header){
+
+	unsigned char page[PDP_S3_TAG_PAGE_SIZE];
+	struct buffer_pointer bp;
+	struct range_get get;
+
+	if(tag_cache_read(object, 0, page, PDP_TAG_HEADER_SIZE))
+		return pdp_tag_header_parse(header, page, PDP_TAG_HEADER_SIZE);
+
+	memset(&bp, 0, sizeof(struct buffer_pointer));
+	bp.buf = page;
+	bp.size = PDP_S3_TAG_PAGE_SIZE;
+	get.object = object;
+	get.start = 0;
+	get.bp = &bp;
+
+	if(!run_range_gets(&get, 1)) return 0;
+	tag_cache_insert(object, 0, page, bp.offset);
+
+	return pdp_tag_header_parse(header, page, bp.offset);
+}
+
+/* get_object_to_file: Downloads a whole object into an open file.  libs3 must already be initialized. */
+static int get_object_to_file(char *object, FILE *file){
+
+	S3GetObjectHandler getObjectHandler =
+	{
+		{ &responsePropertiesCallback, &responseCompleteCallback },
+		&getObjectDataCallbackFile
+	};
+
+	S3_get_object(&bucketContext, object, &getConditions, 0, 0, 0, &getObjectHandler, file);
+	fflush(file);
+
+	return !ferror(file);
+}
+
+
+int pdp_s3_get_block(char *filepath, size_t filepath_len, unsigned char *block, size_t block_len, uint64_t index){
 
 	if(!filepath || !filepath_len || !block || !block_len) return 0;
 	
@@ -106,22 +316,7 @@ int pdp_s3_get_block(char *filepath, size_t filepath_len, unsigned char *block,
         exit(-1);
     }
 
-	S3BucketContext bucketContext =
-    {
-        S3_BUCKET_NAME, //bucket name
-        S3ProtocolHTTPS,
-        S3UriStylePath,
-        S3_ACCESS_KEY, //access key
-        S3_SECRET_ACCESS_KEY //secret access key
-    };
 
-    S3GetConditions getConditions =
-    {
-        -1, //ifModifiedSince,
-        -1, // ifNotModifiedSince,
-        0, //ifMatch,
-        0 //ifNotMatch
-    };
 
     S3GetObjectHandler getObjectHandler =
     {
@@ -132,8 +327,9 @@ int pdp_s3_get_block(char *filepath, size_t filepath_len, unsigned char *block,
 	struct buffer_pointer bp;
 	bp.buf = block;
 	bp.offset = 0;
+	bp.size = block_len;
 
-	S3_get_object(&bucketContext, filepath, &getConditions, (index * PDP_BLOCKSIZE), PDP_BLOCKSIZE, 0, &getObjectHandler, &bp);
+	S3_get_object(&bucketContext, filepath, &getConditions, ((uint64_t)index * PDP_BLOCKSIZE), PDP_BLOCKSIZE, 0, &getObjectHandler, &bp);
 
 	S3_deinitialize();
 
@@ -165,16 +361,6 @@ int pdp_s3_put_file(char *filepath, size_t filepath_len){
 		goto cleanup;
     }
 	
-	/* Set the S3 context */
-	S3BucketContext bucketContext =
-    {
-        S3_BUCKET_NAME,
-        S3ProtocolHTTPS,
-        S3UriStylePath,
-        S3_ACCESS_KEY,
-        S3_SECRET_ACCESS_KEY
-    };
-
 	/* Set the object properties */
     S3PutProperties putProperties =
     {
@@ -236,30 +422,12 @@ int pdp_s3_get_file(char *filepath, size_t filepath_len){
         exit(-1);
     }
 
-	S3BucketContext bucketContext =
-    {
-        S3_BUCKET_NAME,
-        S3ProtocolHTTPS,
-        S3UriStylePath,
-        S3_ACCESS_KEY,
-        S3_SECRET_ACCESS_KEY
-    };
-
-    S3GetConditions getConditions =
-    {
-        -1, //ifModifiedSince,
-        -1, // ifNotModifiedSince,
-        0, //ifMatch,
-        0 //ifNotMatch
-    };
 
-    S3GetObjectHandler getObjectHandler =
-    {
-        { &responsePropertiesCallback, &responseCompleteCallback },
-        &getObjectDataCallbackFile
-    };
 
-	S3_get_object(&bucketContext, filepath, &getConditions, 0, 0, 0, &getObjectHandler, file);
+	if(!get_object_to_file(filepath, file)){
+		S3_deinitialize();
+		goto cleanup;
+	}
 
 	S3_deinitialize();
 	if(file) fclose(file);
@@ -272,21 +440,41 @@ cleanup:
 }
 
 
-/* pdp_prove_file: Computes the server-side proof.
+/* pdp_s3_prove_file: Computes the server-side proof for a file stored in S3.
  * Takes in the file to be proven, its corresponding tag file, and a "sanitized" challenge and key structure.
+ * If the tag file is not on local disk, only the challenged tag records are range-fetched from the tag
+ * object, concurrently with the challenged data blocks.  Tag files in the legacy variable-width layout
+ * cannot be range-fetched and are downloaded whole.
  * Returns an allocated proof structure or NULL on error.
 */
 PDP_proof *pdp_s3_prove_file(char *filepath, size_t filepath_len, char *tagfilepath, size_t tagfilepath_len, PDP_challenge *challenge, PDP_key *key){
 
 	PDP_proof *proof = NULL;
 	PDP_tag *tag = NULL;
-	unsigned int *indices = NULL;
+	PDP_tag_header header;
+	uint64_t *indices = NULL;
 	FILE *tagfile = NULL;
 	char realtagfilepath[MAXPATHLEN];
-	unsigned char buf[PDP_BLOCKSIZE];
+	unsigned char *blocks = NULL;			/* The challenged data blocks */
+	struct buffer_pointer *block_bps = NULL;
+	unsigned char *records = NULL;			/* The challenged tag records, when the tags are remote */
+	int *record_range = NULL;				/* The tag range holding each record, or -1 if it was cached */
+	struct tag_range *ranges = NULL;
+	unsigned int num_ranges = 0;
+	struct range_get *gets = NULL;
+	unsigned int num_gets = 0;
+	int remote_tags = 0;
+	int s3_initialized = 0;
+	S3Status status;
+	off_t offset = 0;
+	off_t first = 0;
+	off_t end = 0;
+	off_t pos = 0;
+	unsigned int r = 0;
 	int j = 0;
 
 	memset(realtagfilepath, 0, MAXPATHLEN);
+	memset(&header, 0, PDP_TAG_HEADER_SIZE);
 	
 	if(!filepath || !challenge || !key) return NULL;
 	if(filepath_len >= MAXPATHLEN) return NULL;
@@ -300,31 +488,113 @@ PDP_proof *pdp_s3_prove_file(char *filepath, size_t filepath_len, char *tagfilep
 		memcpy(realtagfilepath, tagfilepath, tagfilepath_len);
 	}
 
-	/* Get the tag file from S3 */
-	//if(!pdp_s3_get_file(realtagfilepath, tagfilepath_len)) goto cleanup;
-
-	/* Open the tag file for reading */
-	tagfile = fopen(realtagfilepath, "r");
-	if(!tagfile){
-		fprintf(stderr, "ERROR: Was not able to create %s.\n", realtagfilepath);
+	if ((status = S3_initialize("s3", S3_INIT_ALL)) != S3StatusOK) {
+		fprintf(stderr, "Failed to initialize libs3: %s\n", S3_get_status_name(status));
 		goto cleanup;
 	}
+	s3_initialized = 1;
+
+	/* Use a local tag file if there is one, otherwise work out how to read the remote one */
+	if(access(realtagfilepath, R_OK) != 0){
+		if(get_tag_header(realtagfilepath, &header)){
+			remote_tags = 1;
+		}else{
+			tagfile = fopen(realtagfilepath, "w+");
+			if(!tagfile){
+				fprintf(stderr, "ERROR: Was not able to create %s.\n", realtagfilepath);
+				goto cleanup;
+			}
+			if(!get_object_to_file(realtagfilepath, tagfile)){ fprintf(stderr, "Error getting tag file.\n"); goto cleanup; }
+		}
+	}else{
+		tagfile = fopen(realtagfilepath, "r");
+		if(!tagfile){
+			fprintf(stderr, "ERROR: Was not able to open %s.\n", realtagfilepath);
+			goto cleanup;
+		}
+	}
 
 	/* Compute the indices i_j = pi_k1(j); the block indices to sample */
 	indices = generate_prp_pi(challenge);
 	if(!indices) goto cleanup;
-	
+
+	/* Allocate memory */
+	if( ((blocks = malloc(challenge->c * PDP_BLOCKSIZE)) == NULL)) goto cleanup;
+	if( ((block_bps = malloc(challenge->c * sizeof(struct buffer_pointer))) == NULL)) goto cleanup;
+	if( ((gets = malloc(2 * challenge->c * sizeof(struct range_get))) == NULL)) goto cleanup;
+	memset(blocks, 0, challenge->c * PDP_BLOCKSIZE);
+	memset(block_bps, 0, challenge->c * sizeof(struct buffer_pointer));
+	if(remote_tags){
+		if( ((records = malloc(challenge->c * header.record_size)) == NULL)) goto cleanup;
+		if( ((record_range = malloc(challenge->c * sizeof(int))) == NULL)) goto cleanup;
+		if( ((ranges = malloc(challenge->c * sizeof(struct tag_range))) == NULL)) goto cleanup;
+		memset(ranges, 0, challenge->c * sizeof(struct tag_range));
+	}
+
+	/* Plan the fetches.  The indices are ascending, so records that share or neighbor a page
+	 * are coalesced into one page-aligned range */
+	for(j = 0; j < challenge->c; j++){
+		block_bps[j].buf = blocks + (j * PDP_BLOCKSIZE);
+		block_bps[j].size = PDP_BLOCKSIZE;
+		gets[num_gets].object = filepath;
+		gets[num_gets].start = (uint64_t)indices[j] * PDP_BLOCKSIZE;
+		gets[num_gets].bp = &block_bps[j];
+		num_gets++;
+
+		if(!remote_tags) continue;
+
+		offset = pdp_tag_record_offset(&header, indices[j]);
+		if(tag_cache_read(realtagfilepath, offset, records + (j * header.record_size), header.record_size)){
+			record_range[j] = -1;
+			continue;
+		}
+		first = (offset / PDP_S3_TAG_PAGE_SIZE) * PDP_S3_TAG_PAGE_SIZE;
+		end = ((offset + header.record_size + PDP_S3_TAG_PAGE_SIZE - 1) / PDP_S3_TAG_PAGE_SIZE) * PDP_S3_TAG_PAGE_SIZE;
+		if(num_ranges > 0 && ranges[num_ranges - 1].start + ranges[num_ranges - 1].bp.size >= first){
+			if(end > ranges[num_ranges - 1].start + ranges[num_ranges - 1].bp.size)
+				ranges[num_ranges - 1].bp.size = end - ranges[num_ranges - 1].start;
+		}else{
+			ranges[num_ranges].start = first;
+			ranges[num_ranges].bp.size = end - first;
+			/* Interleave the tag fetches with the block fetches so they are in flight together */
+			gets[num_gets].object = realtagfilepath;
+			gets[num_gets].start = first;
+			gets[num_gets].bp = &ranges[num_ranges].bp;
+			num_gets++;
+			num_ranges++;
+		}
+		record_range[j] = num_ranges - 1;
+	}
+
+	for(r = 0; r < num_ranges; r++)
+		if( ((ranges[r].bp.buf = malloc(ranges[r].bp.size)) == NULL)) goto cleanup;
+
+	/* Fetch the data blocks and tag ranges */
+	if(!run_range_gets(gets, num_gets)){ fprintf(stderr, "Error reading blocks and tags from S3.\n"); goto cleanup; }
+
+	/* Keep the fetched tag pages around for later challenges and pull out the records */
+	for(r = 0; r < num_ranges; r++){
+		for(pos = 0; pos < ranges[r].bp.offset; pos += PDP_S3_TAG_PAGE_SIZE)
+			tag_cache_insert(realtagfilepath, (ranges[r].start + pos) / PDP_S3_TAG_PAGE_SIZE, ranges[r].bp.buf + pos,
+				(ranges[r].bp.offset - pos < PDP_S3_TAG_PAGE_SIZE) ? (ranges[r].bp.offset - pos) : PDP_S3_TAG_PAGE_SIZE);
+	}
+	for(j = 0; remote_tags && j < challenge->c; j++){
+		if(record_range[j] < 0) continue;
+		offset = pdp_tag_record_offset(&header, indices[j]) - ranges[record_range[j]].start;
+		if(offset + header.record_size > ranges[record_range[j]].bp.offset){ fprintf(stderr, "Error reading tag.\n"); goto cleanup; }
+		memcpy(records + (j * header.record_size), ranges[record_range[j]].bp.buf + offset, header.record_size);
+	}
+
 	for(j = 0; j < challenge->c; j++){
-		memset(buf, 0, PDP_BLOCKSIZE);
-		
-		/* Get block at indices[j] from S3 */
-		if(!pdp_s3_get_block(filepath, filepath_len, buf, PDP_BLOCKSIZE, indices[j])){ fprintf(stderr, "Error reading block %d from S3.\n", indices[j]); goto cleanup; }
 		
 		/* Read tag for data block at indices[j] */
-		tag = read_pdp_tag(tagfile, indices[j]);
-		if(!tag){ fprintf(stderr, "Error reading tag.\n"); goto cleanup; }
+		if(remote_tags)
+			tag = pdp_tag_record_decode(&header, records + (j * header.record_size));
+		else
+			tag = read_pdp_tag(tagfile, indices[j]);
+		if(!tag || tag->index != indices[j]){ fprintf(stderr, "Error reading tag.\n"); goto cleanup; }
 		
-		proof = pdp_generate_proof_update(key, challenge, tag, proof, buf, PDP_BLOCKSIZE, j);
+		proof = pdp_generate_proof_update(key, challenge, tag, proof, blocks + (j * PDP_BLOCKSIZE), PDP_BLOCKSIZE, j);
 		if(!proof){ fprintf(stderr, "Error generating proof.\n"); goto cleanup; }
 
 		destroy_pdp_tag(tag);
@@ -334,26 +604,34 @@ PDP_proof *pdp_s3_prove_file(char *filepath, size_t filepath_len, char *tagfilep
 	proof = pdp_generate_proof_final(key, challenge, proof);
 	if(!proof){ fprintf(stderr, "Error finalizing proof.\n"); goto cleanup; }
 	
-	if(indices) sfree(indices, (challenge->c * sizeof(unsigned int)));
-	/* Destroy the tag file */
-	if(tagfile){ 
-		//ftruncate(fileno(tagfile), 0);
-		//unlink(realtagfilepath);
-		fclose(tagfile);
-	}
+	for(r = 0; r < num_ranges; r++) if(ranges[r].bp.buf) free(ranges[r].bp.buf);
+	if(ranges) free(ranges);
+	if(records) sfree(records, challenge->c * header.record_size);
+	if(record_range) free(record_range);
+	if(gets) free(gets);
+	if(block_bps) free(block_bps);
+	if(blocks) sfree(blocks, challenge->c * PDP_BLOCKSIZE);
+	if(indices) sfree(indices, (challenge->c * sizeof(uint64_t)));
+	if(tagfile) fclose(tagfile);
+	S3_deinitialize();
+
 	return proof;
 
 cleanup:
-	if(indices) sfree(indices, (challenge->c * sizeof(unsigned int)));
+	for(r = 0; ranges && r < num_ranges; r++) if(ranges[r].bp.buf) free(ranges[r].bp.buf);
+	if(ranges) free(ranges);
+	if(records) sfree(records, challenge->c * header.record_size);
+	if(record_range) free(record_range);
+	if(gets) free(gets);
+	if(block_bps) free(block_bps);
+	if(blocks) sfree(blocks, challenge->c * PDP_BLOCKSIZE);
+	if(indices) sfree(indices, (challenge->c * sizeof(uint64_t)));
 	if(proof) destroy_pdp_proof(proof);
 	if(tag) destroy_pdp_tag(tag);
-	if(tagfile){ 
-		ftruncate(fileno(tagfile), 0);
-		//unlink(realtagfilepath);
-		//fclose(tagfile);
-	}
+	if(tagfile) fclose(tagfile);
+	if(s3_initialized) S3_deinitialize();
 	
 	return NULL;
 }
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,583 @@
+/* 
+* pdp-scheduler.c
+*
+* Copyright (c) 2008, Zachary N J Peterson <zachary@jhu.edu>
+* All rights reserved.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*     * Redistributions of source code must retain the above copyright
+*       notice, this list of conditions and the following disclaimer.
+*     * Redistributions in binary form must reproduce the above copyright
+*       notice, this list of conditions and the following disclaimer in the
+*       documentation and/or other materials provided with the distribution.
+*     * The name of the Zachary N J Peterson may be used to endorse or promote products
+*       derived from this software without specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY ZACHARY N J PETERSON ``AS IS'' AND ANY
+* EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL ZACHARY N J PETERSON BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+/* pdp-scheduler.c contains the audit scheduler, which keeps every file the cluster must audit in a
+*  priority queue ordered by when it is next due, and hands out the due ones grouped by the peer
+*  holding them so each peer can be challenged for a batch at once.  How often a file is due
+*  depends on its risk and size (see PDP_SCHED_INTERVAL), and how many blocks it is challenged for
+*  on the challenge policy and the peer's past audits.  Audits are held to a global I/O budget and
+*  one per device; a file whose device is out of budget stays due while the others go ahead.
+*
+*  The scheduler is driven with the caller's clock, in seconds: pdp_scheduler_next hands out due
+*  files and pdp_scheduler_complete records their results and queues them again.  pdp_scheduler_run
+*  does both, proving each file locally, which is how it is tested from local files.  A scheduler
+*  is not thread-safe.
+*/
+
+#include "pdp.h"
+#include <stdlib.h>
+#include <sys/stat.h>
+
+typedef struct PDP_sched_entry_struct PDP_sched_entry;
+
+struct PDP_sched_entry_struct{
+
+	PDP_audit_record record;	/* First, so a record is its entry */
+	uint32_t peer;				/* Index into the scheduler's peers */
+	uint32_t device;			/* Index into the scheduler's devices */
+	double weight;				/* Risk times the size factor; divides the interval */
+	double detection;			/* The detection probability and corruption fraction c was last sized for */
+	double corrupt_fraction;
+	uint64_t c;
+	int queued;
+};
+
+typedef struct PDP_sched_peer_struct PDP_sched_peer;
+
+struct PDP_sched_peer_struct{
+
+	char *name;
+	PDP_peer_history history;
+	int64_t next;				/* Next peer in the same hash bucket, or -1 */
+};
+
+typedef struct PDP_sched_device_struct PDP_sched_device;
+
+struct PDP_sched_device_struct{
+
+	dev_t dev;
+	PDP_budget *budget;
+};
+
+struct PDP_scheduler_struct{
+
+	PDP_ctx *ctx;
+	char *keypath;
+	char *password;
+	uint64_t interval;
+	PDP_challenge_policy policy;
+	PDP_latency_tracker *latency;	/* Proof latencies of each peer */
+	PDP_budget *budget;			/* The global I/O budget of audits */
+	uint64_t device_io;			/* I/O budget of each device in bytes per second; 0 is unlimited */
+
+	PDP_sched_entry *entries;
+	uint64_t numentries;
+	uint64_t capacity;
+
+	uint64_t *heap;				/* Entry ids, a binary min-heap on next_due then id */
+	uint64_t heapsize;
+
+	PDP_sched_peer *peers;
+	uint64_t numpeers;
+	uint64_t peercapacity;
+	int64_t *buckets;			/* Heads of the peer hash chains */
+	uint64_t numbuckets;
+
+	PDP_sched_device *devices;
+	uint64_t numdevices;
+
+	PDP_scheduler_stats stats;
+};
+
+/* heap_before: Returns 1 if entry a is due before entry b */
+static int heap_before(PDP_scheduler *sched, uint64_t a, uint64_t b){
+
+	if(sched->entries[a].record.next_due != sched->entries[b].record.next_due)
+		return sched->entries[a].record.next_due < sched->entries[b].record.next_due;
+
+	return a < b;
+}
+
+/* heap_push: Queues entry id.  The heap has room for every entry */
+static void heap_push(PDP_scheduler *sched, uint64_t id){
+
+	uint64_t i = sched->heapsize++, parent = 0;
+
+	while(i > 0){
+		parent = (i - 1) / 2;
+		if(!heap_before(sched, id, sched->heap[parent])) break;
+		sched->heap[i] = sched->heap[parent];
+		i = parent;
+	}
+	sched->heap[i] = id;
+	sched->entries[id].queued = 1;
+}
+
+/* heap_pop: Removes and returns the entry due first.  The heap must not be empty */
+static uint64_t heap_pop(PDP_scheduler *sched){
+
+	uint64_t top = sched->heap[0], last = sched->heap[--sched->heapsize];
+	uint64_t i = 0, child = 0;
+
+	while((child = (2 * i) + 1) < sched->heapsize){
+		if(child + 1 < sched->heapsize && heap_before(sched, sched->heap[child + 1], sched->heap[child])) child++;
+		if(!heap_before(sched, sched->heap[child], last)) break;
+		sched->heap[i] = sched->heap[child];
+		i = child;
+	}
+	if(sched->heapsize) sched->heap[i] = last;
+	sched->entries[top].queued = 0;
+
+	return top;
+}
+
+/* find_peer: Returns the index of the peer called name, adding it if it is new, or -1 on error */
+static int64_t find_peer(PDP_scheduler *sched, char *name){
+
+	PDP_sched_peer *peers = NULL;
+	int64_t *buckets = NULL;
+	uint64_t bucket = 0, i = 0, numbuckets = 0;
+	int64_t p = 0;
+
+	bucket = pdp_hash_name(name) % sched->numbuckets;
+	for(p = sched->buckets[bucket]; p >= 0; p = sched->peers[p].next)
+		if(strcmp(sched->peers[p].name, name) == 0) return p;
+
+	if(sched->numpeers == sched->peercapacity){
+		sched->peercapacity = sched->peercapacity ? sched->peercapacity * 2 : 64;
+		if( ((peers = realloc(sched->peers, sched->peercapacity * sizeof(PDP_sched_peer))) == NULL)) return -1;
+		sched->peers = peers;
+	}
+
+	/* Keep the chains short by doubling the buckets along with the peers */
+	if(sched->numpeers >= sched->numbuckets){
+		numbuckets = sched->numbuckets * 2;
+		if( ((buckets = malloc(numbuckets * sizeof(int64_t))) == NULL)) return -1;
+		for(i = 0; i < numbuckets; i++) buckets[i] = -1;
+		for(i = 0; i < sched->numpeers; i++){
+			bucket = pdp_hash_name(sched->peers[i].name) % numbuckets;
+			sched->peers[i].next = buckets[bucket];
+			buckets[bucket] = i;
+		}
+		free(sched->buckets);
+		sched->buckets = buckets;
+		sched->numbuckets = numbuckets;
+		bucket = pdp_hash_name(name) % sched->numbuckets;
+	}
+
+	p = sched->numpeers;
+	memset(&(sched->peers[p]), 0, sizeof(PDP_sched_peer));
+	if( ((sched->peers[p].name = strdup(name)) == NULL)) return -1;
+	sched->peers[p].next = sched->buckets[bucket];
+	sched->buckets[bucket] = p;
+	sched->numpeers++;
+
+	return p;
+}
+
+/* find_device: Returns the index of device dev, adding it with its own I/O budget if it is new, or -1 on error */
+static int64_t find_device(PDP_scheduler *sched, dev_t dev){
+
+	PDP_sched_device *devices = NULL;
+	uint64_t i = 0;
+
+	for(i = 0; i < sched->numdevices; i++)
+		if(sched->devices[i].dev == dev) return i;
+
+	if( ((devices = realloc(sched->devices, (sched->numdevices + 1) * sizeof(PDP_sched_device))) == NULL)) return -1;
+	sched->devices = devices;
+	sched->devices[i].dev = dev;
+	if( ((sched->devices[i].budget = pdp_budget_new()) == NULL)) return -1;
+	pdp_budget_set(sched->devices[i].budget, 0, sched->device_io);
+	sched->numdevices++;
+
+	return i;
+}
+
+/* pdp_scheduler_new: Returns an allocated scheduler auditing files with ctx and the key in keypath
+*  (ctx->keypath if NULL) opened with password, each every interval seconds (PDP_SCHED_INTERVAL if 0)
+*  divided by its weight, under the default challenge policy.  Returns NULL on failure.
+*/
+PDP_scheduler *pdp_scheduler_new(PDP_ctx *ctx, char *keypath, char *password, uint64_t interval){
+
+	PDP_scheduler *sched = NULL;
+	uint64_t i = 0;
+
+	if(!ctx) return NULL;
+
+	if( ((sched = calloc(1, sizeof(PDP_scheduler))) == NULL)) return NULL;
+	sched->ctx = ctx;
+	sched->interval = interval ? interval : PDP_SCHED_INTERVAL;
+	pdp_challenge_policy_init(&(sched->policy));
+
+	if( ((sched->keypath = strdup(keypath ? keypath : ctx->keypath)) == NULL)) goto cleanup;
+	if(password && ((sched->password = strdup(password)) == NULL)) goto cleanup;
+	if( ((sched->budget = pdp_budget_new()) == NULL)) goto cleanup;
+	if( ((sched->latency = pdp_latency_tracker_new(NULL)) == NULL)) goto cleanup;
+	sched->numbuckets = 64;
+	if( ((sched->buckets = malloc(sched->numbuckets * sizeof(int64_t))) == NULL)) goto cleanup;
+	for(i = 0; i < sched->numbuckets; i++) sched->buckets[i] = -1;
+
+	return sched;
+
+cleanup:
+	pdp_scheduler_free(sched);
+
+	return NULL;
+}
+
+/* pdp_scheduler_free: Frees a scheduler and every file it tracks */
+void pdp_scheduler_free(PDP_scheduler *sched){
+
+	uint64_t i = 0;
+
+	if(!sched) return;
+
+	for(i = 0; i < sched->numentries; i++){
+		free(sched->entries[i].record.filepath);
+		if(sched->entries[i].record.tagfilepath) free(sched->entries[i].record.tagfilepath);
+	}
+	for(i = 0; i < sched->numpeers; i++) free(sched->peers[i].name);
+	for(i = 0; i < sched->numdevices; i++) pdp_budget_free(sched->devices[i].budget);
+	if(sched->entries) free(sched->entries);
+	if(sched->heap) free(sched->heap);
+	if(sched->peers) free(sched->peers);
+	if(sched->buckets) free(sched->buckets);
+	if(sched->devices) free(sched->devices);
+	if(sched->budget) pdp_budget_free(sched->budget);
+	if(sched->latency) pdp_latency_tracker_free(sched->latency);
+	if(sched->keypath) free(sched->keypath);
+	if(sched->password) sfree(sched->password, strlen(sched->password));
+	free(sched);
+}
+
+/* pdp_scheduler_set_budget: Sets the I/O audits may use, io_bytes_per_sec across all devices and
+*  device_io_bytes_per_sec on each one.  A budget of 0 is unlimited.  The bytes of an audit are
+*  charged when it is handed out, as its challenged blocks.
+*/
+void pdp_scheduler_set_budget(PDP_scheduler *sched, uint64_t io_bytes_per_sec, uint64_t device_io_bytes_per_sec){
+
+	uint64_t i = 0;
+
+	if(!sched) return;
+
+	pdp_budget_set(sched->budget, 0, io_bytes_per_sec);
+	sched->device_io = device_io_bytes_per_sec;
+	for(i = 0; i < sched->numdevices; i++) pdp_budget_set(sched->devices[i].budget, 0, device_io_bytes_per_sec);
+}
+
+/* pdp_scheduler_policy: Returns the challenge policy of the scheduler, which the caller may change */
+PDP_challenge_policy *pdp_scheduler_policy(PDP_scheduler *sched){
+
+	if(!sched) return NULL;
+
+	return &(sched->policy);
+}
+
+/* pdp_scheduler_latency: Returns the tracker of the proof latencies of each peer the scheduler has audited */
+PDP_latency_tracker *pdp_scheduler_latency(PDP_scheduler *sched){
+
+	if(!sched) return NULL;
+
+	return sched->latency;
+}
+
+/* pdp_scheduler_add: Tracks filepath, with its tags in tagfilepath (filepath with a .tag extension
+*  if NULL), held by peer, at the given risk (1 if not positive).  Its size comes from the context's
+*  catalog when the file is not here.  A new file is due at once, after
+*  the files added before it.  Returns the file's id or -1 on error.
+*/
+int64_t pdp_scheduler_add(PDP_scheduler *sched, char *peer, char *filepath, char *tagfilepath, double risk){
+
+	PDP_sched_entry *entries = NULL;
+	PDP_sched_entry *entry = NULL;
+	uint64_t *heap = NULL;
+	PDP_catalog_entry cataloged;
+	struct stat st;
+	uint64_t blocks = 0;
+	int64_t p = 0, device = 0;
+	int bits = 0;
+
+	if(!sched || !peer || !filepath) return -1;
+
+	/* A verifier without the data has its size from the catalog */
+	if(stat(filepath, &st) < 0){
+		if(!sched->ctx->catalog || !pdp_catalog_get(sched->ctx->catalog, filepath, &cataloged)){
+			fprintf(stderr, "ERROR: Was not able to open %s for reading.\n", filepath);
+			return -1;
+		}
+		memset(&st, 0, sizeof(struct stat));
+		st.st_size = cataloged.file_size;
+	}
+
+	if(sched->numentries == sched->capacity){
+		sched->capacity = sched->capacity ? sched->capacity * 2 : 1024;
+		if( ((entries = realloc(sched->entries, sched->capacity * sizeof(PDP_sched_entry))) == NULL)) return -1;
+		sched->entries = entries;
+		if( ((heap = realloc(sched->heap, sched->capacity * sizeof(uint64_t))) == NULL)) return -1;
+		sched->heap = heap;
+	}
+	if( ((p = find_peer(sched, peer)) < 0)) return -1;
+	if( ((device = find_device(sched, st.st_dev)) < 0)) return -1;
+
+	entry = &(sched->entries[sched->numentries]);
+	memset(entry, 0, sizeof(PDP_sched_entry));
+	if( ((entry->record.filepath = strdup(filepath)) == NULL)) return -1;
+	if(tagfilepath && ((entry->record.tagfilepath = strdup(tagfilepath)) == NULL)){
+		free(entry->record.filepath);
+		return -1;
+	}
+	entry->record.peer = sched->peers[p].name;
+	entry->record.numfileblocks = (st.st_size + PDP_BLOCKSIZE - 1) / PDP_BLOCKSIZE;
+	entry->record.risk = (risk > 0) ? risk : 1;
+	entry->peer = p;
+	entry->device = device;
+
+	/* Weigh the risk by the file's size, 1 + log2(blocks) / PDP_SCHED_SIZE_BITS */
+	for(blocks = entry->record.numfileblocks; blocks > 1; blocks >>= 1) bits++;
+	entry->weight = entry->record.risk * (1 + ((double)bits / PDP_SCHED_SIZE_BITS));
+
+	heap_push(sched, sched->numentries);
+
+	return sched->numentries++;
+}
+
+/* pdp_scheduler_load: Adds the files listed in listpath, one per line as "peer filepath [risk]"
+*  with their tags beside them, skipping blank lines and lines starting with #.  Returns the files
+*  added, or -1 if the list could not be read or a line could not be added.
+*/
+int64_t pdp_scheduler_load(PDP_scheduler *sched, char *listpath){
+
+	FILE *list = NULL;
+	char line[MAXPATHLEN + 256];
+	char peer[256];
+	char filepath[MAXPATHLEN];
+	double risk = 0;
+	int64_t added = 0;
+	int fields = 0;
+
+	if(!sched || !listpath) return -1;
+	if( ((list = fopen(listpath, "r")) == NULL)){
+		fprintf(stderr, "ERROR: Was not able to open %s for reading.\n", listpath);
+		return -1;
+	}
+
+	while(fgets(line, sizeof(line), list)){
+		risk = 1;
+		fields = sscanf(line, "%255s %4095s %lf", peer, filepath, &risk);
+		if(fields <= 0 || peer[0] == '#') continue;
+		if(fields < 2 || pdp_scheduler_add(sched, peer, filepath, NULL, risk) < 0){
+			fprintf(stderr, "ERROR: Could not add \"%s\" from %s.\n", strtok(line, "\n"), listpath);
+			added = -1;
+			break;
+		}
+		added++;
+	}
+	fclose(list);
+
+	return added;
+}
+
+/* pdp_scheduler_record: Returns the record of file id, valid until the next pdp_scheduler_add, or NULL */
+PDP_audit_record *pdp_scheduler_record(PDP_scheduler *sched, uint64_t id){
+
+	if(!sched || id >= sched->numentries) return NULL;
+
+	return &(sched->entries[id].record);
+}
+
+/* compare_jobs: Orders jobs by peer, then by id */
+static int compare_jobs(const void *a, const void *b){
+
+	const PDP_audit_job *x = a, *y = b;
+
+	if(x->record->peer != y->record->peer) return ((uintptr_t)x->record->peer < (uintptr_t)y->record->peer) ? -1 : 1;
+
+	return (x->id > y->id) - (x->id < y->id);
+}
+
+/* pdp_scheduler_next: Hands out up to maxjobs of the files due at now, most overdue first, into
+*  jobs, grouped by peer, and charges their challenged blocks to the I/O budgets.  Stops early when
+*  the global budget runs out; a file whose device is out of budget stays queued and due.  Each
+*  file handed out must be passed to pdp_scheduler_complete before it is queued again.  Returns the
+*  jobs filled in.
+*/
+size_t pdp_scheduler_next(PDP_scheduler *sched, uint64_t now, PDP_audit_job *jobs, size_t maxjobs){
+
+	PDP_sched_entry *entry = NULL;
+	uint64_t *deferred = NULL;
+	uint64_t numdeferred = 0, maxdeferred = 0, id = 0, i = 0;
+	size_t n = 0;
+
+	if(!sched || !jobs || !maxjobs) return 0;
+
+	/* Look past at most as many held back files as jobs asked for */
+	maxdeferred = maxjobs;
+	if( ((deferred = malloc(maxdeferred * sizeof(uint64_t))) == NULL)) return 0;
+
+	while(n < maxjobs && sched->heapsize && sched->entries[sched->heap[0]].record.next_due <= now){
+		id = sched->heap[0];
+		entry = &(sched->entries[id]);
+		jobs[n].id = id;
+		jobs[n].record = &(entry->record);
+		jobs[n].detection = pdp_challenge_policy_detection(&(sched->policy), &(sched->peers[entry->peer].history));
+		/* Sizing a challenge costs O(c), so keep the last size until the peer's tier or the policy changes */
+		if(!entry->c || entry->detection != jobs[n].detection || entry->corrupt_fraction != sched->policy.corrupt_fraction){
+			entry->c = pdp_challenge_size(entry->record.numfileblocks, jobs[n].detection, sched->policy.corrupt_fraction);
+			entry->detection = jobs[n].detection;
+			entry->corrupt_fraction = sched->policy.corrupt_fraction;
+		}
+		jobs[n].c = entry->c;
+
+		if(!pdp_budget_try_io(sched->devices[entry->device].budget, jobs[n].c * PDP_BLOCKSIZE)){
+			sched->stats.deferred++;
+			deferred[numdeferred++] = heap_pop(sched);
+			if(numdeferred == maxdeferred) break;
+			continue;
+		}
+		if(!pdp_budget_try_io(sched->budget, jobs[n].c * PDP_BLOCKSIZE)){
+			pdp_budget_refund_io(sched->devices[entry->device].budget, jobs[n].c * PDP_BLOCKSIZE);
+			break;
+		}
+		heap_pop(sched);
+		n++;
+	}
+
+	/* Held back files keep their place */
+	for(i = 0; i < numdeferred; i++) heap_push(sched, deferred[i]);
+	free(deferred);
+
+	qsort(jobs, n, sizeof(PDP_audit_job), compare_jobs);
+	sched->stats.inflight += n;
+
+	return n;
+}
+
+/* pdp_scheduler_complete: Records the PDP_AUDIT_* status of the audit of file id, handed out by
+*  pdp_scheduler_next, at now and queues the file again: PDP_SCHED_RETRY seconds later if it did not
+*  pass, and its interval divided by its weight later if it did.  Passes and failures are recorded
+*  in the peer's history for the challenge policy; errors are not.  The result is also recorded in
+*  the context's catalog, if it has one.
+*/
+void pdp_scheduler_complete(PDP_scheduler *sched, uint64_t id, int status, uint64_t now){
+
+	PDP_sched_entry *entry = NULL;
+
+	if(!sched || id >= sched->numentries || sched->entries[id].queued) return;
+	entry = &(sched->entries[id]);
+
+	entry->record.audits++;
+	entry->record.last_audit = now;
+	entry->record.last_status = status;
+	sched->stats.audits++;
+	sched->stats.inflight--;
+
+	switch(status){
+		case PDP_AUDIT_PASSED:
+			sched->stats.passed++;
+			pdp_peer_history_record(&(sched->peers[entry->peer].history), 1);
+			entry->record.next_due = now + (uint64_t)(sched->interval / entry->weight);
+			break;
+		case PDP_AUDIT_FAILED:
+			sched->stats.failed++;
+			entry->record.failures++;
+			pdp_peer_history_record(&(sched->peers[entry->peer].history), 0);
+			entry->record.next_due = now + PDP_SCHED_RETRY;
+			break;
+		default:
+			sched->stats.errors++;
+			entry->record.next_due = now + PDP_SCHED_RETRY;
+			break;
+	}
+
+	if(sched->ctx->catalog) pdp_catalog_record_audit(sched->ctx->catalog, entry->record.filepath, status, now);
+
+	heap_push(sched, id);
+}
+
+/* pdp_scheduler_run: Audits up to maxjobs of the files due at now, proving each locally with the
+*  scheduler's context and verifying the proof, one peer's batch after another, and records the
+*  results, timing each proof against the latency model.  Returns the audits run or -1 if the key could not be loaded.
+*/
+int64_t pdp_scheduler_run(PDP_scheduler *sched, uint64_t now, size_t maxjobs){
+
+	PDP_audit_job *jobs = NULL;
+	PDP_audit_record *record = NULL;
+	PDP_key *key = NULL;
+	PDP_challenge *challenge = NULL;
+	PDP_challenge *server_challenge = NULL;
+	PDP_proof *proof = NULL;
+	size_t n = 0, i = 0;
+	int status = 0, slow = 0;
+
+	if(!sched || !maxjobs) return -1;
+
+	if( ((key = pdp_key_cache_get(sched->ctx->keycache, sched->keypath, sched->password)) == NULL)) return -1;
+	if( ((jobs = malloc(maxjobs * sizeof(PDP_audit_job))) == NULL)){
+		pdp_key_cache_put(sched->ctx->keycache, key);
+		return -1;
+	}
+
+	n = pdp_scheduler_next(sched, now, jobs, maxjobs);
+	for(i = 0; i < n; i++){
+		record = jobs[i].record;
+		status = PDP_AUDIT_ERROR;
+
+		challenge = pdp_challenge_target(key, record->numfileblocks, jobs[i].detection, sched->policy.corrupt_fraction);
+		if(challenge) server_challenge = sanitize_pdp_challenge(challenge);
+		if(server_challenge){
+			pdp_challenge_issue(challenge);
+			proof = pdp_ctx_prove_file(sched->ctx, record->filepath, strlen(record->filepath), record->tagfilepath,
+				record->tagfilepath ? strlen(record->tagfilepath) : 0, server_challenge, key);
+		}
+		if(proof){
+			status = pdp_verify_proof_timed(key, challenge, proof, sched->latency, record->peer, &slow) ?
+				PDP_AUDIT_PASSED : PDP_AUDIT_FAILED;
+			if(slow) sched->stats.slow++;
+		}
+
+		pdp_scheduler_complete(sched, jobs[i].id, status, now);
+
+		if(proof) destroy_pdp_proof(proof);
+		if(server_challenge) destroy_pdp_challenge(server_challenge);
+		if(challenge) destroy_pdp_challenge(challenge);
+		proof = NULL;
+		server_challenge = NULL;
+		challenge = NULL;
+	}
+
+	free(jobs);
+	pdp_key_cache_put(sched->ctx->keycache, key);
+
+	return n;
+}
+
+/* pdp_scheduler_stats: Reports the files, peers and devices the scheduler tracks and the audits it has recorded */
+void pdp_scheduler_stats(PDP_scheduler *sched, PDP_scheduler_stats *stats){
+
+	if(!stats) return;
+	memset(stats, 0, sizeof(PDP_scheduler_stats));
+	if(!sched) return;
+
+	memcpy(stats, &(sched->stats), sizeof(PDP_scheduler_stats));
+	stats->files = sched->numentries;
+	stats->peers = sched->numpeers;
+	stats->devices = sched->numdevices;
+	stats->queued = sched->heapsize;
+}
@@ -0,0 +1,452 @@
+/* 
+* pdp-scrub.c
+*
+* Copyright (c) 2008, Zachary N J Peterson <zachary@jhu.edu>
+* All rights reserved.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*     * Redistributions of source code must retain the above copyright
+*       notice, this list of conditions and the following disclaimer.
+*     * Redistributions in binary form must reproduce the above copyright
+*       notice, this list of conditions and the following disclaimer in the
+*       documentation and/or other materials provided with the distribution.
+*     * The name of the Zachary N J Peterson may be used to endorse or promote products
+*       derived from this software without specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY ZACHARY N J PETERSON ``AS IS'' AND ANY
+* EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL ZACHARY N J PETERSON BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+/* pdp-scrub.c contains full-file scrubs, which check the tag of every block of a file instead of a
+*  sample, e.g. after a disk migration or a resilver.  The file is split into contiguous ranges of
+*  whole batches, one per thread.  Each thread streams its blocks through a block reader, held to
+*  the context's I/O budget, reads the tags of each batch with one pread and checks the whole batch
+*  with pdp_verify_tags_batch, recording a status for every batch.  pdp_ctx_locate_corrupt then
+*  narrows failures down to the bad blocks themselves by group testing.
+*/
+
+#include "pdp.h"
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+struct scrub_thread{
+
+	PDP_ctx *ctx;
+	PDP_key *key;				/* The shared key; each thread checks with its own replica */
+	PDP_tag_header *header;
+	PDP_scrub_result *result;
+	char *filepath;
+	int tagfd;
+	uint64_t first_batch;		/* The contiguous range of batches this thread checks */
+	uint64_t numbatches;
+	int started;
+};
+
+/* compare_uint64: Orders uint64_t values for qsort */
+static int compare_uint64(const void *a, const void *b){
+
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return (x > y) - (x < y);
+}
+
+/* scrub_open_tags: Opens the tag file of filepath, tagfilepath or filepath with a .tag extension
+*  when it is NULL, and reads its header into header.  *numblocks is set to the blocks of the data
+*  file or the records of the tag file, whichever are more, so a data file cut short has its lost
+*  blocks checked, as zero-padding, rather than passed over.  Returns the tag file's descriptor, or
+*  -1 on error or if the tag file is in the legacy layout.
+*/
+static int scrub_open_tags(char *filepath, char *tagfilepath, PDP_tag_header *header, uint64_t *numblocks){
+
+	unsigned char hbuf[PDP_TAG_HEADER_SIZE];
+	char realtagfilepath[MAXPATHLEN];
+	struct stat st, tagst;
+	uint64_t records = 0;
+	int tagfd = -1;
+
+	if(!tagfilepath){
+		if(snprintf(realtagfilepath, MAXPATHLEN, "%s.tag", filepath) >= MAXPATHLEN) return -1;
+	}else{
+		if(snprintf(realtagfilepath, MAXPATHLEN, "%s", tagfilepath) >= MAXPATHLEN) return -1;
+	}
+
+	if(stat(filepath, &st) < 0){
+		fprintf(stderr, "ERROR: Was not able to open %s for reading.\n", filepath);
+		return -1;
+	}
+	if( ((tagfd = open(realtagfilepath, O_RDONLY)) < 0)){
+		fprintf(stderr, "ERROR: Was not able to open %s for reading.\n", realtagfilepath);
+		return -1;
+	}
+	if(!pdp_pread_full(tagfd, hbuf, PDP_TAG_HEADER_SIZE, 0) || !pdp_tag_header_parse(header, hbuf, PDP_TAG_HEADER_SIZE)){
+		fprintf(stderr, "ERROR: %s is not in the fixed-width tag layout.\n", realtagfilepath);
+		close(tagfd);
+		return -1;
+	}
+	if(fstat(tagfd, &tagst) < 0){
+		close(tagfd);
+		return -1;
+	}
+
+	*numblocks = (st.st_size + PDP_BLOCKSIZE - 1) / PDP_BLOCKSIZE;
+	if(header->record_size && tagst.st_size > (off_t)PDP_TAG_HEADER_SIZE) records = (tagst.st_size - PDP_TAG_HEADER_SIZE) / header->record_size;
+	if(records > *numblocks) *numblocks = records;
+
+	return tagfd;
+}
+
+/* scrub_read_batch: Reads the next n blocks from reader, which must be at block first, into
+*  blocks, and their tag records from tagfd into records, decoding them into tags.  Returns 1 on
+*  success, 0 if the tag records could not be read or decoded and -1 if the blocks could not be read.
+*/
+static int scrub_read_batch(PDP_ctx *ctx, PDP_block_reader *reader, int tagfd, PDP_tag_header *header, uint64_t first,
+	uint64_t n, unsigned char *blocks, unsigned char *records, PDP_tag_batch *tags){
+
+	unsigned char *block = NULL;
+	uint64_t i = 0, index = 0;
+	int ok = 0;
+
+	for(i = 0; i < n; i++){
+		if( ((block = pdp_block_reader_next(reader, &index)) == NULL)) return -1;
+		memcpy(blocks + (i * PDP_BLOCKSIZE), block, PDP_BLOCKSIZE);
+	}
+
+	/* The batch's tag records are contiguous */
+	pdp_budget_charge_io(ctx->budget, n * header->record_size);
+	ok = pdp_pread_full(tagfd, records, n * header->record_size, pdp_tag_record_offset(header, first));
+	for(i = 0; ok && i < n; i++)
+		ok = pdp_tag_batch_decode(tags, header, i, records + (i * header->record_size));
+	if(!ok) return 0;
+	tags->count = n;
+
+	return 1;
+}
+
+/* scrub_thread_run: Checks the thread's batches in order, recording the status of each.  A batch
+*  whose blocks cannot be read ends the thread's range, and it and the batches after it are
+*  recorded as PDP_SCRUB_ERROR.
+*/
+static void *scrub_thread_run(void *arg){
+
+	struct scrub_thread *thread = arg;
+	PDP_scrub_result *result = thread->result;
+	PDP_tag_header *header = thread->header;
+	PDP_key *key = NULL;
+	PDP_block_reader *reader = NULL;
+	PDP_tag_batch *tags = NULL;
+	unsigned char *blocks = NULL;
+	unsigned char *records = NULL;
+	uint64_t batch = 0, first = 0, n = 0, i = 0;
+	uint64_t cpu = 0;
+
+	for(batch = thread->first_batch; batch < thread->first_batch + thread->numbatches; batch++)
+		result->status[batch] = PDP_SCRUB_ERROR;
+
+	if( ((key = pdp_key_replicate(thread->key)) == NULL)) return NULL;
+	if( ((tags = pdp_tag_batch_new(header, result->batch_blocks)) == NULL)) goto cleanup;
+	if( ((blocks = malloc(result->batch_blocks * PDP_BLOCKSIZE)) == NULL)) goto cleanup;
+	if( ((records = malloc(result->batch_blocks * header->record_size)) == NULL)) goto cleanup;
+
+	first = thread->first_batch * result->batch_blocks;
+	n = (thread->first_batch + thread->numbatches) * result->batch_blocks;
+	if(n > result->numblocks) n = result->numblocks;
+	reader = pdp_block_reader_open(thread->filepath, first, n - first, thread->ctx->io_flags, thread->ctx->budget);
+	if(!reader) goto cleanup;
+
+	for(batch = thread->first_batch; batch < thread->first_batch + thread->numbatches; batch++){
+		first = batch * result->batch_blocks;
+		n = result->numblocks - first;
+		if(n > result->batch_blocks) n = result->batch_blocks;
+
+		switch(scrub_read_batch(thread->ctx, reader, thread->tagfd, header, first, n, blocks, records, tags)){
+			case -1:
+				goto cleanup;
+			case 0:
+				continue;
+		}
+
+		/* A record holding another block's index is as bad as a wrong tag */
+		for(i = 0; i < n; i++)
+			if(tags->indices[i] != first + i) break;
+		if(i < n){
+			result->status[batch] = PDP_SCRUB_CORRUPT;
+			continue;
+		}
+
+		cpu = pdp_budget_thread_cpu();
+		switch(pdp_verify_tags_batch(key, tags, blocks, PDP_BLOCKSIZE, NULL, n)){
+			case 1:
+				result->status[batch] = PDP_SCRUB_OK;
+				break;
+			case 0:
+				result->status[batch] = PDP_SCRUB_CORRUPT;
+				break;
+		}
+		pdp_budget_charge_cpu(thread->ctx->budget, cpu);
+	}
+
+cleanup:
+	if(reader) pdp_block_reader_close(reader);
+	if(tags) pdp_tag_batch_free(tags);
+	if(blocks) sfree(blocks, result->batch_blocks * PDP_BLOCKSIZE);
+	if(records) free(records);
+	destroy_pdp_key(key);
+
+	return NULL;
+}
+
+/* pdp_ctx_scrub_file: Checks every block of filepath against its tag in tagfilepath, or filepath
+*  with a .tag extension when it is NULL, in batches of batch_blocks (PDP_SCRUB_BATCH_BLOCKS if 0) on
+*  numthreads threads (PDP_SCRUB_THREADS if 0).  The key comes from the context's key cache, from
+*  ctx->keypath when keypath is NULL, and the reads are held to the context's budgets.  Returns an
+*  allocated result with the status of each batch, to be freed with pdp_scrub_result_free, or NULL
+*  if the scrub could not start.  Legacy tag files cannot be scrubbed.
+*/
+PDP_scrub_result *pdp_ctx_scrub_file(PDP_ctx *ctx, char *filepath, char *tagfilepath, char *keypath, char *password,
+	int numthreads, uint64_t batch_blocks){
+
+	PDP_scrub_result *result = NULL;
+	PDP_key *key = NULL;
+	PDP_tag_header header;
+	struct scrub_thread *threads = NULL;
+	pthread_t *tids = NULL;
+	uint64_t start = pdp_monotonic_ns();
+	uint64_t numblocks = 0, batch = 0;
+	int tagfd = -1;
+	int t = 0;
+
+	if(!ctx || !filepath) return NULL;
+	if(numthreads <= 0) numthreads = PDP_SCRUB_THREADS;
+	if(!batch_blocks) batch_blocks = PDP_SCRUB_BATCH_BLOCKS;
+
+	if( ((tagfd = scrub_open_tags(filepath, tagfilepath, &header, &numblocks)) < 0)) return NULL;
+
+	key = pdp_key_cache_get(ctx->keycache, keypath ? keypath : ctx->keypath, password);
+	if(!key) goto cleanup;
+
+	if( ((result = malloc(sizeof(PDP_scrub_result))) == NULL)) goto cleanup;
+	memset(result, 0, sizeof(PDP_scrub_result));
+	result->numblocks = numblocks;
+	result->batch_blocks = batch_blocks;
+	result->numbatches = (result->numblocks + batch_blocks - 1) / batch_blocks;
+	if(result->numbatches && ((result->status = malloc(result->numbatches)) == NULL)) goto cleanup;
+	if(result->numbatches) memset(result->status, PDP_SCRUB_ERROR, result->numbatches);
+
+	if((uint64_t)numthreads > result->numbatches) numthreads = result->numbatches ? result->numbatches : 1;
+	if( ((threads = calloc(numthreads, sizeof(struct scrub_thread))) == NULL)) goto cleanup;
+	if( ((tids = calloc(numthreads, sizeof(pthread_t))) == NULL)) goto cleanup;
+
+	/* Split the batches into numthreads contiguous ranges; the first threads take one extra each */
+	for(t = 0; t < numthreads && result->numbatches; t++){
+		threads[t].ctx = ctx;
+		threads[t].key = key;
+		threads[t].header = &header;
+		threads[t].result = result;
+		threads[t].filepath = filepath;
+		threads[t].tagfd = tagfd;
+		threads[t].numbatches = result->numbatches / numthreads + ((uint64_t)t < result->numbatches % numthreads);
+		threads[t].first_batch = batch;
+		batch += threads[t].numbatches;
+		if(pthread_create(&tids[t], NULL, scrub_thread_run, &threads[t]) != 0) break;
+		threads[t].started = 1;
+	}
+	for(t = 0; t < numthreads; t++)
+		if(threads[t].started) pthread_join(tids[t], NULL);
+
+	for(batch = 0; batch < result->numbatches; batch++){
+		if(result->status[batch] == PDP_SCRUB_CORRUPT) result->corrupt++;
+		else if(result->status[batch] == PDP_SCRUB_ERROR) result->errors++;
+	}
+	result->elapsed = (pdp_monotonic_ns() - start) / 1e9;
+
+	free(threads);
+	free(tids);
+	pdp_key_cache_put(ctx->keycache, key);
+	close(tagfd);
+
+	return result;
+
+cleanup:
+	if(threads) free(threads);
+	if(tids) free(tids);
+	if(result) pdp_scrub_result_free(result);
+	if(key) pdp_key_cache_put(ctx->keycache, key);
+	if(tagfd >= 0) close(tagfd);
+
+	return NULL;
+}
+
+/* pdp_scrub_result_free: Frees the result of a scrub */
+void pdp_scrub_result_free(PDP_scrub_result *result){
+
+	if(!result) return;
+
+	if(result->status) free(result->status);
+	free(result);
+}
+
+/* locate_add_bad: Appends index to the result's list of bad blocks.  Returns 1 on success and 0 on error */
+static int locate_add_bad(PDP_locate_result *result, uint64_t index){
+
+	uint64_t *bad = NULL;
+
+	if(result->numbad == result->capacity){
+		result->capacity = result->capacity ? result->capacity * 2 : 16;
+		if( ((bad = realloc(result->bad, result->capacity * sizeof(uint64_t))) == NULL)) return 0;
+		result->bad = bad;
+	}
+	result->bad[result->numbad++] = index;
+
+	return 1;
+}
+
+/* locate_group: Finds the bad blocks among the numslots slots of tags by bisection, adding
+*  first + slot to the result for each.  known_bad says a bad block is known to be among them, so
+*  the group need not be checked as a whole: when the left half of a bad group checks clean, the
+*  right half must hold the bad block.  Returns 1 if the group held a bad block, 0 if not and -1 on
+*  error.
+*/
+static int locate_group(PDP_key *key, PDP_tag_batch *tags, unsigned char *blocks, uint64_t *slots, uint64_t numslots,
+	uint64_t first, int known_bad, PDP_locate_result *result){
+
+	int left = 0, right = 0;
+
+	if(!numslots) return 0;
+	if(!known_bad){
+		result->checks++;
+		switch(pdp_verify_tags_batch(key, tags, blocks, PDP_BLOCKSIZE, slots, numslots)){
+			case 1:
+				return 0;
+			case -1:
+				return -1;
+		}
+	}
+	if(numslots == 1) return locate_add_bad(result, first + slots[0]) ? 1 : -1;
+
+	if( ((left = locate_group(key, tags, blocks, slots, numslots / 2, first, 0, result)) < 0)) return -1;
+	right = locate_group(key, tags, blocks, slots + (numslots / 2), numslots - (numslots / 2), first, !left, result);
+	if(right < 0) return -1;
+
+	return 1;
+}
+
+/* pdp_ctx_locate_corrupt: Finds which of the numblocks blocks of filepath starting at first_block
+*  (to the end of the file if numblocks is 0) are bad, for instance those of a batch a scrub found
+*  corrupt or of a file whose audit failed, so they can be repaired from another replica.  Rather
+*  than checking every tag on its own, it reads windows of PDP_LOCATE_WINDOW_BLOCKS blocks, checks
+*  them in groups of PDP_SCRUB_BATCH_BLOCKS with pdp_verify_tags_batch and bisects the groups that
+*  fail, so k bad blocks among n take about n / PDP_SCRUB_BATCH_BLOCKS + k log2(PDP_SCRUB_BATCH_BLOCKS)
+*  batch checks.  A tag record holding another block's index is bad without a check.
+*  The tag file, key and budgets are as for pdp_ctx_scrub_file.  Returns an allocated result
+*  listing the bad blocks in ascending order, to be freed with pdp_locate_result_free, or NULL on
+*  error.
+*/
+PDP_locate_result *pdp_ctx_locate_corrupt(PDP_ctx *ctx, char *filepath, char *tagfilepath, char *keypath, char *password,
+	uint64_t first_block, uint64_t numblocks){
+
+	PDP_locate_result *result = NULL;
+	PDP_key *key = NULL;
+	PDP_tag_header header;
+	PDP_block_reader *reader = NULL;
+	PDP_tag_batch *tags = NULL;
+	unsigned char *blocks = NULL;
+	unsigned char *records = NULL;
+	uint64_t *slots = NULL;
+	uint64_t start = pdp_monotonic_ns();
+	uint64_t fileblocks = 0, first = 0, n = 0, i = 0, numslots = 0;
+	uint64_t cpu = 0;
+	int tagfd = -1;
+
+	if(!ctx || !filepath) return NULL;
+
+	if( ((tagfd = scrub_open_tags(filepath, tagfilepath, &header, &fileblocks)) < 0)) return NULL;
+	if(first_block > fileblocks) goto cleanup;
+	if(!numblocks || numblocks > fileblocks - first_block) numblocks = fileblocks - first_block;
+
+	key = pdp_key_cache_get(ctx->keycache, keypath ? keypath : ctx->keypath, password);
+	if(!key) goto cleanup;
+
+	if( ((result = calloc(1, sizeof(PDP_locate_result))) == NULL)) goto cleanup;
+	result->first_block = first_block;
+	result->numblocks = numblocks;
+	if(!numblocks) goto done;
+
+	if( ((tags = pdp_tag_batch_new(&header, PDP_LOCATE_WINDOW_BLOCKS)) == NULL)) goto cleanup;
+	if( ((blocks = malloc(PDP_LOCATE_WINDOW_BLOCKS * PDP_BLOCKSIZE)) == NULL)) goto cleanup;
+	if( ((records = malloc(PDP_LOCATE_WINDOW_BLOCKS * header.record_size)) == NULL)) goto cleanup;
+	if( ((slots = malloc(PDP_LOCATE_WINDOW_BLOCKS * sizeof(uint64_t))) == NULL)) goto cleanup;
+	reader = pdp_block_reader_open(filepath, first_block, numblocks, ctx->io_flags, ctx->budget);
+	if(!reader) goto cleanup;
+
+	for(first = first_block; first < first_block + numblocks; first += n){
+		n = first_block + numblocks - first;
+		if(n > PDP_LOCATE_WINDOW_BLOCKS) n = PDP_LOCATE_WINDOW_BLOCKS;
+		if(scrub_read_batch(ctx, reader, tagfd, &header, first, n, blocks, records, tags) != 1) goto cleanup;
+
+		/* Misplaced records are bad as they stand; group test the rest */
+		numslots = 0;
+		for(i = 0; i < n; i++){
+			if(tags->indices[i] == first + i) slots[numslots++] = i;
+			else if(!locate_add_bad(result, first + i)) goto cleanup;
+		}
+
+		/* Every check recomputes its slots' W_i and h(W_i), so bisecting the whole window would
+		*  pay for it about log2(window) times over; start from scrub-sized groups instead */
+		cpu = pdp_budget_thread_cpu();
+		for(i = 0; i < numslots; i += PDP_SCRUB_BATCH_BLOCKS){
+			if(locate_group(key, tags, blocks, slots + i, (numslots - i < PDP_SCRUB_BATCH_BLOCKS) ? numslots - i : PDP_SCRUB_BATCH_BLOCKS,
+				first, 0, result) < 0) goto cleanup;
+		}
+		pdp_budget_charge_cpu(ctx->budget, cpu);
+	}
+
+	/* Misplaced records were added ahead of the window's bisection */
+	qsort(result->bad, result->numbad, sizeof(uint64_t), compare_uint64);
+
+done:
+	result->elapsed = (pdp_monotonic_ns() - start) / 1e9;
+
+	pdp_block_reader_close(reader);
+	pdp_tag_batch_free(tags);
+	if(blocks) sfree(blocks, PDP_LOCATE_WINDOW_BLOCKS * PDP_BLOCKSIZE);
+	if(records) free(records);
+	if(slots) free(slots);
+	pdp_key_cache_put(ctx->keycache, key);
+	close(tagfd);
+
+	return result;
+
+cleanup:
+	if(reader) pdp_block_reader_close(reader);
+	if(tags) pdp_tag_batch_free(tags);
+	if(blocks) sfree(blocks, PDP_LOCATE_WINDOW_BLOCKS * PDP_BLOCKSIZE);
+	if(records) free(records);
+	if(slots) free(slots);
+	if(result) pdp_locate_result_free(result);
+	if(key) pdp_key_cache_put(ctx->keycache, key);
+	close(tagfd);
+
+	return NULL;
+}
+
+/* pdp_locate_result_free: Frees the result of a localization */
+void pdp_locate_result_free(PDP_locate_result *result){
+
+	if(!result) return;
+
+	if(result->bad) free(result->bad);
+	free(result);
+}
@@ -0,0 +1,167 @@
+/* 
+* pdp-tagbatch.c
+*
+* Copyright (c) 2008, Zachary N J Peterson <zachary@jhu.edu>
+* All rights reserved.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*     * Redistributions of source code must retain the above copyright
+*       notice, this list of conditions and the following disclaimer.
+*     * Redistributions in binary form must reproduce the above copyright
+*       notice, this list of conditions and the following disclaimer in the
+*       documentation and/or other materials provided with the distribution.
+*     * The name of the Zachary N J Peterson may be used to endorse or promote products
+*       derived from this software without specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY ZACHARY N J PETERSON ``AS IS'' AND ANY
+* EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL ZACHARY N J PETERSON BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+/* pdp-tagbatch.c contains tag batches, which hold many tags in flat arrays instead of one heap
+*  PDP_tag, BIGNUM and W_i each.  Every Tim is kept as fixed-width little-endian limbs in one
+*  contiguous array, with the block indices and W_i in arrays of their own, so a batch of any size is
+*  three allocations, and walking it touches memory in order.  Tags are loaded from a slot into a
+*  reusable PDP_tag with pdp_tag_batch_get, and a run of slots serializes straight into tag records.
+*  Slots below batch->count hold tags; filling slots and setting the count is up to the caller.
+*/
+
+#include "pdp.h"
+#include <stdlib.h>
+
+/* pdp_tag_batch_new: Returns an allocated, empty batch with room for capacity tags in the layout
+*  header describes, or NULL on failure.
+*/
+PDP_tag_batch *pdp_tag_batch_new(PDP_tag_header *header, uint64_t capacity){
+
+	PDP_tag_batch *batch = NULL;
+
+	if(!header || !header->tim_size || !header->index_prf_size || !capacity) return NULL;
+
+	if( ((batch = malloc(sizeof(PDP_tag_batch))) == NULL)) return NULL;
+	memset(batch, 0, sizeof(PDP_tag_batch));
+
+	batch->capacity = capacity;
+	batch->tim_size = header->tim_size;
+	batch->limb_size = ((header->tim_size + sizeof(BN_ULONG) - 1) / sizeof(BN_ULONG)) * sizeof(BN_ULONG);
+	batch->index_prf_size = header->index_prf_size;
+
+	if( ((batch->tims = calloc(capacity, batch->limb_size)) == NULL)) goto cleanup;
+	if( ((batch->indices = calloc(capacity, sizeof(uint64_t))) == NULL)) goto cleanup;
+	if( ((batch->index_prfs = calloc(capacity, batch->index_prf_size)) == NULL)) goto cleanup;
+
+	return batch;
+
+cleanup:
+	pdp_tag_batch_free(batch);
+	return NULL;
+}
+
+/* pdp_tag_batch_free: Frees a batch and the tags it holds */
+void pdp_tag_batch_free(PDP_tag_batch *batch){
+
+	if(!batch) return;
+
+	if(batch->tims) sfree(batch->tims, batch->capacity * batch->limb_size);
+	if(batch->indices) sfree(batch->indices, batch->capacity * sizeof(uint64_t));
+	if(batch->index_prfs) sfree(batch->index_prfs, batch->capacity * batch->index_prf_size);
+	sfree(batch, sizeof(PDP_tag_batch));
+}
+
+/* pdp_tag_batch_set: Stores a copy of tag in slot.  Different slots may be set from different
+*  threads at once; the caller sets batch->count once the slots are filled.  Returns 1 on success
+*  and 0 on failure.
+*/
+int pdp_tag_batch_set(PDP_tag_batch *batch, uint64_t slot, PDP_tag *tag){
+
+	if(!batch || !tag || !tag->Tim || slot >= batch->capacity) return 0;
+	if(tag->index_prf_size != batch->index_prf_size) return 0;
+
+	if(BN_bn2lebinpad(tag->Tim, PDP_TAG_BATCH_TIM(batch, slot), batch->limb_size) < 0) return 0;
+	batch->indices[slot] = tag->index;
+	memcpy(PDP_TAG_BATCH_INDEX_PRF(batch, slot), tag->index_prf, batch->index_prf_size);
+
+	return 1;
+}
+
+/* pdp_tag_batch_get: Loads the tag in slot into tag without allocating.  tag->Tim must be a BIGNUM
+*  owned by the caller, which is reused; tag->index_prf is pointed into the batch, so tag is only
+*  valid while the batch is and must not be freed with destroy_pdp_tag.  Returns 1 on success and 0
+*  on failure.
+*/
+int pdp_tag_batch_get(PDP_tag_batch *batch, uint64_t slot, PDP_tag *tag){
+
+	if(!batch || !tag || !tag->Tim || slot >= batch->count) return 0;
+
+	if(!BN_lebin2bn(PDP_TAG_BATCH_TIM(batch, slot), batch->limb_size, tag->Tim)) return 0;
+	tag->index = batch->indices[slot];
+	tag->index_prf = PDP_TAG_BATCH_INDEX_PRF(batch, slot);
+	tag->index_prf_size = batch->index_prf_size;
+
+	return 1;
+}
+
+/* pdp_tag_batch_encode: Serializes the numtags tags from slot first on into consecutive tag records
+*  in records, a buffer of numtags * header->record_size bytes.  Returns 1 on success and 0 on
+*  failure.
+*/
+int pdp_tag_batch_encode(PDP_tag_batch *batch, PDP_tag_header *header, uint64_t first, uint64_t numtags,
+	unsigned char *records){
+
+	unsigned char *record = records;
+	unsigned char *tim = NULL;
+	uint64_t slot = 0;
+	uint32_t i = 0;
+
+	if(!batch || !header || !records || first + numtags > batch->count) return 0;
+	if(header->tim_size != batch->tim_size || header->index_prf_size != batch->index_prf_size) return 0;
+	if(header->index_size != sizeof(uint64_t)) return 0;
+
+	for(slot = first; slot < first + numtags; slot++){
+		/* Records hold Tim big-endian; the limbs beyond tim_size are zero */
+		tim = PDP_TAG_BATCH_TIM(batch, slot);
+		for(i = 0; i < header->tim_size; i++) record[i] = tim[header->tim_size - 1 - i];
+		memcpy(record + header->tim_size, &(batch->indices[slot]), header->index_size);
+		memcpy(record + header->tim_size + header->index_size, PDP_TAG_BATCH_INDEX_PRF(batch, slot),
+			header->index_prf_size);
+		record += header->record_size;
+	}
+
+	return 1;
+}
+
+/* pdp_tag_batch_decode: Stores the tag record in record, laid out as header describes, in slot.
+*  Returns 1 on success and 0 on failure.
+*/
+int pdp_tag_batch_decode(PDP_tag_batch *batch, PDP_tag_header *header, uint64_t slot, unsigned char *record){
+
+	unsigned char *tim = NULL;
+	uint32_t index32 = 0;
+	uint32_t i = 0;
+
+	if(!batch || !header || !record || slot >= batch->capacity) return 0;
+	if(header->tim_size != batch->tim_size || header->index_prf_size != batch->index_prf_size) return 0;
+
+	tim = PDP_TAG_BATCH_TIM(batch, slot);
+	for(i = 0; i < header->tim_size; i++) tim[i] = record[header->tim_size - 1 - i];
+	memset(tim + header->tim_size, 0, batch->limb_size - header->tim_size);
+	if(header->index_size == sizeof(uint32_t)){
+		memcpy(&index32, record + header->tim_size, sizeof(uint32_t));
+		batch->indices[slot] = index32;
+	}else{
+		memcpy(&(batch->indices[slot]), record + header->tim_size, sizeof(uint64_t));
+	}
+	memcpy(PDP_TAG_BATCH_INDEX_PRF(batch, slot), record + header->tim_size + header->index_size,
+		header->index_prf_size);
+
+	return 1;
+}
@@ -0,0 +1,453 @@
+/* 
+* pdp-tagcache.c
+*
+* Copyright (c) 2008, Zachary N J Peterson <zachary@jhu.edu>
+* All rights reserved.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*     * Redistributions of source code must retain the above copyright
+*       notice, this list of conditions and the following disclaimer.
+*     * Redistributions in binary form must reproduce the above copyright
+*       notice, this list of conditions and the following disclaimer in the
+*       documentation and/or other materials provided with the distribution.
+*     * The name of the Zachary N J Peterson may be used to endorse or promote products
+*       derived from this software without specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY ZACHARY N J PETERSON ``AS IS'' AND ANY
+* EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL ZACHARY N J PETERSON BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+/* pdp-tagcache.c contains the tag cache, which keeps the decoded tags of hot files between proofs.
+*  Each PDP_ctx has its own, shared by every proof on the context.  Tags are cached by the device,
+*  inode and index they were read from, and a cached tag is only used while its tag file keeps the
+*  size and modification time it was read at.  The cache is split into PDP_TAG_CACHE_SHARDS
+*  shards, each with its own lock, table and least recently used list, so concurrent proofs rarely
+*  contend.  A tag is handed out with a reference that pdp_tag_cache_put returns; tags that are in
+*  use are never evicted.
+*/
+
+#include "pdp.h"
+#include <stdlib.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+typedef struct PDP_tag_cache_entry_struct PDP_tag_cache_entry;
+
+struct PDP_tag_cache_entry_struct{
+
+	PDP_tag tag;				/* Handed out as &entry->tag; owns Tim and index_prf */
+	dev_t dev;					/* Identify the tag file the tag was read from */
+	ino_t ino;
+	off_t size;
+	int64_t mtime_ns;
+	size_t bytes;				/* Memory held by the entry and its tag */
+	unsigned int refs;			/* Callers holding the tag */
+	int cached;					/* Whether the entry is in its shard; freed on the last put if not */
+	unsigned int shard;
+
+	PDP_tag_cache_entry *chain;	/* The next entry in the same hash bucket */
+
+	/* Least recently used list; the head is the most recently used */
+	PDP_tag_cache_entry *prev;
+	PDP_tag_cache_entry *next;
+};
+
+typedef struct PDP_tag_cache_shard_struct PDP_tag_cache_shard;
+
+struct PDP_tag_cache_shard_struct{
+
+	pthread_mutex_t lock;
+	PDP_tag_cache_entry **buckets;
+	size_t numbuckets;			/* A power of two; doubled as entries are added */
+	PDP_tag_cache_entry *head;
+	PDP_tag_cache_entry *tail;
+	PDP_tag_cache_stats stats;	/* stats.budget is the shard's share of the budget */
+};
+
+struct PDP_tag_cache_struct{
+
+	PDP_tag_cache_shard shards[PDP_TAG_CACHE_SHARDS];
+};
+
+/* BIGNUM is opaque; this is the size of its structure on LP64 */
+#define PDP_BIGNUM_OVERHEAD 24
+
+/* hash_tag: Returns the hash of the tag of block index in the file dev and ino */
+static uint64_t hash_tag(dev_t dev, ino_t ino, uint64_t index){
+
+	uint64_t h = ((uint64_t)dev * 0x9e3779b97f4a7c15ULL) ^ ((uint64_t)ino * 0xc2b2ae3d27d4eb4fULL) ^ index;
+
+	/* splitmix64 finalizer */
+	h ^= h >> 30;
+	h *= 0xbf58476d1ce4e5b9ULL;
+	h ^= h >> 27;
+	h *= 0x94d049bb133111ebULL;
+	h ^= h >> 31;
+
+	return h;
+}
+
+/* mtime_ns: Returns the modification time in st in nanoseconds */
+static int64_t mtime_ns(struct stat *st){
+
+	return ((int64_t)st->st_mtim.tv_sec * 1000000000LL) + st->st_mtim.tv_nsec;
+}
+
+/* free_entry: Frees entry and the tag it owns */
+static void free_entry(PDP_tag_cache_entry *entry){
+
+	if(entry->tag.Tim) BN_clear_free(entry->tag.Tim);
+	if(entry->tag.index_prf) sfree(entry->tag.index_prf, entry->tag.index_prf_size);
+	sfree(entry, sizeof(PDP_tag_cache_entry));
+}
+
+/* lru_unlink: Removes entry from the shard's least recently used list.  Call with the shard's lock held */
+static void lru_unlink(PDP_tag_cache_shard *shard, PDP_tag_cache_entry *entry){
+
+	if(entry->prev) entry->prev->next = entry->next;
+	else shard->head = entry->next;
+	if(entry->next) entry->next->prev = entry->prev;
+	else shard->tail = entry->prev;
+	entry->prev = entry->next = NULL;
+}
+
+/* lru_push: Makes entry the most recently used.  Call with the shard's lock held */
+static void lru_push(PDP_tag_cache_shard *shard, PDP_tag_cache_entry *entry){
+
+	entry->prev = NULL;
+	entry->next = shard->head;
+	if(shard->head) shard->head->prev = entry;
+	shard->head = entry;
+	if(!shard->tail) shard->tail = entry;
+}
+
+/* bucket_of: Returns the bucket entry belongs in.  Call with the shard's lock held */
+static PDP_tag_cache_entry **bucket_of(PDP_tag_cache_shard *shard, PDP_tag_cache_entry *entry){
+
+	return &(shard->buckets[(hash_tag(entry->dev, entry->ino, entry->tag.index) >> 8) & (shard->numbuckets - 1)]);
+}
+
+/* remove_entry: Takes entry out of the shard, freeing it unless it is in use.  Call with the
+*  shard's lock held.
+*/
+static void remove_entry(PDP_tag_cache_shard *shard, PDP_tag_cache_entry *entry){
+
+	PDP_tag_cache_entry **link = bucket_of(shard, entry);
+
+	while(*link != entry) link = &((*link)->chain);
+	*link = entry->chain;
+	entry->chain = NULL;
+	lru_unlink(shard, entry);
+	shard->stats.bytes -= entry->bytes;
+	shard->stats.entries--;
+	entry->cached = 0;
+	if(entry->refs == 0) free_entry(entry);
+}
+
+/* evict: Evicts unused tags, least recently used first, until the shard holds at most bytes.
+*  Call with the shard's lock held.
+*/
+static void evict(PDP_tag_cache_shard *shard, size_t bytes){
+
+	PDP_tag_cache_entry *entry = shard->tail;
+	PDP_tag_cache_entry *prev = NULL;
+
+	while(entry && shard->stats.bytes > bytes){
+		prev = entry->prev;
+		if(entry->refs == 0){
+			remove_entry(shard, entry);
+			shard->stats.evictions++;
+		}
+		entry = prev;
+	}
+}
+
+/* grow: Doubles the shard's table once it holds twice as many entries as buckets.  A table that
+*  cannot grow is kept.  Call with the shard's lock held.
+*/
+static void grow(PDP_tag_cache_shard *shard){
+
+	PDP_tag_cache_entry **old = shard->buckets;
+	PDP_tag_cache_entry **buckets = NULL;
+	PDP_tag_cache_entry *entry = NULL;
+	PDP_tag_cache_entry *next = NULL;
+	size_t numbuckets = shard->numbuckets;
+	size_t i = 0;
+
+	if(shard->stats.entries < 2 * numbuckets) return;
+	if( ((buckets = calloc(2 * numbuckets, sizeof(PDP_tag_cache_entry *))) == NULL)) return;
+
+	shard->buckets = buckets;
+	shard->numbuckets = 2 * numbuckets;
+	for(i = 0; i < numbuckets; i++){
+		for(entry = old[i]; entry; entry = next){
+			next = entry->chain;
+			entry->chain = *bucket_of(shard, entry);
+			*bucket_of(shard, entry) = entry;
+		}
+	}
+	free(old);
+}
+
+/* find_entry: Returns the entry of block index in the file dev and ino, or NULL.  Call with the
+*  shard's lock held.
+*/
+static PDP_tag_cache_entry *find_entry(PDP_tag_cache_shard *shard, uint64_t hash, dev_t dev, ino_t ino, uint64_t index){
+
+	PDP_tag_cache_entry *entry = NULL;
+
+	for(entry = shard->buckets[(hash >> 8) & (shard->numbuckets - 1)]; entry; entry = entry->chain)
+		if(entry->tag.index == index && entry->ino == ino && entry->dev == dev) return entry;
+
+	return NULL;
+}
+
+/* new_entry: Moves tag into a new, uncached entry for the file described by st.  Frees tag either
+*  way.  Returns the entry or NULL on failure.
+*/
+static PDP_tag_cache_entry *new_entry(PDP_tag *tag, struct stat *st){
+
+	PDP_tag_cache_entry *entry = NULL;
+
+	if( ((entry = malloc(sizeof(PDP_tag_cache_entry))) == NULL)){
+		destroy_pdp_tag(tag);
+		return NULL;
+	}
+	memset(entry, 0, sizeof(PDP_tag_cache_entry));
+	memcpy(&(entry->tag), tag, sizeof(PDP_tag));
+	free(tag);
+
+	entry->dev = st->st_dev;
+	entry->ino = st->st_ino;
+	entry->size = st->st_size;
+	entry->mtime_ns = mtime_ns(st);
+	entry->bytes = sizeof(PDP_tag_cache_entry) + PDP_BIGNUM_OVERHEAD + BN_num_bytes(entry->tag.Tim) +
+		entry->tag.index_prf_size;
+	entry->refs = 1;
+
+	return entry;
+}
+
+/* pdp_tag_cache_new: Returns an allocated, empty tag cache that may hold budget bytes, or NULL on
+*  failure.  A budget of 0 disables caching; tags are then read for every pdp_tag_cache_get and
+*  freed by pdp_tag_cache_put.
+*/
+PDP_tag_cache *pdp_tag_cache_new(size_t budget){
+
+	PDP_tag_cache *cache = NULL;
+	PDP_tag_cache_shard *shard = NULL;
+	int i = 0;
+
+	if( ((cache = malloc(sizeof(PDP_tag_cache))) == NULL)) return NULL;
+	memset(cache, 0, sizeof(PDP_tag_cache));
+
+	for(i = 0; i < PDP_TAG_CACHE_SHARDS; i++){
+		shard = &(cache->shards[i]);
+		shard->numbuckets = PDP_TAG_CACHE_BUCKETS;
+		if( ((shard->buckets = calloc(shard->numbuckets, sizeof(PDP_tag_cache_entry *))) == NULL)) goto cleanup;
+		if(pthread_mutex_init(&(shard->lock), NULL) != 0){
+			free(shard->buckets);
+			shard->buckets = NULL;
+			goto cleanup;
+		}
+		shard->stats.budget = budget / PDP_TAG_CACHE_SHARDS;
+	}
+
+	return cache;
+
+cleanup:
+	pdp_tag_cache_free(cache);
+	return NULL;
+}
+
+/* pdp_tag_cache_free: Frees a cache and every tag it holds.  No tag may still be in use */
+void pdp_tag_cache_free(PDP_tag_cache *cache){
+
+	PDP_tag_cache_shard *shard = NULL;
+	int i = 0;
+
+	if(!cache) return;
+
+	for(i = 0; i < PDP_TAG_CACHE_SHARDS; i++){
+		shard = &(cache->shards[i]);
+		if(!shard->buckets) continue;
+		while(shard->head) remove_entry(shard, shard->head);
+		free(shard->buckets);
+		pthread_mutex_destroy(&(shard->lock));
+	}
+	sfree(cache, sizeof(PDP_tag_cache));
+}
+
+/* pdp_tag_cache_set_budget: Sets the memory the cache may hold in bytes and evicts unused tags
+*  until it is within it.  The budget is split evenly between the shards.  A budget of 0 disables
+*  caching.
+*/
+void pdp_tag_cache_set_budget(PDP_tag_cache *cache, size_t bytes){
+
+	PDP_tag_cache_shard *shard = NULL;
+	int i = 0;
+
+	if(!cache) return;
+
+	for(i = 0; i < PDP_TAG_CACHE_SHARDS; i++){
+		shard = &(cache->shards[i]);
+		pthread_mutex_lock(&(shard->lock));
+		shard->stats.budget = bytes / PDP_TAG_CACHE_SHARDS;
+		evict(shard, shard->stats.budget);
+		pthread_mutex_unlock(&(shard->lock));
+	}
+}
+
+/* pdp_tag_cache_enabled: Returns 1 if the cache has a budget to hold tags in and 0 otherwise */
+int pdp_tag_cache_enabled(PDP_tag_cache *cache){
+
+	int enabled = 0;
+
+	if(!cache) return 0;
+
+	pthread_mutex_lock(&(cache->shards[0].lock));
+	enabled = (cache->shards[0].stats.budget > 0);
+	pthread_mutex_unlock(&(cache->shards[0].lock));
+
+	return enabled;
+}
+
+/* pdp_tag_cache_get: Returns the tag of block index from the tag file open on fd, reading it on a
+*  miss.  The tag is shared and must be treated as read-only, and returned with pdp_tag_cache_put.
+*  Returns NULL if the tag cannot be read.
+*/
+PDP_tag *pdp_tag_cache_get(PDP_tag_cache *cache, int fd, uint64_t index){
+
+	PDP_tag_cache_shard *shard = NULL;
+	PDP_tag_cache_entry *entry = NULL;
+	PDP_tag_cache_entry *found = NULL;
+	PDP_tag *tag = NULL;
+	struct stat st;
+	uint64_t hash = 0;
+
+	if(!cache) return pdp_read_tag_fd(fd, index);
+	if(fstat(fd, &st) != 0) return NULL;
+
+	hash = hash_tag(st.st_dev, st.st_ino, index);
+	shard = &(cache->shards[hash % PDP_TAG_CACHE_SHARDS]);
+
+	pthread_mutex_lock(&(shard->lock));
+	if( ((entry = find_entry(shard, hash, st.st_dev, st.st_ino, index)) != NULL)){
+		if(entry->size == st.st_size && entry->mtime_ns == mtime_ns(&st)){
+			entry->refs++;
+			lru_unlink(shard, entry);
+			lru_push(shard, entry);
+			shard->stats.hits++;
+			pthread_mutex_unlock(&(shard->lock));
+			return &(entry->tag);
+		}
+
+		/* The tag file was rewritten since */
+		remove_entry(shard, entry);
+		shard->stats.invalidations++;
+	}
+	shard->stats.misses++;
+	pthread_mutex_unlock(&(shard->lock));
+
+	/* Read outside the lock; concurrent misses on the same tag may both read it */
+	if( ((tag = pdp_read_tag_fd(fd, index)) == NULL)) return NULL;
+	if( ((entry = new_entry(tag, &st)) == NULL)) return NULL;
+	entry->shard = hash % PDP_TAG_CACHE_SHARDS;
+
+	pthread_mutex_lock(&(shard->lock));
+	if(shard->stats.budget && entry->bytes <= shard->stats.budget){
+		if( ((found = find_entry(shard, hash, st.st_dev, st.st_ino, index)) != NULL) &&
+			found->size == entry->size && found->mtime_ns == entry->mtime_ns){
+			/* Another miss cached it first; use that one */
+			found->refs++;
+			pthread_mutex_unlock(&(shard->lock));
+			free_entry(entry);
+			return &(found->tag);
+		}
+		if(found) remove_entry(shard, found);
+
+		entry->cached = 1;
+		entry->chain = *bucket_of(shard, entry);
+		*bucket_of(shard, entry) = entry;
+		lru_push(shard, entry);
+		shard->stats.bytes += entry->bytes;
+		shard->stats.entries++;
+		evict(shard, shard->stats.budget);
+		grow(shard);
+	}
+	pthread_mutex_unlock(&(shard->lock));
+
+	return &(entry->tag);
+}
+
+/* pdp_tag_cache_put: Returns a tag from pdp_tag_cache_get.  A tag the cache no longer holds is freed */
+void pdp_tag_cache_put(PDP_tag_cache *cache, PDP_tag *tag){
+
+	PDP_tag_cache_entry *entry = (PDP_tag_cache_entry *)tag;
+	PDP_tag_cache_shard *shard = NULL;
+
+	if(!tag) return;
+	if(!cache){
+		destroy_pdp_tag(tag);
+		return;
+	}
+
+	shard = &(cache->shards[entry->shard]);
+	pthread_mutex_lock(&(shard->lock));
+	entry->refs--;
+	if(entry->refs == 0 && !entry->cached) free_entry(entry);
+	else if(entry->cached) evict(shard, shard->stats.budget);
+	pthread_mutex_unlock(&(shard->lock));
+}
+
+/* pdp_tag_cache_flush: Evicts every tag that is not in use */
+void pdp_tag_cache_flush(PDP_tag_cache *cache){
+
+	PDP_tag_cache_shard *shard = NULL;
+	int i = 0;
+
+	if(!cache) return;
+
+	for(i = 0; i < PDP_TAG_CACHE_SHARDS; i++){
+		shard = &(cache->shards[i]);
+		pthread_mutex_lock(&(shard->lock));
+		evict(shard, 0);
+		pthread_mutex_unlock(&(shard->lock));
+	}
+}
+
+/* pdp_tag_cache_stats: Fills in stats with the cache's counters since it was created, summed over
+*  its shards.
+*/
+void pdp_tag_cache_stats(PDP_tag_cache *cache, PDP_tag_cache_stats *stats){
+
+	PDP_tag_cache_shard *shard = NULL;
+	int i = 0;
+
+	if(!stats) return;
+	memset(stats, 0, sizeof(PDP_tag_cache_stats));
+	if(!cache) return;
+
+	for(i = 0; i < PDP_TAG_CACHE_SHARDS; i++){
+		shard = &(cache->shards[i]);
+		pthread_mutex_lock(&(shard->lock));
+		stats->budget += shard->stats.budget;
+		stats->bytes += shard->stats.bytes;
+		stats->entries += shard->stats.entries;
+		stats->hits += shard->stats.hits;
+		stats->misses += shard->stats.misses;
+		stats->evictions += shard->stats.evictions;
+		stats->invalidations += shard->stats.invalidations;
+		pthread_mutex_unlock(&(shard->lock));
+	}
+}
@@ -0,0 +1,702 @@
+/* 
+* pdp-tagger.c
+*
+* Copyright (c) 2008, Zachary N J Peterson <zachary@jhu.edu>
+* All rights reserved.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*     * Redistributions of source code must retain the above copyright
+*       notice, this list of conditions and the following disclaimer.
+*     * Redistributions in binary form must reproduce the above copyright
+*       notice, this list of conditions and the following disclaimer in the
+*       documentation and/or other materials provided with the distribution.
+*     * The name of the Zachary N J Peterson may be used to endorse or promote products
+*       derived from this software without specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY ZACHARY N J PETERSON ``AS IS'' AND ANY
+* EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL ZACHARY N J PETERSON BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+
+
+/* pdp-tagger.c contains the tagging daemon, which holds the decrypted key on behalf of every local
+*  client.  The key is loaded and its table built once, when the daemon starts, and each worker keeps
+*  its own replica, so a client pays neither the key load nor the table warm-up, and never needs the
+*  password.  A client sends the descriptor of the data to tag, a data file or a memfd holding blocks
+*  in memory, over the socket, so no block is copied through the socket.  The workers pread the
+*  blocks of each chunk through it; the data is not mapped, so a client that truncates its file
+*  while it is tagged fails its own request instead of faulting the daemon with SIGBUS.  Each
+*  client's blocks are cut into chunks that the workers tag in parallel, and the records of each chunk
+*  are streamed back in order as soon as they are ready.  All tagging is charged to the daemon's
+*  context, so its CPU and I/O budgets hold across every client.
+*/
+
+#include "pdp.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+typedef struct PDP_tagger_chunk_struct PDP_tagger_chunk;
+typedef struct PDP_tagger_client_struct PDP_tagger_client;
+
+struct PDP_tagger_chunk_struct{
+
+	PDP_tagger_client *client;
+	uint64_t first_block;
+	uint64_t numblocks;
+	unsigned char *data;		/* PDP_TAGGER_CHUNK_BLOCKS blocks read from the client's data */
+	unsigned char *records;		/* PDP_TAGGER_CHUNK_BLOCKS records */
+	int state;					/* CHUNK_* */
+	PDP_tagger_chunk *next;		/* The work queue */
+};
+
+#define CHUNK_IDLE 0
+#define CHUNK_QUEUED 1
+#define CHUNK_DONE 2
+#define CHUNK_FAILED 3
+
+struct PDP_tagger_client_struct{
+
+	PDP_tagger *tagger;
+	int fd;						/* The client's connection */
+	int datafd;					/* The data to tag, read with pread */
+	size_t size;				/* Of the data when the request came */
+	PDP_tag_header header;
+};
+
+struct PDP_tagger_struct{
+
+	PDP_ctx *ctx;
+	PDP_key *key;				/* Held from the context's key cache */
+	char keypath[PATH_MAX];		/* The canonical keypath the key was loaded from */
+	unsigned char fingerprint[SHA_DIGEST_LENGTH];	/* pdp_key_fingerprint of key, sent in every reply */
+	char socketpath[MAXPATHLEN];
+	int listenfd;
+	int numworkers;
+	pthread_t *workers;
+	int numstarted;
+
+	pthread_mutex_t lock;		/* Protects everything below */
+	pthread_cond_t work;		/* Signalled when a chunk is queued or the workers are to quit */
+	pthread_cond_t done;		/* Broadcast when a chunk is done or a client leaves */
+	int stopping;				/* No new clients are accepted */
+	int quit;					/* Every client is served; the workers exit */
+	PDP_tagger_chunk *head;		/* Chunks waiting for a worker, oldest first */
+	PDP_tagger_chunk *tail;
+	PDP_tagger_stats stats;
+};
+
+/* send_status: Sends a reply carrying only a status.  Returns 1 on success and 0 on error */
+static int send_status(int fd, int status){
+
+	PDP_tagger_reply reply;
+
+	memset(&reply, 0, sizeof(PDP_tagger_reply));
+	memcpy(reply.magic, PDP_TAGGER_MAGIC, PDP_TAGGER_MAGIC_SIZE);
+	reply.version = PDP_TAGGER_VERSION;
+	reply.status = status;
+
+	return pdp_write_full(fd, &reply, sizeof(PDP_tagger_reply));
+}
+
+/* recv_request: Reads a request and the descriptor sent with it.  Returns the descriptor, or -1 if
+*  the request is malformed or came without one.
+*/
+static int recv_request(int fd, PDP_tagger_request *request){
+
+	struct msghdr msg;
+	struct iovec iov;
+	struct cmsghdr *cmsg = NULL;
+	union{
+		struct cmsghdr align;
+		char buf[CMSG_SPACE(sizeof(int))];
+	} control;
+	ssize_t r = 0;
+	int datafd = -1;
+
+	memset(&msg, 0, sizeof(msg));
+	memset(&control, 0, sizeof(control));
+	iov.iov_base = request;
+	iov.iov_len = sizeof(PDP_tagger_request);
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control.buf;
+	msg.msg_controllen = sizeof(control.buf);
+
+	do{
+		r = recvmsg(fd, &msg, MSG_CMSG_CLOEXEC);
+	}while(r < 0 && errno == EINTR);
+	if(r <= 0) return -1;
+
+	for(cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg))
+		if(cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS && cmsg->cmsg_len == CMSG_LEN(sizeof(int)))
+			memcpy(&datafd, CMSG_DATA(cmsg), sizeof(int));
+	if(datafd < 0) return -1;
+
+	/* The descriptor arrives with the first byte; the rest of the request may follow */
+	if((size_t)r < sizeof(PDP_tagger_request) &&
+		!pdp_read_full(fd, (unsigned char *)request + r, sizeof(PDP_tagger_request) - r)){
+		close(datafd);
+		return -1;
+	}
+
+	return datafd;
+}
+
+/* read_chunk: Reads the blocks of a chunk into its buffer, zero-padding the last block of the data.
+*  Returns 1 on success and 0 on a read error or if the data has shrunk since the request.
+*/
+static int read_chunk(PDP_tagger_chunk *chunk){
+
+	PDP_tagger_client *client = chunk->client;
+	off_t offset = (off_t)chunk->first_block * PDP_BLOCKSIZE;
+	size_t len = chunk->numblocks * PDP_BLOCKSIZE, want = 0, got = 0;
+	ssize_t n = 0;
+
+	want = (client->size - offset < len) ? client->size - offset : len;
+	while(got < want){
+		n = pread(client->datafd, chunk->data + got, want - got, offset + got);
+		if(n < 0 && errno == EINTR) continue;
+		if(n <= 0) return 0;
+		got += n;
+	}
+	if(got < len) memset(chunk->data + got, 0, len - got);
+
+	return 1;
+}
+
+/* tag_chunk: Tags the blocks of a chunk with key into the chunk's records.  Returns 1 on success and
+*  0 on failure.
+*/
+static int tag_chunk(PDP_tagger_chunk *chunk, PDP_key *key, PDP_budget *budget){
+
+	PDP_tagger_client *client = chunk->client;
+	PDP_tag *tag = NULL;
+	uint64_t i = 0, index = 0, cpu = 0;
+
+	pdp_budget_charge_io(budget, chunk->numblocks * PDP_BLOCKSIZE);
+	if(!read_chunk(chunk)) return 0;
+	for(i = 0; i < chunk->numblocks; i++){
+		index = chunk->first_block + i;
+
+		cpu = pdp_budget_thread_cpu();
+		tag = pdp_tag_block(key, chunk->data + (i * PDP_BLOCKSIZE), PDP_BLOCKSIZE, index);
+		if(!tag) return 0;
+		if(!pdp_tag_record_encode(&(client->header), tag, chunk->records + (i * client->header.record_size))){
+			destroy_pdp_tag(tag);
+			return 0;
+		}
+		destroy_pdp_tag(tag);
+		pdp_budget_charge_cpu(budget, cpu);
+	}
+
+	return 1;
+}
+
+/* tagger_worker: Tags queued chunks, oldest first, with the worker's own replica of the key until
+*  the tagger stops.
+*/
+static void *tagger_worker(void *arg){
+
+	PDP_tagger *tagger = (PDP_tagger *)arg;
+	PDP_tagger_chunk *chunk = NULL;
+	PDP_key *key = NULL;
+	int ok = 0;
+
+	key = pdp_key_replicate(tagger->key);
+
+	pthread_mutex_lock(&(tagger->lock));
+	while(1){
+		while(!tagger->quit && !tagger->head)
+			pthread_cond_wait(&(tagger->work), &(tagger->lock));
+		if(!tagger->head) break;
+
+		chunk = tagger->head;
+		tagger->head = chunk->next;
+		if(!tagger->head) tagger->tail = NULL;
+		pthread_mutex_unlock(&(tagger->lock));
+
+		ok = key && tag_chunk(chunk, key, tagger->ctx->budget);
+
+		pthread_mutex_lock(&(tagger->lock));
+		chunk->state = ok ? CHUNK_DONE : CHUNK_FAILED;
+		if(ok) tagger->stats.blocks += chunk->numblocks;
+		pthread_cond_broadcast(&(tagger->done));
+	}
+	pthread_mutex_unlock(&(tagger->lock));
+
+	if(key) destroy_pdp_key(key);
+
+	return NULL;
+}
+
+/* queue_chunk: Hands a chunk to the workers.  Call with the lock held */
+static void queue_chunk(PDP_tagger *tagger, PDP_tagger_chunk *chunk){
+
+	chunk->state = CHUNK_QUEUED;
+	chunk->next = NULL;
+	if(tagger->tail) tagger->tail->next = chunk;
+	else tagger->head = chunk;
+	tagger->tail = chunk;
+	pthread_cond_signal(&(tagger->work));
+}
+
+/* keypath_matches: Returns 1 if keypath, or the daemon's own keypath if it is empty, names the
+*  directory the daemon's key was loaded from, and 0 otherwise.
+*/
+static int keypath_matches(PDP_tagger *tagger, char *keypath){
+
+	char resolved[PATH_MAX];
+
+	if(!keypath[0]) return 1;
+	if(!realpath(keypath, resolved)) return 0;
+
+	return strcmp(resolved, tagger->keypath) == 0;
+}
+
+/* serve_client: Tags the data a client sent the descriptor of and streams the records back, keeping
+*  up to PDP_TAGGER_WINDOW chunks with the workers.  Returns the client's final status.
+*/
+static int serve_client(PDP_tagger_client *client){
+
+	PDP_tagger *tagger = client->tagger;
+	PDP_tagger_request request;
+	PDP_tagger_reply reply;
+	PDP_tagger_frame frame;
+	PDP_tagger_chunk chunks[PDP_TAGGER_WINDOW];
+	PDP_tagger_chunk *chunk = NULL;
+	struct stat st;
+	char keypath[MAXPATHLEN];
+	uint64_t numblocks = 0, next = 0, sent = 0;
+	int i = 0, status = PDP_TAGGER_BAD_REQUEST, inflight = 0;
+
+	memset(chunks, 0, sizeof(chunks));
+	memset(keypath, 0, MAXPATHLEN);
+
+	if( ((client->datafd = recv_request(client->fd, &request)) < 0)) goto cleanup;
+	if(memcmp(request.magic, PDP_TAGGER_MAGIC, PDP_TAGGER_MAGIC_SIZE) != 0) goto cleanup;
+	if(request.version != PDP_TAGGER_VERSION || request.keypath_len >= MAXPATHLEN) goto cleanup;
+	if(request.keypath_len && !pdp_read_full(client->fd, keypath, request.keypath_len)) goto cleanup;
+	if(memchr(keypath, '\0', request.keypath_len)) goto cleanup;
+	if(!keypath_matches(tagger, keypath)){
+		status = PDP_TAGGER_WRONG_KEY;
+		goto cleanup;
+	}
+
+	if(fstat(client->datafd, &st) < 0 || st.st_size < 0) goto cleanup;
+	client->size = st.st_size;
+	numblocks = (client->size + PDP_BLOCKSIZE - 1) / PDP_BLOCKSIZE;
+	posix_fadvise(client->datafd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+	status = PDP_TAGGER_FAILED;
+	if(!pdp_tag_header_init(&(client->header), tagger->key)) goto cleanup;
+	for(i = 0; i < PDP_TAGGER_WINDOW; i++){
+		chunks[i].client = client;
+		if( ((chunks[i].data = malloc((size_t)PDP_TAGGER_CHUNK_BLOCKS * PDP_BLOCKSIZE)) == NULL)) goto cleanup;
+		if( ((chunks[i].records = malloc((size_t)PDP_TAGGER_CHUNK_BLOCKS * client->header.record_size)) == NULL)) goto cleanup;
+	}
+
+	memset(&reply, 0, sizeof(PDP_tagger_reply));
+	memcpy(reply.magic, PDP_TAGGER_MAGIC, PDP_TAGGER_MAGIC_SIZE);
+	reply.version = PDP_TAGGER_VERSION;
+	reply.status = PDP_TAGGER_OK;
+	reply.numblocks = numblocks;
+	memcpy(&(reply.header), &(client->header), sizeof(PDP_tag_header));
+	memcpy(reply.key_fingerprint, tagger->fingerprint, SHA_DIGEST_LENGTH);
+	if(!pdp_write_full(client->fd, &reply, sizeof(PDP_tagger_reply))) goto cleanup;
+
+	/* Chunk k lives in chunks[k % PDP_TAGGER_WINDOW]; send them in order as they finish */
+	pthread_mutex_lock(&(tagger->lock));
+	while(sent < numblocks){
+		while(next < numblocks && inflight < PDP_TAGGER_WINDOW){
+			chunk = &(chunks[(next / PDP_TAGGER_CHUNK_BLOCKS) % PDP_TAGGER_WINDOW]);
+			chunk->first_block = next;
+			chunk->numblocks = (numblocks - next < PDP_TAGGER_CHUNK_BLOCKS) ? numblocks - next : PDP_TAGGER_CHUNK_BLOCKS;
+			queue_chunk(tagger, chunk);
+			next += chunk->numblocks;
+			inflight++;
+		}
+
+		chunk = &(chunks[(sent / PDP_TAGGER_CHUNK_BLOCKS) % PDP_TAGGER_WINDOW]);
+		while(chunk->state == CHUNK_QUEUED)
+			pthread_cond_wait(&(tagger->done), &(tagger->lock));
+		if(chunk->state != CHUNK_DONE) break;
+		chunk->state = CHUNK_IDLE;
+		inflight--;
+		pthread_mutex_unlock(&(tagger->lock));
+
+		frame.first_block = chunk->first_block;
+		frame.numrecords = chunk->numblocks;
+		frame.status = PDP_TAGGER_OK;
+		if(!pdp_write_full(client->fd, &frame, sizeof(PDP_tagger_frame)) ||
+			!pdp_write_full(client->fd, chunk->records, chunk->numblocks * client->header.record_size)){
+			pthread_mutex_lock(&(tagger->lock));
+			break;
+		}
+		sent += chunk->numblocks;
+
+		pthread_mutex_lock(&(tagger->lock));
+	}
+
+	/* The workers may still hold chunks of a failed stream; wait them out before freeing them */
+	for(i = 0; i < PDP_TAGGER_WINDOW; i++)
+		while(chunks[i].state == CHUNK_QUEUED)
+			pthread_cond_wait(&(tagger->done), &(tagger->lock));
+	pthread_mutex_unlock(&(tagger->lock));
+
+	if(sent == numblocks) status = PDP_TAGGER_OK;
+	else{
+		memset(&frame, 0, sizeof(PDP_tagger_frame));
+		frame.status = PDP_TAGGER_FAILED;
+		pdp_write_full(client->fd, &frame, sizeof(PDP_tagger_frame));
+	}
+
+	for(i = 0; i < PDP_TAGGER_WINDOW; i++){
+		if(chunks[i].data) free(chunks[i].data);
+		if(chunks[i].records) free(chunks[i].records);
+	}
+	close(client->datafd);
+	client->datafd = -1;
+
+	return status;
+
+cleanup:
+	send_status(client->fd, status);
+	for(i = 0; i < PDP_TAGGER_WINDOW; i++){
+		if(chunks[i].data) free(chunks[i].data);
+		if(chunks[i].records) free(chunks[i].records);
+	}
+	if(client->datafd >= 0) close(client->datafd);
+	client->datafd = -1;
+	return status;
+}
+
+/* client_thread: Serves one client and closes its connection */
+static void *client_thread(void *arg){
+
+	PDP_tagger_client *client = (PDP_tagger_client *)arg;
+	PDP_tagger *tagger = client->tagger;
+	int status = 0;
+
+	status = serve_client(client);
+	close(client->fd);
+	free(client);
+
+	pthread_mutex_lock(&(tagger->lock));
+	if(status == PDP_TAGGER_OK) tagger->stats.completed++;
+	else if(status == PDP_TAGGER_WRONG_KEY) tagger->stats.rejected++;
+	else tagger->stats.failed++;
+	tagger->stats.clients--;
+	pthread_cond_broadcast(&(tagger->done));
+	pthread_mutex_unlock(&(tagger->lock));
+
+	return NULL;
+}
+
+/* pdp_tagger_new: Returns an allocated tagging daemon that will listen on socketpath and tag with
+*  the key in keypath, opened with password, on numworkers workers (PDP_TAGGER_WORKERS if 0).  The
+*  key is loaded through ctx's key cache now, so a wrong password fails here rather than on the first
+*  request.  The socket is only ever accessible to its owner, and replaces a stale one left at
+*  socketpath.  The tagger does not own ctx.  Returns NULL on failure.
+*/
+PDP_tagger *pdp_tagger_new(PDP_ctx *ctx, char *socketpath, char *keypath, char *password, int numworkers){
+
+	PDP_tagger *tagger = NULL;
+	struct sockaddr_un addr;
+
+	if(!ctx || !socketpath || !password) return NULL;
+	if(strlen(socketpath) >= sizeof(addr.sun_path)) return NULL;
+	if(!keypath) keypath = ctx->keypath;
+
+	if( ((tagger = malloc(sizeof(PDP_tagger))) == NULL)) return NULL;
+	memset(tagger, 0, sizeof(PDP_tagger));
+	tagger->listenfd = -1;
+	tagger->ctx = ctx;
+	tagger->numworkers = numworkers > 0 ? numworkers : PDP_TAGGER_WORKERS;
+	strcpy(tagger->socketpath, socketpath);
+
+	if(pthread_mutex_init(&(tagger->lock), NULL) != 0){
+		free(tagger);
+		return NULL;
+	}
+	pthread_cond_init(&(tagger->work), NULL);
+	pthread_cond_init(&(tagger->done), NULL);
+
+	if(!realpath(keypath, tagger->keypath)) goto cleanup;
+	if( ((tagger->key = pdp_key_cache_get(ctx->keycache, keypath, password)) == NULL)) goto cleanup;
+	if(!pdp_key_precompute(tagger->key)) goto cleanup;
+	if(!pdp_key_fingerprint(tagger->key, tagger->fingerprint)) goto cleanup;
+	if( ((tagger->workers = malloc(tagger->numworkers * sizeof(pthread_t))) == NULL)) goto cleanup;
+
+	/* The socket leads to the decrypted key, so it is created private rather than made so after bind */
+	if( ((tagger->listenfd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)) goto cleanup;
+	if(!pdp_bind_private(tagger->listenfd, socketpath)){
+		fprintf(stderr, "ERROR: Was unable to bind %s.\n", socketpath);
+		goto cleanup;
+	}
+	if(listen(tagger->listenfd, SOMAXCONN) != 0) goto cleanup;
+
+	return tagger;
+
+cleanup:
+	pdp_tagger_free(tagger);
+	return NULL;
+}
+
+/* pdp_tagger_run: Serves clients, each on a thread of its own, until pdp_tagger_stop is called, then
+*  waits for the connected clients to be served.  Returns 1 after a stop and 0 if the tagger could not run.
+*/
+int pdp_tagger_run(PDP_tagger *tagger){
+
+	PDP_tagger_client *client = NULL;
+	pthread_t thread;
+	pthread_attr_t attr;
+	int fd = -1, stopping = 0, busy = 0;
+
+	if(!tagger) return 0;
+
+	for(tagger->numstarted = 0; tagger->numstarted < tagger->numworkers; tagger->numstarted++)
+		if(pthread_create(&(tagger->workers[tagger->numstarted]), NULL, tagger_worker, tagger) != 0) break;
+	if(tagger->numstarted == 0) return 0;
+
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+	while(1){
+		fd = accept(tagger->listenfd, NULL, NULL);
+
+		pthread_mutex_lock(&(tagger->lock));
+		stopping = tagger->stopping;
+		busy = (tagger->stats.clients >= PDP_TAGGER_MAX_CLIENTS);
+		if(fd >= 0 && !stopping){
+			tagger->stats.requests++;
+			if(busy) tagger->stats.rejected++;
+			else tagger->stats.clients++;
+		}
+		pthread_mutex_unlock(&(tagger->lock));
+		if(stopping) break;
+		if(fd < 0){
+			if(errno == EINTR || errno == ECONNABORTED || errno == EMFILE || errno == ENFILE) continue;
+			break;
+		}
+		if(busy){
+			send_status(fd, PDP_TAGGER_BUSY);
+			close(fd);
+			continue;
+		}
+
+		if( ((client = malloc(sizeof(PDP_tagger_client))) != NULL)){
+			memset(client, 0, sizeof(PDP_tagger_client));
+			client->tagger = tagger;
+			client->fd = fd;
+			client->datafd = -1;
+			if(pthread_create(&thread, &attr, client_thread, client) == 0) continue;
+			free(client);
+		}
+		send_status(fd, PDP_TAGGER_FAILED);
+		close(fd);
+		pthread_mutex_lock(&(tagger->lock));
+		tagger->stats.clients--;
+		tagger->stats.failed++;
+		pthread_mutex_unlock(&(tagger->lock));
+	}
+	if(fd >= 0) close(fd);
+	pthread_attr_destroy(&attr);
+
+	/* Let the connected clients finish before the workers go */
+	pdp_tagger_stop(tagger);
+	pthread_mutex_lock(&(tagger->lock));
+	while(tagger->stats.clients > 0)
+		pthread_cond_wait(&(tagger->done), &(tagger->lock));
+	tagger->quit = 1;
+	pthread_cond_broadcast(&(tagger->work));
+	pthread_mutex_unlock(&(tagger->lock));
+
+	for(; tagger->numstarted > 0; tagger->numstarted--) pthread_join(tagger->workers[tagger->numstarted - 1], NULL);
+
+	return 1;
+}
+
+/* pdp_tagger_stop: Makes pdp_tagger_run return once the connected clients are served.  Can be
+*  called from any thread.
+*/
+void pdp_tagger_stop(PDP_tagger *tagger){
+
+	if(!tagger) return;
+
+	pthread_mutex_lock(&(tagger->lock));
+	tagger->stopping = 1;
+	pthread_mutex_unlock(&(tagger->lock));
+
+	/* Wake the accepting thread */
+	if(tagger->listenfd >= 0) shutdown(tagger->listenfd, SHUT_RDWR);
+}
+
+/* pdp_tagger_free: Closes and removes the tagger's socket, returns its key to the key cache and
+*  frees it.  pdp_tagger_run must have returned.
+*/
+void pdp_tagger_free(PDP_tagger *tagger){
+
+	if(!tagger) return;
+	if(tagger->listenfd >= 0){
+		close(tagger->listenfd);
+		unlink(tagger->socketpath);
+	}
+	if(tagger->key) pdp_key_cache_put(tagger->ctx->keycache, tagger->key);
+	if(tagger->workers) free(tagger->workers);
+	pthread_cond_destroy(&(tagger->work));
+	pthread_cond_destroy(&(tagger->done));
+	pthread_mutex_destroy(&(tagger->lock));
+	free(tagger);
+}
+
+/* pdp_tagger_stats: Reports the tagger's counters since it was created */
+void pdp_tagger_stats(PDP_tagger *tagger, PDP_tagger_stats *stats){
+
+	if(!tagger || !stats) return;
+
+	pthread_mutex_lock(&(tagger->lock));
+	memcpy(stats, &(tagger->stats), sizeof(PDP_tagger_stats));
+	pthread_mutex_unlock(&(tagger->lock));
+}
+
+/* pdp_tagger_tag_fd: Has the tagging daemon listening on socketpath tag the data fd refers to, a
+*  regular file or a memfd, and writes the tag file to tagfilepath, through a temporary file renamed
+*  into place when complete.  keypath names the key the tags must be made with; NULL accepts the
+*  daemon's.  The fingerprint of the daemon's key is stored in key_fingerprint, SHA_DIGEST_LENGTH
+*  bytes, unless it is NULL, so callers need not load the key to record it.  Returns 1 on success and
+*  0 on failure, including when the daemon holds another key.
+*/
+int pdp_tagger_tag_fd(char *socketpath, char *keypath, int fd, char *tagfilepath, unsigned char *key_fingerprint){
+
+	PDP_tagger_request request;
+	PDP_tagger_reply reply;
+	PDP_tagger_frame frame;
+	PDP_tag_writer *tagwriter = NULL;
+	struct sockaddr_un addr;
+	struct msghdr msg;
+	struct iovec iov;
+	struct cmsghdr *cmsg = NULL;
+	union{
+		struct cmsghdr align;
+		char buf[CMSG_SPACE(sizeof(int))];
+	} control;
+	char tmptagfilepath[MAXPATHLEN];
+	char resolved[PATH_MAX];
+	unsigned char *records = NULL;
+	uint64_t received = 0;
+	size_t len = 0;
+	ssize_t r = 0;
+	int sock = -1;
+	int result = 0;
+
+	if(!socketpath || fd < 0 || !tagfilepath) return 0;
+	if(strlen(socketpath) >= sizeof(addr.sun_path)) return 0;
+	if(keypath && !realpath(keypath, resolved)) return 0;
+	if(keypath && strlen(resolved) >= MAXPATHLEN) return 0;
+	if(keypath) keypath = resolved;
+	if( snprintf(tmptagfilepath, MAXPATHLEN, "%s%s", tagfilepath, PDP_TAG_TMP_EXT) >= MAXPATHLEN ) return 0;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, socketpath);
+	if( ((sock = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)) return 0;
+	if(connect(sock, (struct sockaddr *)&addr, sizeof(addr)) != 0) goto cleanup;
+
+	/* Send the request with the data's descriptor attached */
+	memset(&request, 0, sizeof(PDP_tagger_request));
+	memcpy(request.magic, PDP_TAGGER_MAGIC, PDP_TAGGER_MAGIC_SIZE);
+	request.version = PDP_TAGGER_VERSION;
+	request.keypath_len = keypath ? strlen(keypath) : 0;
+
+	memset(&msg, 0, sizeof(msg));
+	memset(&control, 0, sizeof(control));
+	iov.iov_base = &request;
+	iov.iov_len = sizeof(PDP_tagger_request);
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control.buf;
+	msg.msg_controllen = sizeof(control.buf);
+	cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+	memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+	do{
+		r = sendmsg(sock, &msg, MSG_NOSIGNAL);
+	}while(r < 0 && errno == EINTR);
+	if(r < 0) goto cleanup;
+	if((size_t)r < sizeof(PDP_tagger_request) && !pdp_write_full(sock, (unsigned char *)&request + r, sizeof(PDP_tagger_request) - r))
+		goto cleanup;
+	if(request.keypath_len && !pdp_write_full(sock, keypath, request.keypath_len)) goto cleanup;
+
+	if(!pdp_read_full(sock, &reply, sizeof(PDP_tagger_reply))) goto cleanup;
+	if(memcmp(reply.magic, PDP_TAGGER_MAGIC, PDP_TAGGER_MAGIC_SIZE) != 0 || reply.version != PDP_TAGGER_VERSION) goto cleanup;
+	if(reply.status != PDP_TAGGER_OK){
+		if(reply.status == PDP_TAGGER_WRONG_KEY) fprintf(stderr, "ERROR: The tagging daemon holds a different key.\n");
+		goto cleanup;
+	}
+	if(reply.header.record_size == 0 || reply.header.record_size > (1 << 16)) goto cleanup;
+	if( ((records = malloc((size_t)PDP_TAGGER_CHUNK_BLOCKS * reply.header.record_size)) == NULL)) goto cleanup;
+
+	if( ((tagwriter = pdp_tag_writer_open(tmptagfilepath, 0)) == NULL)){
+		fprintf(stderr, "ERROR: Was not able to create %s.\n", tmptagfilepath);
+		goto cleanup;
+	}
+	if(!pdp_tag_writer_append(tagwriter, (unsigned char *)&(reply.header), PDP_TAG_HEADER_SIZE)) goto cleanup;
+
+	while(received < reply.numblocks){
+		if(!pdp_read_full(sock, &frame, sizeof(PDP_tagger_frame))) goto cleanup;
+		if(frame.status != PDP_TAGGER_OK || frame.first_block != received) goto cleanup;
+		if(frame.numrecords == 0 || frame.numrecords > PDP_TAGGER_CHUNK_BLOCKS) goto cleanup;
+		len = (size_t)frame.numrecords * reply.header.record_size;
+		if(!pdp_read_full(sock, records, len)) goto cleanup;
+		if(!pdp_tag_writer_append(tagwriter, records, len)) goto cleanup;
+		received += frame.numrecords;
+	}
+
+	result = pdp_tag_writer_close(tagwriter);
+	tagwriter = NULL;
+	if(result && rename(tmptagfilepath, tagfilepath) != 0){
+		fprintf(stderr, "ERROR: Was not able to create %s.\n", tagfilepath);
+		result = 0;
+	}
+	if(result && key_fingerprint) memcpy(key_fingerprint, reply.key_fingerprint, SHA_DIGEST_LENGTH);
+
+cleanup:
+	if(tagwriter) pdp_tag_writer_close(tagwriter);
+	if(!result) unlink(tmptagfilepath);
+	if(records) free(records);
+	close(sock);
+	return result;
+}
+
+/* pdp_tagger_tag_file: pdp_tagger_tag_fd on the file at filepath */
+int pdp_tagger_tag_file(char *socketpath, char *keypath, char *filepath, char *tagfilepath, unsigned char *key_fingerprint){
+
+	int fd = -1;
+	int result = 0;
+
+	if(!filepath) return 0;
+	if( ((fd = open(filepath, O_RDONLY)) < 0)) return 0;
+	result = pdp_tagger_tag_fd(socketpath, keypath, fd, tagfilepath, key_fingerprint);
+	close(fd);
+
+	return result;
+}
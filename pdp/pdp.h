@@ -30,6 +30,12 @@
 #ifndef __PDP_H__
 #define __PDP_H__
 
+/* Block indices and file offsets are 64 bits wide so files larger than 2 GB (and, at 4 KB
+ * blocks, 16 TB) can be tagged and challenged on 32-bit platforms too */
+#ifndef _FILE_OFFSET_BITS
+#define _FILE_OFFSET_BITS 64
+#endif
+
 #include <openssl/bn.h>
 #include <openssl/hmac.h>
 #include <openssl/rand.h>
@@ -37,6 +43,9 @@
 #include <openssl/sha.h>
 #include <string.h>
 #include <stdio.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/param.h>
 #include <openssl/bio.h>
 // #include "openssl/crypto/rsa/rsa_locl.h"
 
@@ -47,11 +56,20 @@
  * Key generation is slower as a side effect */
 #define USE_SAFE_PRIMES
 
+/* Safe primes are searched for on up to PDP_KEYGEN_MAX_THREADS threads.  Each thread sieves its
+ * candidates by the first PDP_SIEVE_PRIMES odd primes before any primality test, and picks a new
+ * random starting point after PDP_SIEVE_MAX_DELTA. */
+#define PDP_KEYGEN_MAX_THREADS 64
+#define PDP_SIEVE_PRIMES 2048
+#define PDP_SIEVE_MAX_DELTA (1 << 20)
+
 /* If USE_E_PDP is defined, the protocol is more efficient but offers
  * weaker guarantees of possesion; only a possesion of the sum of file blocks.
  * In general, however, this is practically secure as long as the number of 
- * sampled blocks is high. */
+ * sampled blocks is high.  Building with -DUSE_S_PDP uses S-PDP instead. */
+#ifndef USE_S_PDP
 #define USE_E_PDP
+#endif
 
 /* Tagging is "embarrassingly" parallelizable as each tag can be calculated
  * independenlty.  During tagging, N threads can be spawned, dividing the file
@@ -66,6 +84,108 @@
 #define NUM_THREADS 4
 #endif
 
+/* On multi-socket machines the tagging threads are split between the NUMA nodes and pinned there.
+ * Each thread tags from its own replica of the key, with its precomputed values, and reads into
+ * its own block buffers, all allocated in its node's memory. */
+#define PDP_NUMA_MAX_NODES 64
+
+/* Tagging reads every block of a file once.  With USE_DIRECT_IO the data file is read and the
+ * tag file written with O_DIRECT (or, where that is unsupported, through the page cache with the
+ * pages dropped right after use), so tagging a large file does not evict the working set of
+ * co-located services such as the IPFS daemon. */
+//#define USE_DIRECT_IO
+
+/* Without the page cache there is no kernel read-ahead, so the block reader keeps PDP_IO_DEPTH
+ * chunks of PDP_IO_CHUNK_BLOCKS blocks in flight ahead of the tagger.  Tagging costs about a
+ * millisecond of CPU per block, so a few 1 MB requests ahead keep even a single tagging thread
+ * from ever waiting on the device. */
+#define PDP_IO_ALIGN 4096
+#define PDP_IO_CHUNK_BLOCKS 256
+#define PDP_IO_DEPTH 4
+
+/* The tag writer stages PDP_TAG_WRITER_CHUNKS such chunks of tag records and writes them out with a
+ * single write once they are full.  Tagging without THREADING hands it PDP_TAG_WRITER_BATCH tags at
+ * a time. */
+#define PDP_TAG_WRITER_CHUNKS 4
+#define PDP_TAG_WRITER_BATCH 256
+
+#define PDP_IO_DIRECT 0x1		/* Bypass the page cache with O_DIRECT */
+#define PDP_IO_DONTNEED 0x2		/* Use the page cache but drop pages after use */
+
+/* Tagging can be held to a CPU and an I/O budget (see pdp_tag_budget_set) so it does not starve
+ * IPFS serving and cluster RPC.  A budget accrues at most PDP_BUDGET_BURST_MS worth of unused
+ * allowance, which is also how quickly a change of budget takes effect. */
+#define PDP_BUDGET_BURST_MS 100
+
+/* Each context keeps up to PDP_FD_CACHE_SIZE data and tag files open between proofs */
+#define PDP_FD_CACHE_SIZE 256
+
+/* Each context can keep the decoded tags of hot files between proofs (see pdp_tag_cache_set_budget).
+ * The tag cache is split into PDP_TAG_CACHE_SHARDS independently locked shards, each starting with
+ * a table of PDP_TAG_CACHE_BUCKETS buckets that grows with the number of tags it holds.  A new
+ * context caches up to $PDP_TAG_CACHE_MB megabytes of tags if it is set, and none otherwise. */
+#define PDP_TAG_CACHE_SHARDS 16
+#define PDP_TAG_CACHE_BUCKETS 256
+#define PDP_TAG_CACHE_ENV "PDP_TAG_CACHE_MB"
+
+/* The prover daemon (see pdp_prover_new) proves files on PDP_PROVER_WORKERS threads and queues at
+ * most PDP_PROVER_QUEUE_DEPTH requests, holding at most PDP_PROVER_MAX_IO bytes of reads between
+ * them.  Requests run earliest deadline first, and one that cannot finish by its deadline given
+ * the work queued ahead of it is turned away at once instead of queueing.  Cost estimates start
+ * from PDP_PROVER_BLOCK_NS of CPU per sampled block and follow the measured cost from then on. */
+#define PDP_PROVER_WORKERS 4
+#define PDP_PROVER_QUEUE_DEPTH 256
+#define PDP_PROVER_MAX_IO (64 << 20)
+#define PDP_PROVER_BLOCK_NS 200000
+#define PDP_PROVER_DEADLINE_MS 10000	/* The deadline of requests that give none */
+#define PDP_PROVER_RECV_TIMEOUT_MS 1000	/* How long a client may take to send its request */
+#define PDP_PROVER_TAG_CACHE (64 << 20)	/* The tag cache of pdp -d when $PDP_TAG_CACHE_MB is not set */
+
+/* The tagging daemon (see pdp_tagger_new) holds the decrypted key and tags on PDP_TAGGER_WORKERS
+ * warm threads, each with its own replica of the key and its table.  Clients hand it the data as
+ * a descriptor, which it reads with pread, and it streams back the tag records of each
+ * PDP_TAGGER_CHUNK_BLOCKS blocks as they are done, keeping PDP_TAGGER_WINDOW chunks per client in
+ * flight.  If the
+ * PDP_TAGGER_SOCKET environment variable names a daemon's socket, pdp_tag_file tags through it
+ * and falls back to tagging in-process if it cannot be reached. */
+#define PDP_TAGGER_WORKERS 4
+#define PDP_TAGGER_MAX_CLIENTS 64
+#define PDP_TAGGER_CHUNK_BLOCKS 64
+#define PDP_TAGGER_WINDOW 8
+#define PDP_TAGGER_SOCKET_ENV "PDP_TAGGER_SOCKET"
+
+/* With ctx->numprocs above 1 (or $PDP_TAG_PROCESSES) files are tagged by that many forked worker
+ * processes, so a crash while tagging cannot take down the calling service.  The tag file is sized
+ * up front and mapped shared; each worker tags a contiguous range and writes its records straight
+ * into their slots, reporting every PDP_FORK_CHUNK_BLOCKS blocks done on a lock-free ring of
+ * PDP_FORK_RING_SIZE slots in shared memory.  The parent only watches the ring and its children, and
+ * restarts a worker that dies, from where it got to, up to PDP_FORK_RETRIES times. */
+#define PDP_FORK_CHUNK_BLOCKS 256
+#define PDP_FORK_RING_SIZE 1024
+#define PDP_FORK_RETRIES 2
+#define PDP_FORK_MAX_PROCS 256
+#define PDP_FORK_POLL_US 1000
+#define PDP_TAG_PROCESSES_ENV "PDP_TAG_PROCESSES"
+
+/* The metadata catalog (see pdp_catalog_open) is a file of PDP_CATALOG_SLOT_SIZE-byte slots in an
+ * open-addressing hash table, followed by a string area holding the names (a CID or a path) and tag
+ * paths, mapped into memory.  Names and tag paths may be as long as any path.  It starts with
+ * PDP_CATALOG_INITIAL slots and PDP_CATALOG_STRINGS_INITIAL bytes of strings, and the string area
+ * doubles when it fills.  The table is rebuilt, at twice the size unless dropping deleted entries is
+ * enough, when more than PDP_CATALOG_LOAD of the slots are used or deleted, and at the same size when
+ * most of the string area belongs to replaced or deleted entries.  The context records every file it
+ * tags in the catalog $PDP_CATALOG names, if it is set. */
+#define PDP_CATALOG_MAGIC "PDPCAT01"
+#define PDP_CATALOG_MAGIC_SIZE 8
+#define PDP_CATALOG_VERSION 2
+#define PDP_CATALOG_NAME_SIZE MAXPATHLEN
+#define PDP_CATALOG_PATH_SIZE MAXPATHLEN
+#define PDP_CATALOG_SLOT_SIZE 128
+#define PDP_CATALOG_INITIAL 1024
+#define PDP_CATALOG_STRINGS_INITIAL 65536
+#define PDP_CATALOG_LOAD 0.7
+#define PDP_CATALOG_ENV "PDP_CATALOG"
+
 #define PRF_KEY_SIZE 20
 #define PRP_KEY_SIZE 16
 #define RSA_KEY_SIZE 1024
@@ -73,9 +193,60 @@
 
 #define PDP_BLOCKSIZE 4096 /* 4Kbytes */
 
+/* Tagging raises the fixed generator g to each block.  pdp_key_precompute builds a table holding
+ * g^(j * 2^(w*i)) in Montgomery form for every window i of w = PDP_FIXED_BASE_WINDOW bits of an
+ * exponent below phi(N), and every digit j, so g^m costs one multiplication per window instead of
+ * a full square-and-multiply.  At 1024 bits that is 256 multiplications and a 480 KB table. */
+#define PDP_FIXED_BASE_WINDOW 4
+#define PDP_FIXED_BASE_DIGITS ((1 << PDP_FIXED_BASE_WINDOW) - 1)
+
+/* pdp_verify_tags_batch checks many tags at once by combining their equations with random weights of
+ * PDP_BATCH_WEIGHT_BITS bits, so a bad tag slips through a batch with probability 2^-64.  A scrub
+ * (see pdp_ctx_scrub_file) checks every block of a file in batches of PDP_SCRUB_BATCH_BLOCKS on
+ * PDP_SCRUB_THREADS threads by default.  Localizing bad blocks (see pdp_ctx_locate_corrupt) group tests
+ * windows of PDP_LOCATE_WINDOW_BLOCKS blocks, 16 MB at 4 KB blocks. */
+#define PDP_BATCH_WEIGHT_BITS 64
+#define PDP_SCRUB_BATCH_BLOCKS 256
+#define PDP_SCRUB_THREADS 4
+#define PDP_LOCATE_WINDOW_BLOCKS 4096
+
 /* 460 blocks gives you 99% chance of detecting an error, 300 blocks gives you 95% chance*/
 #define MAGIC_NUM_CHALLENGE_BLOCKS 460
 
+/* A challenge policy (see pdp_challenge_policy) sizes challenges to detect the loss of
+ * PDP_POLICY_CORRUPT_FRACTION of a file with probability PDP_POLICY_DETECTION, which is what
+ * MAGIC_NUM_CHALLENGE_BLOCKS gives.  Peers with a failed audit and fewer than PDP_POLICY_HONEST_STREAK
+ * clean audits since are held to PDP_POLICY_MAX_DETECTION (917 blocks of a large file), and peers
+ * with at least that many to PDP_POLICY_MIN_DETECTION (299 blocks). */
+#define PDP_POLICY_DETECTION 0.99
+#define PDP_POLICY_MIN_DETECTION 0.95
+#define PDP_POLICY_MAX_DETECTION 0.9999
+#define PDP_POLICY_CORRUPT_FRACTION 0.01
+#define PDP_POLICY_HONEST_STREAK 30
+
+/* The audit scheduler (see pdp_scheduler_new) audits each file every PDP_SCHED_INTERVAL seconds,
+ * divided by its weight: the risk given when it was added times 1 + log2(blocks) / PDP_SCHED_SIZE_BITS,
+ * so a 1 GB file is audited twice as often as a one-block file of the same risk.  Failed audits and
+ * audits that could not run are retried after PDP_SCHED_RETRY seconds. */
+#define PDP_SCHED_INTERVAL 86400
+#define PDP_SCHED_RETRY 600
+#define PDP_SCHED_SIZE_BITS 18
+
+/* A proof is expected to take PDP_LATENCY_BASE_US, mostly the proof's arithmetic, plus
+ * PDP_LATENCY_BLOCK_US per challenged block, a random read of a block and its tag from local disk,
+ * unless the model is calibrated (see pdp_latency_model_calibrate).  A proof taking more than PDP_LATENCY_OUTLIER times as long is
+ * flagged.  Each peer's ratios of observed to expected latency are kept in a histogram of
+ * PDP_LATENCY_BINS bins, PDP_LATENCY_BINS_PER_OCTAVE to each doubling, from 2^PDP_LATENCY_MIN_OCTAVE,
+ * and an average weighted PDP_LATENCY_EWMA to the newest proof. */
+#define PDP_LATENCY_BASE_US 15000
+#define PDP_LATENCY_BLOCK_US 100
+#define PDP_LATENCY_OUTLIER 4.0
+#define PDP_LATENCY_BINS 48
+#define PDP_LATENCY_BINS_PER_OCTAVE 4
+#define PDP_LATENCY_MIN_OCTAVE -4
+#define PDP_LATENCY_EWMA 0.1
+#define PDP_LATENCY_CALIBRATE_ROUNDS 5
+
 typedef struct PDP_parameters_struct PDP_params;
 
 struct PDP_parameters_struct{
@@ -89,8 +260,6 @@ struct PDP_parameters_struct{
 	unsigned int num_challenge;
 };
 
-extern PDP_params params;
-
 typedef BIGNUM PDP_generator;
 
 typedef struct PDP_key_struct PDP_key;
@@ -101,6 +270,12 @@ struct PDP_key_struct{
 	unsigned char *v;	/* PRF key */
 	PDP_generator *g;	/* PDP generator */
 
+	/* Values derived from the key for tagging; NULL until pdp_key_precompute */
+	BIGNUM *phi;			/* phi(N) = (p-1)(q-1) */
+	BN_MONT_CTX *mont_n;	/* Montgomery form of N */
+	BIGNUM **g_table;		/* Fixed-base table for g^m; see PDP_FIXED_BASE_WINDOW */
+	size_t g_table_windows;	/* The number of windows in g_table */
+
 };
 
 typedef struct PDP_tag_struct PDP_tag;
@@ -108,23 +283,75 @@ typedef struct PDP_tag_struct PDP_tag;
 struct PDP_tag_struct{
 	
 	BIGNUM *Tim;			/* The tag of the message block i T_i,m = (h(W_i) * g^m)^d */
-	unsigned int index;     /* The index of the block, i */
+	uint64_t index;     /* The index of the block, i */
 	unsigned char *index_prf; /* The pseudo-random function output of the index W_i = w_v(i) */
 	size_t index_prf_size;	/* The size of the prf output */
 
 };
 
+/* Tag files start with a header followed by fixed-width tag records, so the record for
+ * block i lives at a computable offset and can be read (or range-fetched) on its own.
+ * Tag files without the header are in the legacy variable-width layout and are read
+ * with a linear scan. */
+#define PDP_TAG_MAGIC "PDPT"
+#define PDP_TAG_MAGIC_SIZE 4
+#define PDP_TAG_VERSION 2				/* Records hold a 64-bit block index */
+#define PDP_TAG_VERSION_32BIT_INDEX 1	/* Records hold a 32-bit block index; still readable */
+
+typedef struct PDP_tag_header_struct PDP_tag_header;
+
+struct PDP_tag_header_struct{
+
+	char magic[PDP_TAG_MAGIC_SIZE];	/* PDP_TAG_MAGIC */
+	uint32_t version;			/* The tag record layout version */
+	uint32_t tim_size;			/* Width of the zero-padded Tim; the size of N in bytes */
+	uint32_t index_size;		/* Width of the block index */
+	uint32_t index_prf_size;	/* Width of W_i */
+	uint32_t record_size;		/* Width of a whole tag record */
+};
+
+#define PDP_TAG_HEADER_SIZE sizeof(PDP_tag_header)
+
+/* Tags are written to <tagfile>.tmp and renamed into place once complete, so a crash never
+ * leaves a partial file that looks valid.  Every PDP_CHECKPOINT_BLOCKS blocks (256 MB of data
+ * at 4 KB blocks) the tags written so far are flushed to disk and a checkpoint journal,
+ * <tagfile>.ckpt, records how many are durable.  A resumed run validates that prefix and
+ * tags only the rest of the file. */
+#define PDP_TAG_TMP_EXT ".tmp"
+#define PDP_CHECKPOINT_EXT ".ckpt"
+#define PDP_CHECKPOINT_MAGIC "PDPC"
+#define PDP_CHECKPOINT_MAGIC_SIZE 4
+#define PDP_CHECKPOINT_VERSION 1
+#define PDP_CHECKPOINT_BLOCKS 65536
+#define PDP_CHECKPOINT_VERIFY_BLOCKS 4	/* Tags of the prefix recomputed on resume */
+
+#define PDP_TAG_RESUME 0x1		/* Continue from a valid checkpoint instead of starting over */
+
+typedef struct PDP_checkpoint_struct PDP_checkpoint;
+
+struct PDP_checkpoint_struct{
+
+	char magic[PDP_CHECKPOINT_MAGIC_SIZE];	/* PDP_CHECKPOINT_MAGIC */
+	uint32_t version;
+	unsigned char key_fingerprint[SHA_DIGEST_LENGTH];	/* SHA1 of the public key the tags are made with */
+	uint64_t file_size;			/* Size and modification time of the data file being tagged */
+	int64_t file_mtime;
+	uint64_t numblocks;			/* Blocks whose tags are durable in the temporary tag file */
+	PDP_tag_header header;		/* The header the temporary tag file starts with */
+};
+
 
 typedef struct PDP_challenge_struct PDP_challenge;
 
 struct PDP_challenge_struct{
 
 	unsigned int c;     /* Number of blocks to sample */
-	unsigned int numfileblocks; /* Number of total blocks in the file */
+	uint64_t numfileblocks; /* Number of total blocks in the file */
 	BIGNUM *g_s;		/* Random secret base g_s = g^s */
 	BIGNUM *s;			/* Random secret */
 	unsigned char *k1;	/* PRP key */
 	unsigned char *k2;	/* PRF key */
+	uint64_t issued_ns;	/* Monotonic time the challenge was issued, client-side; see pdp_challenge_issue */
 };
 
 typedef struct PDP_proof_struct PDP_proof;
@@ -140,8 +367,10 @@ struct PDP_proof_struct{
 
 /* PDP file operations in pdp-file.c */
 int pdp_tag_file(char *filepath, size_t filepath_len, char *tagfilepath, size_t tagfilepath_len,char* keypath,char* password);
+int pdp_tag_file_resumable(char *filepath, size_t filepath_len, char *tagfilepath, size_t tagfilepath_len,
+	char* keypath, char* password, int flags);
 
-PDP_challenge *pdp_challenge_file(unsigned int numfileblocks);
+PDP_challenge *pdp_challenge_file(uint64_t numfileblocks);
 
 /* NOTE: It's important that challenge->s must be kept secret from the server.  A server challenge is <c, k1, k2, g_s>. 
  * Also, the key structures should only contain the public components.  See: pdp_get_pubkey() */
@@ -151,14 +380,563 @@ int pdp_verify_file(PDP_challenge *challenge, PDP_proof *proof);
 
 /* This function is really used more testing as it does challenging, proof generation and verification */
 int pdp_challenge_and_verify_file(char *filepath, size_t filepath_len, char *tagfilepath, size_t tagfilepath_len);
-PDP_tag *read_pdp_tag(FILE *tagfile, unsigned int index);
+PDP_tag *read_pdp_tag(FILE *tagfile, uint64_t index);
+PDP_tag *pdp_read_tag_fd(int fd, uint64_t index);
+
+int pdp_tag_header_init(PDP_tag_header *header, PDP_key *key);
+int pdp_tag_header_parse(PDP_tag_header *header, unsigned char *buf, size_t buf_len);
+off_t pdp_tag_record_offset(PDP_tag_header *header, uint64_t index);
+int pdp_tag_record_encode(PDP_tag_header *header, PDP_tag *tag, unsigned char *record);
+PDP_tag *pdp_tag_record_decode(PDP_tag_header *header, unsigned char *record);
+int pdp_key_fingerprint(PDP_key *key, unsigned char *fingerprint);
+
+/* Flat tag batches in pdp-tagbatch.c */
+
+typedef struct PDP_tag_batch_struct PDP_tag_batch;
+
+struct PDP_tag_batch_struct{
+
+	uint64_t count;				/* Slots holding tags */
+	uint64_t capacity;
+	uint32_t tim_size;			/* Width of Tim in tag records; the size of N in bytes */
+	uint32_t limb_size;			/* Width of each Tim here; tim_size rounded up to whole limbs */
+	uint32_t index_prf_size;	/* Width of each W_i */
+	unsigned char *tims;		/* capacity Tims of limb_size bytes, little-endian */
+	uint64_t *indices;			/* The block index of each slot */
+	unsigned char *index_prfs;	/* capacity W_i of index_prf_size bytes */
+};
+
+#define PDP_TAG_BATCH_TIM(batch, slot) ((batch)->tims + ((size_t)(slot) * (batch)->limb_size))
+#define PDP_TAG_BATCH_INDEX_PRF(batch, slot) ((batch)->index_prfs + ((size_t)(slot) * (batch)->index_prf_size))
+
+PDP_tag_batch *pdp_tag_batch_new(PDP_tag_header *header, uint64_t capacity);
+void pdp_tag_batch_free(PDP_tag_batch *batch);
+int pdp_tag_batch_set(PDP_tag_batch *batch, uint64_t slot, PDP_tag *tag);
+int pdp_tag_batch_get(PDP_tag_batch *batch, uint64_t slot, PDP_tag *tag);
+int pdp_tag_batch_encode(PDP_tag_batch *batch, PDP_tag_header *header, uint64_t first, uint64_t numtags,
+	unsigned char *records);
+int pdp_tag_batch_decode(PDP_tag_batch *batch, PDP_tag_header *header, uint64_t slot, unsigned char *record);
+PDP_tag_batch *pdp_read_tag_batch_fd(int fd, uint64_t *indices, uint64_t numtags);
+
+/* Block and tag file I/O in pdp-io.c */
+
+typedef struct PDP_block_reader_struct PDP_block_reader;
+typedef struct PDP_tag_writer_struct PDP_tag_writer;
+
+typedef struct PDP_budget_struct PDP_budget;
+
+PDP_block_reader *pdp_block_reader_open(char *filepath, uint64_t first_block, uint64_t numblocks, int flags,
+	PDP_budget *budget);
+unsigned char *pdp_block_reader_next(PDP_block_reader *reader, uint64_t *index);
+int pdp_block_reader_error(PDP_block_reader *reader);
+void pdp_block_reader_close(PDP_block_reader *reader);
+
+PDP_tag_writer *pdp_tag_writer_open(char *tagfilepath, int flags);
+PDP_tag_writer *pdp_tag_writer_resume(char *tagfilepath, off_t offset, int flags);
+void pdp_tag_writer_set_sync(PDP_tag_writer *writer, uint64_t bytes);
+int pdp_tag_writer_append(PDP_tag_writer *writer, unsigned char *data, size_t len);
+int pdp_tag_writer_append_batch(PDP_tag_writer *writer, PDP_tag_header *header, PDP_tag_batch *batch,
+	uint64_t first, uint64_t numtags);
+off_t pdp_tag_writer_sync(PDP_tag_writer *writer);
+int pdp_tag_writer_close(PDP_tag_writer *writer);
+
+int pdp_read_block_fd(int fd, uint64_t index, unsigned char *block);
+
+/* The descriptor cache in pdp-fdcache.c */
+
+typedef struct PDP_fd_cache_struct PDP_fd_cache;
+typedef struct PDP_fd_cache_stats_struct PDP_fd_cache_stats;
+
+struct PDP_fd_cache_stats_struct{
+
+	uint64_t open_fds;			/* Descriptors open, in use or not */
+	uint64_t hits;
+	uint64_t misses;
+	uint64_t evictions;			/* Unused descriptors closed to stay within the limit */
+};
+
+PDP_fd_cache *pdp_fd_cache_new(size_t max_fds);
+void pdp_fd_cache_free(PDP_fd_cache *cache);
+int pdp_fd_cache_open(PDP_fd_cache *cache, char *path);
+void pdp_fd_cache_close(PDP_fd_cache *cache, int fd);
+void pdp_fd_cache_stats(PDP_fd_cache *cache, PDP_fd_cache_stats *stats);
+
+/* The tag cache in pdp-tagcache.c */
+
+typedef struct PDP_tag_cache_struct PDP_tag_cache;
+typedef struct PDP_tag_cache_stats_struct PDP_tag_cache_stats;
+
+struct PDP_tag_cache_stats_struct{
+
+	size_t budget;				/* Memory the cache may hold in bytes; 0 disables it */
+	size_t bytes;				/* Memory held by cached tags */
+	uint64_t entries;			/* Tags cached */
+	uint64_t hits;
+	uint64_t misses;
+	uint64_t evictions;
+	uint64_t invalidations;		/* Cached tags dropped because their tag file changed */
+};
+
+PDP_tag_cache *pdp_tag_cache_new(size_t budget);
+void pdp_tag_cache_free(PDP_tag_cache *cache);
+void pdp_tag_cache_set_budget(PDP_tag_cache *cache, size_t bytes);
+int pdp_tag_cache_enabled(PDP_tag_cache *cache);
+PDP_tag *pdp_tag_cache_get(PDP_tag_cache *cache, int fd, uint64_t index);
+void pdp_tag_cache_put(PDP_tag_cache *cache, PDP_tag *tag);
+void pdp_tag_cache_flush(PDP_tag_cache *cache);
+void pdp_tag_cache_stats(PDP_tag_cache *cache, PDP_tag_cache_stats *stats);
+
+/* Tagging budgets in pdp-budget.c */
+
+typedef struct PDP_budget_stats_struct PDP_budget_stats;
+
+struct PDP_budget_stats_struct{
+
+	double cpu_cores_budget;		/* The CPU budget in cores; 0 is unlimited */
+	double cpu_cores_used;			/* Average cores of CPU time tagging used */
+	double io_bytes_per_sec_budget;	/* The I/O budget; 0 is unlimited */
+	double io_bytes_per_sec_used;	/* Average rate tagging read data files at */
+	double cpu_throttled;			/* Seconds tagging threads slept waiting for CPU budget, summed over threads */
+	double io_throttled;			/* Seconds readers slept waiting for I/O budget, summed over readers */
+	double elapsed;					/* Seconds the averages are taken over */
+};
+
+PDP_budget *pdp_budget_new();
+void pdp_budget_free(PDP_budget *budget);
+void pdp_budget_set(PDP_budget *budget, double cpu_cores, uint64_t io_bytes_per_sec);
+PDP_budget *pdp_budget_split(PDP_budget *budget, int n);
+void pdp_budget_stats(PDP_budget *budget, PDP_budget_stats *stats);
+void pdp_tag_budget_set(double cpu_cores, uint64_t io_bytes_per_sec);
+void pdp_tag_budget_stats(PDP_budget_stats *stats);
+void pdp_budget_charge_io(PDP_budget *budget, size_t len);
+int pdp_budget_try_io(PDP_budget *budget, size_t len);
+void pdp_budget_refund_io(PDP_budget *budget, size_t len);
+uint64_t pdp_budget_thread_cpu();
+void pdp_budget_charge_cpu(PDP_budget *budget, uint64_t since_ns);
+
+/* The multi-tenant key cache in pdp-keycache.c */
+
+typedef struct PDP_key_cache_struct PDP_key_cache;
+typedef struct PDP_key_cache_stats_struct PDP_key_cache_stats;
+
+struct PDP_key_cache_stats_struct{
+
+	size_t budget;				/* Memory the cache may hold in bytes; 0 disables it */
+	size_t bytes;				/* Memory held by cached keys */
+	uint64_t entries;			/* Keys cached, including those being loaded */
+	uint64_t hits;
+	uint64_t misses;
+	uint64_t evictions;
+	uint64_t load_failures;		/* Misses whose key could not be loaded */
+	uint64_t load_ns;			/* Time spent loading and precomputing keys on misses */
+};
+
+PDP_key_cache *pdp_key_cache_new(size_t budget);
+void pdp_key_cache_free(PDP_key_cache *cache);
+void pdp_key_cache_set_budget(PDP_key_cache *cache, size_t bytes);
+PDP_key *pdp_key_cache_get(PDP_key_cache *cache, char *keypath, char *password);
+void pdp_key_cache_put(PDP_key_cache *cache, PDP_key *key);
+void pdp_key_cache_flush(PDP_key_cache *cache);
+void pdp_key_cache_stats(PDP_key_cache *cache, PDP_key_cache_stats *stats);
+
+/* The metadata catalog in pdp-catalog.c */
+
+#define PDP_CATALOG_EMPTY 0
+#define PDP_CATALOG_USED 1
+#define PDP_CATALOG_DELETED 2
+
+typedef struct PDP_catalog_struct PDP_catalog;
+
+typedef struct PDP_catalog_entry_struct PDP_catalog_entry;
+
+/* What a verifier needs to challenge a file without its data or tags */
+struct PDP_catalog_entry_struct{
+
+	char name[PDP_CATALOG_NAME_SIZE];		/* The file's path or CID; the key */
+	char tagpath[PDP_CATALOG_PATH_SIZE];	/* Where its tags are */
+	uint64_t numfileblocks;
+	uint64_t file_size;
+	uint32_t blocksize;
+	uint32_t state;						/* PDP_CATALOG_* */
+	unsigned char key_id[SHA_DIGEST_LENGTH];	/* pdp_key_fingerprint of the key it was tagged with */
+	int32_t last_status;				/* PDP_AUDIT_* of its last audit */
+	int64_t tagged_at;					/* Seconds since the epoch */
+	int64_t last_audit;
+};
+
+PDP_catalog *pdp_catalog_open(char *path);
+void pdp_catalog_close(PDP_catalog *catalog);
+int pdp_catalog_put(PDP_catalog *catalog, PDP_catalog_entry *entry);
+int pdp_catalog_get(PDP_catalog *catalog, char *name, PDP_catalog_entry *entry);
+int pdp_catalog_remove(PDP_catalog *catalog, char *name);
+int pdp_catalog_record_audit(PDP_catalog *catalog, char *name, int status, int64_t when);
+int64_t pdp_catalog_iterate(PDP_catalog *catalog, int (*fn)(PDP_catalog_entry *entry, void *arg), void *arg);
+uint64_t pdp_catalog_count(PDP_catalog *catalog);
+int pdp_catalog_sync(PDP_catalog *catalog);
+int pdp_catalog_add_file(PDP_catalog *catalog, char *name, char *filepath, char *tagfilepath, unsigned char *key_id);
+PDP_challenge *pdp_catalog_challenge(PDP_catalog *catalog, PDP_key *key, char *name);
+
+/* The library context in pdp-ctx.c */
+
+typedef struct PDP_ctx_struct PDP_ctx;
+
+struct PDP_ctx_struct{
+
+	char keypath[MAXPATHLEN];	/* Keys are read from here when a call names no keypath */
+	int numthreads;				/* Threads tagging each file, with THREADING */
+	int io_flags;				/* PDP_IO_* flags data and tag files are accessed with */
+	uint64_t sync_bytes;		/* Tag files are flushed to disk every this many bytes; 0 only at checkpoints */
+	PDP_budget *budget;			/* CPU and I/O budgets of every tagging run of the context */
+	PDP_key_cache *keycache;	/* Keys kept loaded between runs; see pdp_key_cache_set_budget */
+	PDP_fd_cache *fdcache;		/* Data and tag files kept open between proofs */
+	PDP_tag_cache *tagcache;	/* Tags kept decoded between proofs; see pdp_tag_cache_set_budget */
+	char taggerpath[MAXPATHLEN];	/* Socket of the tagging daemon to tag through; empty for none */
+	int numprocs;				/* Worker processes tagging each file; 0 or 1 tags in-process */
+	PDP_catalog *catalog;		/* Catalog tagged files are recorded in and audits looked up in; NULL for none */
+};
+
+PDP_ctx *pdp_ctx_new();
+void pdp_ctx_free(PDP_ctx *ctx);
+PDP_ctx *pdp_default_ctx();
+int pdp_ctx_tag_file(PDP_ctx *ctx, char *filepath, size_t filepath_len, char *tagfilepath, size_t tagfilepath_len,
+	char *keypath, char *password, int flags);
+PDP_proof *pdp_ctx_prove_file(PDP_ctx *ctx, char *filepath, size_t filepath_len, char *tagfilepath, size_t tagfilepath_len,
+	PDP_challenge *challenge, PDP_key *key);
+PDP_challenge *pdp_ctx_challenge_file(PDP_ctx *ctx, uint64_t numfileblocks, char *keypath, char *password);
+int pdp_ctx_verify_file(PDP_ctx *ctx, PDP_challenge *challenge, PDP_proof *proof, char *keypath, char *password);
+
+/* The prover daemon in pdp-prover.c.  A request is a PDP_prover_request followed by the data file
+ * path, the tag file path (may be empty), then N, e and g_s big-endian, k1 and k2.  The reply is a
+ * PDP_prover_reply followed by T big-endian and rho.  Both are in host byte order as the socket is
+ * local. */
+#define PDP_PROVER_MAGIC "PDPR"
+#define PDP_PROVER_MAGIC_SIZE 4
+#define PDP_PROVER_VERSION 1
+
+#define PDP_PROVER_OK 0
+#define PDP_PROVER_BUSY 1			/* Not admitted; the queue is full or the deadline cannot be met */
+#define PDP_PROVER_EXPIRED 2		/* The deadline passed while the request was queued */
+#define PDP_PROVER_FAILED 3			/* The proof could not be generated */
+#define PDP_PROVER_BAD_REQUEST 4
+
+typedef struct PDP_prover_request_struct PDP_prover_request;
+
+struct PDP_prover_request_struct{
+
+	char magic[PDP_PROVER_MAGIC_SIZE];	/* PDP_PROVER_MAGIC */
+	uint32_t version;
+	uint32_t deadline_ms;		/* Time from sending the request by which the proof is wanted; 0 for the default */
+	uint32_t c;					/* The challenge */
+	uint64_t numfileblocks;
+	uint32_t filepath_len;
+	uint32_t tagfilepath_len;
+	uint32_t n_len;				/* The public key */
+	uint32_t e_len;
+	uint32_t g_s_len;
+	uint32_t reserved;
+};
+
+typedef struct PDP_prover_reply_struct PDP_prover_reply;
+
+struct PDP_prover_reply_struct{
+
+	char magic[PDP_PROVER_MAGIC_SIZE];	/* PDP_PROVER_MAGIC */
+	uint32_t version;
+	uint32_t status;			/* PDP_PROVER_* */
+	uint32_t T_len;
+	uint32_t rho_len;
+	uint32_t reserved;
+};
+
+typedef struct PDP_prover_struct PDP_prover;
+typedef struct PDP_prover_stats_struct PDP_prover_stats;
+
+struct PDP_prover_stats_struct{
+
+	uint64_t requests;			/* Requests received, well formed or not */
+	uint64_t admitted;
+	uint64_t rejected;			/* Turned away with PDP_PROVER_BUSY */
+	uint64_t expired;
+	uint64_t failed;
+	uint64_t completed;
+	uint64_t queued;			/* Requests waiting now */
+	uint64_t running;			/* Requests being proven now */
+	double queue_wait;			/* Seconds completed requests spent queued, summed */
+	double block_cost;			/* Current estimate of the CPU seconds a sampled block costs */
+};
+
+PDP_prover *pdp_prover_new(PDP_ctx *ctx, char *socketpath, int numworkers, size_t queue_depth, uint64_t max_io);
+int pdp_prover_run(PDP_prover *prover);
+void pdp_prover_stop(PDP_prover *prover);
+void pdp_prover_free(PDP_prover *prover);
+void pdp_prover_stats(PDP_prover *prover, PDP_prover_stats *stats);
+PDP_proof *pdp_prover_request_proof(char *socketpath, char *filepath, char *tagfilepath, PDP_challenge *challenge,
+	PDP_key *key, unsigned int deadline_ms, int *status);
+
+/* The tagging daemon in pdp-tagger.c.  A request is a PDP_tagger_request followed by the keypath
+ * the client expects tags under (may be empty), sent with the descriptor of the data to tag.  The
+ * reply is a PDP_tagger_reply, then for each chunk a PDP_tagger_frame followed by its records. */
+#define PDP_TAGGER_MAGIC "PDPW"
+#define PDP_TAGGER_MAGIC_SIZE 4
+#define PDP_TAGGER_VERSION 2
+
+#define PDP_TAGGER_OK 0
+#define PDP_TAGGER_BUSY 1			/* Too many clients */
+#define PDP_TAGGER_FAILED 2
+#define PDP_TAGGER_BAD_REQUEST 3
+#define PDP_TAGGER_WRONG_KEY 4		/* The daemon holds a different key than the client asked for */
+
+typedef struct PDP_tagger_request_struct PDP_tagger_request;
+
+struct PDP_tagger_request_struct{
+
+	char magic[PDP_TAGGER_MAGIC_SIZE];	/* PDP_TAGGER_MAGIC */
+	uint32_t version;
+	uint32_t keypath_len;
+	uint32_t reserved;
+};
+
+typedef struct PDP_tagger_reply_struct PDP_tagger_reply;
+
+struct PDP_tagger_reply_struct{
+
+	char magic[PDP_TAGGER_MAGIC_SIZE];	/* PDP_TAGGER_MAGIC */
+	uint32_t version;
+	uint32_t status;			/* PDP_TAGGER_* */
+	uint32_t reserved;
+	uint64_t numblocks;			/* Tags that will follow */
+	PDP_tag_header header;		/* The header of the tag file the records belong in */
+	unsigned char key_fingerprint[SHA_DIGEST_LENGTH];	/* pdp_key_fingerprint of the daemon's key */
+};
+
+typedef struct PDP_tagger_frame_struct PDP_tagger_frame;
+
+struct PDP_tagger_frame_struct{
+
+	uint64_t first_block;		/* The index of the first record in the frame */
+	uint32_t numrecords;
+	uint32_t status;			/* PDP_TAGGER_FAILED ends the stream early */
+};
+
+typedef struct PDP_tagger_struct PDP_tagger;
+typedef struct PDP_tagger_stats_struct PDP_tagger_stats;
+
+struct PDP_tagger_stats_struct{
+
+	uint64_t requests;
+	uint64_t completed;
+	uint64_t failed;			/* Failed or malformed requests */
+	uint64_t rejected;			/* Turned away with PDP_TAGGER_BUSY or PDP_TAGGER_WRONG_KEY */
+	uint64_t blocks;			/* Blocks tagged */
+	uint64_t clients;			/* Clients connected now */
+};
+
+PDP_tagger *pdp_tagger_new(PDP_ctx *ctx, char *socketpath, char *keypath, char *password, int numworkers);
+int pdp_tagger_run(PDP_tagger *tagger);
+void pdp_tagger_stop(PDP_tagger *tagger);
+void pdp_tagger_free(PDP_tagger *tagger);
+void pdp_tagger_stats(PDP_tagger *tagger, PDP_tagger_stats *stats);
+int pdp_tagger_tag_fd(char *socketpath, char *keypath, int fd, char *tagfilepath, unsigned char *key_fingerprint);
+int pdp_tagger_tag_file(char *socketpath, char *keypath, char *filepath, char *tagfilepath, unsigned char *key_fingerprint);
+
+/* Challenge policies in pdp-policy.c */
+
+typedef struct PDP_challenge_policy_struct PDP_challenge_policy;
+
+struct PDP_challenge_policy_struct{
+
+	double detection;			/* Detection probability asked of peers without enough history */
+	double min_detection;		/* Asked of peers with honest_streak clean audits in a row */
+	double max_detection;		/* Asked of peers that failed since */
+	double corrupt_fraction;	/* Fraction of a file assumed lost when sizing challenges */
+	uint64_t honest_streak;
+};
+
+typedef struct PDP_peer_history_struct PDP_peer_history;
+
+struct PDP_peer_history_struct{
+
+	uint64_t audits;
+	uint64_t failures;
+	uint64_t streak;			/* Clean audits since the last failure */
+};
+
+void pdp_challenge_policy_init(PDP_challenge_policy *policy);
+void pdp_peer_history_record(PDP_peer_history *peer, int passed);
+double pdp_challenge_policy_detection(PDP_challenge_policy *policy, PDP_peer_history *peer);
+uint64_t pdp_challenge_policy_size(PDP_challenge_policy *policy, PDP_peer_history *peer, uint64_t numfileblocks);
+PDP_challenge *pdp_challenge_policy(PDP_key *key, uint64_t numfileblocks, PDP_challenge_policy *policy,
+	PDP_peer_history *peer);
+
+/* Proof latency fingerprinting in pdp-latency.c */
+
+typedef struct PDP_latency_model_struct PDP_latency_model;
+
+struct PDP_latency_model_struct{
+
+	double base_ns;				/* Expected latency of a proof of no blocks */
+	double block_ns;			/* Expected latency added per challenged block */
+	double outlier;				/* Proofs taking more than this times the expected latency are flagged */
+};
+
+typedef struct PDP_latency_tracker_struct PDP_latency_tracker;
+
+typedef struct PDP_latency_stats_struct PDP_latency_stats;
+
+struct PDP_latency_stats_struct{
+
+	char *peer;
+	uint64_t proofs;
+	uint64_t outliers;
+	uint64_t blocks;			/* Challenged blocks summed over the proofs */
+	uint64_t fileblocks;		/* Blocks of the challenged files summed over the proofs */
+	double mean_ns;
+	double max_ns;
+	double ratio_mean;			/* Of observed to expected latency */
+	double ratio_ewma;
+	double ratio_p50;			/* Upper bounds of the histogram bins the percentiles fall in */
+	double ratio_p90;
+	double ratio_p99;
+	uint64_t last_outlier_ns;	/* Latency of the last flagged proof */
+};
+
+void pdp_latency_model_init(PDP_latency_model *model);
+double pdp_latency_expected_ns(PDP_latency_model *model, uint64_t c);
+int pdp_latency_model_calibrate(PDP_latency_model *model, PDP_ctx *ctx, PDP_key *key, char *filepath, char *tagfilepath);
+PDP_latency_tracker *pdp_latency_tracker_new(PDP_latency_model *model);
+void pdp_latency_tracker_free(PDP_latency_tracker *tracker);
+int pdp_latency_record(PDP_latency_tracker *tracker, char *peer, uint64_t c, uint64_t numfileblocks, uint64_t latency_ns);
+int pdp_verify_proof_timed(PDP_key *key, PDP_challenge *challenge, PDP_proof *proof, PDP_latency_tracker *tracker,
+	char *peer, int *outlier);
+int pdp_latency_peer_stats(PDP_latency_tracker *tracker, char *peer, PDP_latency_stats *stats);
+int64_t pdp_latency_iterate(PDP_latency_tracker *tracker, int (*fn)(PDP_latency_stats *stats, void *arg), void *arg);
+void pdp_latency_report(PDP_latency_tracker *tracker, FILE *out);
+
+/* Audit scheduling in pdp-scheduler.c */
+
+#define PDP_AUDIT_NONE 0			/* Not audited yet */
+#define PDP_AUDIT_PASSED 1
+#define PDP_AUDIT_FAILED 2			/* The proof did not verify */
+#define PDP_AUDIT_ERROR 3			/* No proof could be had */
+
+typedef struct PDP_scheduler_struct PDP_scheduler;
+
+typedef struct PDP_audit_record_struct PDP_audit_record;
+
+struct PDP_audit_record_struct{
+
+	char *filepath;
+	char *tagfilepath;			/* NULL for filepath with a .tag extension */
+	char *peer;					/* The peer holding the file */
+	uint64_t numfileblocks;
+	double risk;
+	uint64_t next_due;			/* Seconds, on the clock the scheduler is driven with */
+	uint64_t last_audit;
+	uint64_t audits;
+	uint64_t failures;
+	int last_status;			/* PDP_AUDIT_* */
+};
+
+typedef struct PDP_audit_job_struct PDP_audit_job;
+
+struct PDP_audit_job_struct{
+
+	uint64_t id;				/* The file's id, to pass to pdp_scheduler_complete */
+	PDP_audit_record *record;	/* Valid until the next pdp_scheduler_add */
+	double detection;			/* The detection probability the challenge policy asks */
+	uint64_t c;					/* Blocks to challenge, from detection */
+};
+
+typedef struct PDP_scheduler_stats_struct PDP_scheduler_stats;
+
+struct PDP_scheduler_stats_struct{
+
+	uint64_t files;
+	uint64_t peers;
+	uint64_t devices;
+	uint64_t queued;			/* Files waiting in the queue, due or not */
+	uint64_t inflight;			/* Files handed out and not yet completed */
+	uint64_t audits;
+	uint64_t passed;
+	uint64_t failed;
+	uint64_t errors;
+	uint64_t deferred;			/* Times a due file was held back by a device's I/O budget */
+	uint64_t slow;				/* Proofs flagged by the latency model, passed or not */
+};
+
+PDP_scheduler *pdp_scheduler_new(PDP_ctx *ctx, char *keypath, char *password, uint64_t interval);
+void pdp_scheduler_free(PDP_scheduler *sched);
+void pdp_scheduler_set_budget(PDP_scheduler *sched, uint64_t io_bytes_per_sec, uint64_t device_io_bytes_per_sec);
+PDP_challenge_policy *pdp_scheduler_policy(PDP_scheduler *sched);
+PDP_latency_tracker *pdp_scheduler_latency(PDP_scheduler *sched);
+int64_t pdp_scheduler_add(PDP_scheduler *sched, char *peer, char *filepath, char *tagfilepath, double risk);
+int64_t pdp_scheduler_load(PDP_scheduler *sched, char *listpath);
+PDP_audit_record *pdp_scheduler_record(PDP_scheduler *sched, uint64_t id);
+size_t pdp_scheduler_next(PDP_scheduler *sched, uint64_t now, PDP_audit_job *jobs, size_t maxjobs);
+void pdp_scheduler_complete(PDP_scheduler *sched, uint64_t id, int status, uint64_t now);
+int64_t pdp_scheduler_run(PDP_scheduler *sched, uint64_t now, size_t maxjobs);
+void pdp_scheduler_stats(PDP_scheduler *sched, PDP_scheduler_stats *stats);
+
+/* Full-file scrubs in pdp-scrub.c */
+
+#define PDP_SCRUB_OK 0
+#define PDP_SCRUB_CORRUPT 1			/* A block or tag of the batch is bad */
+#define PDP_SCRUB_ERROR 2			/* The batch could not be read or checked */
+
+typedef struct PDP_scrub_result_struct PDP_scrub_result;
+
+struct PDP_scrub_result_struct{
+
+	uint64_t numblocks;			/* Blocks in the file or tagged for it, whichever are more */
+	uint64_t batch_blocks;		/* Blocks per batch; the last batch may hold fewer */
+	uint64_t numbatches;
+	uint64_t corrupt;			/* Batches with status PDP_SCRUB_CORRUPT */
+	uint64_t errors;			/* Batches with status PDP_SCRUB_ERROR */
+	unsigned char *status;		/* PDP_SCRUB_* of each batch */
+	double elapsed;				/* Seconds the scrub took */
+};
+
+PDP_scrub_result *pdp_ctx_scrub_file(PDP_ctx *ctx, char *filepath, char *tagfilepath, char *keypath, char *password,
+	int numthreads, uint64_t batch_blocks);
+void pdp_scrub_result_free(PDP_scrub_result *result);
+
+typedef struct PDP_locate_result_struct PDP_locate_result;
+
+struct PDP_locate_result_struct{
+
+	uint64_t first_block;		/* The range of blocks searched */
+	uint64_t numblocks;
+	uint64_t checks;			/* Batch checks made */
+	uint64_t numbad;
+	uint64_t capacity;			/* Entries allocated in bad */
+	uint64_t *bad;				/* Indices of the bad blocks, ascending */
+	double elapsed;				/* Seconds the search took */
+};
+
+PDP_locate_result *pdp_ctx_locate_corrupt(PDP_ctx *ctx, char *filepath, char *tagfilepath, char *keypath, char *password,
+	uint64_t first_block, uint64_t numblocks);
+void pdp_locate_result_free(PDP_locate_result *result);
+
+/* Multi-process tagging in pdp-fork.c */
+
+int pdp_tag_file_forked(PDP_ctx *ctx, PDP_key *key, char *filepath, uint64_t numfileblocks,
+	PDP_tag_header *header, char *tagfilepath);
+
+/* NUMA placement in pdp-numa.c */
+
+int pdp_numa_num_nodes();
+int pdp_numa_worker_node(int worker, int numworkers);
+int pdp_numa_bind_thread(int node);
 
 /* PDP core primatives in pdp-core.c*/
 
 PDP_tag *pdp_tag_block(PDP_key *key, unsigned char *block, size_t blocksize, 
-	unsigned int index);
+	uint64_t index);
 
-PDP_challenge *pdp_challenge(PDP_key *key, unsigned int numfileblocks);
+PDP_challenge *pdp_challenge(PDP_key *key, uint64_t numfileblocks);
+uint64_t pdp_challenge_size(uint64_t numfileblocks, double detection, double corrupt_fraction);
+PDP_challenge *pdp_challenge_target(PDP_key *key, uint64_t numfileblocks, double detection, double corrupt_fraction);
+void pdp_challenge_issue(PDP_challenge *challenge);
 
 PDP_proof *pdp_generate_proof_update(PDP_key *key, PDP_challenge *challenge, PDP_tag *tag,
 	PDP_proof *proof, unsigned char *block, size_t blocksize, unsigned int j);
@@ -167,6 +945,42 @@ PDP_proof *pdp_generate_proof_final(PDP_key *key, PDP_challenge *challenge, PDP_
 
 int pdp_verify_proof(PDP_key *key, PDP_challenge *challenge, PDP_proof *proof);
 
+int pdp_verify_tags_batch(PDP_key *key, PDP_tag_batch *tags, unsigned char *blocks, size_t blocksize,
+	uint64_t *slots, uint64_t numslots);
+
+
+/* Besides the PEM key pair, write_pdp_keypair saves a binary key bundle holding every component of
+ * the key and its precomputed values, encrypted as a whole with AES-256-GCM under a PBKDF2 key.
+ * Loading it is one key derivation and one decryption, with no PEM parsing, RSA_check_key or table
+ * building; the GCM tag authenticates the contents instead.  The payload holds fixed-width
+ * little-endian fields at fixed offsets: v, then the PDP_KEY_BUNDLE_COMPONENTS key components, then
+ * the fixed-base table, each component and table entry as wide as N except g, which is stored at
+ * twice that width since it is a square that was never reduced modulo N. */
+#define PDP_KEY_BUNDLE_FILE "pdp.kb"
+#define PDP_KEY_BUNDLE_MAGIC "PDPK"
+#define PDP_KEY_BUNDLE_MAGIC_SIZE 4
+#define PDP_KEY_BUNDLE_VERSION 1
+#define PDP_KEY_BUNDLE_V_SIZE 32			/* v, zero-padded to keep the fields 8-byte aligned */
+#define PDP_KEY_BUNDLE_COMPONENTS 10		/* n, e, d, p, q, dmp1, dmq1, iqmp, g, phi */
+#define PDP_KEY_BUNDLE_G 8					/* The index of g among the components */
+#define PDP_KEY_BUNDLE_KEY_SIZE 32
+#define PDP_KEY_BUNDLE_IV_SIZE 12
+#define PDP_KEY_BUNDLE_TAG_SIZE 16
+
+typedef struct PDP_key_bundle_header_struct PDP_key_bundle_header;
+
+struct PDP_key_bundle_header_struct{
+
+	char magic[PDP_KEY_BUNDLE_MAGIC_SIZE];	/* PDP_KEY_BUNDLE_MAGIC */
+	uint32_t version;
+	uint32_t modulus_size;		/* Width of each component and table entry; the size of N in bytes */
+	uint32_t window;			/* The PDP_FIXED_BASE_WINDOW the table was built with */
+	uint64_t table_windows;		/* The number of windows in the table */
+	uint64_t payload_size;		/* Size of the encrypted payload that follows the header */
+	unsigned char salt[PRF_KEY_SIZE];	/* PBKDF2 salt */
+	unsigned char iv[PDP_KEY_BUNDLE_IV_SIZE];
+	unsigned char tag[PDP_KEY_BUNDLE_TAG_SIZE];	/* GCM tag over the payload and the header before it */
+};
 
 /* PDP keying functions pdp-key.c */
 
@@ -179,18 +993,27 @@ PDP_key *pdp_get_keypair();
 PDP_key *pdp_get_pubkey();
 
 PDP_key *generate_pdp_key();
+PDP_key *generate_pdp_key_size(int modulus_bits);
+int pdp_generate_safe_primes(BIGNUM *p, BIGNUM *q, int bits, int numthreads);
 void destroy_pdp_key(PDP_key *key);
 
+int pdp_key_precompute(PDP_key *key);
+PDP_key *pdp_key_replicate(PDP_key *key);
+
+int write_pdp_keypair(PDP_key *key, char *password, char *keypath);
+int write_pdp_key_bundle(PDP_key *key, char *password, char *keypath);
+PDP_key *read_pdp_key_bundle(char *keypath, char *password);
+
 /* Helper functions in pdp-misc.c */
 
 void sfree(void *ptr, size_t size);
 
 PDP_challenge *sanitize_pdp_challenge(PDP_challenge *challenge);
 
-unsigned int *generate_prp_pi(PDP_challenge *challenge);
+uint64_t *generate_prp_pi(PDP_challenge *challenge);
 unsigned char *generate_H(BIGNUM *input, size_t *H_result_size);
 unsigned char *generate_prf_f(PDP_challenge *challenge, unsigned int j, size_t *prf_result_size);
-unsigned char *generate_prf_w(PDP_key *key, unsigned int index, size_t *prf_result_size);
+unsigned char *generate_prf_w(PDP_key *key, uint64_t index, size_t *prf_result_size);
 BIGNUM *generate_fdh_h(PDP_key *key, unsigned char *index_prf, size_t index_prf_size);
 
 PDP_generator *pick_pdp_generator(BIGNUM *n);
@@ -205,6 +1028,14 @@ void destroy_pdp_challenge(PDP_challenge *challenge);
 PDP_proof *generate_pdp_proof();
 void destroy_pdp_proof(PDP_proof *proof);
 
+int pdp_bind_private(int fd, char *socketpath);
+
+uint64_t pdp_monotonic_ns();
+uint64_t pdp_hash_name(char *name);
+int pdp_read_full(int fd, void *buf, size_t len);
+int pdp_write_full(int fd, void *buf, size_t len);
+int pdp_pread_full(int fd, void *buf, size_t len, off_t offset);
+
 /* S3 functions in pdp-s3.c */
 #ifdef USE_S3
 PDP_proof *pdp_s3_prove_file(char *filepath, size_t filepath_len, char *tagfilepath, size_t tagfilepath_len, PDP_challenge *challenge, PDP_key *key);